@@ -0,0 +1,360 @@
+// efi_capture.c
+#include "efi_capture.h"
+#include "efi_gop_framebuffer.h"
+#include "uefi_helpers.h"
+#include "efi_timer.h"
+
+// Size of the BMP file and info headers
+#define BMP_HEADER_SIZE               54
+
+// QOI chunk tags
+#define QOI_OP_INDEX                  0x00
+#define QOI_OP_DIFF                   0x40
+#define QOI_OP_LUMA                   0x80
+#define QOI_OP_RUN                    0xC0
+#define QOI_OP_RGB                    0xFE
+
+// Longest run a single QOI_OP_RUN can encode
+#define QOI_MAX_RUN                   62
+
+static inline void StoreLe16(uint8_t *Bytes, uint32_t Value) {
+    Bytes[0] = (uint8_t)Value;
+    Bytes[1] = (uint8_t)(Value >> 8);
+}
+
+static inline void StoreLe32(uint8_t *Bytes, uint32_t Value) {
+    StoreLe16(Bytes, Value);
+    StoreLe16(Bytes + 2, Value >> 16);
+}
+
+static inline void StoreBe32(uint8_t *Bytes, uint32_t Value) {
+    Bytes[0] = (uint8_t)(Value >> 24);
+    Bytes[1] = (uint8_t)(Value >> 16);
+    Bytes[2] = (uint8_t)(Value >> 8);
+    Bytes[3] = (uint8_t)Value;
+}
+
+//
+// Buffered writer
+//
+
+static EFI_STATUS WriterFlush(CAPTURE_WRITER *Writer) {
+    if (EFI_ERROR(Writer->Status) || Writer->Used == 0) {
+        return Writer->Status;
+    }
+    
+    Writer->Status = WriteFile(Writer->File, Writer->Buffer, Writer->Used);
+    Writer->Written += Writer->Used;
+    Writer->Writes++;
+    Writer->Used = 0;
+    return Writer->Status;
+}
+
+static EFI_STATUS WriterWrite(CAPTURE_WRITER *Writer, const void *Data, uint64_t Size) {
+    const uint8_t *Bytes = (const uint8_t*)Data;
+    
+    while (Size > 0 && !EFI_ERROR(Writer->Status)) {
+        uint64_t Step = CAPTURE_WRITE_BUFFER_SIZE - Writer->Used;
+        if (Step > Size) {
+            Step = Size;
+        }
+        
+        MemCpy(Writer->Buffer + Writer->Used, Bytes, Step);
+        Writer->Used += Step;
+        Bytes += Step;
+        Size -= Step;
+        
+        if (Writer->Used == CAPTURE_WRITE_BUFFER_SIZE) {
+            WriterFlush(Writer);
+        }
+    }
+    
+    return Writer->Status;
+}
+
+//
+// Encoders (each turns one row into bytes in Out and returns the length)
+//
+
+static uint64_t BmpRowBytes(uint32_t Width) {
+    return ((uint64_t)Width * 3 + 3) & ~3ull;
+}
+
+// 24-bit BMP with a negative height, so rows are stored top-down in capture order
+static EFI_STATUS WriteBmpHeader(CAPTURE_WRITER *Writer, uint32_t Width, uint32_t Height) {
+    uint8_t Header[BMP_HEADER_SIZE];
+    uint64_t ImageSize = BmpRowBytes(Width) * Height;
+    
+    MemSet(Header, 0, sizeof(Header));
+    Header[0] = 'B';
+    Header[1] = 'M';
+    StoreLe32(Header + 2, (uint32_t)(BMP_HEADER_SIZE + ImageSize));
+    StoreLe32(Header + 10, BMP_HEADER_SIZE);
+    StoreLe32(Header + 14, 40);
+    StoreLe32(Header + 18, Width);
+    StoreLe32(Header + 22, (uint32_t)-(int32_t)Height);
+    StoreLe16(Header + 26, 1);
+    StoreLe16(Header + 28, 24);
+    StoreLe32(Header + 34, (uint32_t)ImageSize);
+    StoreLe32(Header + 38, 2835);    // 72 DPI
+    StoreLe32(Header + 42, 2835);
+    
+    return WriterWrite(Writer, Header, sizeof(Header));
+}
+
+static uint64_t EncodeBmpRow(const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Row, uint32_t Width, uint8_t *Out) {
+    uint64_t Length = BmpRowBytes(Width);
+    uint8_t *Start = Out;
+    
+    for (uint32_t x = 0; x < Width; x++, Out += 3) {
+        Out[0] = Row[x].Blue;
+        Out[1] = Row[x].Green;
+        Out[2] = Row[x].Red;
+    }
+    while ((uint64_t)(Out - Start) < Length) {
+        *Out++ = 0;
+    }
+    
+    return Length;
+}
+
+static EFI_STATUS WriteQoiHeader(CAPTURE_WRITER *Writer, CAPTURE_QOI_STATE *State,
+                                 uint32_t Width, uint32_t Height) {
+    uint8_t Header[14] = { 'q', 'o', 'i', 'f' };
+    
+    StoreBe32(Header + 4, Width);
+    StoreBe32(Header + 8, Height);
+    Header[12] = 3;    // RGB
+    Header[13] = 0;    // sRGB
+    
+    MemSet(State, 0, sizeof(*State));
+    State->Previous.Reserved = 255;
+    
+    return WriterWrite(Writer, Header, sizeof(Header));
+}
+
+// Alpha is always 255 (Reserved on screen is not alpha), so RGBA ops never occur
+static uint64_t EncodeQoiRow(CAPTURE_QOI_STATE *State, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Row,
+                             uint32_t Width, uint8_t *Out) {
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL Previous = State->Previous;
+    uint32_t Run = State->Run;
+    uint8_t *Start = Out;
+    
+    for (uint32_t x = 0; x < Width; x++) {
+        EFI_GRAPHICS_OUTPUT_BLT_PIXEL Pixel = Row[x];
+        Pixel.Reserved = 255;
+        
+        if (*(uint32_t*)&Pixel == *(uint32_t*)&Previous) {
+            if (++Run == QOI_MAX_RUN) {
+                *Out++ = (uint8_t)(QOI_OP_RUN | (Run - 1));
+                Run = 0;
+            }
+            continue;
+        }
+        
+        if (Run > 0) {
+            *Out++ = (uint8_t)(QOI_OP_RUN | (Run - 1));
+            Run = 0;
+        }
+        
+        uint32_t Hash = (Pixel.Red * 3 + Pixel.Green * 5 + Pixel.Blue * 7 + 255 * 11) % 64;
+        if (*(uint32_t*)&State->Index[Hash] == *(uint32_t*)&Pixel) {
+            *Out++ = (uint8_t)(QOI_OP_INDEX | Hash);
+        } else {
+            int8_t Red = (int8_t)(Pixel.Red - Previous.Red);
+            int8_t Green = (int8_t)(Pixel.Green - Previous.Green);
+            int8_t Blue = (int8_t)(Pixel.Blue - Previous.Blue);
+            int8_t RedGreen = (int8_t)(Red - Green);
+            int8_t BlueGreen = (int8_t)(Blue - Green);
+            
+            State->Index[Hash] = Pixel;
+            
+            if (Red >= -2 && Red <= 1 && Green >= -2 && Green <= 1 && Blue >= -2 && Blue <= 1) {
+                *Out++ = (uint8_t)(QOI_OP_DIFF | ((Red + 2) << 4) | ((Green + 2) << 2) | (Blue + 2));
+            } else if (Green >= -32 && Green <= 31 && RedGreen >= -8 && RedGreen <= 7 &&
+                       BlueGreen >= -8 && BlueGreen <= 7) {
+                *Out++ = (uint8_t)(QOI_OP_LUMA | (Green + 32));
+                *Out++ = (uint8_t)(((RedGreen + 8) << 4) | (BlueGreen + 8));
+            } else {
+                *Out++ = QOI_OP_RGB;
+                *Out++ = Pixel.Red;
+                *Out++ = Pixel.Green;
+                *Out++ = Pixel.Blue;
+            }
+        }
+        
+        Previous = Pixel;
+    }
+    
+    State->Previous = Previous;
+    State->Run = Run;
+    return (uint64_t)(Out - Start);
+}
+
+// Pending run and the end marker
+static EFI_STATUS WriteQoiEnd(CAPTURE_WRITER *Writer, CAPTURE_QOI_STATE *State) {
+    static const uint8_t EndMarker[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+    
+    if (State->Run > 0) {
+        uint8_t Op = (uint8_t)(QOI_OP_RUN | (State->Run - 1));
+        WriterWrite(Writer, &Op, 1);
+        State->Run = 0;
+    }
+    
+    return WriterWrite(Writer, EndMarker, sizeof(EndMarker));
+}
+
+//
+// Capture
+//
+
+// Save the current screen as BMP or QOI. The screen is read CAPTURE_BAND_ROWS
+// rows at a time, so memory use is bounded by the band rather than the frame.
+EFI_STATUS CaptureScreen(EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop, EFI_FILE_PROTOCOL *Root,
+                         const char16_t *FileName, IMAGE_FORMAT Format, CAPTURE_STATS *Stats) {
+    CAPTURE_WRITER Writer;
+    CAPTURE_QOI_STATE Qoi;
+    GOP_FRAMEBUFFER Framebuffer;
+    EFI_FILE_PROTOCOL *File = NULL;
+    EFI_FILE_INFO *Info = NULL;
+    uint64_t Start = ReadTimestamp();
+    uint64_t ReadTicks = 0, Bands = 0;
+    EFI_STATUS Status;
+    
+    if (Gop == NULL || Root == NULL || FileName == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    if (Format != ImageFormatBmp && Format != ImageFormatQoi) {
+        return EFI_UNSUPPORTED;
+    }
+    
+    Status = FramebufferInit(&Framebuffer, Gop);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    uint32_t Width = Framebuffer.Width;
+    uint32_t Height = Framebuffer.Height;
+    uint64_t BandBytes = (uint64_t)Width * CAPTURE_BAND_ROWS * sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL);
+    uint64_t EncodeBytes = (uint64_t)Width * 4 + 4;    // Worst case for either format
+    uint64_t MemoryUsed = BandBytes + EncodeBytes + CAPTURE_WRITE_BUFFER_SIZE;
+    
+    if (Width == 0 || Height == 0) {
+        return EFI_NOT_READY;
+    }
+    
+    uint8_t *Memory = (uint8_t*)AllocatePool(MemoryUsed);
+    if (Memory == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Band = (EFI_GRAPHICS_OUTPUT_BLT_PIXEL*)Memory;
+    uint8_t *Encoded = Memory + BandBytes;
+    
+    Status = OpenFile(Root, FileName, &File, EFI_FILE_MODE_CREATE | EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE);
+    if (EFI_ERROR(Status)) {
+        FreePool(Memory);
+        return Status;
+    }
+    
+    MemSet(&Writer, 0, sizeof(Writer));
+    Writer.File = File;
+    Writer.Buffer = Encoded + EncodeBytes;
+    Writer.Status = EFI_SUCCESS;
+    
+    if (Format == ImageFormatBmp) {
+        WriteBmpHeader(&Writer, Width, Height);
+    } else {
+        WriteQoiHeader(&Writer, &Qoi, Width, Height);
+    }
+    
+    for (uint32_t Y = 0; Y < Height && !EFI_ERROR(Writer.Status); Y += CAPTURE_BAND_ROWS) {
+        uint32_t Rows = Height - Y < CAPTURE_BAND_ROWS ? Height - Y : CAPTURE_BAND_ROWS;
+        uint64_t ReadStart = ReadTimestamp();
+        
+        Status = FramebufferRead(&Framebuffer, 0, Y, Width, Rows, Band, Width);
+        ReadTicks += ReadTimestamp() - ReadStart;
+        if (EFI_ERROR(Status)) {
+            Writer.Status = Status;
+            break;
+        }
+        Bands++;
+        
+        for (uint32_t Row = 0; Row < Rows; Row++) {
+            const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Pixels = Band + (uint64_t)Row * Width;
+            uint64_t Length = Format == ImageFormatBmp ? EncodeBmpRow(Pixels, Width, Encoded)
+                                                       : EncodeQoiRow(&Qoi, Pixels, Width, Encoded);
+            WriterWrite(&Writer, Encoded, Length);
+        }
+    }
+    
+    if (Format == ImageFormatQoi) {
+        WriteQoiEnd(&Writer, &Qoi);
+    }
+    WriterFlush(&Writer);
+    Status = Writer.Status;
+    
+    // An older, larger capture may have been overwritten in place
+    if (!EFI_ERROR(Status) && !EFI_ERROR(ReadFileInfo(File, &Info))) {
+        if (Info->FileSize > Writer.Written) {
+            Info->FileSize = Writer.Written;
+            Status = File->SetInfo(File, (EFI_GUID*)&gEfiFileInfoGuid, Info->Size, Info);
+        }
+        FreePool(Info);
+    }
+    
+    File->Flush(File);
+    File->Close(File);
+    FreePool(Memory);
+    
+    if (Stats != NULL) {
+        Stats->Width = Width;
+        Stats->Height = Height;
+        Stats->Direct = Framebuffer.Direct;
+        Stats->Bands = Bands;
+        Stats->BytesWritten = Writer.Written;
+        Stats->FileWrites = Writer.Writes;
+        Stats->MemoryUsed = MemoryUsed;
+        Stats->ReadTicks = ReadTicks;
+        Stats->TotalTicks = ReadTimestamp() - Start;
+    }
+    
+    return Status;
+}
+
+static void PrintCaptureStats(const char16_t *Label, const CAPTURE_STATS *Stats) {
+    PRINT(Label);
+    PrintDec(Stats->BytesWritten / 1024);
+    PRINT(u" KiB in ");
+    PrintDec(TimestampToMicroseconds(Stats->TotalTicks) / 1000);
+    PRINT(u" ms (read ");
+    PrintDec(TimestampToMicroseconds(Stats->ReadTicks) / 1000);
+    PRINT(u" ms, ");
+    PrintDec(Stats->FileWrites);
+    PRINTL(u" writes)");
+}
+
+// Capture the screen in both formats and report size, time and memory
+void CaptureBenchmark(EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop, EFI_FILE_PROTOCOL *Root) {
+    CAPTURE_STATS Bmp, Qoi;
+    const char16_t *Source;
+    
+    if (EFI_ERROR(CaptureScreen(Gop, Root, u"capture.bmp", ImageFormatBmp, &Bmp)) ||
+        EFI_ERROR(CaptureScreen(Gop, Root, u"capture.qoi", ImageFormatQoi, &Qoi))) {
+        PRINTL(u"Capture benchmark: capture failed");
+        return;
+    }
+    
+    PRINT(u"Captured ");
+    PrintDec(Bmp.Width);
+    PRINT(u"x");
+    PrintDec(Bmp.Height);
+    Source = Bmp.Direct ? u" from the framebuffer" : u" through Blt";
+    PRINT(Source);
+    PRINT(u", ");
+    PrintDec(Bmp.MemoryUsed / 1024);
+    PRINT(u" KiB working memory (frame is ");
+    PrintDec((uint64_t)Bmp.Width * Bmp.Height * 4 / 1024);
+    PRINTL(u" KiB)");
+    PrintCaptureStats(u"BMP: ", &Bmp);
+    PrintCaptureStats(u"QOI: ", &Qoi);
+}
@@ -0,0 +1,51 @@
+// efi_capture.h
+#ifndef TINYUEFI_CAPTURE_H
+#define TINYUEFI_CAPTURE_H
+
+#include "uefi_types.h"
+#include "efi_file_protocol.h"
+#include "efi_gop_protocol.h"
+#include "efi_image.h"
+
+// Screen rows read and encoded per band
+#define CAPTURE_BAND_ROWS             32
+
+// Encoded bytes collected before each file write
+#define CAPTURE_WRITE_BUFFER_SIZE     (64 * 1024)
+
+// Buffered file writer; Status keeps the first write error
+typedef struct {
+    EFI_FILE_PROTOCOL *File;
+    uint8_t *Buffer;
+    uint64_t Used;
+    uint64_t Written;
+    uint64_t Writes;
+    EFI_STATUS Status;
+} CAPTURE_WRITER;
+
+// Streaming QOI encoder state (runs and the index carry across bands)
+typedef struct {
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL Index[64];
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL Previous;
+    uint32_t Run;
+} CAPTURE_QOI_STATE;
+
+// Outcome of one capture
+typedef struct {
+    uint32_t Width;
+    uint32_t Height;
+    bool Direct;                  // Read from the linear framebuffer rather than Blt
+    uint64_t Bands;
+    uint64_t BytesWritten;
+    uint64_t FileWrites;
+    uint64_t MemoryUsed;          // Band, encode and write buffers together
+    uint64_t ReadTicks;
+    uint64_t TotalTicks;
+} CAPTURE_STATS;
+
+// Helper functions
+EFI_STATUS CaptureScreen(EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop, EFI_FILE_PROTOCOL *Root,
+                         const char16_t *FileName, IMAGE_FORMAT Format, CAPTURE_STATS *Stats);
+void CaptureBenchmark(EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop, EFI_FILE_PROTOCOL *Root);
+
+#endif // TINYUEFI_CAPTURE_H
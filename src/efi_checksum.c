@@ -0,0 +1,474 @@
+// efi_checksum.c
+#include <immintrin.h>
+#include "efi_checksum.h"
+#include "uefi_helpers.h"
+#include "efi_cpu.h"
+#include "efi_timer.h"
+
+// Vector iterations between spills of the 64-bit lanes into the scalar
+// sum; each lane grows by under 2^32 per iteration, so this leaves them
+// far from overflowing
+#define CHECKSUM_VECTOR_CHUNK         (1u << 24)
+
+// Kernel chosen on first use
+static const CHECKSUM_KERNEL *SelectedKernel = NULL;
+
+static inline uint16_t SwapBytes16(uint16_t Value) {
+    return (uint16_t)((Value >> 8) | (Value << 8));
+}
+
+static inline uint32_t SwapBytes32(uint32_t Value) {
+    return (Value >> 24) | ((Value >> 8) & 0xFF00) | ((Value << 8) & 0xFF0000) | (Value << 24);
+}
+
+// Ones'-complement add: a carry out of bit 63 wraps around to bit 0
+static inline uint64_t AddCarry(uint64_t Sum, uint64_t Value) {
+    Sum += Value;
+    return Sum + (Sum < Value);
+}
+
+//
+// Scalar kernel
+//
+
+static uint64_t ChecksumScalar(const void *Data, uint64_t Length, uint64_t Sum) {
+    const uint8_t *Bytes = (const uint8_t*)Data;
+    uint64_t Carries = 0;
+    
+    // Four independent 64-bit adds per iteration; carries are counted and
+    // added back once at the end
+    while (Length >= 32) {
+        uint64_t Words[4];
+        __builtin_memcpy(Words, Bytes, sizeof(Words));
+        Sum += Words[0];
+        Carries += Sum < Words[0];
+        Sum += Words[1];
+        Carries += Sum < Words[1];
+        Sum += Words[2];
+        Carries += Sum < Words[2];
+        Sum += Words[3];
+        Carries += Sum < Words[3];
+        Bytes += 32;
+        Length -= 32;
+    }
+    while (Length >= 8) {
+        uint64_t Word;
+        __builtin_memcpy(&Word, Bytes, sizeof(Word));
+        Sum += Word;
+        Carries += Sum < Word;
+        Bytes += 8;
+        Length -= 8;
+    }
+    Sum = AddCarry(Sum, Carries);
+    
+    if (Length >= 4) {
+        uint32_t Word;
+        __builtin_memcpy(&Word, Bytes, sizeof(Word));
+        Sum = AddCarry(Sum, Word);
+        Bytes += 4;
+        Length -= 4;
+    }
+    if (Length >= 2) {
+        uint16_t Half;
+        __builtin_memcpy(&Half, Bytes, sizeof(Half));
+        Sum = AddCarry(Sum, Half);
+        Bytes += 2;
+        Length -= 2;
+    }
+    if (Length != 0) {
+        Sum = AddCarry(Sum, Bytes[0]);
+    }
+    
+    return Sum;
+}
+
+static const CHECKSUM_KERNEL ChecksumKernelScalar = { u"Scalar", ChecksumScalar };
+
+//
+// SSE2 kernel: each 64-bit lane sums the low and high 32-bit halves of the
+// words loaded into it, so no adds can carry out of a lane
+//
+
+static uint64_t ChecksumSse2(const void *Data, uint64_t Length, uint64_t Sum) {
+    const uint8_t *Bytes = (const uint8_t*)Data;
+    const __m128i Low = _mm_set1_epi64x(0xFFFFFFFF);
+    
+    while (Length >= 64) {
+        __m128i Sums[4] = { _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128() };
+        uint64_t Iterations = Length / 64 < CHECKSUM_VECTOR_CHUNK ? Length / 64 : CHECKSUM_VECTOR_CHUNK;
+        
+        for (uint64_t i = 0; i < Iterations; i++) {
+#pragma GCC unroll 4
+            for (uint32_t j = 0; j < 4; j++) {
+                __m128i Words = _mm_loadu_si128((const __m128i*)(Bytes + j * 16));
+                Sums[j] = _mm_add_epi64(Sums[j], _mm_and_si128(Words, Low));
+                Sums[j] = _mm_add_epi64(Sums[j], _mm_srli_epi64(Words, 32));
+            }
+            Bytes += 64;
+        }
+        Length -= Iterations * 64;
+        
+        __m128i Total = _mm_add_epi64(_mm_add_epi64(Sums[0], Sums[1]), _mm_add_epi64(Sums[2], Sums[3]));
+        uint64_t Lanes[2];
+        _mm_storeu_si128((__m128i*)Lanes, Total);
+        Sum = AddCarry(Sum, Lanes[0]);
+        Sum = AddCarry(Sum, Lanes[1]);
+    }
+    
+    return ChecksumScalar(Bytes, Length, Sum);
+}
+
+static const CHECKSUM_KERNEL ChecksumKernelSse2 = { u"SSE2", ChecksumSse2 };
+
+//
+// AVX2 kernel: the SSE2 scheme on 256-bit vectors, 128 bytes per iteration
+//
+
+__attribute__((target("avx2")))
+static uint64_t ChecksumAvx2(const void *Data, uint64_t Length, uint64_t Sum) {
+    const uint8_t *Bytes = (const uint8_t*)Data;
+    const __m256i Low = _mm256_set1_epi64x(0xFFFFFFFF);
+    
+    while (Length >= 128) {
+        __m256i Sums[4] = { _mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256() };
+        uint64_t Iterations = Length / 128 < CHECKSUM_VECTOR_CHUNK ? Length / 128 : CHECKSUM_VECTOR_CHUNK;
+        
+        for (uint64_t i = 0; i < Iterations; i++) {
+#pragma GCC unroll 4
+            for (uint32_t j = 0; j < 4; j++) {
+                __m256i Words = _mm256_loadu_si256((const __m256i*)(Bytes + j * 32));
+                Sums[j] = _mm256_add_epi64(Sums[j], _mm256_and_si256(Words, Low));
+                Sums[j] = _mm256_add_epi64(Sums[j], _mm256_srli_epi64(Words, 32));
+            }
+            Bytes += 128;
+        }
+        Length -= Iterations * 128;
+        
+        __m256i Total = _mm256_add_epi64(_mm256_add_epi64(Sums[0], Sums[1]), _mm256_add_epi64(Sums[2], Sums[3]));
+        __m128i Half = _mm_add_epi64(_mm256_castsi256_si128(Total), _mm256_extracti128_si256(Total, 1));
+        uint64_t Lanes[2];
+        _mm_storeu_si128((__m128i*)Lanes, Half);
+        Sum = AddCarry(Sum, Lanes[0]);
+        Sum = AddCarry(Sum, Lanes[1]);
+    }
+    
+    // The tail is a sibling call the compiler does not fence, and legacy
+    // SSE code after dirty upper halves pays a transition stall per call
+    _mm256_zeroupper();
+    return ChecksumSse2(Bytes, Length, Sum);
+}
+
+static const CHECKSUM_KERNEL ChecksumKernelAvx2 = { u"AVX2", ChecksumAvx2 };
+
+// Every implementation the CPU can run, slowest first
+static uint32_t GetAvailableKernels(const CHECKSUM_KERNEL *Kernels[3]) {
+    uint32_t Count = 0;
+    
+    Kernels[Count++] = &ChecksumKernelScalar;
+    if (CpuHasFeature(CPU_FEATURE_SSE2)) {
+        Kernels[Count++] = &ChecksumKernelSse2;
+    }
+    if (CpuHasFeature(CPU_FEATURE_AVX2)) {
+        Kernels[Count++] = &ChecksumKernelAvx2;
+    }
+    
+    return Count;
+}
+
+// Fastest kernel the CPU supports (chosen once)
+const CHECKSUM_KERNEL *GetChecksumKernel(void) {
+    if (SelectedKernel == NULL) {
+        const CHECKSUM_KERNEL *Kernels[3];
+        SelectedKernel = Kernels[GetAvailableKernels(Kernels) - 1];
+    }
+    
+    return SelectedKernel;
+}
+
+// When chaining, every piece but the last must have an even length
+uint64_t ChecksumPartial(const void *Data, uint64_t Length, uint64_t Sum) {
+    return GetChecksumKernel()->Partial(Data, Length, Sum);
+}
+
+// Ones'-complement of the folded sum, ready to store with a plain 16-bit
+// write. A buffer that includes a valid checksum folds to 0.
+uint16_t ChecksumFold(uint64_t Sum) {
+    Sum = (Sum & 0xFFFFFFFF) + (Sum >> 32);
+    Sum = (Sum & 0xFFFFFFFF) + (Sum >> 32);
+    Sum = (Sum & 0xFFFF) + (Sum >> 16);
+    Sum = (Sum & 0xFFFF) + (Sum >> 16);
+    return (uint16_t)~Sum;
+}
+
+uint16_t Checksum(const void *Data, uint64_t Length) {
+    return ChecksumFold(ChecksumPartial(Data, Length, 0));
+}
+
+// Sum of the IPv4 pseudo-header used by UDP and TCP, to seed ChecksumPartial
+// over the transport header and payload. Length is the transport length.
+uint64_t ChecksumPseudoHeader(uint32_t Source, uint32_t Destination, uint8_t Protocol, uint16_t Length) {
+    return (uint64_t)SwapBytes32(Source) + SwapBytes32(Destination) +
+           ((uint32_t)Protocol << 8) + SwapBytes16(Length);
+}
+
+// Patch Checksum after a 16-bit field changed from Old to New, without
+// summing the rest of the packet again (RFC 1624, equation 3)
+uint16_t ChecksumUpdate16(uint16_t Checksum, uint16_t Old, uint16_t New) {
+    uint32_t Sum = (uint32_t)(uint16_t)~Checksum + (uint16_t)~Old + New;
+    
+    Sum = (Sum & 0xFFFF) + (Sum >> 16);
+    Sum = (Sum & 0xFFFF) + (Sum >> 16);
+    return (uint16_t)~Sum;
+}
+
+// The same for a 32-bit field such as an address
+uint16_t ChecksumUpdate32(uint16_t Checksum, uint32_t Old, uint32_t New) {
+    uint32_t Sum = (uint32_t)(uint16_t)~Checksum + (uint16_t)~Old + (uint16_t)~(Old >> 16) +
+                   (New & 0xFFFF) + (New >> 16);
+    
+    Sum = (Sum & 0xFFFF) + (Sum >> 16);
+    Sum = (Sum & 0xFFFF) + (Sum >> 16);
+    return (uint16_t)~Sum;
+}
+
+//
+// Self-test
+//
+
+// Byte pairs added one at a time with the carries left in the accumulator,
+// the RFC 1071 loop in kernel form. It is the baseline ChecksumBenchmark
+// measures the kernels against, and is checked with them here.
+static uint64_t ChecksumByteLoop(const void *Data, uint64_t Length, uint64_t Sum) {
+    const uint8_t *Bytes = (const uint8_t*)Data;
+    uint64_t i = 0;
+    
+    for (; i + 1 < Length; i += 2) {
+        Sum += (uint64_t)Bytes[i] | (uint64_t)Bytes[i + 1] << 8;
+    }
+    if (i < Length) {
+        Sum += Bytes[i];
+    }
+    
+    return Sum;
+}
+
+static const CHECKSUM_KERNEL ChecksumKernelByteLoop = { u"Byte loop", ChecksumByteLoop };
+
+static uint32_t ChecksumTestRandom(uint32_t *Seed) {
+    *Seed = *Seed * 1664525 + 1013904223;
+    return *Seed;
+}
+
+// RFC 1071 reference: big-endian byte pairs with the carries folded back
+// as they occur. Returns the checksum in host order.
+static uint16_t ChecksumReference(const uint8_t *Bytes, uint64_t Length) {
+    uint32_t Sum = 0;
+    
+    for (uint64_t i = 0; i < Length; i++) {
+        Sum += (i & 1) != 0 ? Bytes[i] : (uint32_t)Bytes[i] << 8;
+        Sum = (Sum & 0xFFFF) + (Sum >> 16);
+    }
+    return (uint16_t)~Sum;
+}
+
+static bool ReportFailure(const CHECKSUM_KERNEL *Kernel, const char16_t *Test, uint64_t Length, uint64_t Offset) {
+    PRINT(u"Checksum self-test: ");
+    PRINT(Kernel->Name);
+    PRINT(u" ");
+    PRINT(Test);
+    PRINT(u" failed for ");
+    PrintDec(Length);
+    PRINT(u" bytes at offset ");
+    PrintDec(Offset);
+    PRINTL(u"");
+    return false;
+}
+
+// Every length up to CHECKSUM_TEST_BYTES at every offset up to
+// CHECKSUM_TEST_ALIGNMENTS; the reference grows one byte at a time
+static bool TestLengths(const CHECKSUM_KERNEL *Kernel, uint8_t *Buffer, uint64_t *Checks) {
+    for (uint32_t Offset = 0; Offset < CHECKSUM_TEST_ALIGNMENTS; Offset++) {
+        const uint8_t *Bytes = Buffer + Offset;
+        uint32_t Sum = 0;
+        
+        for (uint32_t Length = 0; Length <= CHECKSUM_TEST_BYTES; Length++) {
+            uint16_t Expected = SwapBytes16((uint16_t)~Sum);
+            
+            if (ChecksumFold(Kernel->Partial(Bytes, Length, 0)) != Expected) {
+                return ReportFailure(Kernel, u"length", Length, Offset);
+            }
+            
+            // Split at an even point and chain the two pieces
+            uint32_t Split = (Length / 3) & ~1u;
+            uint64_t Chained = Kernel->Partial(Bytes + Split, Length - Split, Kernel->Partial(Bytes, Split, 0));
+            if (ChecksumFold(Chained) != Expected) {
+                return ReportFailure(Kernel, u"chained", Length, Offset);
+            }
+            
+            if (Length < CHECKSUM_TEST_BYTES) {
+                Sum += (Length & 1) != 0 ? Bytes[Length] : (uint32_t)Bytes[Length] << 8;
+                Sum = (Sum & 0xFFFF) + (Sum >> 16);
+            }
+            *Checks += 2;
+        }
+    }
+    
+    return true;
+}
+
+// Pseudo-header sums and incremental updates against full recomputation
+static bool TestHelpers(uint32_t *Seed, uint64_t *Checks) {
+    uint8_t Header[20];
+    uint8_t Pseudo[12];
+    
+    for (uint32_t Round = 0; Round < 4096; Round++) {
+        uint32_t Source = ChecksumTestRandom(Seed);
+        uint32_t Destination = ChecksumTestRandom(Seed);
+        uint8_t Protocol = (uint8_t)ChecksumTestRandom(Seed);
+        uint16_t Length = (uint16_t)ChecksumTestRandom(Seed);
+        
+        Pseudo[0] = (uint8_t)(Source >> 24);
+        Pseudo[1] = (uint8_t)(Source >> 16);
+        Pseudo[2] = (uint8_t)(Source >> 8);
+        Pseudo[3] = (uint8_t)Source;
+        Pseudo[4] = (uint8_t)(Destination >> 24);
+        Pseudo[5] = (uint8_t)(Destination >> 16);
+        Pseudo[6] = (uint8_t)(Destination >> 8);
+        Pseudo[7] = (uint8_t)Destination;
+        Pseudo[8] = 0;
+        Pseudo[9] = Protocol;
+        Pseudo[10] = (uint8_t)(Length >> 8);
+        Pseudo[11] = (uint8_t)Length;
+        if (ChecksumFold(ChecksumPseudoHeader(Source, Destination, Protocol, Length)) !=
+            SwapBytes16(ChecksumReference(Pseudo, sizeof(Pseudo)))) {
+            return ReportFailure(&ChecksumKernelScalar, u"pseudo-header", sizeof(Pseudo), 0);
+        }
+        
+        // A header with a valid checksum at bytes 10-11; every fourth round
+        // is all zero or all ones to reach the ones'-complement edge cases
+        for (uint32_t i = 0; i < sizeof(Header); i++) {
+            Header[i] = (Round & 3) == 1 ? 0 : (Round & 3) == 2 ? 0xFF : (uint8_t)ChecksumTestRandom(Seed);
+        }
+        Header[10] = Header[11] = 0;
+        uint16_t Stored = Checksum(Header, sizeof(Header));
+        __builtin_memcpy(Header + 10, &Stored, sizeof(Stored));
+        
+        // Rewrite one 16-bit field, then one 32-bit field
+        uint32_t Field = (ChecksumTestRandom(Seed) % 9) * 2;
+        Field = Field >= 10 ? Field + 2 : Field;
+        uint16_t Old16;
+        uint16_t New16 = (Round & 3) == 3 ? 0 : (uint16_t)ChecksumTestRandom(Seed);
+        __builtin_memcpy(&Old16, Header + Field, sizeof(Old16));
+        __builtin_memcpy(Header + Field, &New16, sizeof(New16));
+        Stored = ChecksumUpdate16(Stored, Old16, New16);
+        __builtin_memcpy(Header + 10, &Stored, sizeof(Stored));
+        if (Checksum(Header, sizeof(Header)) != 0) {
+            return ReportFailure(&ChecksumKernelScalar, u"16-bit update", sizeof(Header), Field);
+        }
+        
+        uint32_t Old32;
+        uint32_t New32 = (Round & 3) == 3 ? 0xFFFFFFFF : ChecksumTestRandom(Seed);
+        Field = (ChecksumTestRandom(Seed) & 1) != 0 ? 12 : 16;
+        __builtin_memcpy(&Old32, Header + Field, sizeof(Old32));
+        __builtin_memcpy(Header + Field, &New32, sizeof(New32));
+        Stored = ChecksumUpdate32(Stored, Old32, New32);
+        __builtin_memcpy(Header + 10, &Stored, sizeof(Stored));
+        if (Checksum(Header, sizeof(Header)) != 0) {
+            return ReportFailure(&ChecksumKernelScalar, u"32-bit update", sizeof(Header), Field);
+        }
+        
+        *Checks += 3;
+    }
+    
+    return true;
+}
+
+// Compare every available kernel with the RFC 1071 reference over random
+// and all-ones data (the worst case for carries), then check the helpers
+EFI_STATUS ChecksumSelfTest(void) {
+    const CHECKSUM_KERNEL *Kernels[4];
+    uint32_t KernelCount = GetAvailableKernels(Kernels);
+    uint32_t Seed = 0x12345678;
+    uint64_t Checks = 0;
+    bool Passed = true;
+    
+    uint8_t *Buffer = (uint8_t*)AllocatePool(CHECKSUM_TEST_BYTES + CHECKSUM_TEST_ALIGNMENTS);
+    if (Buffer == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    
+    Kernels[KernelCount++] = &ChecksumKernelByteLoop;
+    
+    for (uint32_t Pattern = 0; Pattern < 2 && Passed; Pattern++) {
+        for (uint32_t i = 0; i < CHECKSUM_TEST_BYTES + CHECKSUM_TEST_ALIGNMENTS; i++) {
+            Buffer[i] = Pattern == 0 ? (uint8_t)(ChecksumTestRandom(&Seed) >> 24) : 0xFF;
+        }
+        for (uint32_t k = 0; k < KernelCount && Passed; k++) {
+            Passed = TestLengths(Kernels[k], Buffer, &Checks);
+        }
+    }
+    if (Passed) {
+        Passed = TestHelpers(&Seed, &Checks);
+    }
+    
+    FreePool(Buffer);
+    
+    if (!Passed) {
+        return EFI_DEVICE_ERROR;
+    }
+    
+    PRINT(u"Checksum self-test: ");
+    PrintDec(Checks);
+    PRINTL(u" checks passed");
+    return EFI_SUCCESS;
+}
+
+//
+// Benchmark
+//
+
+static uint64_t TimeChecksumKernel(const CHECKSUM_KERNEL *Kernel, const uint8_t *Data, uint64_t Size) {
+    volatile uint64_t Sink = 0;
+    uint64_t Passes = CHECKSUM_BENCHMARK_BYTES / Size;
+    uint64_t Start = ReadTimestamp();
+    
+    for (uint64_t Pass = 0; Pass < Passes; Pass++) {
+        Sink = Sink + Kernel->Partial(Data, Size, 0);
+    }
+    
+    return ReadTimestamp() - Start;
+}
+
+void ChecksumBenchmark(void) {
+    static const uint64_t Sizes[] = { 64, 1500, 65536 };
+    const CHECKSUM_KERNEL *Kernels[4];
+    uint32_t KernelCount = GetAvailableKernels(Kernels + 1) + 1;
+    
+    Kernels[0] = &ChecksumKernelByteLoop;
+    
+    // One odd offset so unaligned loads are part of the measurement
+    uint8_t *Data = (uint8_t*)AllocatePool(Sizes[2] + 1);
+    if (Data == NULL) {
+        PRINTL(u"Checksum benchmark: out of memory");
+        return;
+    }
+    for (uint64_t i = 0; i <= Sizes[2]; i++) {
+        Data[i] = (uint8_t)(i * 131 + 7);
+    }
+    
+    for (uint32_t s = 0; s < sizeof(Sizes) / sizeof(Sizes[0]); s++) {
+        uint64_t Bytes = CHECKSUM_BENCHMARK_BYTES / Sizes[s] * Sizes[s];
+        
+        for (uint32_t k = 0; k < KernelCount; k++) {
+            PRINT(u"Checksum ");
+            PRINT(Kernels[k]->Name);
+            PRINT(u" ");
+            PrintDec(Sizes[s]);
+            PRINT(u" bytes: ");
+            PrintThroughput(Bytes, TimeChecksumKernel(Kernels[k], Data + 1, Sizes[s]));
+            PRINTL(u"");
+        }
+    }
+    
+    FreePool(Data);
+}
@@ -0,0 +1,42 @@
+// efi_checksum.h
+#ifndef TINYUEFI_CHECKSUM_H
+#define TINYUEFI_CHECKSUM_H
+
+#include "uefi_types.h"
+
+// Largest buffer and alignment offset covered by ChecksumSelfTest
+#define CHECKSUM_TEST_BYTES           2048
+#define CHECKSUM_TEST_ALIGNMENTS      64
+
+// Bytes summed for each buffer size timed by ChecksumBenchmark
+#define CHECKSUM_BENCHMARK_BYTES      (256 * 1024 * 1024)
+
+// Adds Length bytes of Data to the 64-bit accumulator Sum. Bytes are taken
+// in memory order as little-endian words, so the folded result is in
+// packet byte order; carries are kept until ChecksumFold.
+typedef uint64_t (*CHECKSUM_FUNCTION)(const void *Data, uint64_t Length, uint64_t Sum);
+
+// One implementation of the Internet checksum (RFC 1071)
+typedef struct {
+    const char16_t *Name;
+    CHECKSUM_FUNCTION Partial;
+} CHECKSUM_KERNEL;
+
+// Kernel selection
+const CHECKSUM_KERNEL *GetChecksumKernel(void);
+
+// Checksums. Values and fields are in packet byte order, as loaded and
+// stored with plain 16- and 32-bit accesses; addresses and lengths given to
+// ChecksumPseudoHeader are in host order.
+uint64_t ChecksumPartial(const void *Data, uint64_t Length, uint64_t Sum);
+uint16_t ChecksumFold(uint64_t Sum);
+uint16_t Checksum(const void *Data, uint64_t Length);
+uint64_t ChecksumPseudoHeader(uint32_t Source, uint32_t Destination, uint8_t Protocol, uint16_t Length);
+uint16_t ChecksumUpdate16(uint16_t Checksum, uint16_t Old, uint16_t New);
+uint16_t ChecksumUpdate32(uint16_t Checksum, uint32_t Old, uint32_t New);
+
+// Testing
+EFI_STATUS ChecksumSelfTest(void);
+void ChecksumBenchmark(void);
+
+#endif // TINYUEFI_CHECKSUM_H
@@ -0,0 +1,78 @@
+// efi_cpu.c
+#include "efi_cpu.h"
+
+// Cached feature mask (CPUID is serializing, so only query it once)
+static uint32_t CpuFeatures = 0;
+static bool CpuFeaturesValid = false;
+
+// Execute CPUID for the given leaf/subleaf
+void Cpuid(uint32_t Leaf, uint32_t SubLeaf, 
+           uint32_t *Eax, uint32_t *Ebx, uint32_t *Ecx, uint32_t *Edx) {
+    uint32_t A, B, C, D;
+    
+    __asm__ volatile ("cpuid"
+                      : "=a"(A), "=b"(B), "=c"(C), "=d"(D)
+                      : "a"(Leaf), "c"(SubLeaf));
+    
+    if (Eax != NULL) *Eax = A;
+    if (Ebx != NULL) *Ebx = B;
+    if (Ecx != NULL) *Ecx = C;
+    if (Edx != NULL) *Edx = D;
+}
+
+// Read an extended control register (only valid when OSXSAVE is set)
+static uint64_t ReadXcr(uint32_t Index) {
+    uint32_t Low, High;
+    
+    __asm__ volatile ("xgetbv" : "=a"(Low), "=d"(High) : "c"(Index));
+    return ((uint64_t)High << 32) | Low;
+}
+
+// Detect the CPU features used by the accelerated code paths
+uint32_t GetCpuFeatures(void) {
+    uint32_t MaxLeaf, MaxExtLeaf;
+    uint32_t Ebx, Ecx, Edx;
+    uint32_t Features = 0;
+    
+    if (CpuFeaturesValid) {
+        return CpuFeatures;
+    }
+    
+    Cpuid(0, 0, &MaxLeaf, NULL, NULL, NULL);
+    
+    if (MaxLeaf >= 1) {
+        Cpuid(1, 0, NULL, NULL, &Ecx, &Edx);
+        
+        if (Edx & (1u << 26)) Features |= CPU_FEATURE_SSE2;
+        if (Ecx & (1u << 9))  Features |= CPU_FEATURE_SSSE3;
+        if (Ecx & (1u << 19)) Features |= CPU_FEATURE_SSE41;
+        
+        // AVX state must be enabled by whoever owns XCR0 (firmware often doesn't)
+        bool AvxUsable = false;
+        if ((Ecx & (1u << 27)) && (Ecx & (1u << 28))) {
+            AvxUsable = (ReadXcr(0) & 0x6) == 0x6;
+        }
+        
+        if (MaxLeaf >= 7) {
+            Cpuid(7, 0, NULL, &Ebx, NULL, NULL);
+            
+            if (AvxUsable && (Ebx & (1u << 5))) Features |= CPU_FEATURE_AVX2;
+            if (Ebx & (1u << 29)) Features |= CPU_FEATURE_SHA;
+        }
+    }
+    
+    Cpuid(0x80000000, 0, &MaxExtLeaf, NULL, NULL, NULL);
+    if (MaxExtLeaf >= 0x80000007) {
+        Cpuid(0x80000007, 0, NULL, NULL, NULL, &Edx);
+        if (Edx & (1u << 8)) Features |= CPU_FEATURE_INVARIANT_TSC;
+    }
+    
+    CpuFeatures = Features;
+    CpuFeaturesValid = true;
+    return CpuFeatures;
+}
+
+// Check whether all of the requested feature bits are present
+bool CpuHasFeature(uint32_t Feature) {
+    return (GetCpuFeatures() & Feature) == Feature;
+}
@@ -0,0 +1,21 @@
+// efi_cpu.h
+#ifndef TINYUEFI_CPU_H
+#define TINYUEFI_CPU_H
+
+#include "uefi_types.h"
+
+// CPU feature bits reported by GetCpuFeatures
+#define CPU_FEATURE_SSE2              0x00000001
+#define CPU_FEATURE_SSSE3             0x00000002
+#define CPU_FEATURE_SSE41             0x00000004
+#define CPU_FEATURE_AVX2              0x00000008
+#define CPU_FEATURE_SHA               0x00000010
+#define CPU_FEATURE_INVARIANT_TSC     0x00000020
+
+// Helper functions
+void Cpuid(uint32_t Leaf, uint32_t SubLeaf, 
+           uint32_t *Eax, uint32_t *Ebx, uint32_t *Ecx, uint32_t *Edx);
+uint32_t GetCpuFeatures(void);
+bool CpuHasFeature(uint32_t Feature);
+
+#endif // TINYUEFI_CPU_H
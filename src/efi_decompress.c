@@ -0,0 +1,1486 @@
+// efi_decompress.c
+#include "efi_decompress.h"
+#include "uefi_helpers.h"
+#include "efi_timer.h"
+
+// Huffman lookup tables: a 10-bit primary table plus 5-bit subtables for
+// the (rare) codes longer than 10 bits
+#define INFLATE_PRIMARY_BITS          10
+#define INFLATE_PRIMARY_SIZE          (1 << INFLATE_PRIMARY_BITS)
+#define INFLATE_SUBTABLE_BITS         5
+#define INFLATE_SUBTABLE_SIZE         (1 << INFLATE_SUBTABLE_BITS)
+#define INFLATE_MAX_SUBTABLES         288
+#define INFLATE_MAX_CODE_LENGTH       15
+
+// Table entry layout: Symbol << 16 | Length, or Index << 16 | SUBTABLE
+#define INFLATE_ENTRY_SUBTABLE        0x8000
+#define INFLATE_ENTRY_LENGTH_MASK     0x00FF
+
+// Symbol decode results
+#define INFLATE_SYMBOL_UNDERFLOW      -1
+#define INFLATE_SYMBOL_INVALID        -2
+
+// gzip header flags
+#define GZIP_FLAG_HCRC                0x02
+#define GZIP_FLAG_EXTRA               0x04
+#define GZIP_FLAG_NAME                0x08
+#define GZIP_FLAG_COMMENT             0x10
+
+// LZ4 frame constants
+#define LZ4_FRAME_MAGIC               0x184D2204
+#define LZ4_SKIPPABLE_MAGIC           0x184D2A50
+#define LZ4_SKIPPABLE_MASK            0xFFFFFFF0
+#define LZ4_FLAG_BLOCK_CHECKSUM       0x10
+#define LZ4_FLAG_CONTENT_SIZE         0x08
+#define LZ4_FLAG_CONTENT_CHECKSUM     0x04
+#define LZ4_FLAG_DICTIONARY_ID        0x01
+#define LZ4_BLOCK_UNCOMPRESSED        0x80000000
+#define LZ4_MIN_MATCH                 4
+
+// Input needed before the LZ4 sequence fast path is attempted
+#define LZ4_FAST_MARGIN               32
+
+// Decoder states
+typedef enum {
+    InflateGzipHeader,
+    InflateGzipExtraLength,
+    InflateGzipExtra,
+    InflateGzipName,
+    InflateGzipComment,
+    InflateGzipHeaderCrc,
+    InflateBlockHeader,
+    InflateStored,
+    InflateHuffman,
+    InflateGzipTrailer,
+    InflateDone
+} INFLATE_STATE;
+
+typedef enum {
+    Lz4Magic,
+    Lz4SkipSize,
+    Lz4Skip,
+    Lz4HeaderFlags,
+    Lz4HeaderRest,
+    Lz4BlockSize,
+    Lz4BlockRaw,
+    Lz4Token,
+    Lz4LiteralLength,
+    Lz4Literals,
+    Lz4Offset,
+    Lz4MatchLength,
+    Lz4BlockChecksum,
+    Lz4ContentChecksum
+} LZ4_STATE;
+
+// Canonical Huffman decode table
+typedef struct {
+    uint32_t Primary[INFLATE_PRIMARY_SIZE];
+    uint32_t Sub[INFLATE_MAX_SUBTABLES * INFLATE_SUBTABLE_SIZE];
+    uint32_t SubCount;
+} INFLATE_HUFFMAN_TABLE;
+
+// Tables allocated once per context
+typedef struct {
+    INFLATE_HUFFMAN_TABLE LiteralLength;
+    INFLATE_HUFFMAN_TABLE Distance;
+    bool FixedLoaded;
+    uint8_t Lengths[320];
+} INFLATE_TABLES;
+
+static const uint16_t LengthBase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+static const uint8_t LengthExtra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+static const uint16_t DistanceBase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+
+static const uint8_t DistanceExtra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+static const uint8_t CodeLengthOrder[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+// CRC-32 (slicing-by-8) tables, built on first use
+static uint32_t Crc32Table[8][256];
+static bool Crc32TableValid = false;
+
+// Unaligned word access
+static inline uint64_t Load64(const void *Pointer) {
+    uint64_t Value;
+    __builtin_memcpy(&Value, Pointer, sizeof(Value));
+    return Value;
+}
+
+static inline void Store64(void *Pointer, uint64_t Value) {
+    __builtin_memcpy(Pointer, &Value, sizeof(Value));
+}
+
+static inline uint32_t Load32(const uint8_t *Bytes) {
+    return (uint32_t)Bytes[0] | ((uint32_t)Bytes[1] << 8) | 
+           ((uint32_t)Bytes[2] << 16) | ((uint32_t)Bytes[3] << 24);
+}
+
+// Copy bytes a word at a time; may write up to 7 bytes past Dest + Length,
+// so callers only use it when the output has that much slack
+static inline void WideCopy(uint8_t *Dest, const uint8_t *Src, uint64_t Length) {
+    uint8_t *End = Dest + Length;
+    
+    while (Dest < End) {
+        Store64(Dest, Load64(Src));
+        Dest += 8;
+        Src += 8;
+    }
+}
+
+// Copy literal bytes from the input window to the output
+static inline void CopyLiterals(DECOMPRESS_CONTEXT *Context, const uint8_t *Src, uint64_t Length) {
+    uint8_t *Dest = Context->Output;
+    
+    if ((uint64_t)(Context->OutputEnd - Dest) >= Length + 8 && 
+        (uint64_t)(Context->End - Src) >= Length + 8) {
+        WideCopy(Dest, Src, Length);
+    } else {
+        MemCpy(Dest, Src, Length);
+    }
+}
+
+// Copy a back-reference that lies entirely inside the output region
+static inline void CopyMatch(uint8_t *Dest, uint64_t Distance, uint64_t Length, uint8_t *OutputEnd) {
+    const uint8_t *Src = Dest - Distance;
+    uint8_t *End = Dest + Length;
+    
+    if (OutputEnd - End >= 8) {
+        if (Distance >= 8) {
+            WideCopy(Dest, Src, Length);
+            return;
+        }
+        
+        if (Distance == 1) {
+            uint64_t Pattern = Src[0] * 0x0101010101010101ULL;
+            while (Dest < End) {
+                Store64(Dest, Pattern);
+                Dest += 8;
+            }
+            return;
+        }
+        
+        // Short periods: seed 8 bytes, then copy with a period that is a
+        // multiple of Distance and at least one word wide
+        if (Length > 8) {
+            uint64_t Period = Distance * ((8 + Distance - 1) / Distance);
+            for (int i = 0; i < 8; i++) {
+                Dest[i] = Src[i];
+            }
+            WideCopy(Dest + 8, Dest + 8 - Period, Length - 8);
+            return;
+        }
+    }
+    
+    while (Dest < End) {
+        *Dest++ = *Src++;
+    }
+}
+
+// CRC-32 as used by gzip
+static uint32_t Crc32(const uint8_t *Data, uint64_t Size) {
+    uint32_t Crc = 0xFFFFFFFF;
+    
+    if (!Crc32TableValid) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t Value = i;
+            for (int Bit = 0; Bit < 8; Bit++) {
+                Value = (Value >> 1) ^ (0xEDB88320 & (0 - (Value & 1)));
+            }
+            Crc32Table[0][i] = Value;
+        }
+        for (uint32_t i = 0; i < 256; i++) {
+            for (int Slice = 1; Slice < 8; Slice++) {
+                uint32_t Prev = Crc32Table[Slice - 1][i];
+                Crc32Table[Slice][i] = (Prev >> 8) ^ Crc32Table[0][Prev & 0xFF];
+            }
+        }
+        Crc32TableValid = true;
+    }
+    
+    while (Size >= 8) {
+        uint32_t Low = Load32(Data) ^ Crc;
+        uint32_t High = Load32(Data + 4);
+        Crc = Crc32Table[7][Low & 0xFF] ^ Crc32Table[6][(Low >> 8) & 0xFF] ^
+              Crc32Table[5][(Low >> 16) & 0xFF] ^ Crc32Table[4][Low >> 24] ^
+              Crc32Table[3][High & 0xFF] ^ Crc32Table[2][(High >> 8) & 0xFF] ^
+              Crc32Table[1][(High >> 16) & 0xFF] ^ Crc32Table[0][High >> 24];
+        Data += 8;
+        Size -= 8;
+    }
+    
+    while (Size-- > 0) {
+        Crc = (Crc >> 8) ^ Crc32Table[0][(Crc ^ *Data++) & 0xFF];
+    }
+    
+    return ~Crc;
+}
+
+// xxHash32 as used by the LZ4 frame format
+#define XXH_PRIME1                    0x9E3779B1U
+#define XXH_PRIME2                    0x85EBCA77U
+#define XXH_PRIME3                    0xC2B2AE3DU
+#define XXH_PRIME4                    0x27D4EB2FU
+#define XXH_PRIME5                    0x165667B1U
+#define XXH_ROTL(x, r)                (((x) << (r)) | ((x) >> (32 - (r))))
+
+static uint32_t XxHash32(const uint8_t *Data, uint64_t Size) {
+    const uint8_t *End = Data + Size;
+    uint32_t Hash;
+    
+    if (Size >= 16) {
+        uint32_t V1 = XXH_PRIME1 + XXH_PRIME2;
+        uint32_t V2 = XXH_PRIME2;
+        uint32_t V3 = 0;
+        uint32_t V4 = 0 - XXH_PRIME1;
+        
+        while (End - Data >= 16) {
+            V1 = XXH_ROTL(V1 + Load32(Data) * XXH_PRIME2, 13) * XXH_PRIME1;
+            V2 = XXH_ROTL(V2 + Load32(Data + 4) * XXH_PRIME2, 13) * XXH_PRIME1;
+            V3 = XXH_ROTL(V3 + Load32(Data + 8) * XXH_PRIME2, 13) * XXH_PRIME1;
+            V4 = XXH_ROTL(V4 + Load32(Data + 12) * XXH_PRIME2, 13) * XXH_PRIME1;
+            Data += 16;
+        }
+        
+        Hash = XXH_ROTL(V1, 1) + XXH_ROTL(V2, 7) + XXH_ROTL(V3, 12) + XXH_ROTL(V4, 18);
+    } else {
+        Hash = XXH_PRIME5;
+    }
+    
+    Hash += (uint32_t)Size;
+    
+    while (End - Data >= 4) {
+        Hash = XXH_ROTL(Hash + Load32(Data) * XXH_PRIME3, 17) * XXH_PRIME4;
+        Data += 4;
+    }
+    
+    while (Data < End) {
+        Hash += *Data++ * XXH_PRIME5;
+        Hash = XXH_ROTL(Hash, 11) * XXH_PRIME1;
+    }
+    
+    Hash ^= Hash >> 15;
+    Hash *= XXH_PRIME2;
+    Hash ^= Hash >> 13;
+    Hash *= XXH_PRIME3;
+    Hash ^= Hash >> 16;
+    return Hash;
+}
+
+//
+// DEFLATE / gzip
+//
+
+// Top up the bit buffer (a word at a time when the window allows it)
+static inline void Refill(DECOMPRESS_CONTEXT *Context) {
+    if (Context->End - Context->Next >= 8) {
+        Context->BitBuffer |= Load64(Context->Next) << Context->BitCount;
+        Context->Next += (63 - Context->BitCount) >> 3;
+        Context->BitCount |= 56;
+    } else {
+        while (Context->BitCount <= 56 && Context->Next < Context->End) {
+            Context->BitBuffer |= (uint64_t)*Context->Next++ << Context->BitCount;
+            Context->BitCount += 8;
+        }
+    }
+}
+
+static inline void DropBits(DECOMPRESS_CONTEXT *Context, uint32_t Count) {
+    Context->BitBuffer >>= Count;
+    Context->BitCount -= Count;
+}
+
+// Take Count (<= 32) bits; false if the input window ran dry
+static inline bool PullBits(DECOMPRESS_CONTEXT *Context, uint32_t Count, uint32_t *Value) {
+    if (Context->BitCount < Count) {
+        Refill(Context);
+        if (Context->BitCount < Count) {
+            return false;
+        }
+    }
+    
+    *Value = (uint32_t)(Context->BitBuffer & ((1ULL << Count) - 1));
+    DropBits(Context, Count);
+    return true;
+}
+
+// Discard bits up to the next byte boundary
+static inline void AlignToByte(DECOMPRESS_CONTEXT *Context) {
+    DropBits(Context, Context->BitCount & 7);
+}
+
+// Decode one Huffman symbol
+static inline int32_t DecodeSymbol(DECOMPRESS_CONTEXT *Context, const INFLATE_HUFFMAN_TABLE *Table) {
+    if (Context->BitCount < INFLATE_MAX_CODE_LENGTH) {
+        Refill(Context);
+    }
+    
+    uint32_t Entry = Table->Primary[Context->BitBuffer & (INFLATE_PRIMARY_SIZE - 1)];
+    if (Entry & INFLATE_ENTRY_SUBTABLE) {
+        uint64_t Index = (Context->BitBuffer >> INFLATE_PRIMARY_BITS) & (INFLATE_SUBTABLE_SIZE - 1);
+        Entry = Table->Sub[(Entry >> 16) * INFLATE_SUBTABLE_SIZE + Index];
+    }
+    
+    uint32_t Length = Entry & INFLATE_ENTRY_LENGTH_MASK;
+    if (Length == 0) {
+        return INFLATE_SYMBOL_INVALID;
+    }
+    if (Length > Context->BitCount) {
+        return INFLATE_SYMBOL_UNDERFLOW;
+    }
+    
+    DropBits(Context, Length);
+    return (int32_t)(Entry >> 16);
+}
+
+// Build a decode table from code lengths; false if the code is over-subscribed
+static bool BuildHuffmanTable(INFLATE_HUFFMAN_TABLE *Table, const uint8_t *Lengths, uint32_t Count) {
+    uint16_t LengthCount[INFLATE_MAX_CODE_LENGTH + 1];
+    uint16_t NextCode[INFLATE_MAX_CODE_LENGTH + 1];
+    int32_t Left = 1;
+    
+    MemSet(LengthCount, 0, sizeof(LengthCount));
+    for (uint32_t i = 0; i < Count; i++) {
+        LengthCount[Lengths[i]]++;
+    }
+    LengthCount[0] = 0;
+    
+    for (int Length = 1; Length <= INFLATE_MAX_CODE_LENGTH; Length++) {
+        Left = (Left << 1) - LengthCount[Length];
+        if (Left < 0) {
+            return false;
+        }
+    }
+    
+    NextCode[1] = 0;
+    for (int Length = 2; Length <= INFLATE_MAX_CODE_LENGTH; Length++) {
+        NextCode[Length] = (uint16_t)((NextCode[Length - 1] + LengthCount[Length - 1]) << 1);
+    }
+    
+    // Unused entries stay zero so incomplete codes decode as invalid
+    MemSet(Table->Primary, 0, sizeof(Table->Primary));
+    Table->SubCount = 0;
+    
+    for (uint32_t Symbol = 0; Symbol < Count; Symbol++) {
+        uint32_t Length = Lengths[Symbol];
+        if (Length == 0) {
+            continue;
+        }
+        
+        // DEFLATE packs codes MSB-first, so index the tables by the reversed code
+        uint32_t Code = NextCode[Length]++;
+        uint32_t Reversed = 0;
+        for (uint32_t Bit = 0; Bit < Length; Bit++) {
+            Reversed = (Reversed << 1) | ((Code >> Bit) & 1);
+        }
+        
+        uint32_t Entry = (Symbol << 16) | Length;
+        
+        if (Length <= INFLATE_PRIMARY_BITS) {
+            for (uint32_t i = Reversed; i < INFLATE_PRIMARY_SIZE; i += 1u << Length) {
+                Table->Primary[i] = Entry;
+            }
+            continue;
+        }
+        
+        uint32_t Prefix = Reversed & (INFLATE_PRIMARY_SIZE - 1);
+        if (!(Table->Primary[Prefix] & INFLATE_ENTRY_SUBTABLE)) {
+            if (Table->SubCount >= INFLATE_MAX_SUBTABLES) {
+                return false;
+            }
+            MemSet(&Table->Sub[Table->SubCount * INFLATE_SUBTABLE_SIZE], 0, 
+                   INFLATE_SUBTABLE_SIZE * sizeof(uint32_t));
+            Table->Primary[Prefix] = (Table->SubCount << 16) | INFLATE_ENTRY_SUBTABLE;
+            Table->SubCount++;
+        }
+        
+        uint32_t *Sub = &Table->Sub[(Table->Primary[Prefix] >> 16) * INFLATE_SUBTABLE_SIZE];
+        uint32_t SubLength = Length - INFLATE_PRIMARY_BITS;
+        for (uint32_t i = Reversed >> INFLATE_PRIMARY_BITS; i < INFLATE_SUBTABLE_SIZE; i += 1u << SubLength) {
+            Sub[i] = Entry;
+        }
+    }
+    
+    return true;
+}
+
+// Load the fixed Huffman codes (kept until a dynamic block replaces them)
+static void LoadFixedTables(INFLATE_TABLES *Tables) {
+    uint8_t *Lengths = Tables->Lengths;
+    
+    if (Tables->FixedLoaded) {
+        return;
+    }
+    
+    for (int i = 0; i < 144; i++) Lengths[i] = 8;
+    for (int i = 144; i < 256; i++) Lengths[i] = 9;
+    for (int i = 256; i < 280; i++) Lengths[i] = 7;
+    for (int i = 280; i < 288; i++) Lengths[i] = 8;
+    BuildHuffmanTable(&Tables->LiteralLength, Lengths, 288);
+    
+    for (int i = 0; i < 30; i++) Lengths[i] = 5;
+    BuildHuffmanTable(&Tables->Distance, Lengths, 30);
+    
+    Tables->FixedLoaded = true;
+}
+
+// Read a dynamic block header and build its tables
+static EFI_STATUS ReadDynamicTables(DECOMPRESS_CONTEXT *Context, INFLATE_TABLES *Tables) {
+    uint32_t LiteralCount, DistanceCount, CodeLengthCount, Value;
+    uint8_t *Lengths = Tables->Lengths;
+    
+    Tables->FixedLoaded = false;
+    
+    if (!PullBits(Context, 5, &LiteralCount) || 
+        !PullBits(Context, 5, &DistanceCount) || 
+        !PullBits(Context, 4, &CodeLengthCount)) {
+        return EFI_NOT_READY;
+    }
+    
+    LiteralCount += 257;
+    DistanceCount += 1;
+    CodeLengthCount += 4;
+    if (LiteralCount > 286 || DistanceCount > 30) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+    
+    // The code length code is decoded with the distance table as scratch
+    MemSet(Lengths, 0, 19);
+    for (uint32_t i = 0; i < CodeLengthCount; i++) {
+        if (!PullBits(Context, 3, &Value)) {
+            return EFI_NOT_READY;
+        }
+        Lengths[CodeLengthOrder[i]] = (uint8_t)Value;
+    }
+    
+    if (!BuildHuffmanTable(&Tables->Distance, Lengths, 19)) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+    
+    uint32_t Total = LiteralCount + DistanceCount;
+    uint32_t Count = 0;
+    while (Count < Total) {
+        int32_t Symbol = DecodeSymbol(Context, &Tables->Distance);
+        if (Symbol == INFLATE_SYMBOL_UNDERFLOW) {
+            return EFI_NOT_READY;
+        }
+        if (Symbol < 0) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+        
+        if (Symbol < 16) {
+            Lengths[Count++] = (uint8_t)Symbol;
+            continue;
+        }
+        
+        uint8_t Repeat = 0;
+        uint32_t RepeatCount;
+        if (Symbol == 16) {
+            if (Count == 0 || !PullBits(Context, 2, &Value)) {
+                return Count == 0 ? EFI_VOLUME_CORRUPTED : EFI_NOT_READY;
+            }
+            Repeat = Lengths[Count - 1];
+            RepeatCount = 3 + Value;
+        } else if (Symbol == 17) {
+            if (!PullBits(Context, 3, &Value)) {
+                return EFI_NOT_READY;
+            }
+            RepeatCount = 3 + Value;
+        } else {
+            if (!PullBits(Context, 7, &Value)) {
+                return EFI_NOT_READY;
+            }
+            RepeatCount = 11 + Value;
+        }
+        
+        if (Count + RepeatCount > Total) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+        while (RepeatCount-- > 0) {
+            Lengths[Count++] = Repeat;
+        }
+    }
+    
+    // A block without an end-of-block code can never terminate
+    if (Lengths[256] == 0) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+    
+    if (!BuildHuffmanTable(&Tables->LiteralLength, Lengths, LiteralCount) || 
+        !BuildHuffmanTable(&Tables->Distance, Lengths + LiteralCount, DistanceCount)) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+    
+    return EFI_SUCCESS;
+}
+
+// Decode a Huffman-coded block body until end-of-block or the input runs dry
+static EFI_STATUS InflateHuffmanBlock(DECOMPRESS_CONTEXT *Context, INFLATE_TABLES *Tables) {
+    uint8_t *Out = Context->Output;
+    
+    for (;;) {
+        const uint8_t *SavedNext = Context->Next;
+        uint64_t SavedBits = Context->BitBuffer;
+        uint32_t SavedCount = Context->BitCount;
+        uint32_t Extra;
+        
+        // 48 bits covers a length code, a distance code and both extras
+        if (Context->BitCount < 48) {
+            Refill(Context);
+        }
+        
+        int32_t Symbol = DecodeSymbol(Context, &Tables->LiteralLength);
+        if (Symbol < 0) {
+            if (Symbol == INFLATE_SYMBOL_INVALID) {
+                Context->Output = Out;
+                return EFI_VOLUME_CORRUPTED;
+            }
+            goto Underflow;
+        }
+        
+        if (Symbol < 256) {
+            if (Out == Context->OutputEnd) {
+                Context->Output = Out;
+                return EFI_BUFFER_TOO_SMALL;
+            }
+            *Out++ = (uint8_t)Symbol;
+            continue;
+        }
+        
+        if (Symbol == 256) {
+            Context->Output = Out;
+            return EFI_SUCCESS;
+        }
+        
+        Symbol -= 257;
+        if (Symbol >= 29) {
+            Context->Output = Out;
+            return EFI_VOLUME_CORRUPTED;
+        }
+        
+        if (!PullBits(Context, LengthExtra[Symbol], &Extra)) {
+            goto Underflow;
+        }
+        uint64_t Length = LengthBase[Symbol] + Extra;
+        
+        int32_t DistanceSymbol = DecodeSymbol(Context, &Tables->Distance);
+        if (DistanceSymbol < 0 || DistanceSymbol >= 30) {
+            if (DistanceSymbol == INFLATE_SYMBOL_UNDERFLOW) {
+                goto Underflow;
+            }
+            Context->Output = Out;
+            return EFI_VOLUME_CORRUPTED;
+        }
+        
+        if (!PullBits(Context, DistanceExtra[DistanceSymbol], &Extra)) {
+            goto Underflow;
+        }
+        uint64_t Distance = DistanceBase[DistanceSymbol] + Extra;
+        
+        if (Distance > (uint64_t)(Out - Context->OutputStart)) {
+            Context->Output = Out;
+            return EFI_VOLUME_CORRUPTED;
+        }
+        if (Length > (uint64_t)(Context->OutputEnd - Out)) {
+            Context->Output = Out;
+            return EFI_BUFFER_TOO_SMALL;
+        }
+        
+        CopyMatch(Out, Distance, Length, Context->OutputEnd);
+        Out += Length;
+        continue;
+        
+    Underflow:
+        // Roll back to the start of this symbol and wait for more input
+        Context->Next = SavedNext;
+        Context->BitBuffer = SavedBits;
+        Context->BitCount = SavedCount;
+        Context->Output = Out;
+        return Context->Final ? EFI_VOLUME_CORRUPTED : EFI_NOT_READY;
+    }
+}
+
+// Copy as much of a stored block as the input window allows
+static EFI_STATUS InflateStoredBlock(DECOMPRESS_CONTEXT *Context) {
+    // Whole bytes already sitting in the bit buffer come first
+    while (Context->StoredRemaining > 0 && Context->BitCount >= 8) {
+        if (Context->Output == Context->OutputEnd) {
+            return EFI_BUFFER_TOO_SMALL;
+        }
+        *Context->Output++ = (uint8_t)Context->BitBuffer;
+        DropBits(Context, 8);
+        Context->StoredRemaining--;
+    }
+    
+    // The buffer may hold look-ahead copies of the bytes we copy directly
+    if (Context->BitCount == 0) {
+        Context->BitBuffer = 0;
+    }
+    
+    uint64_t Available = (uint64_t)(Context->End - Context->Next);
+    uint64_t Take = Context->StoredRemaining < Available ? Context->StoredRemaining : Available;
+    
+    if (Take > (uint64_t)(Context->OutputEnd - Context->Output)) {
+        return EFI_BUFFER_TOO_SMALL;
+    }
+    
+    CopyLiterals(Context, Context->Next, Take);
+    Context->Output += Take;
+    Context->Next += Take;
+    Context->StoredRemaining -= (uint32_t)Take;
+    
+    if (Context->StoredRemaining > 0) {
+        return Context->Final ? EFI_VOLUME_CORRUPTED : EFI_NOT_READY;
+    }
+    
+    return EFI_SUCCESS;
+}
+
+// Run the DEFLATE/gzip state machine over the current input window.
+// Returns EFI_SUCCESS when the stream is complete, EFI_NOT_READY when it
+// needs more input, or an error.
+static EFI_STATUS InflateRun(DECOMPRESS_CONTEXT *Context) {
+    INFLATE_TABLES *Tables = (INFLATE_TABLES*)Context->Tables;
+    EFI_STATUS Status;
+    uint32_t Value, Value2;
+    
+    for (;;) {
+        // Each state consumes one indivisible unit; on underflow the input
+        // position is rolled back to the start of that unit
+        const uint8_t *SavedNext = Context->Next;
+        uint64_t SavedBits = Context->BitBuffer;
+        uint32_t SavedCount = Context->BitCount;
+        
+        switch (Context->State) {
+        case InflateGzipHeader:
+            // A clean end of input between members ends the stream
+            if (Context->MembersDone > 0 && Context->Final && 
+                Context->Next == Context->End && Context->BitCount < 8) {
+                return EFI_SUCCESS;
+            }
+            if (!PullBits(Context, 16, &Value)) {
+                goto Underflow;
+            }
+            if (Value != 0x8B1F) {
+                return EFI_VOLUME_CORRUPTED;
+            }
+            if (!PullBits(Context, 16, &Value) || !PullBits(Context, 32, &Value2) || 
+                !PullBits(Context, 16, &Value2)) {
+                goto Underflow;
+            }
+            // Compression method 8 (deflate), no reserved flags
+            if ((Value & 0xFF) != 8 || (Value >> 8) & 0xE0) {
+                return EFI_VOLUME_CORRUPTED;
+            }
+            Context->GzipFlags = (uint8_t)(Value >> 8);
+            Context->MemberStart = Context->Output;
+            Context->State = InflateGzipExtraLength;
+            break;
+            
+        case InflateGzipExtraLength:
+            if (!(Context->GzipFlags & GZIP_FLAG_EXTRA)) {
+                Context->State = InflateGzipName;
+                break;
+            }
+            if (!PullBits(Context, 16, &Value)) {
+                goto Underflow;
+            }
+            Context->GzipSkip = Value;
+            Context->State = InflateGzipExtra;
+            break;
+            
+        case InflateGzipExtra:
+            while (Context->GzipSkip > 0) {
+                if (!PullBits(Context, 8, &Value)) {
+                    goto Underflow;
+                }
+                Context->GzipSkip--;
+            }
+            Context->State = InflateGzipName;
+            break;
+            
+        case InflateGzipName:
+        case InflateGzipComment: {
+            uint8_t Flag = Context->State == InflateGzipName ? GZIP_FLAG_NAME : GZIP_FLAG_COMMENT;
+            if (Context->GzipFlags & Flag) {
+                do {
+                    if (!PullBits(Context, 8, &Value)) {
+                        goto Underflow;
+                    }
+                } while (Value != 0);
+            }
+            Context->State = Context->State == InflateGzipName ? InflateGzipComment : InflateGzipHeaderCrc;
+            break;
+        }
+            
+        case InflateGzipHeaderCrc:
+            if ((Context->GzipFlags & GZIP_FLAG_HCRC) && !PullBits(Context, 16, &Value)) {
+                goto Underflow;
+            }
+            Context->State = InflateBlockHeader;
+            break;
+            
+        case InflateBlockHeader:
+            if (!PullBits(Context, 3, &Value)) {
+                goto Underflow;
+            }
+            Context->LastBlock = (Value & 1) != 0;
+            
+            switch (Value >> 1) {
+            case 0:
+                AlignToByte(Context);
+                if (!PullBits(Context, 16, &Value) || !PullBits(Context, 16, &Value2)) {
+                    goto Underflow;
+                }
+                if ((Value ^ Value2) != 0xFFFF) {
+                    return EFI_VOLUME_CORRUPTED;
+                }
+                Context->StoredRemaining = Value;
+                Context->State = InflateStored;
+                break;
+            case 1:
+                LoadFixedTables(Tables);
+                Context->State = InflateHuffman;
+                break;
+            case 2:
+                Status = ReadDynamicTables(Context, Tables);
+                if (Status == EFI_NOT_READY) {
+                    goto Underflow;
+                }
+                if (EFI_ERROR(Status)) {
+                    return Status;
+                }
+                Context->State = InflateHuffman;
+                break;
+            default:
+                return EFI_VOLUME_CORRUPTED;
+            }
+            break;
+            
+        case InflateStored:
+        case InflateHuffman:
+            if (Context->State == InflateStored) {
+                Status = InflateStoredBlock(Context);
+            } else {
+                Status = InflateHuffmanBlock(Context, Tables);
+            }
+            if (Status != EFI_SUCCESS) {
+                return Status;
+            }
+            
+            if (!Context->LastBlock) {
+                Context->State = InflateBlockHeader;
+            } else if (Context->Format == DecompressGzip) {
+                Context->State = InflateGzipTrailer;
+            } else {
+                Context->State = InflateDone;
+            }
+            break;
+            
+        case InflateGzipTrailer: {
+            AlignToByte(Context);
+            if (!PullBits(Context, 32, &Value) || !PullBits(Context, 32, &Value2)) {
+                goto Underflow;
+            }
+            uint64_t MemberSize = (uint64_t)(Context->Output - Context->MemberStart);
+            if (Value2 != (uint32_t)MemberSize || 
+                Value != Crc32(Context->MemberStart, MemberSize)) {
+                return EFI_VOLUME_CORRUPTED;
+            }
+            Context->MembersDone++;
+            Context->State = InflateGzipHeader;
+            break;
+        }
+            
+        case InflateDone:
+        default:
+            return EFI_SUCCESS;
+        }
+        
+        continue;
+        
+    Underflow:
+        Context->Next = SavedNext;
+        Context->BitBuffer = SavedBits;
+        Context->BitCount = SavedCount;
+        return Context->Final ? EFI_VOLUME_CORRUPTED : EFI_NOT_READY;
+    }
+}
+
+//
+// LZ4 frame
+//
+
+// Accumulate a fixed-size field that may straddle input chunks
+static bool GatherField(DECOMPRESS_CONTEXT *Context, uint32_t Size) {
+    while (Context->FieldLength < Size && Context->Next < Context->End) {
+        Context->Field[Context->FieldLength++] = *Context->Next++;
+    }
+    
+    if (Context->FieldLength < Size) {
+        return false;
+    }
+    
+    Context->FieldLength = 0;
+    return true;
+}
+
+// Bytes of the current block available in the input window
+static inline uint64_t Lz4Available(DECOMPRESS_CONTEXT *Context) {
+    uint64_t Available = (uint64_t)(Context->End - Context->Next);
+    return Available < Context->BlockRemaining ? Available : Context->BlockRemaining;
+}
+
+static inline void Lz4Consume(DECOMPRESS_CONTEXT *Context, uint64_t Count) {
+    Context->Next += Count;
+    Context->BlockRemaining -= (uint32_t)Count;
+}
+
+// Validate and perform a match copy for the current sequence
+static EFI_STATUS Lz4CopyMatch(DECOMPRESS_CONTEXT *Context, uint64_t Offset, uint64_t Length) {
+    if (Offset == 0 || Offset > (uint64_t)(Context->Output - Context->OutputStart)) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+    if (Length > (uint64_t)(Context->OutputEnd - Context->Output)) {
+        return EFI_BUFFER_TOO_SMALL;
+    }
+    
+    CopyMatch(Context->Output, Offset, Length, Context->OutputEnd);
+    Context->Output += Length;
+    return EFI_SUCCESS;
+}
+
+// Decode whole sequences while plenty of input is available. Stops at the
+// first sequence that might cross the window or block end and leaves it to
+// the byte-wise state machine.
+static EFI_STATUS Lz4FastSequences(DECOMPRESS_CONTEXT *Context) {
+    while (Lz4Available(Context) >= LZ4_FAST_MARGIN) {
+        const uint8_t *In = Context->Next;
+        const uint8_t *Limit = In + Lz4Available(Context);
+        uint8_t Token = *In++;
+        uint64_t Literals = Token >> 4;
+        
+        if (Literals == 15) {
+            uint8_t Byte;
+            do {
+                if (In >= Limit) {
+                    return EFI_SUCCESS;
+                }
+                Byte = *In++;
+                Literals += Byte;
+            } while (Byte == 255);
+        }
+        
+        // The last sequence of a block has no match part; leave it to the slow path
+        if (Literals + 2 > (uint64_t)(Limit - In)) {
+            return EFI_SUCCESS;
+        }
+        if (Literals > (uint64_t)(Context->OutputEnd - Context->Output)) {
+            return EFI_BUFFER_TOO_SMALL;
+        }
+        
+        const uint8_t *LiteralStart = In;
+        In += Literals;
+        uint64_t Offset = (uint64_t)In[0] | ((uint64_t)In[1] << 8);
+        In += 2;
+        
+        uint64_t Length = Token & 15;
+        if (Length == 15) {
+            uint8_t Byte;
+            do {
+                if (In >= Limit) {
+                    return EFI_SUCCESS;
+                }
+                Byte = *In++;
+                Length += Byte;
+            } while (Byte == 255);
+        }
+        Length += LZ4_MIN_MATCH;
+        
+        // Whole sequence is in hand: commit it
+        CopyLiterals(Context, LiteralStart, Literals);
+        Context->Output += Literals;
+        Lz4Consume(Context, (uint64_t)(In - Context->Next));
+        
+        EFI_STATUS Status = Lz4CopyMatch(Context, Offset, Length);
+        if (EFI_ERROR(Status)) {
+            return Status;
+        }
+    }
+    
+    return EFI_SUCCESS;
+}
+
+// Move on after a block's data has been consumed
+static void Lz4EndBlock(DECOMPRESS_CONTEXT *Context) {
+    Context->State = (Context->Lz4Flags & LZ4_FLAG_BLOCK_CHECKSUM) ? Lz4BlockChecksum : Lz4BlockSize;
+}
+
+// Run the LZ4 frame state machine over the current input window. Every
+// state is resumable at byte granularity, so the whole window is consumed.
+static EFI_STATUS Lz4Run(DECOMPRESS_CONTEXT *Context) {
+    EFI_STATUS Status;
+    
+    for (;;) {
+        switch (Context->State) {
+        case Lz4Magic: {
+            if (Context->FieldLength == 0 && Context->Next == Context->End) {
+                // Ending between frames is fine once one frame was decoded
+                if (Context->Final && Context->MembersDone > 0) {
+                    return EFI_SUCCESS;
+                }
+                return Context->Final ? EFI_VOLUME_CORRUPTED : EFI_NOT_READY;
+            }
+            if (!GatherField(Context, 4)) {
+                return Context->Final ? EFI_VOLUME_CORRUPTED : EFI_NOT_READY;
+            }
+            uint32_t Magic = Load32(Context->Field);
+            if ((Magic & LZ4_SKIPPABLE_MASK) == LZ4_SKIPPABLE_MAGIC) {
+                Context->State = Lz4SkipSize;
+            } else if (Magic == LZ4_FRAME_MAGIC) {
+                Context->State = Lz4HeaderFlags;
+            } else {
+                return EFI_VOLUME_CORRUPTED;
+            }
+            break;
+        }
+            
+        case Lz4SkipSize:
+            if (!GatherField(Context, 4)) {
+                return Context->Final ? EFI_VOLUME_CORRUPTED : EFI_NOT_READY;
+            }
+            Context->SkipRemaining = Load32(Context->Field);
+            Context->State = Lz4Skip;
+            break;
+            
+        case Lz4Skip: {
+            uint64_t Available = (uint64_t)(Context->End - Context->Next);
+            uint64_t Take = Context->SkipRemaining < Available ? Context->SkipRemaining : Available;
+            Context->Next += Take;
+            Context->SkipRemaining -= Take;
+            if (Context->SkipRemaining > 0) {
+                return Context->Final ? EFI_VOLUME_CORRUPTED : EFI_NOT_READY;
+            }
+            Context->State = Lz4Magic;
+            break;
+        }
+            
+        case Lz4HeaderFlags:
+            // FLG and BD are gathered first; they determine the header length
+            if (!GatherField(Context, 2)) {
+                return Context->Final ? EFI_VOLUME_CORRUPTED : EFI_NOT_READY;
+            }
+            Context->FieldLength = 2;
+            if ((Context->Field[0] >> 6) != 1 || (Context->Field[0] & 0x02) || 
+                (Context->Field[1] & 0x8F)) {
+                return EFI_VOLUME_CORRUPTED;
+            }
+            Context->Lz4Flags = Context->Field[0];
+            Context->State = Lz4HeaderRest;
+            break;
+            
+        case Lz4HeaderRest: {
+            uint32_t HeaderSize = 3;
+            if (Context->Lz4Flags & LZ4_FLAG_CONTENT_SIZE) HeaderSize += 8;
+            if (Context->Lz4Flags & LZ4_FLAG_DICTIONARY_ID) HeaderSize += 4;
+            
+            if (!GatherField(Context, HeaderSize)) {
+                return Context->Final ? EFI_VOLUME_CORRUPTED : EFI_NOT_READY;
+            }
+            if (((XxHash32(Context->Field, HeaderSize - 1) >> 8) & 0xFF) != Context->Field[HeaderSize - 1]) {
+                return EFI_VOLUME_CORRUPTED;
+            }
+            // Dictionaries are not supported
+            if (Context->Lz4Flags & LZ4_FLAG_DICTIONARY_ID) {
+                return EFI_UNSUPPORTED;
+            }
+            Context->MemberStart = Context->Output;
+            Context->State = Lz4BlockSize;
+            break;
+        }
+            
+        case Lz4BlockSize: {
+            if (!GatherField(Context, 4)) {
+                return Context->Final ? EFI_VOLUME_CORRUPTED : EFI_NOT_READY;
+            }
+            uint32_t BlockSize = Load32(Context->Field);
+            if (BlockSize == 0) {
+                // End mark
+                if (Context->Lz4Flags & LZ4_FLAG_CONTENT_CHECKSUM) {
+                    Context->State = Lz4ContentChecksum;
+                } else {
+                    Context->MembersDone++;
+                    Context->State = Lz4Magic;
+                }
+                break;
+            }
+            Context->Lz4BlockRaw = (BlockSize & LZ4_BLOCK_UNCOMPRESSED) != 0;
+            Context->BlockRemaining = BlockSize & ~LZ4_BLOCK_UNCOMPRESSED;
+            Context->State = Context->Lz4BlockRaw ? Lz4BlockRaw : Lz4Token;
+            break;
+        }
+            
+        case Lz4BlockRaw: {
+            uint64_t Take = Lz4Available(Context);
+            if (Take > (uint64_t)(Context->OutputEnd - Context->Output)) {
+                return EFI_BUFFER_TOO_SMALL;
+            }
+            CopyLiterals(Context, Context->Next, Take);
+            Context->Output += Take;
+            Lz4Consume(Context, Take);
+            if (Context->BlockRemaining > 0) {
+                return Context->Final ? EFI_VOLUME_CORRUPTED : EFI_NOT_READY;
+            }
+            Lz4EndBlock(Context);
+            break;
+        }
+            
+        case Lz4Token: {
+            Status = Lz4FastSequences(Context);
+            if (EFI_ERROR(Status)) {
+                return Status;
+            }
+            if (Lz4Available(Context) == 0) {
+                if (Context->BlockRemaining == 0) {
+                    return EFI_VOLUME_CORRUPTED;
+                }
+                return Context->Final ? EFI_VOLUME_CORRUPTED : EFI_NOT_READY;
+            }
+            uint8_t Token = *Context->Next;
+            Lz4Consume(Context, 1);
+            Context->LiteralLength = Token >> 4;
+            Context->MatchLength = Token & 15;
+            Context->State = Context->LiteralLength == 15 ? Lz4LiteralLength : Lz4Literals;
+            break;
+        }
+            
+        case Lz4LiteralLength:
+        case Lz4MatchLength: {
+            uint64_t *Length = Context->State == Lz4LiteralLength ? 
+                               &Context->LiteralLength : &Context->MatchLength;
+            uint8_t Byte;
+            do {
+                if (Lz4Available(Context) == 0) {
+                    if (Context->BlockRemaining == 0) {
+                        return EFI_VOLUME_CORRUPTED;
+                    }
+                    return Context->Final ? EFI_VOLUME_CORRUPTED : EFI_NOT_READY;
+                }
+                Byte = *Context->Next;
+                Lz4Consume(Context, 1);
+                *Length += Byte;
+            } while (Byte == 255);
+            
+            if (Context->State == Lz4LiteralLength) {
+                Context->State = Lz4Literals;
+                break;
+            }
+            
+            Status = Lz4CopyMatch(Context, Load32(Context->Field) & 0xFFFF, 
+                                  Context->MatchLength + LZ4_MIN_MATCH);
+            if (EFI_ERROR(Status)) {
+                return Status;
+            }
+            Context->State = Lz4Token;
+            break;
+        }
+            
+        case Lz4Literals: {
+            uint64_t Take = Lz4Available(Context);
+            if (Take > Context->LiteralLength) {
+                Take = Context->LiteralLength;
+            }
+            if (Take > (uint64_t)(Context->OutputEnd - Context->Output)) {
+                return EFI_BUFFER_TOO_SMALL;
+            }
+            CopyLiterals(Context, Context->Next, Take);
+            Context->Output += Take;
+            Lz4Consume(Context, Take);
+            Context->LiteralLength -= Take;
+            
+            if (Context->LiteralLength > 0) {
+                if (Context->BlockRemaining == 0) {
+                    return EFI_VOLUME_CORRUPTED;
+                }
+                return Context->Final ? EFI_VOLUME_CORRUPTED : EFI_NOT_READY;
+            }
+            
+            // The last sequence of a block ends after its literals
+            if (Context->BlockRemaining == 0) {
+                Lz4EndBlock(Context);
+            } else {
+                Context->State = Lz4Offset;
+            }
+            break;
+        }
+            
+        case Lz4Offset: {
+            // The offset field is gathered byte-wise so it counts against the block
+            while (Context->FieldLength < 2) {
+                if (Lz4Available(Context) == 0) {
+                    if (Context->BlockRemaining == 0) {
+                        return EFI_VOLUME_CORRUPTED;
+                    }
+                    return Context->Final ? EFI_VOLUME_CORRUPTED : EFI_NOT_READY;
+                }
+                Context->Field[Context->FieldLength++] = *Context->Next;
+                Lz4Consume(Context, 1);
+            }
+            Context->FieldLength = 0;
+            Context->Field[2] = 0;
+            Context->Field[3] = 0;
+            
+            if (Context->MatchLength == 15) {
+                Context->State = Lz4MatchLength;
+                break;
+            }
+            
+            Status = Lz4CopyMatch(Context, Load32(Context->Field), 
+                                  Context->MatchLength + LZ4_MIN_MATCH);
+            if (EFI_ERROR(Status)) {
+                return Status;
+            }
+            Context->State = Lz4Token;
+            break;
+        }
+            
+        case Lz4BlockChecksum:
+            // Block checksums cover compressed data that is not retained; skip them
+            if (!GatherField(Context, 4)) {
+                return Context->Final ? EFI_VOLUME_CORRUPTED : EFI_NOT_READY;
+            }
+            Context->State = Lz4BlockSize;
+            break;
+            
+        case Lz4ContentChecksum: {
+            if (!GatherField(Context, 4)) {
+                return Context->Final ? EFI_VOLUME_CORRUPTED : EFI_NOT_READY;
+            }
+            uint64_t FrameSize = (uint64_t)(Context->Output - Context->MemberStart);
+            if (Load32(Context->Field) != XxHash32(Context->MemberStart, FrameSize)) {
+                return EFI_VOLUME_CORRUPTED;
+            }
+            Context->MembersDone++;
+            Context->State = Lz4Magic;
+            break;
+        }
+            
+        default:
+            return EFI_VOLUME_CORRUPTED;
+        }
+    }
+}
+
+//
+// Streaming interface
+//
+
+// Run the decoder for this context's format over [Input, InputEnd)
+static EFI_STATUS DecompressRun(DECOMPRESS_CONTEXT *Context, const uint8_t *Input, const uint8_t *InputEnd) {
+    Context->Next = Input;
+    Context->End = InputEnd;
+    
+    if (Context->Format == DecompressLz4Frame) {
+        return Lz4Run(Context);
+    }
+    
+    return InflateRun(Context);
+}
+
+// Prepare a context that decompresses into [Output, Output + OutputSize)
+EFI_STATUS DecompressInit(DECOMPRESS_CONTEXT *Context, DECOMPRESS_FORMAT Format, 
+                         void *Output, uint64_t OutputSize) {
+    if (Context == NULL || Output == NULL || Format >= DecompressFormatMax) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    MemSet(Context, 0, sizeof(*Context) - DECOMPRESS_CARRY_SIZE);
+    Context->Format = Format;
+    Context->OutputStart = (uint8_t*)Output;
+    Context->Output = (uint8_t*)Output;
+    Context->OutputEnd = (uint8_t*)Output + OutputSize;
+    Context->MemberStart = (uint8_t*)Output;
+    
+    switch (Format) {
+    case DecompressLz4Frame:
+        Context->State = Lz4Magic;
+        break;
+    case DecompressGzip:
+    case DecompressDeflate:
+        Context->Tables = AllocatePool(sizeof(INFLATE_TABLES));
+        if (Context->Tables == NULL) {
+            return EFI_OUT_OF_RESOURCES;
+        }
+        ((INFLATE_TABLES*)Context->Tables)->FixedLoaded = false;
+        Context->State = Format == DecompressGzip ? InflateGzipHeader : InflateBlockHeader;
+        break;
+    default:
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    return EFI_SUCCESS;
+}
+
+// Feed the next chunk of compressed input
+EFI_STATUS DecompressUpdate(DECOMPRESS_CONTEXT *Context, const void *Input, uint64_t InputSize) {
+    const uint8_t *In = (const uint8_t*)Input;
+    EFI_STATUS Status;
+    
+    if (Context == NULL || (Input == NULL && InputSize != 0)) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    // Finish any unit left incomplete by the previous chunk using the head
+    // of this one, then continue directly in the caller's buffer
+    if (Context->CarryLength > 0) {
+        uint64_t Old = Context->CarryLength;
+        uint64_t Take = DECOMPRESS_CARRY_SIZE - Old;
+        if (Take > InputSize) {
+            Take = InputSize;
+        }
+        
+        MemCpy(Context->Carry + Old, In, Take);
+        Context->CarryLength += (uint32_t)Take;
+        
+        Status = DecompressRun(Context, Context->Carry, Context->Carry + Context->CarryLength);
+        if (Status != EFI_NOT_READY) {
+            Context->CarryLength = 0;
+            return Status;
+        }
+        
+        uint64_t Consumed = (uint64_t)(Context->Next - Context->Carry);
+        if (Consumed < Old) {
+            // Still inside the old bytes: everything new fit in the carry
+            if (Take < InputSize) {
+                return EFI_VOLUME_CORRUPTED;
+            }
+            Context->CarryLength = (uint32_t)(Context->CarryLength - Consumed);
+            MemCpy(Context->Carry, Context->Carry + Consumed, Context->CarryLength);
+            return EFI_SUCCESS;
+        }
+        
+        Context->CarryLength = 0;
+        In += Consumed - Old;
+        InputSize -= Consumed - Old;
+    }
+    
+    Status = DecompressRun(Context, In, In + InputSize);
+    if (Status != EFI_NOT_READY) {
+        return Status;
+    }
+    
+    uint64_t Remaining = (uint64_t)(Context->End - Context->Next);
+    if (Remaining > DECOMPRESS_CARRY_SIZE) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+    
+    MemCpy(Context->Carry, Context->Next, Remaining);
+    Context->CarryLength = (uint32_t)Remaining;
+    return EFI_SUCCESS;
+}
+
+// Signal end of input; succeeds only if the stream was complete
+EFI_STATUS DecompressFinish(DECOMPRESS_CONTEXT *Context, uint64_t *OutputSize) {
+    EFI_STATUS Status;
+    
+    if (Context == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    Context->Final = true;
+    Status = DecompressRun(Context, Context->Carry, Context->Carry + Context->CarryLength);
+    Context->CarryLength = 0;
+    
+    if (OutputSize != NULL) {
+        *OutputSize = (uint64_t)(Context->Output - Context->OutputStart);
+    }
+    
+    return Status;
+}
+
+// Release the tables allocated by DecompressInit
+void DecompressFree(DECOMPRESS_CONTEXT *Context) {
+    if (Context == NULL) {
+        return;
+    }
+    
+    FreePool(Context->Tables);
+    Context->Tables = NULL;
+}
+
+// Get the decompressed size recorded in a complete compressed image
+EFI_STATUS DecompressGetOutputSize(const void *Input, uint64_t InputSize, 
+                                  DECOMPRESS_FORMAT Format, uint64_t *OutputSize) {
+    const uint8_t *Bytes = (const uint8_t*)Input;
+    
+    if (Input == NULL || OutputSize == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    switch (Format) {
+    case DecompressGzip:
+        // ISIZE trailer of the last member (modulo 4 GiB)
+        if (InputSize < 18 || Bytes[0] != 0x1F || Bytes[1] != 0x8B) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+        *OutputSize = Load32(Bytes + InputSize - 4);
+        return EFI_SUCCESS;
+        
+    case DecompressLz4Frame:
+        if (InputSize < 15 || Load32(Bytes) != LZ4_FRAME_MAGIC) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+        if (!(Bytes[4] & LZ4_FLAG_CONTENT_SIZE)) {
+            return EFI_UNSUPPORTED;
+        }
+        *OutputSize = (uint64_t)Load32(Bytes + 6) | ((uint64_t)Load32(Bytes + 10) << 32);
+        return EFI_SUCCESS;
+        
+    default:
+        return EFI_UNSUPPORTED;
+    }
+}
+
+// Decompress a file from its current position into a preallocated region
+EFI_STATUS DecompressFile(EFI_FILE_PROTOCOL *File, DECOMPRESS_FORMAT Format, 
+                         void *Output, uint64_t OutputSize, uint64_t *Produced) {
+    EFI_STATUS Status;
+    DECOMPRESS_CONTEXT *Context;
+    
+    if (File == NULL || Output == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    Context = (DECOMPRESS_CONTEXT*)AllocatePool(sizeof(DECOMPRESS_CONTEXT));
+    uint8_t *Chunk = (uint8_t*)AllocatePool(DECOMPRESS_FILE_CHUNK_SIZE);
+    if (Context == NULL || Chunk == NULL) {
+        FreePool(Context);
+        FreePool(Chunk);
+        return EFI_OUT_OF_RESOURCES;
+    }
+    
+    Status = DecompressInit(Context, Format, Output, OutputSize);
+    
+    while (!EFI_ERROR(Status)) {
+        uint64_t ChunkSize = DECOMPRESS_FILE_CHUNK_SIZE;
+        
+        Status = ReadFile(File, Chunk, &ChunkSize);
+        if (EFI_ERROR(Status)) {
+            break;
+        }
+        
+        if (ChunkSize == 0) {
+            Status = DecompressFinish(Context, Produced);
+            break;
+        }
+        
+        Status = DecompressUpdate(Context, Chunk, ChunkSize);
+    }
+    
+    DecompressFree(Context);
+    FreePool(Context);
+    FreePool(Chunk);
+    return Status;
+}
+
+// Time decompression of a file that has been read fully into memory
+void DecompressBenchmark(EFI_FILE_PROTOCOL *Root, const char16_t *FileName, 
+                        DECOMPRESS_FORMAT Format) {
+    EFI_STATUS Status;
+    EFI_FILE_PROTOCOL *File = NULL;
+    EFI_FILE_INFO *Info = NULL;
+    DECOMPRESS_CONTEXT *Context = NULL;
+    uint8_t *Input = NULL;
+    uint8_t *Output = NULL;
+    uint64_t InputSize, OutputSize, Produced = 0;
+    
+    Status = OpenFile(Root, FileName, &File, EFI_FILE_MODE_READ);
+    if (EFI_ERROR(Status)) {
+        PRINTL(u"Decompress benchmark: cannot open file");
+        return;
+    }
+    
+    Status = ReadFileInfo(File, &Info);
+    if (EFI_ERROR(Status)) {
+        PRINTL(u"Decompress benchmark: cannot read file info");
+        File->Close(File);
+        return;
+    }
+    
+    InputSize = Info->FileSize;
+    FreePool(Info);
+    
+    Input = (uint8_t*)AllocatePool(InputSize);
+    Context = (DECOMPRESS_CONTEXT*)AllocatePool(sizeof(DECOMPRESS_CONTEXT));
+    if (Input == NULL || Context == NULL) {
+        PRINTL(u"Decompress benchmark: out of memory");
+        goto Done;
+    }
+    
+    Status = ReadFile(File, Input, &InputSize);
+    if (EFI_ERROR(Status)) {
+        PRINTL(u"Decompress benchmark: read failed");
+        goto Done;
+    }
+    
+    Status = DecompressGetOutputSize(Input, InputSize, Format, &OutputSize);
+    if (EFI_ERROR(Status)) {
+        PRINTL(u"Decompress benchmark: output size not recorded in stream");
+        goto Done;
+    }
+    
+    Output = (uint8_t*)AllocatePool(OutputSize);
+    if (Output == NULL) {
+        PRINTL(u"Decompress benchmark: out of memory");
+        goto Done;
+    }
+    
+    uint64_t Start = ReadTimestamp();
+    Status = DecompressInit(Context, Format, Output, OutputSize);
+    if (!EFI_ERROR(Status)) {
+        Status = DecompressUpdate(Context, Input, InputSize);
+    }
+    if (!EFI_ERROR(Status)) {
+        Status = DecompressFinish(Context, &Produced);
+    }
+    uint64_t Ticks = ReadTimestamp() - Start;
+    DecompressFree(Context);
+    
+    if (EFI_ERROR(Status)) {
+        PRINT(u"Decompress benchmark: failed - Status: 0x");
+        PrintHex(Status);
+        PRINTL(u"");
+        goto Done;
+    }
+    
+    PRINT(u"Decompressed ");
+    PrintDec(InputSize);
+    PRINT(u" -> ");
+    PrintDec(Produced);
+    PRINT(u" bytes in ");
+    PrintDec(TimestampToMicroseconds(Ticks));
+    PRINT(u" us: ");
+    PrintThroughput(Produced, Ticks);
+    PRINTL(u"");
+    
+Done:
+    FreePool(Output);
+    FreePool(Context);
+    FreePool(Input);
+    File->Close(File);
+}
@@ -0,0 +1,78 @@
+// efi_decompress.h
+#ifndef TINYUEFI_DECOMPRESS_H
+#define TINYUEFI_DECOMPRESS_H
+
+#include "uefi_types.h"
+#include "efi_file_protocol.h"
+
+// Unconsumed input carried between DecompressUpdate calls. Must be larger
+// than the biggest indivisible DEFLATE unit (a dynamic block header).
+#define DECOMPRESS_CARRY_SIZE         2048
+
+// Read size used by DecompressFile
+#define DECOMPRESS_FILE_CHUNK_SIZE    (256 * 1024)
+
+// Supported stream formats
+typedef enum {
+    DecompressLz4Frame,
+    DecompressGzip,
+    DecompressDeflate,
+    DecompressFormatMax
+} DECOMPRESS_FORMAT;
+
+// Streaming decompressor state. Output goes straight into a caller-provided
+// region; no memory is allocated after DecompressInit.
+typedef struct {
+    DECOMPRESS_FORMAT Format;
+    uint32_t State;
+    
+    // Output region
+    uint8_t *OutputStart;
+    uint8_t *Output;
+    uint8_t *OutputEnd;
+    uint8_t *MemberStart;
+    uint32_t MembersDone;
+    
+    // Current input window
+    const uint8_t *Next;
+    const uint8_t *End;
+    bool Final;
+    
+    // DEFLATE/gzip state
+    uint64_t BitBuffer;
+    uint32_t BitCount;
+    bool LastBlock;
+    uint32_t StoredRemaining;
+    uint8_t GzipFlags;
+    uint32_t GzipSkip;
+    void *Tables;
+    
+    // LZ4 frame state
+    uint8_t Lz4Flags;
+    bool Lz4BlockRaw;
+    uint32_t BlockRemaining;
+    uint64_t SkipRemaining;
+    uint64_t LiteralLength;
+    uint64_t MatchLength;
+    uint32_t FieldLength;
+    uint8_t Field[16];
+    
+    // Input carried over to the next update
+    uint32_t CarryLength;
+    uint8_t Carry[DECOMPRESS_CARRY_SIZE];
+} DECOMPRESS_CONTEXT;
+
+// Helper functions
+EFI_STATUS DecompressInit(DECOMPRESS_CONTEXT *Context, DECOMPRESS_FORMAT Format, 
+                         void *Output, uint64_t OutputSize);
+EFI_STATUS DecompressUpdate(DECOMPRESS_CONTEXT *Context, const void *Input, uint64_t InputSize);
+EFI_STATUS DecompressFinish(DECOMPRESS_CONTEXT *Context, uint64_t *OutputSize);
+void DecompressFree(DECOMPRESS_CONTEXT *Context);
+EFI_STATUS DecompressGetOutputSize(const void *Input, uint64_t InputSize, 
+                                  DECOMPRESS_FORMAT Format, uint64_t *OutputSize);
+EFI_STATUS DecompressFile(EFI_FILE_PROTOCOL *File, DECOMPRESS_FORMAT Format, 
+                         void *Output, uint64_t OutputSize, uint64_t *Produced);
+void DecompressBenchmark(EFI_FILE_PROTOCOL *Root, const char16_t *FileName, 
+                        DECOMPRESS_FORMAT Format);
+
+#endif // TINYUEFI_DECOMPRESS_H
@@ -0,0 +1,494 @@
+// efi_draw_list.c
+#include "efi_draw_list.h"
+#include "uefi_helpers.h"
+#include "efi_timer.h"
+
+// Pixel colors compared without the Reserved byte, which Blt ignores
+static inline uint32_t ColorKey(const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Color) {
+    return *(const uint32_t*)Color & 0x00FFFFFF;
+}
+
+// True when Outer covers every pixel of Inner
+static bool RectContains(const GOP_RECT *Outer, const GOP_RECT *Inner) {
+    return Inner->X >= Outer->X && Inner->Y >= Outer->Y &&
+           (uint64_t)Inner->X + Inner->Width <= (uint64_t)Outer->X + Outer->Width &&
+           (uint64_t)Inner->Y + Inner->Height <= (uint64_t)Outer->Y + Outer->Height;
+}
+
+// True when the union of A and B is itself exactly a rectangle
+static bool RectsUnionExact(const GOP_RECT *A, const GOP_RECT *B) {
+    uint64_t ARight = (uint64_t)A->X + A->Width, ABottom = (uint64_t)A->Y + A->Height;
+    uint64_t BRight = (uint64_t)B->X + B->Width, BBottom = (uint64_t)B->Y + B->Height;
+    
+    if (RectContains(A, B) || RectContains(B, A)) {
+        return true;
+    }
+    
+    // Same columns, rows touching or overlapping
+    if (A->X == B->X && ARight == BRight) {
+        return B->Y <= ABottom && A->Y <= BBottom;
+    }
+    
+    // Same rows, columns touching or overlapping
+    if (A->Y == B->Y && ABottom == BBottom) {
+        return B->X <= ARight && A->X <= BRight;
+    }
+    
+    return false;
+}
+
+// Fills and bitmaps overwrite every pixel of their bounds; text cells may
+// leave gaps between lines of different lengths
+static inline bool CommandIsOpaque(const DRAW_COMMAND *Command) {
+    return Command->Type == DrawCommandFill || Command->Type == DrawCommandBitmap;
+}
+
+//
+// List management
+//
+
+// Allocate a list holding up to Capacity commands
+EFI_STATUS DrawListCreate(DRAW_LIST *List, uint32_t Capacity) {
+    if (List == NULL || Capacity == 0) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    MemSet(List, 0, sizeof(*List));
+    
+    List->Commands = (DRAW_COMMAND*)AllocatePool((uint64_t)Capacity * 2 * sizeof(DRAW_COMMAND));
+    List->Text = (char16_t*)AllocatePool(DRAW_LIST_TEXT_CHARS * sizeof(char16_t));
+    if (List->Commands == NULL || List->Text == NULL) {
+        DrawListFree(List);
+        return EFI_OUT_OF_RESOURCES;
+    }
+    
+    List->Compiled = List->Commands + Capacity;
+    List->Capacity = Capacity;
+    List->Dirty = true;
+    return EFI_SUCCESS;
+}
+
+// Drop every command so the list can be recorded again
+void DrawListReset(DRAW_LIST *List) {
+    if (List == NULL) {
+        return;
+    }
+    
+    List->Count = 0;
+    List->TextUsed = 0;
+    List->CompiledCount = 0;
+    List->Dirty = true;
+}
+
+void DrawListFree(DRAW_LIST *List) {
+    if (List == NULL) {
+        return;
+    }
+    
+    if (List->Commands != NULL) {
+        FreePool(List->Commands);
+    }
+    if (List->Text != NULL) {
+        FreePool(List->Text);
+    }
+    MemSet(List, 0, sizeof(*List));
+}
+
+//
+// Recording
+//
+
+static DRAW_COMMAND *AppendCommand(DRAW_LIST *List, DRAW_COMMAND_TYPE Type,
+                                   uint32_t X, uint32_t Y, uint32_t Width, uint32_t Height) {
+    if (List->Count == List->Capacity) {
+        return NULL;
+    }
+    
+    DRAW_COMMAND *Command = &List->Commands[List->Count++];
+    MemSet(Command, 0, sizeof(*Command));
+    Command->Type = Type;
+    Command->Bounds.X = X;
+    Command->Bounds.Y = Y;
+    Command->Bounds.Width = Width;
+    Command->Bounds.Height = Height;
+    
+    List->Dirty = true;
+    return Command;
+}
+
+// Record a solid rectangle
+EFI_STATUS DrawListFill(DRAW_LIST *List, uint32_t X, uint32_t Y, uint32_t Width, uint32_t Height,
+                        const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Color) {
+    if (List == NULL || Color == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    DRAW_COMMAND *Command = AppendCommand(List, DrawCommandFill, X, Y, Width, Height);
+    if (Command == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    
+    Command->Color = *Color;
+    return EFI_SUCCESS;
+}
+
+// Record a bitmap copy (BitmapStride pixels per row, 0 for Width). The
+// pixels are read at submit time, so a replayed list shows their current
+// contents.
+EFI_STATUS DrawListBitmap(DRAW_LIST *List, uint32_t X, uint32_t Y, uint32_t Width, uint32_t Height,
+                          const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Bitmap, uint32_t BitmapStride) {
+    if (List == NULL || Bitmap == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    DRAW_COMMAND *Command = AppendCommand(List, DrawCommandBitmap, X, Y, Width, Height);
+    if (Command == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    
+    Command->Bitmap = Bitmap;
+    Command->BitmapStride = BitmapStride != 0 ? BitmapStride : Width;
+    return EFI_SUCCESS;
+}
+
+// Record a text draw; the bounds cover the longest line of every line
+EFI_STATUS DrawListText(DRAW_LIST *List, GLYPH_CACHE *Glyphs, uint32_t X, uint32_t Y,
+                        const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Foreground,
+                        const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Background, const char16_t *Text) {
+    if (List == NULL || Glyphs == NULL || Foreground == NULL || Background == NULL || Text == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    uint32_t Length = 0, Lines = 1, Column = 0, Longest = 0;
+    for (; Text[Length] != 0; Length++) {
+        if (Text[Length] == u'\r' || Text[Length] == u'\n') {
+            Lines += Text[Length] == u'\n';
+            Column = 0;
+        } else if (++Column > Longest) {
+            Longest = Column;
+        }
+    }
+    
+    if (Length + 1 > DRAW_LIST_TEXT_CHARS - List->TextUsed) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    
+    DRAW_COMMAND *Command = AppendCommand(List, DrawCommandText, X, Y,
+                                          Longest * Glyphs->GlyphWidth, Lines * Glyphs->GlyphHeight);
+    if (Command == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    
+    Command->Glyphs = Glyphs;
+    Command->Color = *Foreground;
+    Command->Background = *Background;
+    Command->TextOffset = List->TextUsed;
+    MemCpy(List->Text + List->TextUsed, Text, (Length + 1) * sizeof(char16_t));
+    List->TextUsed += Length + 1;
+    return EFI_SUCCESS;
+}
+
+//
+// Compilation
+//
+
+// Drop commands that a later opaque command covers completely
+static uint32_t CullOccluded(DRAW_COMMAND *Commands, uint32_t Count) {
+    uint32_t Kept = 0;
+    
+    for (uint32_t i = 0; i < Count; i++) {
+        bool Hidden = false;
+        
+        for (uint32_t j = i + 1; j < Count && !Hidden; j++) {
+            Hidden = CommandIsOpaque(&Commands[j]) && RectContains(&Commands[j].Bounds, &Commands[i].Bounds);
+        }
+        
+        if (!Hidden) {
+            Commands[Kept++] = Commands[i];
+        }
+    }
+    
+    return Kept;
+}
+
+// Sort order: type, then color (fills to merge and text sharing glyph
+// colors end up together), then top-to-bottom, left-to-right
+static int CompareCommands(const DRAW_COMMAND *A, const DRAW_COMMAND *B) {
+    if (A->Type != B->Type) {
+        return A->Type < B->Type ? -1 : 1;
+    }
+    if (A->Type == DrawCommandText && A->Glyphs != B->Glyphs) {
+        return (uintptr_t)A->Glyphs < (uintptr_t)B->Glyphs ? -1 : 1;
+    }
+    if (ColorKey(&A->Color) != ColorKey(&B->Color)) {
+        return ColorKey(&A->Color) < ColorKey(&B->Color) ? -1 : 1;
+    }
+    if (A->Type == DrawCommandText && ColorKey(&A->Background) != ColorKey(&B->Background)) {
+        return ColorKey(&A->Background) < ColorKey(&B->Background) ? -1 : 1;
+    }
+    if (A->Bounds.Y != B->Bounds.Y) {
+        return A->Bounds.Y < B->Bounds.Y ? -1 : 1;
+    }
+    if (A->Bounds.X != B->Bounds.X) {
+        return A->Bounds.X < B->Bounds.X ? -1 : 1;
+    }
+    return 0;
+}
+
+// Insertion sort that only swaps neighbors which do not overlap, so the
+// painter's order of anything that touches the same pixels is kept
+static void SortCommands(DRAW_COMMAND *Commands, uint32_t Count) {
+    for (uint32_t i = 1; i < Count; i++) {
+        DRAW_COMMAND Command = Commands[i];
+        uint32_t j = i;
+        
+        while (j > 0 && CompareCommands(&Command, &Commands[j - 1]) < 0 &&
+               !RectsOverlap(&Command.Bounds, &Commands[j - 1].Bounds)) {
+            Commands[j] = Commands[j - 1];
+            j--;
+        }
+        Commands[j] = Command;
+    }
+}
+
+// Fold same-color fills whose union is a rectangle into the earlier one.
+// The later fill moves back in time, so nothing drawn in between may touch it.
+static uint32_t MergeFills(DRAW_COMMAND *Commands, uint32_t Count) {
+    for (uint32_t i = 0; i < Count; i++) {
+        if (Commands[i].Type != DrawCommandFill) {
+            continue;
+        }
+        
+        uint32_t Limit = Count - i - 1 < DRAW_LIST_MERGE_WINDOW ? Count : i + 1 + DRAW_LIST_MERGE_WINDOW;
+        for (uint32_t j = i + 1; j < Limit; j++) {
+            DRAW_COMMAND *Other = &Commands[j];
+            
+            if (Other->Type != DrawCommandFill || ColorKey(&Other->Color) != ColorKey(&Commands[i].Color) ||
+                !RectsUnionExact(&Commands[i].Bounds, &Other->Bounds)) {
+                continue;
+            }
+            
+            bool Blocked = false;
+            for (uint32_t k = i + 1; k < j && !Blocked; k++) {
+                Blocked = Commands[k].Type != DrawCommandMax && RectsOverlap(&Commands[k].Bounds, &Other->Bounds);
+            }
+            if (Blocked) {
+                continue;
+            }
+            
+            UnionRect(&Commands[i].Bounds, &Other->Bounds, &Commands[i].Bounds);
+            Other->Type = DrawCommandMax;
+            
+            // The grown fill may now meet fills that were skipped
+            j = i;
+        }
+    }
+    
+    uint32_t Kept = 0;
+    for (uint32_t i = 0; i < Count; i++) {
+        if (Commands[i].Type != DrawCommandMax) {
+            Commands[Kept++] = Commands[i];
+        }
+    }
+    return Kept;
+}
+
+// Build the submission order for a Width x Height target
+static void DrawListCompile(DRAW_LIST *List, uint32_t Width, uint32_t Height) {
+    uint64_t Start = ReadTimestamp();
+    uint32_t Count = 0;
+    
+    for (uint32_t i = 0; i < List->Count; i++) {
+        List->Compiled[Count] = List->Commands[i];
+        if (ClipRect(&List->Compiled[Count].Bounds, Width, Height)) {
+            Count++;
+        }
+    }
+    
+    uint32_t Visible = Count;
+    Count = CullOccluded(List->Compiled, Count);
+    SortCommands(List->Compiled, Count);
+    
+    uint32_t Sorted = Count;
+    Count = MergeFills(List->Compiled, Count);
+    uint32_t Merged = Count;
+    
+    // Merged fills can cover commands no single fill did
+    Count = CullOccluded(List->Compiled, Count);
+    
+    List->Culled = (List->Count - Visible) + (Visible - Sorted) + (Merged - Count);
+    List->Merged = Sorted - Merged;
+    List->CompiledCount = Count;
+    List->CompiledWidth = Width;
+    List->CompiledHeight = Height;
+    List->Dirty = false;
+    List->Compiles++;
+    List->LastCompileTicks = ReadTimestamp() - Start;
+}
+
+//
+// Submission
+//
+
+// Issue one command; the framebuffer functions clip and fall back to Blt
+static EFI_STATUS DrawCommand(DRAW_LIST *List, DRAW_COMMAND *Command, GOP_FRAMEBUFFER *Framebuffer) {
+    GOP_RECT *Bounds = &Command->Bounds;
+    
+    switch (Command->Type) {
+        case DrawCommandFill:
+            return FramebufferFill(Framebuffer, Bounds->X, Bounds->Y, Bounds->Width, Bounds->Height,
+                                   &Command->Color);
+        case DrawCommandBitmap:
+            return FramebufferBlit(Framebuffer, Bounds->X, Bounds->Y, Bounds->Width, Bounds->Height,
+                                   Command->Bitmap, Command->BitmapStride);
+        case DrawCommandText:
+            GlyphCacheSetColors(Command->Glyphs, &Command->Color, &Command->Background);
+            return DrawTextToFramebuffer(Command->Glyphs, Framebuffer, Bounds->X, Bounds->Y,
+                                         List->Text + Command->TextOffset);
+        default:
+            return EFI_SUCCESS;
+    }
+}
+
+// Draw the list to the screen, compiling it first if it changed since the
+// last submission. Replaying an unchanged list only issues the compiled draws.
+EFI_STATUS DrawListSubmit(DRAW_LIST *List, GOP_FRAMEBUFFER *Framebuffer) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    
+    if (List == NULL || Framebuffer == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    if (List->Dirty || List->CompiledWidth != Framebuffer->Width || List->CompiledHeight != Framebuffer->Height) {
+        DrawListCompile(List, Framebuffer->Width, Framebuffer->Height);
+    }
+    
+    uint64_t Start = ReadTimestamp();
+    
+    for (uint32_t i = 0; i < List->CompiledCount && !EFI_ERROR(Status); i++) {
+        Status = DrawCommand(List, &List->Compiled[i], Framebuffer);
+    }
+    
+    List->Submits++;
+    List->LastSubmitTicks = ReadTimestamp() - Start;
+    return Status;
+}
+
+void DrawListPrintStats(DRAW_LIST *List) {
+    if (List == NULL) {
+        return;
+    }
+    
+    PRINT(u"Commands: ");
+    PrintDec(List->Count);
+    PRINT(u" recorded, ");
+    PrintDec(List->CompiledCount);
+    PRINT(u" submitted  Compiles: ");
+    PrintDec(List->Compiles);
+    PRINT(u" (");
+    PrintDec(TimestampToMicroseconds(List->LastCompileTicks));
+    PRINT(u" us)  Merged: ");
+    PrintDec(List->Merged);
+    PRINT(u"  Culled: ");
+    PrintDec(List->Culled);
+    PRINT(u"  Last submit: ");
+    PrintDec(TimestampToMicroseconds(List->LastSubmitTicks));
+    PRINTL(u" us");
+}
+
+// Record a tiled dashboard-like scene and compare drawing it command by
+// command with compiling it once and replaying the compiled list
+void DrawListBenchmark(void) {
+    EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop;
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL Background, Bands[2], Foreground;
+    GOP_FRAMEBUFFER Framebuffer;
+    GOP_SURFACE Panel;
+    GLYPH_CACHE Glyphs;
+    DRAW_LIST List;
+    uint64_t Start, ImmediateTicks, FirstTicks, ReplayTicks;
+    
+    if (EFI_ERROR(GetGraphicsOutputProtocol(&Gop)) || EFI_ERROR(FramebufferInit(&Framebuffer, Gop))) {
+        PRINTL(u"Draw list benchmark: graphics output not available");
+        return;
+    }
+    
+    uint32_t Columns = Framebuffer.Width / DRAW_LIST_BENCHMARK_TILE;
+    uint32_t Rows = Framebuffer.Height / DRAW_LIST_BENCHMARK_TILE;
+    uint32_t PanelWidth = Framebuffer.Width / 2;
+    uint32_t PanelHeight = Framebuffer.Height / 2;
+    
+    GetPixelForRGB(0x10, 0x10, 0x18, &Background);
+    GetPixelForRGB(0x20, 0x30, 0x50, &Bands[0]);
+    GetPixelForRGB(0x30, 0x20, 0x40, &Bands[1]);
+    GetPixelForRGB(0xF0, 0xF0, 0xF0, &Foreground);
+    
+    if (Columns == 0 || Rows == 0 || EFI_ERROR(CreateSurface(&Panel, PanelWidth, PanelHeight))) {
+        PRINTL(u"Draw list benchmark: screen too small");
+        return;
+    }
+    if (EFI_ERROR(GlyphCacheInit(&Glyphs, GetBuiltinFont(), 1, &Foreground, &Background))) {
+        FreeSurface(&Panel);
+        PRINTL(u"Draw list benchmark: out of memory");
+        return;
+    }
+    if (EFI_ERROR(DrawListCreate(&List, Columns * Rows + 64))) {
+        GlyphCacheFree(&Glyphs);
+        FreeSurface(&Panel);
+        PRINTL(u"Draw list benchmark: out of memory");
+        return;
+    }
+    
+    for (uint32_t Y = 0; Y < PanelHeight; Y++) {
+        for (uint32_t X = 0; X < PanelWidth; X++) {
+            GetPixelForRGB((uint8_t)(X * 255 / PanelWidth), (uint8_t)(Y * 255 / PanelHeight), 0x80,
+                           &Panel.Pixels[(uint64_t)Y * Panel.Stride + X]);
+        }
+    }
+    
+    // Background, a tile grid in alternating bands of rows, a panel on top
+    // of the middle tiles and a few lines of text on the panel
+    DrawListFill(&List, 0, 0, Framebuffer.Width, Framebuffer.Height, &Background);
+    for (uint32_t Row = 0; Row < Rows; Row++) {
+        for (uint32_t Column = 0; Column < Columns; Column++) {
+            DrawListFill(&List, Column * DRAW_LIST_BENCHMARK_TILE, Row * DRAW_LIST_BENCHMARK_TILE,
+                         DRAW_LIST_BENCHMARK_TILE, DRAW_LIST_BENCHMARK_TILE, &Bands[(Row / 4) & 1]);
+        }
+    }
+    DrawListBitmap(&List, PanelWidth / 2, PanelHeight / 2, PanelWidth, PanelHeight, Panel.Pixels, Panel.Stride);
+    for (uint32_t Line = 0; Line < 8; Line++) {
+        DrawListText(&List, &Glyphs, PanelWidth / 2 + 8, PanelHeight / 2 + 8 + Line * Glyphs.GlyphHeight,
+                     &Foreground, &Bands[Line & 1], u"Retained draw list benchmark");
+    }
+    
+    Start = ReadTimestamp();
+    for (int Pass = 0; Pass < DRAW_LIST_BENCHMARK_PASSES; Pass++) {
+        for (uint32_t i = 0; i < List.Count; i++) {
+            DrawCommand(&List, &List.Commands[i], &Framebuffer);
+        }
+    }
+    ImmediateTicks = ReadTimestamp() - Start;
+    
+    Start = ReadTimestamp();
+    DrawListSubmit(&List, &Framebuffer);
+    FirstTicks = ReadTimestamp() - Start;
+    
+    Start = ReadTimestamp();
+    for (int Pass = 0; Pass < DRAW_LIST_BENCHMARK_PASSES; Pass++) {
+        DrawListSubmit(&List, &Framebuffer);
+    }
+    ReplayTicks = ReadTimestamp() - Start;
+    
+    CLEAR_SCREEN();
+    DrawListPrintStats(&List);
+    PRINT(u"Immediate: ");
+    PrintDec(TimestampToMicroseconds(ImmediateTicks) / DRAW_LIST_BENCHMARK_PASSES);
+    PRINT(u" us/frame  First submit: ");
+    PrintDec(TimestampToMicroseconds(FirstTicks));
+    PRINT(u" us  Replay: ");
+    PrintDec(TimestampToMicroseconds(ReplayTicks) / DRAW_LIST_BENCHMARK_PASSES);
+    PRINTL(u" us/frame");
+    
+    DrawListFree(&List);
+    GlyphCacheFree(&Glyphs);
+    FreeSurface(&Panel);
+}
@@ -0,0 +1,87 @@
+// efi_draw_list.h
+#ifndef TINYUEFI_DRAW_LIST_H
+#define TINYUEFI_DRAW_LIST_H
+
+#include "uefi_types.h"
+#include "efi_gop_protocol.h"
+#include "efi_gop_surface.h"
+#include "efi_gop_framebuffer.h"
+#include "efi_font.h"
+
+// Characters of text a list can hold across all of its text commands
+#define DRAW_LIST_TEXT_CHARS          4096
+
+// Sorted commands searched past each fill for a same-color partner to merge with
+#define DRAW_LIST_MERGE_WINDOW        64
+
+// Work done by DrawListBenchmark
+#define DRAW_LIST_BENCHMARK_TILE      32
+#define DRAW_LIST_BENCHMARK_PASSES    16
+
+// Recorded command kinds
+typedef enum {
+    DrawCommandFill,
+    DrawCommandBitmap,
+    DrawCommandText,
+    DrawCommandMax
+} DRAW_COMMAND_TYPE;
+
+// One recorded draw. Bitmaps and glyph caches are referenced, not copied,
+// so they must outlive the list; text is copied into the list.
+typedef struct {
+    DRAW_COMMAND_TYPE Type;
+    GOP_RECT Bounds;
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL Color;        // Fill color or text foreground
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL Background;   // Text background
+    const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Bitmap;
+    uint32_t BitmapStride;
+    GLYPH_CACHE *Glyphs;
+    uint32_t TextOffset;
+} DRAW_COMMAND;
+
+// Retained list of draw commands. Submitting compiles the commands once
+// (cull, sort, merge) and later submissions replay the compiled form until
+// the list is changed or the target size differs.
+typedef struct {
+    DRAW_COMMAND *Commands;
+    uint32_t Count;
+    uint32_t Capacity;
+    char16_t *Text;
+    uint32_t TextUsed;
+    
+    // Compiled form
+    DRAW_COMMAND *Compiled;
+    uint32_t CompiledCount;
+    uint32_t CompiledWidth;
+    uint32_t CompiledHeight;
+    bool Dirty;
+    
+    // Statistics (Culled and Merged are for the last compile)
+    uint64_t Compiles;
+    uint64_t Submits;
+    uint32_t Culled;
+    uint32_t Merged;
+    uint64_t LastCompileTicks;
+    uint64_t LastSubmitTicks;
+} DRAW_LIST;
+
+// List management
+EFI_STATUS DrawListCreate(DRAW_LIST *List, uint32_t Capacity);
+void DrawListReset(DRAW_LIST *List);
+void DrawListFree(DRAW_LIST *List);
+
+// Recording
+EFI_STATUS DrawListFill(DRAW_LIST *List, uint32_t X, uint32_t Y, uint32_t Width, uint32_t Height,
+                        const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Color);
+EFI_STATUS DrawListBitmap(DRAW_LIST *List, uint32_t X, uint32_t Y, uint32_t Width, uint32_t Height,
+                          const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Bitmap, uint32_t BitmapStride);
+EFI_STATUS DrawListText(DRAW_LIST *List, GLYPH_CACHE *Glyphs, uint32_t X, uint32_t Y,
+                        const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Foreground,
+                        const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Background, const char16_t *Text);
+
+// Submission
+EFI_STATUS DrawListSubmit(DRAW_LIST *List, GOP_FRAMEBUFFER *Framebuffer);
+void DrawListPrintStats(DRAW_LIST *List);
+void DrawListBenchmark(void);
+
+#endif // TINYUEFI_DRAW_LIST_H
@@ -2,6 +2,7 @@
 #include "efi_file_protocol.h"
 #include "uefi_helpers.h"
 #include "efi_protocol_discovery.h"
+#include "efi_protocol_cache.h"
 
 // Define GUIDs - using const to prevent inadvertent modification
 const EFI_GUID gEfiSimpleFileSystemProtocolGuid = {
@@ -17,9 +18,9 @@ const EFI_GUID gEfiFileSystemInfoGuid = {
 };
 
 
-// Get the file system protocol
+// Get the file system protocol, cached until another one is installed
 EFI_STATUS GetFileSystemProtocol(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL **FileSystem) {
-    return LocateProtocol(&gEfiSimpleFileSystemProtocolGuid, (void**)FileSystem);
+    return CachedLocateProtocol(&gEfiSimpleFileSystemProtocolGuid, (void**)FileSystem);
 }
 
 // Open the root volume
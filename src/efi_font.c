@@ -0,0 +1,444 @@
+// efi_font.c
+#include "efi_font.h"
+#include "uefi_helpers.h"
+#include "efi_pixel.h"
+#include "efi_timer.h"
+
+// Built-in 8x8 font covering printable ASCII (0x20-0x7E)
+static const uint8_t BuiltinGlyphs[95][8] = {
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },    // 0x20 ' '
+    { 0x18, 0x3C, 0x3C, 0x18, 0x18, 0x00, 0x18, 0x00 },    // 0x21 '!'
+    { 0x6C, 0x6C, 0x48, 0x00, 0x00, 0x00, 0x00, 0x00 },    // 0x22 '"'
+    { 0x6C, 0x6C, 0xFE, 0x6C, 0xFE, 0x6C, 0x6C, 0x00 },    // 0x23 '#'
+    { 0x18, 0x7E, 0xC0, 0x7C, 0x06, 0xFC, 0x18, 0x00 },    // 0x24 '$'
+    { 0x00, 0xC6, 0xCC, 0x18, 0x30, 0x66, 0xC6, 0x00 },    // 0x25 '%'
+    { 0x38, 0x6C, 0x38, 0x76, 0xDC, 0xCC, 0x76, 0x00 },    // 0x26 '&'
+    { 0x18, 0x18, 0x30, 0x00, 0x00, 0x00, 0x00, 0x00 },    // 0x27 '''
+    { 0x0C, 0x18, 0x30, 0x30, 0x30, 0x18, 0x0C, 0x00 },    // 0x28 '('
+    { 0x30, 0x18, 0x0C, 0x0C, 0x0C, 0x18, 0x30, 0x00 },    // 0x29 ')'
+    { 0x00, 0x66, 0x3C, 0xFF, 0x3C, 0x66, 0x00, 0x00 },    // 0x2A '*'
+    { 0x00, 0x18, 0x18, 0x7E, 0x18, 0x18, 0x00, 0x00 },    // 0x2B '+'
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x18, 0x18, 0x30 },    // 0x2C ','
+    { 0x00, 0x00, 0x00, 0x7E, 0x00, 0x00, 0x00, 0x00 },    // 0x2D '-'
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x18, 0x18, 0x00 },    // 0x2E '.'
+    { 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xC0, 0x00 },    // 0x2F '/'
+    { 0x7C, 0xC6, 0xCE, 0xDE, 0xF6, 0xE6, 0x7C, 0x00 },    // 0x30 '0'
+    { 0x18, 0x38, 0x18, 0x18, 0x18, 0x18, 0x7E, 0x00 },    // 0x31 '1'
+    { 0x78, 0xCC, 0x0C, 0x18, 0x30, 0x60, 0xFC, 0x00 },    // 0x32 '2'
+    { 0x78, 0xCC, 0x0C, 0x38, 0x0C, 0xCC, 0x78, 0x00 },    // 0x33 '3'
+    { 0x1C, 0x3C, 0x6C, 0xCC, 0xFE, 0x0C, 0x1E, 0x00 },    // 0x34 '4'
+    { 0xFC, 0xC0, 0xF8, 0x0C, 0x0C, 0xCC, 0x78, 0x00 },    // 0x35 '5'
+    { 0x38, 0x60, 0xC0, 0xF8, 0xCC, 0xCC, 0x78, 0x00 },    // 0x36 '6'
+    { 0xFC, 0xCC, 0x0C, 0x18, 0x30, 0x30, 0x30, 0x00 },    // 0x37 '7'
+    { 0x78, 0xCC, 0xCC, 0x78, 0xCC, 0xCC, 0x78, 0x00 },    // 0x38 '8'
+    { 0x78, 0xCC, 0xCC, 0x7C, 0x0C, 0x18, 0x70, 0x00 },    // 0x39 '9'
+    { 0x00, 0x18, 0x18, 0x00, 0x00, 0x18, 0x18, 0x00 },    // 0x3A ':'
+    { 0x00, 0x18, 0x18, 0x00, 0x00, 0x18, 0x18, 0x30 },    // 0x3B ';'
+    { 0x0C, 0x18, 0x30, 0x60, 0x30, 0x18, 0x0C, 0x00 },    // 0x3C '<'
+    { 0x00, 0x00, 0x7E, 0x00, 0x7E, 0x00, 0x00, 0x00 },    // 0x3D '='
+    { 0x60, 0x30, 0x18, 0x0C, 0x18, 0x30, 0x60, 0x00 },    // 0x3E '>'
+    { 0x78, 0xCC, 0x0C, 0x18, 0x30, 0x00, 0x30, 0x00 },    // 0x3F '?'
+    { 0x7C, 0xC6, 0xDE, 0xDE, 0xDE, 0xC0, 0x78, 0x00 },    // 0x40 '@'
+    { 0x30, 0x78, 0xCC, 0xCC, 0xFC, 0xCC, 0xCC, 0x00 },    // 0x41 'A'
+    { 0xFC, 0x66, 0x66, 0x7C, 0x66, 0x66, 0xFC, 0x00 },    // 0x42 'B'
+    { 0x3C, 0x66, 0xC0, 0xC0, 0xC0, 0x66, 0x3C, 0x00 },    // 0x43 'C'
+    { 0xF8, 0x6C, 0x66, 0x66, 0x66, 0x6C, 0xF8, 0x00 },    // 0x44 'D'
+    { 0xFE, 0x62, 0x68, 0x78, 0x68, 0x62, 0xFE, 0x00 },    // 0x45 'E'
+    { 0xFE, 0x62, 0x68, 0x78, 0x68, 0x60, 0xF0, 0x00 },    // 0x46 'F'
+    { 0x3C, 0x66, 0xC0, 0xC0, 0xCE, 0x66, 0x3E, 0x00 },    // 0x47 'G'
+    { 0xCC, 0xCC, 0xCC, 0xFC, 0xCC, 0xCC, 0xCC, 0x00 },    // 0x48 'H'
+    { 0x78, 0x30, 0x30, 0x30, 0x30, 0x30, 0x78, 0x00 },    // 0x49 'I'
+    { 0x1E, 0x0C, 0x0C, 0x0C, 0xCC, 0xCC, 0x78, 0x00 },    // 0x4A 'J'
+    { 0xE6, 0x66, 0x6C, 0x78, 0x6C, 0x66, 0xE6, 0x00 },    // 0x4B 'K'
+    { 0xF0, 0x60, 0x60, 0x60, 0x62, 0x66, 0xFE, 0x00 },    // 0x4C 'L'
+    { 0xC6, 0xEE, 0xFE, 0xFE, 0xD6, 0xC6, 0xC6, 0x00 },    // 0x4D 'M'
+    { 0xC6, 0xE6, 0xF6, 0xDE, 0xCE, 0xC6, 0xC6, 0x00 },    // 0x4E 'N'
+    { 0x38, 0x6C, 0xC6, 0xC6, 0xC6, 0x6C, 0x38, 0x00 },    // 0x4F 'O'
+    { 0xFC, 0x66, 0x66, 0x7C, 0x60, 0x60, 0xF0, 0x00 },    // 0x50 'P'
+    { 0x78, 0xCC, 0xCC, 0xCC, 0xDC, 0x78, 0x1C, 0x00 },    // 0x51 'Q'
+    { 0xFC, 0x66, 0x66, 0x7C, 0x6C, 0x66, 0xE6, 0x00 },    // 0x52 'R'
+    { 0x78, 0xCC, 0xE0, 0x70, 0x1C, 0xCC, 0x78, 0x00 },    // 0x53 'S'
+    { 0xFC, 0xB4, 0x30, 0x30, 0x30, 0x30, 0x78, 0x00 },    // 0x54 'T'
+    { 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xFC, 0x00 },    // 0x55 'U'
+    { 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0x78, 0x30, 0x00 },    // 0x56 'V'
+    { 0xC6, 0xC6, 0xC6, 0xD6, 0xFE, 0xEE, 0xC6, 0x00 },    // 0x57 'W'
+    { 0xC6, 0xC6, 0x6C, 0x38, 0x38, 0x6C, 0xC6, 0x00 },    // 0x58 'X'
+    { 0xCC, 0xCC, 0xCC, 0x78, 0x30, 0x30, 0x78, 0x00 },    // 0x59 'Y'
+    { 0xFE, 0xC6, 0x8C, 0x18, 0x32, 0x66, 0xFE, 0x00 },    // 0x5A 'Z'
+    { 0x78, 0x60, 0x60, 0x60, 0x60, 0x60, 0x78, 0x00 },    // 0x5B '['
+    { 0xC0, 0x60, 0x30, 0x18, 0x0C, 0x06, 0x02, 0x00 },    // 0x5C '\\'
+    { 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0x78, 0x00 },    // 0x5D ']'
+    { 0x10, 0x38, 0x6C, 0xC6, 0x00, 0x00, 0x00, 0x00 },    // 0x5E '^'
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF },    // 0x5F '_'
+    { 0x30, 0x30, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00 },    // 0x60 '`'
+    { 0x00, 0x00, 0x78, 0x0C, 0x7C, 0xCC, 0x76, 0x00 },    // 0x61 'a'
+    { 0xE0, 0x60, 0x60, 0x7C, 0x66, 0x66, 0xDC, 0x00 },    // 0x62 'b'
+    { 0x00, 0x00, 0x78, 0xCC, 0xC0, 0xCC, 0x78, 0x00 },    // 0x63 'c'
+    { 0x1C, 0x0C, 0x0C, 0x7C, 0xCC, 0xCC, 0x76, 0x00 },    // 0x64 'd'
+    { 0x00, 0x00, 0x78, 0xCC, 0xFC, 0xC0, 0x78, 0x00 },    // 0x65 'e'
+    { 0x38, 0x6C, 0x60, 0xF0, 0x60, 0x60, 0xF0, 0x00 },    // 0x66 'f'
+    { 0x00, 0x00, 0x76, 0xCC, 0xCC, 0x7C, 0x0C, 0xF8 },    // 0x67 'g'
+    { 0xE0, 0x60, 0x6C, 0x76, 0x66, 0x66, 0xE6, 0x00 },    // 0x68 'h'
+    { 0x30, 0x00, 0x70, 0x30, 0x30, 0x30, 0x78, 0x00 },    // 0x69 'i'
+    { 0x0C, 0x00, 0x0C, 0x0C, 0x0C, 0xCC, 0xCC, 0x78 },    // 0x6A 'j'
+    { 0xE0, 0x60, 0x66, 0x6C, 0x78, 0x6C, 0xE6, 0x00 },    // 0x6B 'k'
+    { 0x70, 0x30, 0x30, 0x30, 0x30, 0x30, 0x78, 0x00 },    // 0x6C 'l'
+    { 0x00, 0x00, 0xCC, 0xFE, 0xFE, 0xD6, 0xC6, 0x00 },    // 0x6D 'm'
+    { 0x00, 0x00, 0xF8, 0xCC, 0xCC, 0xCC, 0xCC, 0x00 },    // 0x6E 'n'
+    { 0x00, 0x00, 0x78, 0xCC, 0xCC, 0xCC, 0x78, 0x00 },    // 0x6F 'o'
+    { 0x00, 0x00, 0xDC, 0x66, 0x66, 0x7C, 0x60, 0xF0 },    // 0x70 'p'
+    { 0x00, 0x00, 0x76, 0xCC, 0xCC, 0x7C, 0x0C, 0x1E },    // 0x71 'q'
+    { 0x00, 0x00, 0xDC, 0x76, 0x66, 0x60, 0xF0, 0x00 },    // 0x72 'r'
+    { 0x00, 0x00, 0x7C, 0xC0, 0x78, 0x0C, 0xF8, 0x00 },    // 0x73 's'
+    { 0x10, 0x30, 0x7C, 0x30, 0x30, 0x34, 0x18, 0x00 },    // 0x74 't'
+    { 0x00, 0x00, 0xCC, 0xCC, 0xCC, 0xCC, 0x76, 0x00 },    // 0x75 'u'
+    { 0x00, 0x00, 0xCC, 0xCC, 0xCC, 0x78, 0x30, 0x00 },    // 0x76 'v'
+    { 0x00, 0x00, 0xC6, 0xD6, 0xFE, 0xFE, 0x6C, 0x00 },    // 0x77 'w'
+    { 0x00, 0x00, 0xC6, 0x6C, 0x38, 0x6C, 0xC6, 0x00 },    // 0x78 'x'
+    { 0x00, 0x00, 0xCC, 0xCC, 0xCC, 0x7C, 0x0C, 0xF8 },    // 0x79 'y'
+    { 0x00, 0x00, 0xFC, 0x98, 0x30, 0x64, 0xFC, 0x00 },    // 0x7A 'z'
+    { 0x1C, 0x30, 0x30, 0xE0, 0x30, 0x30, 0x1C, 0x00 },    // 0x7B '{'
+    { 0x18, 0x18, 0x18, 0x00, 0x18, 0x18, 0x18, 0x00 },    // 0x7C '|'
+    { 0xE0, 0x30, 0x30, 0x1C, 0x30, 0x30, 0xE0, 0x00 },    // 0x7D '}'
+    { 0x76, 0xDC, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },    // 0x7E '~'
+};
+
+static const BITMAP_FONT BuiltinFont = {
+    8, 8, 1, 8, 0x20, 95, &BuiltinGlyphs[0][0]
+};
+
+// Sample text for FontBenchmark
+static const char16_t FontBenchmarkText[] = u"The quick brown fox jumps over the lazy dog 0123456789 !?#&{}";
+
+static inline uint32_t LoadLe32(const uint8_t *Bytes) {
+    return (uint32_t)Bytes[0] | ((uint32_t)Bytes[1] << 8) | 
+           ((uint32_t)Bytes[2] << 16) | ((uint32_t)Bytes[3] << 24);
+}
+
+// Font compiled into the application
+const BITMAP_FONT *GetBuiltinFont(void) {
+    return &BuiltinFont;
+}
+
+// Describe a PSF1 or PSF2 font held in memory. Glyphs are indexed by code
+// point (any Unicode table is ignored) and Data must outlive the font.
+EFI_STATUS FontLoadPsf(BITMAP_FONT *Font, const void *Data, uint64_t Size) {
+    const uint8_t *Bytes = (const uint8_t*)Data;
+    uint64_t HeaderSize;
+    
+    if (Font == NULL || Data == NULL || Size < 4) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    if ((Bytes[0] | (Bytes[1] << 8)) == PSF1_MAGIC) {
+        // Magic, mode, height; glyphs are always 8 pixels wide
+        HeaderSize = 4;
+        Font->Width = 8;
+        Font->Height = Bytes[3];
+        Font->BytesPerRow = 1;
+        Font->BytesPerGlyph = Bytes[3];
+        Font->GlyphCount = (Bytes[2] & 0x01) ? 512 : 256;
+    } else if (Size >= 32 && LoadLe32(Bytes) == PSF2_MAGIC) {
+        HeaderSize = LoadLe32(Bytes + 8);
+        Font->GlyphCount = LoadLe32(Bytes + 16);
+        Font->BytesPerGlyph = LoadLe32(Bytes + 20);
+        Font->Height = LoadLe32(Bytes + 24);
+        Font->Width = LoadLe32(Bytes + 28);
+        Font->BytesPerRow = (Font->Width + 7) / 8;
+    } else {
+        return EFI_UNSUPPORTED;
+    }
+    
+    if (Font->Width == 0 || Font->Height == 0 || Font->GlyphCount == 0 || 
+        Font->BytesPerGlyph < (uint64_t)Font->BytesPerRow * Font->Height ||
+        HeaderSize + (uint64_t)Font->GlyphCount * Font->BytesPerGlyph > Size) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+    
+    Font->FirstChar = 0;
+    Font->Glyphs = Bytes + HeaderSize;
+    return EFI_SUCCESS;
+}
+
+// Glyph index for a character; '?' (or the first glyph) stands in for missing ones
+static uint32_t FontGlyphIndex(const BITMAP_FONT *Font, char16_t Char) {
+    if (Char >= Font->FirstChar && Char - Font->FirstChar < Font->GlyphCount) {
+        return Char - Font->FirstChar;
+    }
+    
+    if (u'?' >= Font->FirstChar && u'?' - Font->FirstChar < Font->GlyphCount) {
+        return u'?' - Font->FirstChar;
+    }
+    
+    return 0;
+}
+
+// Prepare a cache for a font at an integer scale
+EFI_STATUS GlyphCacheInit(GLYPH_CACHE *Cache, const BITMAP_FONT *Font, uint32_t Scale, 
+                          const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Foreground, 
+                          const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Background) {
+    if (Cache == NULL || Font == NULL || Foreground == NULL || Background == NULL || Scale == 0) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    MemSet(Cache, 0, sizeof(*Cache));
+    Cache->Font = Font;
+    Cache->Scale = Scale;
+    Cache->GlyphWidth = Font->Width * Scale;
+    Cache->GlyphHeight = Font->Height * Scale;
+    Cache->Foreground = *Foreground;
+    Cache->Background = *Background;
+    
+    uint64_t GlyphPixels = (uint64_t)Cache->GlyphWidth * Cache->GlyphHeight;
+    Cache->Pixels = (EFI_GRAPHICS_OUTPUT_BLT_PIXEL*)AllocatePool(
+        GlyphPixels * Font->GlyphCount * sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL));
+    Cache->Expanded = (uint8_t*)AllocatePool(Font->GlyphCount);
+    
+    if (Cache->Pixels == NULL || Cache->Expanded == NULL || 
+        EFI_ERROR(CreateSurface(&Cache->Line, Cache->GlyphWidth * GLYPH_CACHE_LINE_CHARS, 
+                                Cache->GlyphHeight))) {
+        GlyphCacheFree(Cache);
+        return EFI_OUT_OF_RESOURCES;
+    }
+    
+    MemSet(Cache->Expanded, 0, Font->GlyphCount);
+    return EFI_SUCCESS;
+}
+
+// Switch colors; glyphs are re-expanded lazily
+void GlyphCacheSetColors(GLYPH_CACHE *Cache, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Foreground, 
+                         const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Background) {
+    if (Cache == NULL || Foreground == NULL || Background == NULL) {
+        return;
+    }
+    
+    if (*(const uint32_t*)Foreground == *(const uint32_t*)&Cache->Foreground && 
+        *(const uint32_t*)Background == *(const uint32_t*)&Cache->Background) {
+        return;
+    }
+    
+    Cache->Foreground = *Foreground;
+    Cache->Background = *Background;
+    MemSet(Cache->Expanded, 0, Cache->Font->GlyphCount);
+}
+
+// Turn one glyph bitmap into scaled pixels
+static void ExpandGlyph(GLYPH_CACHE *Cache, uint32_t Index, EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Out) {
+    const BITMAP_FONT *Font = Cache->Font;
+    const uint8_t *Bitmap = Font->Glyphs + (uint64_t)Index * Font->BytesPerGlyph;
+    
+    for (uint32_t Row = 0; Row < Font->Height; Row++) {
+        EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Line = Out;
+        
+        for (uint32_t Column = 0; Column < Font->Width; Column++) {
+            bool Set = (Bitmap[Column / 8] >> (7 - (Column % 8))) & 1;
+            PixelFill(Out, Set ? &Cache->Foreground : &Cache->Background, Cache->Scale);
+            Out += Cache->Scale;
+        }
+        
+        // Repeat the row for vertical scaling
+        for (uint32_t Copy = 1; Copy < Cache->Scale; Copy++) {
+            PixelCopy(Out, Line, Cache->GlyphWidth);
+            Out += Cache->GlyphWidth;
+        }
+        
+        Bitmap += Font->BytesPerRow;
+    }
+}
+
+// Pixels for a character (GlyphWidth x GlyphHeight, stride GlyphWidth)
+const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *GlyphCacheGet(GLYPH_CACHE *Cache, char16_t Char) {
+    if (Cache == NULL || Cache->Pixels == NULL) {
+        return NULL;
+    }
+    
+    uint32_t Index = FontGlyphIndex(Cache->Font, Char);
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Glyph = Cache->Pixels + 
+        (uint64_t)Index * Cache->GlyphWidth * Cache->GlyphHeight;
+    
+    if (!Cache->Expanded[Index]) {
+        ExpandGlyph(Cache, Index, Glyph);
+        Cache->Expanded[Index] = 1;
+        Cache->GlyphsExpanded++;
+    }
+    
+    return Glyph;
+}
+
+void GlyphCacheFree(GLYPH_CACHE *Cache) {
+    if (Cache == NULL) {
+        return;
+    }
+    
+    if (Cache->Pixels != NULL) {
+        FreePool(Cache->Pixels);
+        Cache->Pixels = NULL;
+    }
+    if (Cache->Expanded != NULL) {
+        FreePool(Cache->Expanded);
+        Cache->Expanded = NULL;
+    }
+    FreeSurface(&Cache->Line);
+}
+
+// Draw text into a surface, one glyph blit per character
+EFI_STATUS DrawTextToSurface(GLYPH_CACHE *Cache, GOP_SURFACE *Surface, 
+                             uint32_t X, uint32_t Y, const char16_t *Text) {
+    if (Cache == NULL || Surface == NULL || Text == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    uint64_t PenX = X;
+    uint64_t PenY = Y;
+    
+    for (; *Text != 0; Text++) {
+        if (*Text == u'\r' || *Text == u'\n') {
+            if (*Text == u'\n') {
+                PenY += Cache->GlyphHeight;
+            }
+            PenX = X;
+            continue;
+        }
+        
+        if (PenX < Surface->Width && PenY < Surface->Height) {
+            SurfaceBlit(Surface, (uint32_t)PenX, (uint32_t)PenY, Cache->GlyphWidth, Cache->GlyphHeight, 
+                        GlyphCacheGet(Cache, *Text), Cache->GlyphWidth);
+            Cache->GlyphsDrawn++;
+        }
+        PenX += Cache->GlyphWidth;
+    }
+    
+    return EFI_SUCCESS;
+}
+
+// Draw text straight to the screen. Each run of characters is composed into
+// one strip first so every scanline goes out as a single long streamed store.
+EFI_STATUS DrawTextToFramebuffer(GLYPH_CACHE *Cache, GOP_FRAMEBUFFER *Framebuffer, 
+                                 uint32_t X, uint32_t Y, const char16_t *Text) {
+    if (Cache == NULL || Framebuffer == NULL || Text == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    uint64_t PenX = X;
+    uint64_t PenY = Y;
+    
+    while (*Text != 0) {
+        if (*Text == u'\r' || *Text == u'\n') {
+            if (*Text == u'\n') {
+                PenY += Cache->GlyphHeight;
+            }
+            PenX = X;
+            Text++;
+            continue;
+        }
+        
+        // Compose up to one strip of glyphs
+        uint32_t Count = 0;
+        while (Text[Count] != 0 && Text[Count] != u'\r' && Text[Count] != u'\n' && 
+               Count < GLYPH_CACHE_LINE_CHARS) {
+            SurfaceBlit(&Cache->Line, Count * Cache->GlyphWidth, 0, Cache->GlyphWidth, Cache->GlyphHeight, 
+                        GlyphCacheGet(Cache, Text[Count]), Cache->GlyphWidth);
+            Count++;
+        }
+        
+        if (PenX < Framebuffer->Width && PenY < Framebuffer->Height) {
+            EFI_STATUS Status = FramebufferBlit(Framebuffer, (uint32_t)PenX, (uint32_t)PenY, 
+                                                Count * Cache->GlyphWidth, Cache->GlyphHeight, 
+                                                Cache->Line.Pixels, Cache->Line.Stride);
+            if (EFI_ERROR(Status)) {
+                return Status;
+            }
+            Cache->GlyphsDrawn += Count;
+        }
+        
+        PenX += (uint64_t)Count * Cache->GlyphWidth;
+        Text += Count;
+    }
+    
+    return EFI_SUCCESS;
+}
+
+// Compare cached glyph rendering with the firmware console
+void FontBenchmark(void) {
+    EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop;
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL Foreground, Background;
+    GOP_FRAMEBUFFER Framebuffer;
+    GOP_SURFACE Surface;
+    GLYPH_CACHE Cache;
+    char16_t Text[GLYPH_CACHE_LINE_CHARS + 1];
+    uint64_t Start, SurfaceTicks, FramebufferTicks, ConOutTicks;
+    
+    if (EFI_ERROR(GetGraphicsOutputProtocol(&Gop)) || EFI_ERROR(FramebufferInit(&Framebuffer, Gop))) {
+        PRINTL(u"Font benchmark: graphics output not available");
+        return;
+    }
+    
+    GetPixelForRGB(0xE0, 0xE0, 0xE0, &Foreground);
+    GetPixelForRGB(0x00, 0x20, 0x40, &Background);
+    if (EFI_ERROR(GlyphCacheInit(&Cache, GetBuiltinFont(), 1, &Foreground, &Background))) {
+        PRINTL(u"Font benchmark: out of memory");
+        return;
+    }
+    if (EFI_ERROR(CreateSurface(&Surface, Framebuffer.Width, Framebuffer.Height))) {
+        GlyphCacheFree(&Cache);
+        PRINTL(u"Font benchmark: out of memory");
+        return;
+    }
+    
+    // One screen-wide line of sample text
+    uint32_t Columns = Framebuffer.Width / Cache.GlyphWidth;
+    uint32_t Rows = Framebuffer.Height / Cache.GlyphHeight;
+    uint32_t SampleLength = sizeof(FontBenchmarkText) / sizeof(char16_t) - 1;
+    
+    if (Columns > GLYPH_CACHE_LINE_CHARS) {
+        Columns = GLYPH_CACHE_LINE_CHARS;
+    }
+    for (uint32_t i = 0; i < Columns; i++) {
+        Text[i] = FontBenchmarkText[i % SampleLength];
+    }
+    Text[Columns] = 0;
+    
+    uint64_t Glyphs = (uint64_t)Columns * Rows * FONT_BENCHMARK_PASSES;
+    
+    Start = ReadTimestamp();
+    for (int Pass = 0; Pass < FONT_BENCHMARK_PASSES; Pass++) {
+        for (uint32_t Row = 0; Row < Rows; Row++) {
+            DrawTextToSurface(&Cache, &Surface, 0, Row * Cache.GlyphHeight, Text);
+        }
+    }
+    SurfaceTicks = ReadTimestamp() - Start;
+    
+    Start = ReadTimestamp();
+    for (int Pass = 0; Pass < FONT_BENCHMARK_PASSES; Pass++) {
+        for (uint32_t Row = 0; Row < Rows; Row++) {
+            DrawTextToFramebuffer(&Cache, &Framebuffer, 0, Row * Cache.GlyphHeight, Text);
+        }
+    }
+    FramebufferTicks = ReadTimestamp() - Start;
+    
+    // The console is far slower, so it gets a fixed number of shorter lines
+    uint32_t ConOutColumns = Columns < SampleLength ? Columns : SampleLength;
+    Text[ConOutColumns] = 0;
+    
+    CLEAR_SCREEN();
+    Start = ReadTimestamp();
+    for (int Line = 0; Line < FONT_BENCHMARK_CONOUT_LINES; Line++) {
+        PRINTL(Text);
+    }
+    ConOutTicks = ReadTimestamp() - Start;
+    uint64_t ConOutGlyphs = (uint64_t)ConOutColumns * FONT_BENCHMARK_CONOUT_LINES;
+    
+    FreeSurface(&Surface);
+    GlyphCacheFree(&Cache);
+    
+    CLEAR_SCREEN();
+    PRINT(u"Glyph cache -> surface:     ");
+    PrintDec(BytesPerSecond(Glyphs, SurfaceTicks));
+    PRINTL(u" glyphs/s");
+    PRINT(u"Glyph cache -> framebuffer: ");
+    PrintDec(BytesPerSecond(Glyphs, FramebufferTicks));
+    PRINTL(u" glyphs/s");
+    PRINT(u"ConOut OutputString:        ");
+    PrintDec(BytesPerSecond(ConOutGlyphs, ConOutTicks));
+    PRINTL(u" glyphs/s");
+}
@@ -0,0 +1,73 @@
+// efi_font.h
+#ifndef TINYUEFI_FONT_H
+#define TINYUEFI_FONT_H
+
+#include "uefi_types.h"
+#include "efi_gop_protocol.h"
+#include "efi_gop_surface.h"
+#include "efi_gop_framebuffer.h"
+
+// PSF font signatures
+#define PSF1_MAGIC                    0x0436
+#define PSF2_MAGIC                    0x864AB572
+
+// Widest text run composed before a single framebuffer blit
+#define GLYPH_CACHE_LINE_CHARS        256
+
+// Work done by FontBenchmark
+#define FONT_BENCHMARK_PASSES         8
+#define FONT_BENCHMARK_CONOUT_LINES   40
+
+// 1-bit-per-pixel font, rows padded to whole bytes, most significant bit leftmost
+typedef struct {
+    uint32_t Width;
+    uint32_t Height;
+    uint32_t BytesPerRow;
+    uint32_t BytesPerGlyph;
+    uint32_t FirstChar;
+    uint32_t GlyphCount;
+    const uint8_t *Glyphs;
+} BITMAP_FONT;
+
+// Glyphs pre-expanded to pixels for one scale and color pair
+typedef struct {
+    const BITMAP_FONT *Font;
+    uint32_t Scale;
+    uint32_t GlyphWidth;
+    uint32_t GlyphHeight;
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL Foreground;
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL Background;
+    
+    // GlyphCount glyphs of GlyphWidth x GlyphHeight pixels, expanded on first use
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Pixels;
+    uint8_t *Expanded;
+    
+    // One composed run of text for framebuffer output
+    GOP_SURFACE Line;
+    
+    // Statistics
+    uint64_t GlyphsDrawn;
+    uint64_t GlyphsExpanded;
+} GLYPH_CACHE;
+
+// Font helpers
+const BITMAP_FONT *GetBuiltinFont(void);
+EFI_STATUS FontLoadPsf(BITMAP_FONT *Font, const void *Data, uint64_t Size);
+
+// Glyph cache helpers
+EFI_STATUS GlyphCacheInit(GLYPH_CACHE *Cache, const BITMAP_FONT *Font, uint32_t Scale, 
+                          const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Foreground, 
+                          const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Background);
+void GlyphCacheSetColors(GLYPH_CACHE *Cache, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Foreground, 
+                         const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Background);
+const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *GlyphCacheGet(GLYPH_CACHE *Cache, char16_t Char);
+void GlyphCacheFree(GLYPH_CACHE *Cache);
+
+// Text rendering ('\r' returns to the original X, '\n' also moves down a line)
+EFI_STATUS DrawTextToSurface(GLYPH_CACHE *Cache, GOP_SURFACE *Surface, 
+                             uint32_t X, uint32_t Y, const char16_t *Text);
+EFI_STATUS DrawTextToFramebuffer(GLYPH_CACHE *Cache, GOP_FRAMEBUFFER *Framebuffer, 
+                                 uint32_t X, uint32_t Y, const char16_t *Text);
+void FontBenchmark(void);
+
+#endif // TINYUEFI_FONT_H
@@ -0,0 +1,408 @@
+// efi_gop_framebuffer.c
+#include <immintrin.h>
+#include "efi_gop_framebuffer.h"
+#include "uefi_helpers.h"
+#include "efi_timer.h"
+#include "efi_cpu.h"
+
+// Store a native pixel of 2, 3 or 4 bytes
+static inline void StorePixel(uint8_t *Dest, uint32_t Value, uint32_t BytesPerPixel) {
+    Dest[0] = (uint8_t)Value;
+    Dest[1] = (uint8_t)(Value >> 8);
+    if (BytesPerPixel > 2) Dest[2] = (uint8_t)(Value >> 16);
+    if (BytesPerPixel > 3) Dest[3] = (uint8_t)(Value >> 24);
+}
+
+// Fill 32-bit pixels with non-temporal stores (the framebuffer is write-combined
+// and never read back, so there is no point dragging it through the cache)
+static void StreamFill32(uint32_t *Dest, uint32_t Value, uint64_t Count) {
+    if ((uintptr_t)Dest & 3) {
+        while (Count-- > 0) *Dest++ = Value;
+        return;
+    }
+    
+    while (Count > 0 && ((uintptr_t)Dest & 15)) {
+        *Dest++ = Value;
+        Count--;
+    }
+    
+    __m128i Wide = _mm_set1_epi32((int)Value);
+    while (Count >= 16) {
+        _mm_stream_si128((__m128i*)Dest + 0, Wide);
+        _mm_stream_si128((__m128i*)Dest + 1, Wide);
+        _mm_stream_si128((__m128i*)Dest + 2, Wide);
+        _mm_stream_si128((__m128i*)Dest + 3, Wide);
+        Dest += 16;
+        Count -= 16;
+    }
+    while (Count >= 4) {
+        _mm_stream_si128((__m128i*)Dest, Wide);
+        Dest += 4;
+        Count -= 4;
+    }
+    while (Count-- > 0) {
+        *Dest++ = Value;
+    }
+}
+
+// Copy 32-bit pixels with non-temporal stores, optionally swapping the
+// first and third bytes (BGRx <-> RGBx)
+static void StreamCopy32(uint32_t *Dest, const uint32_t *Src, uint64_t Count, bool SwapRedBlue) {
+    const __m128i GreenMask = _mm_set1_epi32((int)0xFF00FF00);
+    const __m128i LowMask = _mm_set1_epi32(0xFF);
+    
+#define SWAP_SCALAR(p)  (SwapRedBlue ? (((p) & 0xFF00FF00) | (((p) >> 16) & 0xFF) | (((p) & 0xFF) << 16)) : (p))
+    
+    if ((uintptr_t)Dest & 3) {
+        while (Count-- > 0) {
+            uint32_t Pixel = *Src++;
+            *Dest++ = SWAP_SCALAR(Pixel);
+        }
+        return;
+    }
+    
+    while (Count > 0 && ((uintptr_t)Dest & 15)) {
+        uint32_t Pixel = *Src++;
+        *Dest++ = SWAP_SCALAR(Pixel);
+        Count--;
+    }
+    
+    while (Count >= 4) {
+        __m128i Pixels = _mm_loadu_si128((const __m128i*)Src);
+        if (SwapRedBlue) {
+            Pixels = _mm_or_si128(_mm_and_si128(Pixels, GreenMask), 
+                     _mm_or_si128(_mm_and_si128(_mm_srli_epi32(Pixels, 16), LowMask),
+                                  _mm_slli_epi32(_mm_and_si128(Pixels, LowMask), 16)));
+        }
+        _mm_stream_si128((__m128i*)Dest, Pixels);
+        Dest += 4;
+        Src += 4;
+        Count -= 4;
+    }
+    
+    while (Count-- > 0) {
+        uint32_t Pixel = *Src++;
+        *Dest++ = SWAP_SCALAR(Pixel);
+    }
+    
+#undef SWAP_SCALAR
+}
+
+// Map the framebuffer of the current graphics mode
+EFI_STATUS FramebufferInit(GOP_FRAMEBUFFER *Framebuffer, EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop) {
+    if (Framebuffer == NULL || Gop == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *Info = Gop->Mode->Info;
+    EFI_PIXEL_BITMASK Masks = { 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000 };
+    
+    MemSet(Framebuffer, 0, sizeof(*Framebuffer));
+    Framebuffer->Gop = Gop;
+    Framebuffer->Base = (uint8_t*)(uintptr_t)Gop->Mode->FrameBufferBase;
+    Framebuffer->Size = Gop->Mode->FrameBufferSize;
+    Framebuffer->Width = Info->HorizontalResolution;
+    Framebuffer->Height = Info->VerticalResolution;
+    Framebuffer->PixelsPerScanLine = Info->PixelsPerScanLine;
+    Framebuffer->Format = Info->PixelFormat;
+    Framebuffer->Direct = true;
+    
+    switch (Info->PixelFormat) {
+    case PixelRedGreenBlueReserved8BitPerColor:
+        Masks.RedMask = 0x000000FF;
+        Masks.BlueMask = 0x00FF0000;
+        break;
+    case PixelBlueGreenRedReserved8BitPerColor:
+        break;
+    case PixelBitMask:
+        Masks = Info->PixelInformation;
+        break;
+    default:
+        Framebuffer->Direct = false;
+        break;
+    }
+    
+    // An empty bitmask leaves only Blt
+    if (EFI_ERROR(PixelBitmaskLayoutInit(&Framebuffer->Layout, &Masks))) {
+        Framebuffer->Direct = false;
+    }
+    Framebuffer->BytesPerPixel = Framebuffer->Direct ? Framebuffer->Layout.BytesPerPixel : 4;
+    
+    // Refuse to write outside what the firmware reported
+    uint64_t Needed = (uint64_t)Framebuffer->PixelsPerScanLine * Framebuffer->Height * 
+                      Framebuffer->BytesPerPixel;
+    if (Framebuffer->Base == NULL || Framebuffer->PixelsPerScanLine < Framebuffer->Width || 
+        Needed > Framebuffer->Size) {
+        Framebuffer->Direct = false;
+    }
+    
+    return EFI_SUCCESS;
+}
+
+// Convert a Blt pixel to the native framebuffer pixel value
+uint32_t FramebufferMapColor(GOP_FRAMEBUFFER *Framebuffer, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Color) {
+    if (Framebuffer == NULL || Color == NULL) {
+        return 0;
+    }
+    
+    return PixelToBitmask(Color, &Framebuffer->Layout);
+}
+
+// Read 32-bit pixels back from the framebuffer, optionally swapping red and
+// blue. Ordinary loads from write-combined memory are uncached and issued one
+// at a time; SSE4.1 streaming loads fetch whole lines instead.
+__attribute__((target("sse4.1")))
+static void StreamRead32(uint32_t *Dest, const uint32_t *Src, uint64_t Count, bool SwapRedBlue) {
+    const __m128i Shuffle = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    
+#define SWAP_SCALAR(p)  (SwapRedBlue ? (((p) & 0xFF00FF00) | (((p) >> 16) & 0xFF) | (((p) & 0xFF) << 16)) : (p))
+    
+    if (((uintptr_t)Src & 3) == 0) {
+        while (Count > 0 && ((uintptr_t)Src & 15)) {
+            uint32_t Pixel = *Src++;
+            *Dest++ = SWAP_SCALAR(Pixel);
+            Count--;
+        }
+        
+        while (Count >= 4) {
+            __m128i Pixels = _mm_stream_load_si128((__m128i*)Src);
+            if (SwapRedBlue) {
+                Pixels = _mm_shuffle_epi8(Pixels, Shuffle);
+            }
+            _mm_storeu_si128((__m128i*)Dest, Pixels);
+            Dest += 4;
+            Src += 4;
+            Count -= 4;
+        }
+    }
+    
+    while (Count-- > 0) {
+        uint32_t Pixel = *Src++;
+        *Dest++ = SWAP_SCALAR(Pixel);
+    }
+    
+#undef SWAP_SCALAR
+}
+
+// Clip a rectangle to the screen; false if nothing is left
+static bool ClipToFramebuffer(GOP_FRAMEBUFFER *Framebuffer, uint32_t X, uint32_t Y, 
+                              uint32_t *Width, uint32_t *Height) {
+    if (X >= Framebuffer->Width || Y >= Framebuffer->Height || *Width == 0 || *Height == 0) {
+        return false;
+    }
+    
+    if (*Width > Framebuffer->Width - X) {
+        *Width = Framebuffer->Width - X;
+    }
+    if (*Height > Framebuffer->Height - Y) {
+        *Height = Framebuffer->Height - Y;
+    }
+    
+    return true;
+}
+
+// Fill a rectangle of the screen with a solid color
+EFI_STATUS FramebufferFill(GOP_FRAMEBUFFER *Framebuffer, uint32_t X, uint32_t Y, 
+                          uint32_t Width, uint32_t Height, EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Color) {
+    if (Framebuffer == NULL || Color == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    if (!ClipToFramebuffer(Framebuffer, X, Y, &Width, &Height)) {
+        return EFI_SUCCESS;
+    }
+    
+    if (!Framebuffer->Direct) {
+        return Framebuffer->Gop->Blt(Framebuffer->Gop, Color, EfiBltVideoFill, 
+                                     0, 0, X, Y, Width, Height, 0);
+    }
+    
+    uint32_t Value = FramebufferMapColor(Framebuffer, Color);
+    uint64_t Pitch = (uint64_t)Framebuffer->PixelsPerScanLine * Framebuffer->BytesPerPixel;
+    uint8_t *Row = Framebuffer->Base + Y * Pitch + (uint64_t)X * Framebuffer->BytesPerPixel;
+    
+    for (uint32_t Line = 0; Line < Height; Line++) {
+        if (Framebuffer->BytesPerPixel == 4) {
+            StreamFill32((uint32_t*)Row, Value, Width);
+        } else {
+            for (uint32_t i = 0; i < Width; i++) {
+                StorePixel(Row + i * Framebuffer->BytesPerPixel, Value, Framebuffer->BytesPerPixel);
+            }
+        }
+        Row += Pitch;
+    }
+    
+    _mm_sfence();
+    return EFI_SUCCESS;
+}
+
+// Copy a bitmap (BitmapStride pixels per row) to the screen
+EFI_STATUS FramebufferBlit(GOP_FRAMEBUFFER *Framebuffer, uint32_t X, uint32_t Y, 
+                          uint32_t Width, uint32_t Height, 
+                          const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Bitmap, uint32_t BitmapStride) {
+    if (Framebuffer == NULL || Bitmap == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    if (!ClipToFramebuffer(Framebuffer, X, Y, &Width, &Height)) {
+        return EFI_SUCCESS;
+    }
+    
+    if (!Framebuffer->Direct) {
+        return Framebuffer->Gop->Blt(Framebuffer->Gop, (EFI_GRAPHICS_OUTPUT_BLT_PIXEL*)Bitmap, 
+                                     EfiBltBufferToVideo, 0, 0, X, Y, Width, Height, 
+                                     (uint64_t)BitmapStride * sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL));
+    }
+    
+    uint64_t Pitch = (uint64_t)Framebuffer->PixelsPerScanLine * Framebuffer->BytesPerPixel;
+    uint8_t *Row = Framebuffer->Base + Y * Pitch + (uint64_t)X * Framebuffer->BytesPerPixel;
+    
+    for (uint32_t Line = 0; Line < Height; Line++) {
+        switch (Framebuffer->Format) {
+        case PixelBlueGreenRedReserved8BitPerColor:
+            StreamCopy32((uint32_t*)Row, (const uint32_t*)Bitmap, Width, false);
+            break;
+        case PixelRedGreenBlueReserved8BitPerColor:
+            StreamCopy32((uint32_t*)Row, (const uint32_t*)Bitmap, Width, true);
+            break;
+        default:
+            PixelConvertBitmask(Row, Bitmap, Width, &Framebuffer->Layout);
+            break;
+        }
+        Row += Pitch;
+        Bitmap += BitmapStride;
+    }
+    
+    _mm_sfence();
+    return EFI_SUCCESS;
+}
+
+// Read a rectangle of the screen into Blt pixels (BitmapStride pixels per row)
+EFI_STATUS FramebufferRead(GOP_FRAMEBUFFER *Framebuffer, uint32_t X, uint32_t Y, 
+                          uint32_t Width, uint32_t Height, 
+                          EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Bitmap, uint32_t BitmapStride) {
+    if (Framebuffer == NULL || Bitmap == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    if (!ClipToFramebuffer(Framebuffer, X, Y, &Width, &Height)) {
+        return EFI_SUCCESS;
+    }
+    
+    if (!Framebuffer->Direct) {
+        return Framebuffer->Gop->Blt(Framebuffer->Gop, Bitmap, EfiBltVideoToBltBuffer, 
+                                     X, Y, 0, 0, Width, Height, 
+                                     (uint64_t)BitmapStride * sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL));
+    }
+    
+    uint64_t Pitch = (uint64_t)Framebuffer->PixelsPerScanLine * Framebuffer->BytesPerPixel;
+    const uint8_t *Row = Framebuffer->Base + Y * Pitch + (uint64_t)X * Framebuffer->BytesPerPixel;
+    bool Streaming = CpuHasFeature(CPU_FEATURE_SSE41);
+    
+    for (uint32_t Line = 0; Line < Height; Line++) {
+        switch (Framebuffer->Format) {
+        case PixelBlueGreenRedReserved8BitPerColor:
+        case PixelRedGreenBlueReserved8BitPerColor: {
+            bool Swap = Framebuffer->Format == PixelRedGreenBlueReserved8BitPerColor;
+            
+            if (Streaming) {
+                StreamRead32((uint32_t*)Bitmap, (const uint32_t*)Row, Width, Swap);
+            } else if (Swap) {
+                PixelSwapRedBlue(Bitmap, (const EFI_GRAPHICS_OUTPUT_BLT_PIXEL*)Row, Width);
+            } else {
+                PixelCopy(Bitmap, (const EFI_GRAPHICS_OUTPUT_BLT_PIXEL*)Row, Width);
+            }
+            break;
+        }
+        default:
+            for (uint32_t x = 0; x < Width; x++) {
+                const uint8_t *Native = Row + (uint64_t)x * Framebuffer->BytesPerPixel;
+                uint32_t Value = Native[0] | ((uint32_t)Native[1] << 8);
+                
+                if (Framebuffer->BytesPerPixel > 2) Value |= (uint32_t)Native[2] << 16;
+                if (Framebuffer->BytesPerPixel > 3) Value |= (uint32_t)Native[3] << 24;
+                PixelFromBitmask(Value, &Framebuffer->Layout, &Bitmap[x]);
+            }
+            break;
+        }
+        Row += Pitch;
+        Bitmap += BitmapStride;
+    }
+    
+    return EFI_SUCCESS;
+}
+
+// Compare direct framebuffer writes against the firmware Blt
+void FramebufferBenchmark(GOP_FRAMEBUFFER *Framebuffer) {
+    EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop;
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL Color;
+    uint64_t Start, DirectTicks, BltTicks;
+    
+    if (Framebuffer == NULL) {
+        return;
+    }
+    
+    Gop = Framebuffer->Gop;
+    uint32_t Width = Framebuffer->Width;
+    uint32_t Height = Framebuffer->Height;
+    uint64_t FrameBytes = (uint64_t)Width * Height * sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL);
+    uint64_t TotalBytes = FrameBytes * FRAMEBUFFER_BENCHMARK_FRAMES;
+    
+    if (!Framebuffer->Direct) {
+        PRINTL(u"Framebuffer benchmark: mode has no linear framebuffer");
+        return;
+    }
+    
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Bitmap = (EFI_GRAPHICS_OUTPUT_BLT_PIXEL*)AllocatePool(FrameBytes);
+    if (Bitmap == NULL) {
+        PRINTL(u"Framebuffer benchmark: out of memory");
+        return;
+    }
+    
+    for (uint64_t i = 0; i < (uint64_t)Width * Height; i++) {
+        GetPixelForRGB((uint8_t)i, (uint8_t)(i >> 8), (uint8_t)(i >> 16), &Bitmap[i]);
+    }
+    
+    // Solid fills
+    Start = ReadTimestamp();
+    for (int Frame = 0; Frame < FRAMEBUFFER_BENCHMARK_FRAMES; Frame++) {
+        GetPixelForRGB((uint8_t)(Frame * 16), 0x40, 0x80, &Color);
+        FramebufferFill(Framebuffer, 0, 0, Width, Height, &Color);
+    }
+    DirectTicks = ReadTimestamp() - Start;
+    
+    Start = ReadTimestamp();
+    for (int Frame = 0; Frame < FRAMEBUFFER_BENCHMARK_FRAMES; Frame++) {
+        GetPixelForRGB((uint8_t)(Frame * 16), 0x80, 0x40, &Color);
+        Gop->Blt(Gop, &Color, EfiBltVideoFill, 0, 0, 0, 0, Width, Height, 0);
+    }
+    BltTicks = ReadTimestamp() - Start;
+    
+    // Full-screen bitmap copies
+    Start = ReadTimestamp();
+    for (int Frame = 0; Frame < FRAMEBUFFER_BENCHMARK_FRAMES; Frame++) {
+        FramebufferBlit(Framebuffer, 0, 0, Width, Height, Bitmap, Width);
+    }
+    uint64_t DirectBlitTicks = ReadTimestamp() - Start;
+    
+    Start = ReadTimestamp();
+    for (int Frame = 0; Frame < FRAMEBUFFER_BENCHMARK_FRAMES; Frame++) {
+        Gop->Blt(Gop, Bitmap, EfiBltBufferToVideo, 0, 0, 0, 0, Width, Height, 
+                 (uint64_t)Width * sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL));
+    }
+    uint64_t BltBlitTicks = ReadTimestamp() - Start;
+    
+    FreePool(Bitmap);
+    
+    CLEAR_SCREEN();
+    PRINT(u"Fill   direct: ");
+    PrintThroughput(TotalBytes, DirectTicks);
+    PRINT(u"  Blt: ");
+    PrintThroughput(TotalBytes, BltTicks);
+    PRINTL(u"");
+    PRINT(u"Blit   direct: ");
+    PrintThroughput(TotalBytes, DirectBlitTicks);
+    PRINT(u"  Blt: ");
+    PrintThroughput(TotalBytes, BltBlitTicks);
+    PRINTL(u"");
+}
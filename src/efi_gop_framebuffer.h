@@ -0,0 +1,43 @@
+// efi_gop_framebuffer.h
+#ifndef TINYUEFI_GOP_FRAMEBUFFER_H
+#define TINYUEFI_GOP_FRAMEBUFFER_H
+
+#include "uefi_types.h"
+#include "efi_gop_protocol.h"
+#include "efi_pixel.h"
+
+// Iterations per measurement in FramebufferBenchmark
+#define FRAMEBUFFER_BENCHMARK_FRAMES  16
+
+// Direct view of the linear framebuffer for the current mode
+typedef struct {
+    EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop;
+    uint8_t *Base;
+    uint64_t Size;
+    uint32_t Width;
+    uint32_t Height;
+    uint32_t PixelsPerScanLine;
+    uint32_t BytesPerPixel;
+    EFI_GRAPHICS_PIXEL_FORMAT Format;
+    
+    // False when the mode is PixelBltOnly and every draw must use Blt
+    bool Direct;
+    
+    // Native pixel layout (also filled in for the RGB/BGR formats)
+    PIXEL_BITMASK_LAYOUT Layout;
+} GOP_FRAMEBUFFER;
+
+// Helper functions
+EFI_STATUS FramebufferInit(GOP_FRAMEBUFFER *Framebuffer, EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop);
+uint32_t FramebufferMapColor(GOP_FRAMEBUFFER *Framebuffer, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Color);
+EFI_STATUS FramebufferFill(GOP_FRAMEBUFFER *Framebuffer, uint32_t X, uint32_t Y, 
+                          uint32_t Width, uint32_t Height, EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Color);
+EFI_STATUS FramebufferBlit(GOP_FRAMEBUFFER *Framebuffer, uint32_t X, uint32_t Y, 
+                          uint32_t Width, uint32_t Height, 
+                          const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Bitmap, uint32_t BitmapStride);
+EFI_STATUS FramebufferRead(GOP_FRAMEBUFFER *Framebuffer, uint32_t X, uint32_t Y, 
+                          uint32_t Width, uint32_t Height, 
+                          EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Bitmap, uint32_t BitmapStride);
+void FramebufferBenchmark(GOP_FRAMEBUFFER *Framebuffer);
+
+#endif // TINYUEFI_GOP_FRAMEBUFFER_H
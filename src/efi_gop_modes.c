@@ -0,0 +1,344 @@
+// efi_gop_modes.c
+#include "efi_gop_modes.h"
+#include "uefi_helpers.h"
+#include "efi_timer.h"
+
+// Tables built so far, one per GOP instance
+static GOP_MODE_TABLE ModeTables[GOP_MODE_MAX_OUTPUTS];
+
+// Bytes per pixel implied by a mode's format
+static uint32_t ModeBytesPerPixel(const EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *Info) {
+    if (Info->PixelFormat != PixelBitMask) {
+        return 4;
+    }
+    
+    uint32_t Used = Info->PixelInformation.RedMask | Info->PixelInformation.GreenMask |
+                    Info->PixelInformation.BlueMask | Info->PixelInformation.ReservedMask;
+    uint32_t Bits = Used != 0 ? 32 - (uint32_t)__builtin_clz(Used) : 32;
+    
+    return (Bits + 7) / 8;
+}
+
+static void FillEntry(GOP_MODE_ENTRY *Entry, uint32_t Mode, const EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *Info) {
+    Entry->Mode = Mode;
+    Entry->Width = Info->HorizontalResolution;
+    Entry->Height = Info->VerticalResolution;
+    Entry->Format = Info->PixelFormat;
+    Entry->Bitmask = Info->PixelInformation;
+    Entry->PixelsPerScanLine = Info->PixelsPerScanLine;
+    Entry->BytesPerPixel = ModeBytesPerPixel(Info);
+}
+
+// Query every mode once. The current mode is read from Gop->Mode->Info
+// instead of going through QueryMode and its pool allocation.
+static EFI_STATUS BuildModeTable(GOP_MODE_TABLE *Table, EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop) {
+    uint32_t MaxMode = Gop->Mode->MaxMode;
+    uint64_t Start = ReadTimestamp();
+    
+    MemSet(Table, 0, sizeof(*Table));
+    Table->Entries = (GOP_MODE_ENTRY*)AllocatePool((uint64_t)(MaxMode ? MaxMode : 1) * sizeof(GOP_MODE_ENTRY));
+    if (Table->Entries == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    
+    for (uint32_t Mode = 0; Mode < MaxMode; Mode++) {
+        EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *Info = NULL;
+        uint64_t SizeOfInfo;
+        
+        if (Mode == Gop->Mode->Mode && Gop->Mode->Info != NULL) {
+            FillEntry(&Table->Entries[Table->Count++], Mode, Gop->Mode->Info);
+            continue;
+        }
+        
+        if (EFI_ERROR(Gop->QueryMode(Gop, Mode, &SizeOfInfo, &Info))) {
+            continue;
+        }
+        FillEntry(&Table->Entries[Table->Count++], Mode, Info);
+        FreePool(Info);
+    }
+    
+    Table->Gop = Gop;
+    Table->BuildTicks = ReadTimestamp() - Start;
+    return EFI_SUCCESS;
+}
+
+// Mode table for a GOP instance, built on first use
+EFI_STATUS GopModeTableGet(EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop, GOP_MODE_TABLE **Table) {
+    GOP_MODE_TABLE *Free = NULL;
+    EFI_STATUS Status;
+    
+    if (Gop == NULL || Gop->Mode == NULL || Table == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    for (uint32_t i = 0; i < GOP_MODE_MAX_OUTPUTS; i++) {
+        if (ModeTables[i].Gop == Gop) {
+            *Table = &ModeTables[i];
+            return EFI_SUCCESS;
+        }
+        if (Free == NULL && ModeTables[i].Gop == NULL) {
+            Free = &ModeTables[i];
+        }
+    }
+    
+    if (Free == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    
+    Status = BuildModeTable(Free, Gop);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    *Table = Free;
+    return EFI_SUCCESS;
+}
+
+// Forget the table of a GOP instance (e.g. after a display change)
+void GopModeTableFree(EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop) {
+    for (uint32_t i = 0; i < GOP_MODE_MAX_OUTPUTS; i++) {
+        if (ModeTables[i].Gop == Gop && Gop != NULL) {
+            FreePool(ModeTables[i].Entries);
+            MemSet(&ModeTables[i], 0, sizeof(ModeTables[i]));
+        }
+    }
+}
+
+// Entry of the mode the GOP is in right now
+const GOP_MODE_ENTRY *GopModeCurrent(GOP_MODE_TABLE *Table) {
+    if (Table == NULL || Table->Gop == NULL) {
+        return NULL;
+    }
+    
+    for (uint32_t i = 0; i < Table->Count; i++) {
+        if (Table->Entries[i].Mode == Table->Gop->Mode->Mode) {
+            return &Table->Entries[i];
+        }
+    }
+    
+    return NULL;
+}
+
+static inline uint64_t ModeArea(const GOP_MODE_ENTRY *Entry) {
+    return (uint64_t)Entry->Width * Entry->Height;
+}
+
+static bool ModeUsable(const GOP_MODE_ENTRY *Entry, const GOP_MODE_REQUEST *Request) {
+    if (Entry->Width == 0 || Entry->Height == 0) {
+        return false;
+    }
+    
+    return !Request->LinearOnly || Entry->Format != PixelBltOnly;
+}
+
+// Larger area wins; equal areas prefer an unpadded scan line, then BGR
+// (which the framebuffer writes without a swizzle), then the lower mode
+static bool ModeBetter(const GOP_MODE_ENTRY *Entry, const GOP_MODE_ENTRY *Best) {
+    if (Best == NULL || ModeArea(Entry) != ModeArea(Best)) {
+        return Best == NULL || ModeArea(Entry) > ModeArea(Best);
+    }
+    
+    bool EntryPacked = Entry->PixelsPerScanLine == Entry->Width;
+    bool BestPacked = Best->PixelsPerScanLine == Best->Width;
+    if (EntryPacked != BestPacked) {
+        return EntryPacked;
+    }
+    
+    bool EntryBgr = Entry->Format == PixelBlueGreenRedReserved8BitPerColor;
+    bool BestBgr = Best->Format == PixelBlueGreenRedReserved8BitPerColor;
+    return EntryBgr && !BestBgr;
+}
+
+static const GOP_MODE_ENTRY *SelectMaxArea(GOP_MODE_TABLE *Table, const GOP_MODE_REQUEST *Request) {
+    const GOP_MODE_ENTRY *Best = NULL;
+    
+    for (uint32_t i = 0; i < Table->Count; i++) {
+        if (ModeUsable(&Table->Entries[i], Request) && ModeBetter(&Table->Entries[i], Best)) {
+            Best = &Table->Entries[i];
+        }
+    }
+    
+    return Best;
+}
+
+static const GOP_MODE_ENTRY *SelectPreferred(GOP_MODE_TABLE *Table, const GOP_MODE_REQUEST *Request) {
+    const GOP_MODE_ENTRY *Exact = NULL;
+    const GOP_MODE_ENTRY *Covering = NULL;
+    
+    for (uint32_t i = 0; i < Table->Count; i++) {
+        const GOP_MODE_ENTRY *Entry = &Table->Entries[i];
+        
+        if (!ModeUsable(Entry, Request) || Entry->Width < Request->Width || Entry->Height < Request->Height) {
+            continue;
+        }
+        
+        if (Entry->Width == Request->Width && Entry->Height == Request->Height) {
+            if (ModeBetter(Entry, Exact)) {
+                Exact = Entry;
+            }
+        } else if (Covering == NULL || ModeArea(Entry) < ModeArea(Covering)) {
+            Covering = Entry;
+        }
+    }
+    
+    if (Exact != NULL) {
+        return Exact;
+    }
+    
+    return Covering != NULL ? Covering : SelectMaxArea(Table, Request);
+}
+
+static const GOP_MODE_ENTRY *SelectStrideAligned(GOP_MODE_TABLE *Table, const GOP_MODE_REQUEST *Request) {
+    uint32_t Alignment = Request->StrideAlignment ? Request->StrideAlignment : GOP_MODE_DEFAULT_ALIGNMENT;
+    const GOP_MODE_ENTRY *Best = NULL;
+    
+    for (uint32_t i = 0; i < Table->Count; i++) {
+        const GOP_MODE_ENTRY *Entry = &Table->Entries[i];
+        uint64_t Pitch = (uint64_t)Entry->PixelsPerScanLine * Entry->BytesPerPixel;
+        
+        if (ModeUsable(Entry, Request) && Pitch % Alignment == 0 && ModeBetter(Entry, Best)) {
+            Best = Entry;
+        }
+    }
+    
+    return Best != NULL ? Best : SelectMaxArea(Table, Request);
+}
+
+static const GOP_MODE_ENTRY *SelectKeepCurrent(GOP_MODE_TABLE *Table, const GOP_MODE_REQUEST *Request) {
+    const GOP_MODE_ENTRY *Current = GopModeCurrent(Table);
+    
+    if (Current != NULL && ModeUsable(Current, Request) &&
+        Current->Width >= Request->Width && Current->Height >= Request->Height) {
+        return Current;
+    }
+    
+    return SelectMaxArea(Table, Request);
+}
+
+// Pick a mode from the table without touching the hardware
+EFI_STATUS GopModeSelect(GOP_MODE_TABLE *Table, const GOP_MODE_REQUEST *Request,
+                         const GOP_MODE_ENTRY **Entry) {
+    const GOP_MODE_ENTRY *Selected = NULL;
+    
+    if (Table == NULL || Request == NULL || Entry == NULL || Request->Policy >= GopModePolicyMax) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    switch (Request->Policy) {
+    case GopModePolicyPreferred:
+        Selected = SelectPreferred(Table, Request);
+        break;
+    case GopModePolicyStrideAligned:
+        Selected = SelectStrideAligned(Table, Request);
+        break;
+    case GopModePolicyKeepCurrent:
+        Selected = SelectKeepCurrent(Table, Request);
+        break;
+    default:
+        Selected = SelectMaxArea(Table, Request);
+        break;
+    }
+    
+    if (Selected == NULL) {
+        return EFI_NOT_FOUND;
+    }
+    
+    *Entry = Selected;
+    return EFI_SUCCESS;
+}
+
+// Select a mode and switch to it, skipping SetMode when it is already current.
+// Anything holding framebuffer geometry must be re-initialized after a switch.
+EFI_STATUS GopModeApply(GOP_MODE_TABLE *Table, const GOP_MODE_REQUEST *Request) {
+    const GOP_MODE_ENTRY *Entry;
+    EFI_STATUS Status = GopModeSelect(Table, Request, &Entry);
+    
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    if (Entry->Mode == Table->Gop->Mode->Mode) {
+        Table->SetModeSkipped++;
+        return EFI_SUCCESS;
+    }
+    
+    uint64_t Start = ReadTimestamp();
+    Status = Table->Gop->SetMode(Table->Gop, Entry->Mode);
+    Table->LastSetModeTicks = ReadTimestamp() - Start;
+    Table->TotalSetModeTicks += Table->LastSetModeTicks;
+    Table->SetModeCalls++;
+    
+    return Status;
+}
+
+// Largest-area mode straight from QueryMode, for a GOP that has no table
+// (every slot taken or the entry array could not be allocated)
+EFI_STATUS GopModeApplyLargest(EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop) {
+    GOP_MODE_REQUEST Request = { GopModePolicyMaxArea, 0, 0, 0, false };
+    GOP_MODE_ENTRY Best;
+    bool Found = false;
+    
+    if (Gop == NULL || Gop->Mode == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    for (uint32_t Mode = 0; Mode < Gop->Mode->MaxMode; Mode++) {
+        EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *Info = NULL;
+        GOP_MODE_ENTRY Entry;
+        uint64_t SizeOfInfo;
+        
+        if (EFI_ERROR(Gop->QueryMode(Gop, Mode, &SizeOfInfo, &Info))) {
+            continue;
+        }
+        FillEntry(&Entry, Mode, Info);
+        FreePool(Info);
+        
+        if (ModeUsable(&Entry, &Request) && ModeBetter(&Entry, Found ? &Best : NULL)) {
+            Best = Entry;
+            Found = true;
+        }
+    }
+    
+    if (!Found) {
+        return EFI_NOT_FOUND;
+    }
+    
+    return Best.Mode == Gop->Mode->Mode ? EFI_SUCCESS : Gop->SetMode(Gop, Best.Mode);
+}
+
+// Print every mode and the enumeration and mode-set timings
+void GopModeTablePrint(GOP_MODE_TABLE *Table) {
+    static const char16_t *FormatNames[PixelFormatMax] = { u"RGB", u"BGR", u"BitMask", u"BltOnly" };
+    
+    if (Table == NULL || Table->Gop == NULL) {
+        return;
+    }
+    
+    for (uint32_t i = 0; i < Table->Count; i++) {
+        const GOP_MODE_ENTRY *Entry = &Table->Entries[i];
+        const char16_t *Marker = Entry->Mode == Table->Gop->Mode->Mode ? u"* " : u"  ";
+        const char16_t *Format = Entry->Format < PixelFormatMax ? FormatNames[Entry->Format] : u"?";
+        
+        PRINT(Marker);
+        PrintDec(Entry->Mode);
+        PRINT(u": ");
+        PrintDec(Entry->Width);
+        PRINT(u"x");
+        PrintDec(Entry->Height);
+        PRINT(u" ");
+        PRINT(Format);
+        PRINT(u" stride ");
+        PrintDec(Entry->PixelsPerScanLine);
+        PRINTL(u"");
+    }
+    
+    PRINT(u"Enumeration: ");
+    PrintDec(TimestampToMicroseconds(Table->BuildTicks));
+    PRINT(u" us, mode sets: ");
+    PrintDec(Table->SetModeCalls);
+    PRINT(u" (");
+    PrintDec(Table->SetModeSkipped);
+    PRINT(u" skipped), last ");
+    PrintDec(TimestampToMicroseconds(Table->LastSetModeTicks));
+    PRINTL(u" us");
+}
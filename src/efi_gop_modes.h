@@ -0,0 +1,67 @@
+// efi_gop_modes.h
+#ifndef TINYUEFI_GOP_MODES_H
+#define TINYUEFI_GOP_MODES_H
+
+#include "uefi_types.h"
+#include "efi_gop_protocol.h"
+
+// GOP instances whose mode tables are kept
+#define GOP_MODE_MAX_OUTPUTS          4
+
+// Stride alignment used by GopModePolicyStrideAligned when none is given
+#define GOP_MODE_DEFAULT_ALIGNMENT    64
+
+// One video mode as reported by QueryMode
+typedef struct {
+    uint32_t Mode;
+    uint32_t Width;
+    uint32_t Height;
+    EFI_GRAPHICS_PIXEL_FORMAT Format;
+    EFI_PIXEL_BITMASK Bitmask;
+    uint32_t PixelsPerScanLine;
+    uint32_t BytesPerPixel;
+} GOP_MODE_ENTRY;
+
+// Every mode of one GOP instance, enumerated once
+typedef struct {
+    EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop;
+    GOP_MODE_ENTRY *Entries;
+    uint32_t Count;
+    uint64_t BuildTicks;
+    
+    // Mode-set statistics
+    uint64_t SetModeCalls;
+    uint64_t SetModeSkipped;
+    uint64_t LastSetModeTicks;
+    uint64_t TotalSetModeTicks;
+} GOP_MODE_TABLE;
+
+// How GopModeSelect picks a mode
+typedef enum {
+    GopModePolicyMaxArea,         // Largest Width * Height
+    GopModePolicyPreferred,       // Width x Height, else the smallest mode covering it
+    GopModePolicyStrideAligned,   // Largest mode whose scan line is a multiple of StrideAlignment bytes
+    GopModePolicyKeepCurrent,     // Current mode if at least Width x Height, else largest
+    GopModePolicyMax
+} GOP_MODE_POLICY;
+
+// Selection request; fields a policy does not use are ignored
+typedef struct {
+    GOP_MODE_POLICY Policy;
+    uint32_t Width;
+    uint32_t Height;
+    uint32_t StrideAlignment;
+    bool LinearOnly;              // Skip PixelBltOnly modes
+} GOP_MODE_REQUEST;
+
+// Helper functions
+EFI_STATUS GopModeTableGet(EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop, GOP_MODE_TABLE **Table);
+void GopModeTableFree(EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop);
+const GOP_MODE_ENTRY *GopModeCurrent(GOP_MODE_TABLE *Table);
+EFI_STATUS GopModeSelect(GOP_MODE_TABLE *Table, const GOP_MODE_REQUEST *Request,
+                         const GOP_MODE_ENTRY **Entry);
+EFI_STATUS GopModeApply(GOP_MODE_TABLE *Table, const GOP_MODE_REQUEST *Request);
+EFI_STATUS GopModeApplyLargest(EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop);
+void GopModeTablePrint(GOP_MODE_TABLE *Table);
+
+#endif // TINYUEFI_GOP_MODES_H
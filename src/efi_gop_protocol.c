@@ -2,55 +2,40 @@
 #include "efi_gop_protocol.h"
 #include "uefi_helpers.h"
 #include "efi_protocol_discovery.h"
+#include "efi_protocol_cache.h"
+#include "efi_gop_modes.h"
 
 // GUID for graphics output protocol
 EFI_GUID gEfiGraphicsOutputProtocolGuid = {
     0x9042a9de, 0x23dc, 0x4a38, {0x96, 0xfb, 0x7a, 0xde, 0xd0, 0x80, 0x51, 0x6a}
 };
 
-// Get the graphics output protocol
+// Get the graphics output protocol, cached until another one is installed
 EFI_STATUS GetGraphicsOutputProtocol(EFI_GRAPHICS_OUTPUT_PROTOCOL **Gop) {
-    return LocateProtocol(&gEfiGraphicsOutputProtocolGuid, (void**)Gop);
+    return CachedLocateProtocol(&gEfiGraphicsOutputProtocolGuid, (void**)Gop);
 }
 
-// Set the best available graphics mode (highest resolution)
+// Set the best available graphics mode (largest area). Modes are enumerated
+// once per GOP and SetMode is skipped when the best mode is already current.
+// A GOP that gets no table (all slots taken) is scanned directly instead.
 EFI_STATUS SetBestGraphicsMode(EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop) {
+    GOP_MODE_REQUEST Request = { GopModePolicyMaxArea, 0, 0, 0, false };
+    GOP_MODE_TABLE *Table;
     EFI_STATUS Status;
-    uint32_t MaxWidth = 0;
-    uint32_t MaxHeight = 0;
-    uint32_t BestMode = 0;
-    EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *Info = NULL;
-    uint64_t SizeOfInfo;
     
     if (Gop == NULL) {
         return EFI_INVALID_PARAMETER;
     }
     
-    // Find the best available mode
-    for (uint32_t Mode = 0; Mode < Gop->Mode->MaxMode; Mode++) {
-        Status = Gop->QueryMode(Gop, Mode, &SizeOfInfo, &Info);
-        if (EFI_ERROR(Status)) {
-            continue;
-        }
-        
-        if (Info->HorizontalResolution > MaxWidth && 
-            Info->VerticalResolution > MaxHeight) {
-            MaxWidth = Info->HorizontalResolution;
-            MaxHeight = Info->VerticalResolution;
-            BestMode = Mode;
-        }
-        
-        FreePool(Info);
-    }
-    
-    // Set the best mode
-    if (MaxWidth > 0 && MaxHeight > 0) {
-        Status = Gop->SetMode(Gop, BestMode);
-        return Status;
+    Status = GopModeTableGet(Gop, &Table);
+    if (Status == EFI_OUT_OF_RESOURCES) {
+        Status = GopModeApplyLargest(Gop);
+    } else if (!EFI_ERROR(Status)) {
+        Status = GopModeApply(Table, &Request);
     }
     
     // If no suitable mode was found, keep the current mode
-    return EFI_SUCCESS;
+    return Status == EFI_NOT_FOUND ? EFI_SUCCESS : Status;
 }
 
 // Clear the screen with a specific color
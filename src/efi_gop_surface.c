@@ -0,0 +1,351 @@
+// efi_gop_surface.c
+#include "efi_gop_surface.h"
+#include "uefi_helpers.h"
+#include "efi_pixel.h"
+
+// Clip a rectangle to [0, Width) x [0, Height); false if nothing is left
+bool ClipRect(GOP_RECT *Rect, uint32_t Width, uint32_t Height) {
+    if (Rect == NULL || Rect->X >= Width || Rect->Y >= Height || 
+        Rect->Width == 0 || Rect->Height == 0) {
+        return false;
+    }
+    
+    if (Rect->Width > Width - Rect->X) {
+        Rect->Width = Width - Rect->X;
+    }
+    if (Rect->Height > Height - Rect->Y) {
+        Rect->Height = Height - Rect->Y;
+    }
+    
+    return true;
+}
+
+// Smallest rectangle covering both inputs
+void UnionRect(const GOP_RECT *A, const GOP_RECT *B, GOP_RECT *Result) {
+    uint64_t Right = (uint64_t)A->X + A->Width;
+    uint64_t Bottom = (uint64_t)A->Y + A->Height;
+    uint64_t OtherRight = (uint64_t)B->X + B->Width;
+    uint64_t OtherBottom = (uint64_t)B->Y + B->Height;
+    
+    uint32_t X = A->X < B->X ? A->X : B->X;
+    uint32_t Y = A->Y < B->Y ? A->Y : B->Y;
+    
+    Result->X = X;
+    Result->Y = Y;
+    Result->Width = (uint32_t)((Right > OtherRight ? Right : OtherRight) - X);
+    Result->Height = (uint32_t)((Bottom > OtherBottom ? Bottom : OtherBottom) - Y);
+}
+
+// Check whether two rectangles share any pixel
+bool RectsOverlap(const GOP_RECT *A, const GOP_RECT *B) {
+    return (uint64_t)A->X < (uint64_t)B->X + B->Width && 
+           (uint64_t)B->X < (uint64_t)A->X + A->Width &&
+           (uint64_t)A->Y < (uint64_t)B->Y + B->Height && 
+           (uint64_t)B->Y < (uint64_t)A->Y + A->Height;
+}
+
+static inline uint64_t RectArea(const GOP_RECT *Rect) {
+    return (uint64_t)Rect->Width * Rect->Height;
+}
+
+// Area shared by two rectangles
+static uint64_t OverlapArea(const GOP_RECT *A, const GOP_RECT *B) {
+    if (!RectsOverlap(A, B)) {
+        return 0;
+    }
+    
+    uint64_t Left = A->X > B->X ? A->X : B->X;
+    uint64_t Top = A->Y > B->Y ? A->Y : B->Y;
+    uint64_t Right = (uint64_t)A->X + A->Width;
+    uint64_t Bottom = (uint64_t)A->Y + A->Height;
+    uint64_t OtherRight = (uint64_t)B->X + B->Width;
+    uint64_t OtherBottom = (uint64_t)B->Y + B->Height;
+    
+    if (OtherRight < Right) Right = OtherRight;
+    if (OtherBottom < Bottom) Bottom = OtherBottom;
+    
+    return (Right - Left) * (Bottom - Top);
+}
+
+// Allocate a surface with Stride == Width
+EFI_STATUS CreateSurface(GOP_SURFACE *Surface, uint32_t Width, uint32_t Height) {
+    if (Surface == NULL || Width == 0 || Height == 0) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    Surface->Pixels = (EFI_GRAPHICS_OUTPUT_BLT_PIXEL*)AllocatePool(
+        (uint64_t)Width * Height * sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL));
+    if (Surface->Pixels == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    
+    Surface->Width = Width;
+    Surface->Height = Height;
+    Surface->Stride = Width;
+    return EFI_SUCCESS;
+}
+
+// Release a surface allocated with CreateSurface
+void FreeSurface(GOP_SURFACE *Surface) {
+    if (Surface == NULL) {
+        return;
+    }
+    
+    FreePool(Surface->Pixels);
+    Surface->Pixels = NULL;
+    Surface->Width = 0;
+    Surface->Height = 0;
+}
+
+// Fill a (clipped) rectangle of a surface with a solid color
+void SurfaceFill(GOP_SURFACE *Surface, uint32_t X, uint32_t Y, uint32_t Width, uint32_t Height, 
+                 EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Color) {
+    GOP_RECT Rect = { X, Y, Width, Height };
+    
+    if (Surface == NULL || Color == NULL || !ClipRect(&Rect, Surface->Width, Surface->Height)) {
+        return;
+    }
+    
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Row = Surface->Pixels + (uint64_t)Rect.Y * Surface->Stride + Rect.X;
+    
+    for (uint32_t Line = 0; Line < Rect.Height; Line++) {
+        PixelFill(Row, Color, Rect.Width);
+        Row += Surface->Stride;
+    }
+}
+
+// Copy a bitmap into a surface, clipping it to the surface bounds
+void SurfaceBlit(GOP_SURFACE *Surface, uint32_t X, uint32_t Y, uint32_t Width, uint32_t Height, 
+                 const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Bitmap, uint32_t BitmapStride) {
+    GOP_RECT Rect = { X, Y, Width, Height };
+    
+    if (Surface == NULL || Bitmap == NULL || !ClipRect(&Rect, Surface->Width, Surface->Height)) {
+        return;
+    }
+    
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Row = Surface->Pixels + (uint64_t)Rect.Y * Surface->Stride + Rect.X;
+    
+    for (uint32_t Line = 0; Line < Rect.Height; Line++) {
+        PixelCopy(Row, Bitmap, Rect.Width);
+        Row += Surface->Stride;
+        Bitmap += BitmapStride;
+    }
+}
+
+// Alpha-blend a bitmap (Reserved is the alpha) onto a surface, clipping it to the surface bounds
+void SurfaceBlend(GOP_SURFACE *Surface, uint32_t X, uint32_t Y, uint32_t Width, uint32_t Height, 
+                  const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Bitmap, uint32_t BitmapStride) {
+    GOP_RECT Rect = { X, Y, Width, Height };
+    
+    if (Surface == NULL || Bitmap == NULL || !ClipRect(&Rect, Surface->Width, Surface->Height)) {
+        return;
+    }
+    
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Row = Surface->Pixels + (uint64_t)Rect.Y * Surface->Stride + Rect.X;
+    
+    for (uint32_t Line = 0; Line < Rect.Height; Line++) {
+        PixelBlend(Row, Bitmap, Rect.Width);
+        Row += Surface->Stride;
+        Bitmap += BitmapStride;
+    }
+}
+
+// Create a back buffer matching the current graphics mode
+EFI_STATUS BackBufferCreate(GOP_BACK_BUFFER *BackBuffer, EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop) {
+    EFI_STATUS Status;
+    
+    if (BackBuffer == NULL || Gop == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    MemSet(BackBuffer, 0, sizeof(*BackBuffer));
+    BackBuffer->Gop = Gop;
+    
+    Status = CreateSurface(&BackBuffer->Surface, 
+                           Gop->Mode->Info->HorizontalResolution, 
+                           Gop->Mode->Info->VerticalResolution);
+    return Status;
+}
+
+// Release the back buffer surface
+void BackBufferDestroy(GOP_BACK_BUFFER *BackBuffer) {
+    if (BackBuffer == NULL) {
+        return;
+    }
+    
+    FreeSurface(&BackBuffer->Surface);
+    BackBuffer->DirtyCount = 0;
+}
+
+// Remove a dirty rectangle by moving the last one into its slot
+static void RemoveDirty(GOP_BACK_BUFFER *BackBuffer, uint32_t Index) {
+    BackBuffer->Dirty[Index] = BackBuffer->Dirty[--BackBuffer->DirtyCount];
+}
+
+// Record a changed region. Rectangles are clipped, and merged with existing
+// ones whenever the union costs little more than presenting them separately.
+void BackBufferMarkDirty(GOP_BACK_BUFFER *BackBuffer, uint32_t X, uint32_t Y, 
+                         uint32_t Width, uint32_t Height) {
+    GOP_RECT Rect = { X, Y, Width, Height };
+    GOP_RECT Merged;
+    
+    if (BackBuffer == NULL || 
+        !ClipRect(&Rect, BackBuffer->Surface.Width, BackBuffer->Surface.Height)) {
+        return;
+    }
+    
+    for (;;) {
+        bool Changed = false;
+        
+        for (uint32_t i = 0; i < BackBuffer->DirtyCount; i++) {
+            GOP_RECT *Other = &BackBuffer->Dirty[i];
+            
+            UnionRect(&Rect, Other, &Merged);
+            uint64_t Covered = RectArea(&Rect) + RectArea(Other) - OverlapArea(&Rect, Other);
+            if (RectArea(&Merged) - Covered <= BACK_BUFFER_MERGE_SLACK) {
+                Rect = Merged;
+                RemoveDirty(BackBuffer, i);
+                Changed = true;
+                break;
+            }
+        }
+        
+        if (Changed) {
+            continue;
+        }
+        
+        if (BackBuffer->DirtyCount < BACK_BUFFER_MAX_DIRTY) {
+            break;
+        }
+        
+        // List is full: fold into whichever rectangle grows the least
+        uint32_t Best = 0;
+        uint64_t BestGrowth = (uint64_t)-1;
+        for (uint32_t i = 0; i < BackBuffer->DirtyCount; i++) {
+            UnionRect(&Rect, &BackBuffer->Dirty[i], &Merged);
+            uint64_t Growth = RectArea(&Merged) - RectArea(&BackBuffer->Dirty[i]);
+            if (Growth < BestGrowth) {
+                BestGrowth = Growth;
+                Best = i;
+            }
+        }
+        
+        UnionRect(&Rect, &BackBuffer->Dirty[Best], &Rect);
+        RemoveDirty(BackBuffer, Best);
+    }
+    
+    BackBuffer->Dirty[BackBuffer->DirtyCount++] = Rect;
+}
+
+// Fill the whole back buffer
+void BackBufferClear(GOP_BACK_BUFFER *BackBuffer, EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Color) {
+    if (BackBuffer == NULL) {
+        return;
+    }
+    
+    BackBufferDrawRectangle(BackBuffer, 0, 0, 
+                            BackBuffer->Surface.Width, BackBuffer->Surface.Height, Color);
+}
+
+// Fill a rectangle in the back buffer
+void BackBufferDrawRectangle(GOP_BACK_BUFFER *BackBuffer, uint32_t X, uint32_t Y, 
+                             uint32_t Width, uint32_t Height, EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Color) {
+    if (BackBuffer == NULL || Color == NULL) {
+        return;
+    }
+    
+    SurfaceFill(&BackBuffer->Surface, X, Y, Width, Height, Color);
+    BackBufferMarkDirty(BackBuffer, X, Y, Width, Height);
+}
+
+// Copy a bitmap (Width pixels per row) into the back buffer
+void BackBufferDrawBitmap(GOP_BACK_BUFFER *BackBuffer, uint32_t X, uint32_t Y, 
+                          uint32_t Width, uint32_t Height, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Bitmap) {
+    if (BackBuffer == NULL || Bitmap == NULL) {
+        return;
+    }
+    
+    SurfaceBlit(&BackBuffer->Surface, X, Y, Width, Height, Bitmap, Width);
+    BackBufferMarkDirty(BackBuffer, X, Y, Width, Height);
+}
+
+// Push all dirty regions to the screen
+EFI_STATUS BackBufferPresent(GOP_BACK_BUFFER *BackBuffer) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    GOP_RECT Bounds;
+    uint64_t DirtyArea = 0;
+    
+    if (BackBuffer == NULL || BackBuffer->Surface.Pixels == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    BackBuffer->LastFrameBytes = 0;
+    BackBuffer->LastFrameBlts = 0;
+    
+    if (BackBuffer->DirtyCount == 0) {
+        return EFI_SUCCESS;
+    }
+    
+    // One transfer of the bounding box beats several calls when the
+    // rectangles nearly tile it
+    Bounds = BackBuffer->Dirty[0];
+    for (uint32_t i = 0; i < BackBuffer->DirtyCount; i++) {
+        UnionRect(&Bounds, &BackBuffer->Dirty[i], &Bounds);
+        DirtyArea += RectArea(&BackBuffer->Dirty[i]);
+    }
+    
+    if (RectArea(&Bounds) <= DirtyArea + (uint64_t)BACK_BUFFER_MERGE_SLACK * (BackBuffer->DirtyCount - 1)) {
+        BackBuffer->Dirty[0] = Bounds;
+        BackBuffer->DirtyCount = 1;
+    }
+    
+    uint64_t Delta = (uint64_t)BackBuffer->Surface.Stride * sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL);
+    
+    for (uint32_t i = 0; i < BackBuffer->DirtyCount; i++) {
+        GOP_RECT *Rect = &BackBuffer->Dirty[i];
+        
+        Status = BackBuffer->Gop->Blt(
+            BackBuffer->Gop,
+            BackBuffer->Surface.Pixels,
+            EfiBltBufferToVideo,
+            Rect->X, Rect->Y,
+            Rect->X, Rect->Y,
+            Rect->Width, Rect->Height,
+            Delta
+        );
+        if (EFI_ERROR(Status)) {
+            // Keep the rectangles not yet presented for the next attempt
+            for (uint32_t j = i; j < BackBuffer->DirtyCount; j++) {
+                BackBuffer->Dirty[j - i] = BackBuffer->Dirty[j];
+            }
+            BackBuffer->DirtyCount -= i;
+            return Status;
+        }
+        
+        BackBuffer->LastFrameBytes += RectArea(Rect) * sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL);
+        BackBuffer->LastFrameBlts++;
+    }
+    
+    BackBuffer->DirtyCount = 0;
+    BackBuffer->FramesPresented++;
+    BackBuffer->TotalBytes += BackBuffer->LastFrameBytes;
+    BackBuffer->TotalBlts += BackBuffer->LastFrameBlts;
+    return Status;
+}
+
+// Print present statistics
+void BackBufferPrintStats(GOP_BACK_BUFFER *BackBuffer) {
+    if (BackBuffer == NULL) {
+        return;
+    }
+    
+    PRINT(u"Frames: ");
+    PrintDec(BackBuffer->FramesPresented);
+    PRINT(u"  Last frame: ");
+    PrintDec(BackBuffer->LastFrameBytes);
+    PRINT(u" bytes in ");
+    PrintDec(BackBuffer->LastFrameBlts);
+    PRINT(u" Blt calls  Average: ");
+    PrintDec(BackBuffer->FramesPresented ? BackBuffer->TotalBytes / BackBuffer->FramesPresented : 0);
+    PRINTL(u" bytes/frame");
+}
@@ -0,0 +1,74 @@
+// efi_gop_surface.h
+#ifndef TINYUEFI_GOP_SURFACE_H
+#define TINYUEFI_GOP_SURFACE_H
+
+#include "uefi_types.h"
+#include "efi_gop_protocol.h"
+
+// Dirty rectangles tracked per frame before they are forcibly merged
+#define BACK_BUFFER_MAX_DIRTY         32
+
+// Merge two dirty rectangles when their union wastes at most this many
+// extra pixels (a Blt call costs roughly this much in transfer)
+#define BACK_BUFFER_MERGE_SLACK       4096
+
+// Rectangle in pixel coordinates
+typedef struct {
+    uint32_t X;
+    uint32_t Y;
+    uint32_t Width;
+    uint32_t Height;
+} GOP_RECT;
+
+// CPU-side pixel surface (Stride is in pixels)
+typedef struct {
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Pixels;
+    uint32_t Width;
+    uint32_t Height;
+    uint32_t Stride;
+} GOP_SURFACE;
+
+// Off-screen copy of the screen with dirty-rectangle tracking
+typedef struct {
+    EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop;
+    GOP_SURFACE Surface;
+    GOP_RECT Dirty[BACK_BUFFER_MAX_DIRTY];
+    uint32_t DirtyCount;
+    
+    // Statistics
+    uint64_t FramesPresented;
+    uint64_t LastFrameBytes;
+    uint64_t LastFrameBlts;
+    uint64_t TotalBytes;
+    uint64_t TotalBlts;
+} GOP_BACK_BUFFER;
+
+// Rectangle helpers
+bool ClipRect(GOP_RECT *Rect, uint32_t Width, uint32_t Height);
+void UnionRect(const GOP_RECT *A, const GOP_RECT *B, GOP_RECT *Result);
+bool RectsOverlap(const GOP_RECT *A, const GOP_RECT *B);
+
+// Surface helpers
+EFI_STATUS CreateSurface(GOP_SURFACE *Surface, uint32_t Width, uint32_t Height);
+void FreeSurface(GOP_SURFACE *Surface);
+void SurfaceFill(GOP_SURFACE *Surface, uint32_t X, uint32_t Y, uint32_t Width, uint32_t Height, 
+                 EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Color);
+void SurfaceBlit(GOP_SURFACE *Surface, uint32_t X, uint32_t Y, uint32_t Width, uint32_t Height, 
+                 const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Bitmap, uint32_t BitmapStride);
+void SurfaceBlend(GOP_SURFACE *Surface, uint32_t X, uint32_t Y, uint32_t Width, uint32_t Height, 
+                  const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Bitmap, uint32_t BitmapStride);
+
+// Back buffer helpers
+EFI_STATUS BackBufferCreate(GOP_BACK_BUFFER *BackBuffer, EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop);
+void BackBufferDestroy(GOP_BACK_BUFFER *BackBuffer);
+void BackBufferMarkDirty(GOP_BACK_BUFFER *BackBuffer, uint32_t X, uint32_t Y, 
+                         uint32_t Width, uint32_t Height);
+void BackBufferClear(GOP_BACK_BUFFER *BackBuffer, EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Color);
+void BackBufferDrawRectangle(GOP_BACK_BUFFER *BackBuffer, uint32_t X, uint32_t Y, 
+                             uint32_t Width, uint32_t Height, EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Color);
+void BackBufferDrawBitmap(GOP_BACK_BUFFER *BackBuffer, uint32_t X, uint32_t Y, 
+                          uint32_t Width, uint32_t Height, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Bitmap);
+EFI_STATUS BackBufferPresent(GOP_BACK_BUFFER *BackBuffer);
+void BackBufferPrintStats(GOP_BACK_BUFFER *BackBuffer);
+
+#endif // TINYUEFI_GOP_SURFACE_H
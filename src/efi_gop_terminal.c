@@ -0,0 +1,406 @@
+// efi_gop_terminal.c
+#include "efi_gop_terminal.h"
+#include "uefi_helpers.h"
+#include "efi_timer.h"
+
+// EFI text colors (Blue, Green, Red, Reserved)
+static const EFI_GRAPHICS_OUTPUT_BLT_PIXEL TerminalPalette[16] = {
+    { 0x00, 0x00, 0x00, 0 },    // EFI_BLACK
+    { 0xAA, 0x00, 0x00, 0 },    // EFI_BLUE
+    { 0x00, 0xAA, 0x00, 0 },    // EFI_GREEN
+    { 0xAA, 0xAA, 0x00, 0 },    // EFI_CYAN
+    { 0x00, 0x00, 0xAA, 0 },    // EFI_RED
+    { 0xAA, 0x00, 0xAA, 0 },    // EFI_MAGENTA
+    { 0x00, 0x55, 0xAA, 0 },    // EFI_BROWN
+    { 0xAA, 0xAA, 0xAA, 0 },    // EFI_LIGHTGRAY
+    { 0x55, 0x55, 0x55, 0 },    // EFI_DARKGRAY
+    { 0xFF, 0x55, 0x55, 0 },    // EFI_LIGHTBLUE
+    { 0x55, 0xFF, 0x55, 0 },    // EFI_LIGHTGREEN
+    { 0xFF, 0xFF, 0x55, 0 },    // EFI_LIGHTCYAN
+    { 0x55, 0x55, 0xFF, 0 },    // EFI_LIGHTRED
+    { 0xFF, 0x55, 0xFF, 0 },    // EFI_LIGHTMAGENTA
+    { 0x55, 0xFF, 0xFF, 0 },    // EFI_YELLOW
+    { 0xFF, 0xFF, 0xFF, 0 },    // EFI_WHITE
+};
+
+// Attribute used after Reset
+#define TERMINAL_DEFAULT_ATTRIBUTE    (EFI_LIGHTGRAY | EFI_BACKGROUND_BLACK)
+
+// The protocol is the first member of GOP_TERMINAL
+static inline GOP_TERMINAL *TerminalFromProtocol(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL *This) {
+    return (GOP_TERMINAL*)This;
+}
+
+// Clear one text row (or the rest of it from Column) to the background color
+static EFI_STATUS ClearTextRow(GOP_TERMINAL *Terminal, uint32_t Row, uint32_t Column) {
+    return FramebufferFill(&Terminal->Framebuffer, Column * Terminal->Glyphs.GlyphWidth, 
+                           Row * Terminal->Glyphs.GlyphHeight, 
+                           (Terminal->Columns - Column) * Terminal->Glyphs.GlyphWidth, 
+                           Terminal->Glyphs.GlyphHeight, &Terminal->Glyphs.Background);
+}
+
+// Move every row up by one with a single video-to-video Blt and blank the last row
+static EFI_STATUS ScrollUp(GOP_TERMINAL *Terminal) {
+    EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop = Terminal->Framebuffer.Gop;
+    uint64_t LineHeight = Terminal->Glyphs.GlyphHeight;
+    EFI_STATUS Status;
+    
+    if (Terminal->Rows > 1) {
+        Status = Gop->Blt(Gop, NULL, EfiBltVideoToVideo, 0, LineHeight, 0, 0, 
+                          (uint64_t)Terminal->Columns * Terminal->Glyphs.GlyphWidth, 
+                          (Terminal->Rows - 1) * LineHeight, 0);
+        if (EFI_ERROR(Status)) {
+            return Status;
+        }
+    }
+    
+    Terminal->LinesScrolled++;
+    return ClearTextRow(Terminal, Terminal->Rows - 1, 0);
+}
+
+// Advance to the start of the next row, scrolling at the bottom
+static EFI_STATUS NewLine(GOP_TERMINAL *Terminal) {
+    Terminal->Mode.CursorColumn = 0;
+    
+    if ((uint32_t)Terminal->Mode.CursorRow + 1 < Terminal->Rows) {
+        Terminal->Mode.CursorRow++;
+        return EFI_SUCCESS;
+    }
+    
+    return ScrollUp(Terminal);
+}
+
+// Draw the buffered run of characters at its starting column
+static EFI_STATUS FlushRun(GOP_TERMINAL *Terminal, char16_t *Run, uint32_t *Length, uint32_t Column) {
+    if (*Length == 0) {
+        return EFI_SUCCESS;
+    }
+    
+    Run[*Length] = 0;
+    Terminal->CharactersWritten += *Length;
+    *Length = 0;
+    
+    return DrawTextToFramebuffer(&Terminal->Glyphs, &Terminal->Framebuffer, 
+                                 Column * Terminal->Glyphs.GlyphWidth, 
+                                 (uint32_t)Terminal->Mode.CursorRow * Terminal->Glyphs.GlyphHeight, Run);
+}
+
+static EFI_STATUS TerminalOutputString(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL *This, const char16_t *String) {
+    GOP_TERMINAL *Terminal = TerminalFromProtocol(This);
+    char16_t Run[GLYPH_CACHE_LINE_CHARS + 1];
+    uint32_t RunLength = 0;
+    uint32_t RunColumn = 0;
+    EFI_STATUS Status = EFI_SUCCESS;
+    
+    if (This == NULL || String == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    for (; *String != 0 && !EFI_ERROR(Status); String++) {
+        char16_t Char = *String;
+        
+        switch (Char) {
+        case u'\r':
+            Status = FlushRun(Terminal, Run, &RunLength, RunColumn);
+            Terminal->Mode.CursorColumn = 0;
+            continue;
+        case u'\n':
+            // Like the firmware console, LF only moves down a row
+            Status = FlushRun(Terminal, Run, &RunLength, RunColumn);
+            if (!EFI_ERROR(Status)) {
+                int32_t Column = Terminal->Mode.CursorColumn;
+                Status = NewLine(Terminal);
+                Terminal->Mode.CursorColumn = Column;
+            }
+            continue;
+        case u'\b':
+            Status = FlushRun(Terminal, Run, &RunLength, RunColumn);
+            if (Terminal->Mode.CursorColumn > 0) {
+                Terminal->Mode.CursorColumn--;
+            }
+            continue;
+        default:
+            break;
+        }
+        
+        // Wrap at the right edge
+        if ((uint32_t)Terminal->Mode.CursorColumn >= Terminal->Columns) {
+            Status = FlushRun(Terminal, Run, &RunLength, RunColumn);
+            if (!EFI_ERROR(Status)) {
+                Status = NewLine(Terminal);
+            }
+            if (EFI_ERROR(Status)) {
+                break;
+            }
+        }
+        
+        if (RunLength == 0) {
+            RunColumn = (uint32_t)Terminal->Mode.CursorColumn;
+        }
+        Run[RunLength++] = Char;
+        Terminal->Mode.CursorColumn++;
+        
+        if (RunLength == GLYPH_CACHE_LINE_CHARS) {
+            Status = FlushRun(Terminal, Run, &RunLength, RunColumn);
+        }
+    }
+    
+    if (!EFI_ERROR(Status)) {
+        Status = FlushRun(Terminal, Run, &RunLength, RunColumn);
+    }
+    
+    return Status;
+}
+
+// Every character has a glyph (missing ones fall back to '?')
+static EFI_STATUS TerminalTestString(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL *This, const char16_t *String) {
+    return (This == NULL || String == NULL) ? EFI_INVALID_PARAMETER : EFI_SUCCESS;
+}
+
+static EFI_STATUS TerminalQueryMode(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL *This, uint64_t ModeNumber, 
+                                    uint64_t *Columns, uint64_t *Rows) {
+    GOP_TERMINAL *Terminal = TerminalFromProtocol(This);
+    
+    if (This == NULL || Columns == NULL || Rows == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    if (ModeNumber != 0) {
+        return EFI_UNSUPPORTED;
+    }
+    
+    *Columns = Terminal->Columns;
+    *Rows = Terminal->Rows;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS TerminalSetAttribute(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL *This, uint64_t Attribute) {
+    GOP_TERMINAL *Terminal = TerminalFromProtocol(This);
+    
+    if (This == NULL || Attribute > 0x7F) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    Terminal->Mode.Attribute = (int32_t)Attribute;
+    GlyphCacheSetColors(&Terminal->Glyphs, &TerminalPalette[Attribute & 0x0F], 
+                        &TerminalPalette[(Attribute >> 4) & 0x07]);
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS TerminalClearScreen(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL *This) {
+    GOP_TERMINAL *Terminal = TerminalFromProtocol(This);
+    
+    if (This == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    Terminal->Mode.CursorColumn = 0;
+    Terminal->Mode.CursorRow = 0;
+    return FramebufferFill(&Terminal->Framebuffer, 0, 0, Terminal->Framebuffer.Width, 
+                           Terminal->Framebuffer.Height, &Terminal->Glyphs.Background);
+}
+
+static EFI_STATUS TerminalSetMode(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL *This, uint64_t ModeNumber) {
+    if (This == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    if (ModeNumber != 0) {
+        return EFI_UNSUPPORTED;
+    }
+    
+    return TerminalClearScreen(This);
+}
+
+static EFI_STATUS TerminalReset(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL *This, bool ExtendedVerification) {
+    EFI_STATUS Status = TerminalSetAttribute(This, TERMINAL_DEFAULT_ATTRIBUTE);
+    
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    return TerminalClearScreen(This);
+}
+
+static EFI_STATUS TerminalSetCursorPosition(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL *This, 
+                                            uint64_t Column, uint64_t Row) {
+    GOP_TERMINAL *Terminal = TerminalFromProtocol(This);
+    
+    if (This == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    if (Column >= Terminal->Columns || Row >= Terminal->Rows) {
+        return EFI_UNSUPPORTED;
+    }
+    
+    Terminal->Mode.CursorColumn = (int32_t)Column;
+    Terminal->Mode.CursorRow = (int32_t)Row;
+    return EFI_SUCCESS;
+}
+
+// The cursor is tracked but not drawn
+static EFI_STATUS TerminalEnableCursor(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL *This, bool Visible) {
+    GOP_TERMINAL *Terminal = TerminalFromProtocol(This);
+    
+    if (This == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    Terminal->Mode.CursorVisible = Visible;
+    return EFI_SUCCESS;
+}
+
+// Recompute the system table checksum after swapping console pointers
+static void UpdateSystemTableCrc(void) {
+    EFI_CALCULATE_CRC32 CalculateCrc32 = (EFI_CALCULATE_CRC32)ST->BootServices->CalculateCrc32;
+    
+    if (CalculateCrc32 == NULL) {
+        return;
+    }
+    
+    ST->Hdr.CRC32 = 0;
+    CalculateCrc32(ST, ST->Hdr.HeaderSize, &ST->Hdr.CRC32);
+}
+
+// Set up a terminal on the current graphics mode. Font NULL uses the built-in
+// font and Scale 0 picks the smallest scale giving at most
+// GOP_TERMINAL_TARGET_COLUMNS columns.
+EFI_STATUS GopTerminalInit(GOP_TERMINAL *Terminal, EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop, 
+                           const BITMAP_FONT *Font, uint32_t Scale) {
+    EFI_STATUS Status;
+    
+    if (Terminal == NULL || Gop == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    MemSet(Terminal, 0, sizeof(*Terminal));
+    if (Font == NULL) {
+        Font = GetBuiltinFont();
+    }
+    
+    Status = FramebufferInit(&Terminal->Framebuffer, Gop);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    if (Scale == 0) {
+        uint32_t TargetWidth = Font->Width * GOP_TERMINAL_TARGET_COLUMNS;
+        Scale = (Terminal->Framebuffer.Width + TargetWidth - 1) / TargetWidth;
+        if (Scale == 0) {
+            Scale = 1;
+        }
+    }
+    
+    Status = GlyphCacheInit(&Terminal->Glyphs, Font, Scale, 
+                            &TerminalPalette[TERMINAL_DEFAULT_ATTRIBUTE & 0x0F], 
+                            &TerminalPalette[(TERMINAL_DEFAULT_ATTRIBUTE >> 4) & 0x07]);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    Terminal->Columns = Terminal->Framebuffer.Width / Terminal->Glyphs.GlyphWidth;
+    Terminal->Rows = Terminal->Framebuffer.Height / Terminal->Glyphs.GlyphHeight;
+    if (Terminal->Columns == 0 || Terminal->Rows == 0) {
+        GlyphCacheFree(&Terminal->Glyphs);
+        return EFI_UNSUPPORTED;
+    }
+    
+    Terminal->Mode.MaxMode = 1;
+    Terminal->Mode.Mode = 0;
+    Terminal->Mode.Attribute = TERMINAL_DEFAULT_ATTRIBUTE;
+    Terminal->Mode.CursorVisible = false;
+    
+    Terminal->Protocol.Reset = TerminalReset;
+    Terminal->Protocol.OutputString = TerminalOutputString;
+    Terminal->Protocol.TestString = TerminalTestString;
+    Terminal->Protocol.QueryMode = TerminalQueryMode;
+    Terminal->Protocol.SetMode = TerminalSetMode;
+    Terminal->Protocol.SetAttribute = TerminalSetAttribute;
+    Terminal->Protocol.ClearScreen = TerminalClearScreen;
+    Terminal->Protocol.SetCursorPosition = TerminalSetCursorPosition;
+    Terminal->Protocol.EnableCursor = TerminalEnableCursor;
+    Terminal->Protocol.Mode = &Terminal->Mode;
+    
+    return TerminalClearScreen(&Terminal->Protocol);
+}
+
+// Route ST->ConOut (and StdErr when it shares the console) to the terminal
+EFI_STATUS GopTerminalInstall(GOP_TERMINAL *Terminal) {
+    if (Terminal == NULL || Terminal->Protocol.OutputString == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    if (Terminal->Installed) {
+        return EFI_SUCCESS;
+    }
+    
+    Terminal->PreviousConOut = ST->ConOut;
+    Terminal->PreviousStdErr = ST->StdErr;
+    
+    ST->ConOut = &Terminal->Protocol;
+    if (Terminal->PreviousStdErr == Terminal->PreviousConOut) {
+        ST->StdErr = &Terminal->Protocol;
+    }
+    UpdateSystemTableCrc();
+    
+    Terminal->Installed = true;
+    return EFI_SUCCESS;
+}
+
+// Give the consoles back to the firmware
+EFI_STATUS GopTerminalUninstall(GOP_TERMINAL *Terminal) {
+    if (Terminal == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    if (!Terminal->Installed) {
+        return EFI_NOT_FOUND;
+    }
+    
+    ST->ConOut = Terminal->PreviousConOut;
+    ST->StdErr = Terminal->PreviousStdErr;
+    UpdateSystemTableCrc();
+    
+    Terminal->Installed = false;
+    return EFI_SUCCESS;
+}
+
+void GopTerminalFree(GOP_TERMINAL *Terminal) {
+    if (Terminal == NULL) {
+        return;
+    }
+    
+    if (Terminal->Installed) {
+        GopTerminalUninstall(Terminal);
+    }
+    GlyphCacheFree(&Terminal->Glyphs);
+}
+
+// Time a screenful of scrolling lines on one console
+static uint64_t TimeScrolling(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL *Console) {
+    static const char16_t Line[] = u"Scrolling benchmark: the quick brown fox jumps over the lazy dog\r\n";
+    uint64_t Start;
+    
+    Console->ClearScreen(Console);
+    Start = ReadTimestamp();
+    for (int i = 0; i < GOP_TERMINAL_BENCHMARK_LINES; i++) {
+        Console->OutputString(Console, Line);
+    }
+    
+    return ReadTimestamp() - Start;
+}
+
+// Compare scrolling output on the firmware console and the terminal
+void GopTerminalBenchmark(GOP_TERMINAL *Terminal) {
+    if (Terminal == NULL) {
+        return;
+    }
+    
+    EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL *Firmware = Terminal->Installed ? Terminal->PreviousConOut : ST->ConOut;
+    uint64_t FirmwareTicks = TimeScrolling(Firmware);
+    uint64_t TerminalTicks = TimeScrolling(&Terminal->Protocol);
+    
+    CLEAR_SCREEN();
+    PRINT(u"Firmware ConOut: ");
+    PrintDec(BytesPerSecond(GOP_TERMINAL_BENCHMARK_LINES, FirmwareTicks));
+    PRINTL(u" lines/s");
+    PRINT(u"GOP terminal:    ");
+    PrintDec(BytesPerSecond(GOP_TERMINAL_BENCHMARK_LINES, TerminalTicks));
+    PRINTL(u" lines/s");
+}
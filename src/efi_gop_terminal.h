@@ -0,0 +1,45 @@
+// efi_gop_terminal.h
+#ifndef TINYUEFI_GOP_TERMINAL_H
+#define TINYUEFI_GOP_TERMINAL_H
+
+#include "uefi_types.h"
+#include "efi_gop_protocol.h"
+#include "efi_gop_framebuffer.h"
+#include "efi_font.h"
+
+// Automatic scaling aims for at most this many columns
+#define GOP_TERMINAL_TARGET_COLUMNS   128
+
+// Lines printed per console by GopTerminalBenchmark
+#define GOP_TERMINAL_BENCHMARK_LINES  200
+
+// Text console drawn through GOP. Protocol must stay the first member so
+// the protocol functions can recover the terminal from This.
+typedef struct {
+    EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL Protocol;
+    SIMPLE_TEXT_OUTPUT_MODE Mode;
+    
+    GOP_FRAMEBUFFER Framebuffer;
+    GLYPH_CACHE Glyphs;
+    uint32_t Columns;
+    uint32_t Rows;
+    
+    // Consoles replaced by GopTerminalInstall
+    EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL *PreviousConOut;
+    EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL *PreviousStdErr;
+    bool Installed;
+    
+    // Statistics
+    uint64_t CharactersWritten;
+    uint64_t LinesScrolled;
+} GOP_TERMINAL;
+
+// Helper functions
+EFI_STATUS GopTerminalInit(GOP_TERMINAL *Terminal, EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop, 
+                           const BITMAP_FONT *Font, uint32_t Scale);
+EFI_STATUS GopTerminalInstall(GOP_TERMINAL *Terminal);
+EFI_STATUS GopTerminalUninstall(GOP_TERMINAL *Terminal);
+void GopTerminalFree(GOP_TERMINAL *Terminal);
+void GopTerminalBenchmark(GOP_TERMINAL *Terminal);
+
+#endif // TINYUEFI_GOP_TERMINAL_H
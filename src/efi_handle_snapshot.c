@@ -0,0 +1,438 @@
+// efi_handle_snapshot.c
+#include "efi_handle_snapshot.h"
+#include "uefi_helpers.h"
+#include "efi_timer.h"
+
+// What ProtocolsPerHandle returned for one handle while building
+typedef struct {
+    EFI_GUID **Guids;
+    uint64_t Count;
+} HANDLE_PROTOCOLS;
+
+static inline void LoadGuid(const EFI_GUID *Guid, uint64_t *Words) {
+    __builtin_memcpy(Words, Guid, 2 * sizeof(uint64_t));
+}
+
+static inline uint32_t HashGuid(const uint64_t *Words) {
+    uint64_t Hash = (Words[0] ^ (Words[1] * 0x9e3779b97f4a7c15ULL)) * 0x9e3779b97f4a7c15ULL;
+    return (uint32_t)(Hash >> 32);
+}
+
+static inline uint32_t HashHandle(EFI_HANDLE Handle) {
+    uint64_t Hash = (uint64_t)(uintptr_t)Handle * 0x9e3779b97f4a7c15ULL;
+    return (uint32_t)(Hash >> 32);
+}
+
+// Power of two at least twice Entries
+static uint32_t SlotCount(uint64_t Entries) {
+    uint32_t Slots = HANDLE_SNAPSHOT_MIN_SLOTS;
+    while (Slots < 2 * Entries) {
+        Slots <<= 1;
+    }
+    return Slots;
+}
+
+static void *Carve(uint8_t **Cursor, uint64_t Size) {
+    void *Block = *Cursor;
+    *Cursor += Size;
+    return Block;
+}
+
+static void Clear(HANDLE_SNAPSHOT *Snapshot) {
+    Snapshot->HandleCount = 0;
+    Snapshot->ProtocolCount = 0;
+    Snapshot->PairCount = 0;
+}
+
+// Lay the arrays out in one block, growing it when the database outgrew it
+static EFI_STATUS Reserve(HANDLE_SNAPSHOT *Snapshot, uint64_t HandleCount, uint64_t PairCount) {
+    uint32_t HandleSlots = SlotCount(HandleCount);
+    uint32_t GuidSlots = SlotCount(PairCount);
+    
+    // 8-byte members first so every array stays aligned
+    uint64_t Size = (HandleCount + PairCount) * sizeof(EFI_HANDLE) +
+                    PairCount * sizeof(EFI_GUID) +
+                    ((HandleCount + 1) + PairCount + (PairCount + 2)) * sizeof(uint32_t) +
+                    ((uint64_t)HandleSlots + GuidSlots) * sizeof(uint32_t);
+    
+    if (Size > Snapshot->StorageSize) {
+        FreePool(Snapshot->Storage);
+        Snapshot->Storage = AllocatePool(Size);
+        Snapshot->StorageSize = Snapshot->Storage != NULL ? Size : 0;
+        if (Snapshot->Storage == NULL) {
+            return EFI_OUT_OF_RESOURCES;
+        }
+    }
+    
+    uint8_t *Cursor = (uint8_t*)Snapshot->Storage;
+    Snapshot->Handles = (EFI_HANDLE*)Carve(&Cursor, HandleCount * sizeof(EFI_HANDLE));
+    Snapshot->ProtocolHandles = (EFI_HANDLE*)Carve(&Cursor, PairCount * sizeof(EFI_HANDLE));
+    Snapshot->Guids = (EFI_GUID*)Carve(&Cursor, PairCount * sizeof(EFI_GUID));
+    Snapshot->HandleFirst = (uint32_t*)Carve(&Cursor, (HandleCount + 1) * sizeof(uint32_t));
+    Snapshot->HandleProtocols = (uint32_t*)Carve(&Cursor, PairCount * sizeof(uint32_t));
+    Snapshot->ProtocolFirst = (uint32_t*)Carve(&Cursor, (PairCount + 2) * sizeof(uint32_t));
+    Snapshot->HandleSlots = (uint32_t*)Carve(&Cursor, HandleSlots * sizeof(uint32_t));
+    Snapshot->GuidSlots = (uint32_t*)Carve(&Cursor, GuidSlots * sizeof(uint32_t));
+    Snapshot->HandleSlotMask = HandleSlots - 1;
+    Snapshot->GuidSlotMask = GuidSlots - 1;
+    
+    MemSet(Snapshot->HandleSlots, 0, HandleSlots * sizeof(uint32_t));
+    MemSet(Snapshot->GuidSlots, 0, GuidSlots * sizeof(uint32_t));
+    return EFI_SUCCESS;
+}
+
+static void AddHandle(HANDLE_SNAPSHOT *Snapshot, EFI_HANDLE Handle) {
+    uint32_t Slot = HashHandle(Handle) & Snapshot->HandleSlotMask;
+    while (Snapshot->HandleSlots[Slot] != 0) {
+        Slot = (Slot + 1) & Snapshot->HandleSlotMask;
+    }
+    
+    Snapshot->Handles[Snapshot->HandleCount] = Handle;
+    Snapshot->HandleSlots[Slot] = ++Snapshot->HandleCount;
+}
+
+// Number of Guid, adding it when new. ProtocolFirst[Number + 2] counts the
+// handles carrying it until the build turns the counts into offsets.
+static uint32_t AddProtocol(HANDLE_SNAPSHOT *Snapshot, const EFI_GUID *Guid) {
+    uint64_t Words[2];
+    uint64_t Probe[2];
+    
+    LoadGuid(Guid, Words);
+    uint32_t Slot = HashGuid(Words) & Snapshot->GuidSlotMask;
+    while (Snapshot->GuidSlots[Slot] != 0) {
+        uint32_t Number = Snapshot->GuidSlots[Slot] - 1;
+        LoadGuid(&Snapshot->Guids[Number], Probe);
+        if (Probe[0] == Words[0] && Probe[1] == Words[1]) {
+            return Number;
+        }
+        Slot = (Slot + 1) & Snapshot->GuidSlotMask;
+    }
+    
+    uint32_t Number = Snapshot->ProtocolCount++;
+    __builtin_memcpy(&Snapshot->Guids[Number], Guid, sizeof(EFI_GUID));
+    Snapshot->ProtocolFirst[Number + 2] = 0;
+    Snapshot->GuidSlots[Slot] = Number + 1;
+    return Number;
+}
+
+// Turn the protocol-grouped counts into offsets and fill ProtocolHandles.
+// Handles go in by number, so each group keeps the firmware's order.
+static void IndexByProtocol(HANDLE_SNAPSHOT *Snapshot) {
+    uint32_t *First = Snapshot->ProtocolFirst;
+    
+    First[0] = 0;
+    First[1] = 0;
+    for (uint32_t p = 0; p < Snapshot->ProtocolCount; p++) {
+        First[p + 2] += First[p + 1];
+    }
+    
+    // First[p + 1] is the fill cursor of protocol p and ends at its end,
+    // which is where protocol p + 1 starts
+    for (uint32_t h = 0; h < Snapshot->HandleCount; h++) {
+        for (uint32_t i = Snapshot->HandleFirst[h]; i < Snapshot->HandleFirst[h + 1]; i++) {
+            uint32_t Protocol = Snapshot->HandleProtocols[i];
+            Snapshot->ProtocolHandles[First[Protocol + 1]++] = Snapshot->Handles[h];
+        }
+    }
+}
+
+// Read the whole handle database: one LocateHandleBuffer for every handle,
+// then one ProtocolsPerHandle per handle. Call again after a hotplug; the
+// arrays are rebuilt in place when they still fit.
+EFI_STATUS HandleSnapshotBuild(HANDLE_SNAPSHOT *Snapshot) {
+    EFI_HANDLE *Buffer = NULL;
+    uint64_t BufferCount = 0;
+    uint64_t PairCount = 0;
+    
+    if (Snapshot == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    uint64_t Start = ReadTimestamp();
+    Clear(Snapshot);
+    Snapshot->Vanished = 0;
+    Snapshot->FirmwareQueries = 1;
+    
+    EFI_LOCATE_HANDLE_BUFFER LocateHandleBuffer = (EFI_LOCATE_HANDLE_BUFFER)ST->BootServices->LocateHandleBuffer;
+    EFI_PROTOCOLS_PER_HANDLE ProtocolsPerHandle = (EFI_PROTOCOLS_PER_HANDLE)ST->BootServices->ProtocolsPerHandle;
+    
+    EFI_STATUS Status = LocateHandleBuffer(AllHandles, NULL, NULL, &BufferCount, &Buffer);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    HANDLE_PROTOCOLS *Lists = (HANDLE_PROTOCOLS*)AllocatePool(BufferCount * sizeof(HANDLE_PROTOCOLS));
+    if (Lists == NULL) {
+        FreePool(Buffer);
+        return EFI_OUT_OF_RESOURCES;
+    }
+    
+    // A handle uninstalled since LocateHandleBuffer fails here and is left out
+    for (uint64_t h = 0; h < BufferCount; h++) {
+        Snapshot->FirmwareQueries++;
+        if (EFI_ERROR(ProtocolsPerHandle(Buffer[h], &Lists[h].Guids, &Lists[h].Count))) {
+            Lists[h].Guids = NULL;
+            Lists[h].Count = 0;
+            Snapshot->Vanished++;
+        }
+        PairCount += Lists[h].Count;
+    }
+    
+    Status = Reserve(Snapshot, BufferCount, PairCount);
+    if (!EFI_ERROR(Status)) {
+        uint32_t Pair = 0;
+        
+        for (uint64_t h = 0; h < BufferCount; h++) {
+            if (Lists[h].Guids == NULL) {
+                continue;
+            }
+            
+            Snapshot->HandleFirst[Snapshot->HandleCount] = Pair;
+            AddHandle(Snapshot, Buffer[h]);
+            for (uint64_t i = 0; i < Lists[h].Count; i++) {
+                uint32_t Protocol = AddProtocol(Snapshot, Lists[h].Guids[i]);
+                Snapshot->ProtocolFirst[Protocol + 2]++;
+                Snapshot->HandleProtocols[Pair++] = Protocol;
+            }
+        }
+        Snapshot->HandleFirst[Snapshot->HandleCount] = Pair;
+        Snapshot->PairCount = Pair;
+        
+        IndexByProtocol(Snapshot);
+        Snapshot->Builds++;
+    }
+    
+    for (uint64_t h = 0; h < BufferCount; h++) {
+        FreePool(Lists[h].Guids);
+    }
+    FreePool(Lists);
+    FreePool(Buffer);
+    
+    Snapshot->BuildTicks = ReadTimestamp() - Start;
+    return Status;
+}
+
+void HandleSnapshotFree(HANDLE_SNAPSHOT *Snapshot) {
+    if (Snapshot == NULL) {
+        return;
+    }
+    
+    FreePool(Snapshot->Storage);
+    MemSet(Snapshot, 0, sizeof(*Snapshot));
+}
+
+uint32_t HandleSnapshotFindHandle(const HANDLE_SNAPSHOT *Snapshot, EFI_HANDLE Handle) {
+    if (Snapshot == NULL || Snapshot->HandleCount == 0) {
+        return HANDLE_SNAPSHOT_NONE;
+    }
+    
+    uint32_t Slot = HashHandle(Handle) & Snapshot->HandleSlotMask;
+    while (Snapshot->HandleSlots[Slot] != 0) {
+        uint32_t Number = Snapshot->HandleSlots[Slot] - 1;
+        if (Snapshot->Handles[Number] == Handle) {
+            return Number;
+        }
+        Slot = (Slot + 1) & Snapshot->HandleSlotMask;
+    }
+    return HANDLE_SNAPSHOT_NONE;
+}
+
+uint32_t HandleSnapshotFindProtocol(const HANDLE_SNAPSHOT *Snapshot, const EFI_GUID *Protocol) {
+    uint64_t Words[2];
+    uint64_t Probe[2];
+    
+    if (Snapshot == NULL || Protocol == NULL || Snapshot->ProtocolCount == 0) {
+        return HANDLE_SNAPSHOT_NONE;
+    }
+    
+    LoadGuid(Protocol, Words);
+    uint32_t Slot = HashGuid(Words) & Snapshot->GuidSlotMask;
+    while (Snapshot->GuidSlots[Slot] != 0) {
+        uint32_t Number = Snapshot->GuidSlots[Slot] - 1;
+        LoadGuid(&Snapshot->Guids[Number], Probe);
+        if (Probe[0] == Words[0] && Probe[1] == Words[1]) {
+            return Number;
+        }
+        Slot = (Slot + 1) & Snapshot->GuidSlotMask;
+    }
+    return HANDLE_SNAPSHOT_NONE;
+}
+
+const EFI_GUID *HandleSnapshotGuid(const HANDLE_SNAPSHOT *Snapshot, uint32_t Protocol) {
+    if (Snapshot == NULL || Protocol >= Snapshot->ProtocolCount) {
+        return NULL;
+    }
+    return &Snapshot->Guids[Protocol];
+}
+
+// Every handle carrying Protocol, in the order LocateHandleBuffer gave them;
+// EFI_NOT_FOUND when there is none, as LocateHandles reports
+EFI_STATUS HandleSnapshotHandlesWith(const HANDLE_SNAPSHOT *Snapshot, const EFI_GUID *Protocol,
+                                     EFI_HANDLE const **Handles, uint32_t *Count) {
+    if (Snapshot == NULL || Protocol == NULL || Handles == NULL || Count == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    *Handles = NULL;
+    *Count = 0;
+    
+    uint32_t Number = HandleSnapshotFindProtocol(Snapshot, Protocol);
+    if (Number == HANDLE_SNAPSHOT_NONE) {
+        return EFI_NOT_FOUND;
+    }
+    
+    *Handles = &Snapshot->ProtocolHandles[Snapshot->ProtocolFirst[Number]];
+    *Count = Snapshot->ProtocolFirst[Number + 1] - Snapshot->ProtocolFirst[Number];
+    return EFI_SUCCESS;
+}
+
+bool HandleSnapshotSupports(const HANDLE_SNAPSHOT *Snapshot, EFI_HANDLE Handle, const EFI_GUID *Protocol) {
+    uint32_t HandleNumber = HandleSnapshotFindHandle(Snapshot, Handle);
+    uint32_t ProtocolNumber = HandleSnapshotFindProtocol(Snapshot, Protocol);
+    
+    if (HandleNumber == HANDLE_SNAPSHOT_NONE || ProtocolNumber == HANDLE_SNAPSHOT_NONE) {
+        return false;
+    }
+    
+    // A handle carries a handful of protocols, so a scan beats another table
+    for (uint32_t i = Snapshot->HandleFirst[HandleNumber]; i < Snapshot->HandleFirst[HandleNumber + 1]; i++) {
+        if (Snapshot->HandleProtocols[i] == ProtocolNumber) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Protocol numbers on Handle; HandleSnapshotGuid gives each GUID
+EFI_STATUS HandleSnapshotProtocolsOn(const HANDLE_SNAPSHOT *Snapshot, EFI_HANDLE Handle,
+                                     const uint32_t **Protocols, uint32_t *Count) {
+    if (Snapshot == NULL || Protocols == NULL || Count == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    *Protocols = NULL;
+    *Count = 0;
+    
+    uint32_t Number = HandleSnapshotFindHandle(Snapshot, Handle);
+    if (Number == HANDLE_SNAPSHOT_NONE) {
+        return EFI_NOT_FOUND;
+    }
+    
+    *Protocols = &Snapshot->HandleProtocols[Snapshot->HandleFirst[Number]];
+    *Count = Snapshot->HandleFirst[Number + 1] - Snapshot->HandleFirst[Number];
+    return EFI_SUCCESS;
+}
+
+void HandleSnapshotPrintStats(const HANDLE_SNAPSHOT *Snapshot) {
+    if (Snapshot == NULL) {
+        return;
+    }
+    
+    PRINT(u"Handle snapshot: ");
+    PrintDec(Snapshot->HandleCount);
+    PRINT(u" handles, ");
+    PrintDec(Snapshot->ProtocolCount);
+    PRINT(u" protocols, ");
+    PrintDec(Snapshot->PairCount);
+    PRINT(u" pairs, built in ");
+    PrintDec(TimestampToMicroseconds(Snapshot->BuildTicks));
+    PRINT(u" us with ");
+    PrintDec(Snapshot->FirmwareQueries);
+    PRINT(u" firmware queries");
+    if (Snapshot->Vanished != 0) {
+        PRINT(u", ");
+        PrintDec(Snapshot->Vanished);
+        PRINT(u" handles vanished");
+    }
+    PRINTL(u"");
+}
+
+// Inventory: every protocol with the number of handles carrying it
+void HandleSnapshotPrint(const HANDLE_SNAPSHOT *Snapshot) {
+    if (Snapshot == NULL) {
+        return;
+    }
+    
+    HandleSnapshotPrintStats(Snapshot);
+    for (uint32_t p = 0; p < Snapshot->ProtocolCount; p++) {
+        PRINT(u"  ");
+        PrintGUID(&Snapshot->Guids[p]);
+        PRINT(u" on ");
+        PrintDec(Snapshot->ProtocolFirst[p + 1] - Snapshot->ProtocolFirst[p]);
+        PRINTL(u" handles");
+    }
+}
+
+static void PrintQueryCost(const char16_t *Label, uint64_t Ticks) {
+    PRINT(Label);
+    PrintDec(TimestampToMicroseconds(Ticks) * 1000 / HANDLE_SNAPSHOT_BENCHMARK_QUERIES);
+    PRINTL(u" ns per query");
+}
+
+// Time a rebuild, then "all handles with X" through LocateHandles against
+// the snapshot, and check both agree for every protocol in the database
+void HandleSnapshotBenchmark(void) {
+    HANDLE_SNAPSHOT Snapshot;
+    EFI_HANDLE *Buffer;
+    uint64_t BufferCount;
+    const EFI_HANDLE *Handles;
+    uint32_t Count;
+    
+    MemSet(&Snapshot, 0, sizeof(Snapshot));
+    if (EFI_ERROR(HandleSnapshotBuild(&Snapshot)) || Snapshot.ProtocolCount == 0) {
+        PRINTL(u"Handle snapshot benchmark: cannot read the handle database");
+        HandleSnapshotFree(&Snapshot);
+        return;
+    }
+    
+    // The second build reuses the arrays, as a rebuild after a hotplug does
+    HandleSnapshotBuild(&Snapshot);
+    HandleSnapshotPrintStats(&Snapshot);
+    
+    uint64_t Start = ReadTimestamp();
+    for (uint32_t i = 0; i < HANDLE_SNAPSHOT_BENCHMARK_QUERIES; i++) {
+        if (!EFI_ERROR(LocateHandles(&Snapshot.Guids[i % Snapshot.ProtocolCount], &Buffer, &BufferCount))) {
+            FreePool(Buffer);
+        }
+    }
+    uint64_t FirmwareTicks = ReadTimestamp() - Start;
+    
+    Start = ReadTimestamp();
+    for (uint32_t i = 0; i < HANDLE_SNAPSHOT_BENCHMARK_QUERIES; i++) {
+        HandleSnapshotHandlesWith(&Snapshot, &Snapshot.Guids[i % Snapshot.ProtocolCount], &Handles, &Count);
+    }
+    uint64_t SnapshotTicks = ReadTimestamp() - Start;
+    
+    PrintQueryCost(u"LocateHandles: ", FirmwareTicks);
+    PrintQueryCost(u"Snapshot: ", SnapshotTicks);
+    
+    uint32_t Mismatches = 0;
+    for (uint32_t p = 0; p < Snapshot.ProtocolCount; p++) {
+        HandleSnapshotHandlesWith(&Snapshot, &Snapshot.Guids[p], &Handles, &Count);
+        if (EFI_ERROR(LocateHandles(&Snapshot.Guids[p], &Buffer, &BufferCount))) {
+            Mismatches++;
+            continue;
+        }
+        
+        if (BufferCount != Count) {
+            Mismatches++;
+        }
+        for (uint64_t i = 0; i < BufferCount; i++) {
+            if (!HandleSnapshotSupports(&Snapshot, Buffer[i], &Snapshot.Guids[p])) {
+                Mismatches++;
+                break;
+            }
+        }
+        FreePool(Buffer);
+    }
+    
+    if (Mismatches == 0) {
+        PRINTL(u"Snapshot matches the firmware for every protocol");
+    } else {
+        PRINT(u"Snapshot disagrees with the firmware on ");
+        PrintDec(Mismatches);
+        PRINTL(u" protocols");
+    }
+    
+    HandleSnapshotFree(&Snapshot);
+}
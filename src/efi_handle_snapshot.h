@@ -0,0 +1,72 @@
+// efi_handle_snapshot.h
+#ifndef TINYUEFI_HANDLE_SNAPSHOT_H
+#define TINYUEFI_HANDLE_SNAPSHOT_H
+
+#include "uefi_types.h"
+#include "efi_protocol_discovery.h"
+
+// Returned by the find functions for a handle or GUID not in the snapshot
+#define HANDLE_SNAPSHOT_NONE          0xffffffff
+
+// Smallest hash table; tables are kept at most half full
+#define HANDLE_SNAPSHOT_MIN_SLOTS     16
+
+// Queries timed each way by HandleSnapshotBenchmark
+#define HANDLE_SNAPSHOT_BENCHMARK_QUERIES 1000
+
+// Copy of the firmware handle database. Handles and distinct protocols are
+// numbered in the order found. Every (handle, protocol) pair is stored twice
+// in flat arrays, grouped by handle and grouped by protocol, with First
+// arrays giving where each group starts. Two open-addressing tables map a
+// handle or a GUID to its number, so queries make no firmware calls.
+typedef struct {
+    EFI_HANDLE *Handles;              // HandleCount
+    EFI_HANDLE *ProtocolHandles;      // PairCount, grouped by protocol
+    EFI_GUID *Guids;                  // ProtocolCount
+    uint32_t *HandleFirst;            // HandleCount + 1 offsets into HandleProtocols
+    uint32_t *HandleProtocols;        // PairCount protocol numbers, grouped by handle
+    uint32_t *ProtocolFirst;          // ProtocolCount + 1 offsets into ProtocolHandles
+    uint32_t *HandleSlots;            // Handle number + 1, 0 when empty
+    uint32_t *GuidSlots;              // Protocol number + 1, 0 when empty
+    uint32_t HandleSlotMask;
+    uint32_t GuidSlotMask;
+    
+    uint32_t HandleCount;
+    uint32_t ProtocolCount;
+    uint32_t PairCount;
+    
+    // One allocation holds the arrays above and is reused by later builds
+    // that fit, so rebuilding after a hotplug costs only the firmware calls
+    void *Storage;
+    uint64_t StorageSize;
+    
+    // Statistics
+    uint32_t Builds;
+    uint32_t Vanished;                // Handles removed while the last build ran
+    uint64_t FirmwareQueries;         // Made by the last build
+    uint64_t BuildTicks;              // Last build
+} HANDLE_SNAPSHOT;
+
+// Building. On failure the snapshot is left empty.
+EFI_STATUS HandleSnapshotBuild(HANDLE_SNAPSHOT *Snapshot);
+void HandleSnapshotFree(HANDLE_SNAPSHOT *Snapshot);
+
+// Lookups by number
+uint32_t HandleSnapshotFindHandle(const HANDLE_SNAPSHOT *Snapshot, EFI_HANDLE Handle);
+uint32_t HandleSnapshotFindProtocol(const HANDLE_SNAPSHOT *Snapshot, const EFI_GUID *Protocol);
+const EFI_GUID *HandleSnapshotGuid(const HANDLE_SNAPSHOT *Snapshot, uint32_t Protocol);
+
+// Queries. The arrays returned point into the snapshot and stay valid until
+// the next build.
+EFI_STATUS HandleSnapshotHandlesWith(const HANDLE_SNAPSHOT *Snapshot, const EFI_GUID *Protocol,
+                                     EFI_HANDLE const **Handles, uint32_t *Count);
+bool HandleSnapshotSupports(const HANDLE_SNAPSHOT *Snapshot, EFI_HANDLE Handle, const EFI_GUID *Protocol);
+EFI_STATUS HandleSnapshotProtocolsOn(const HANDLE_SNAPSHOT *Snapshot, EFI_HANDLE Handle,
+                                     const uint32_t **Protocols, uint32_t *Count);
+
+// Reporting
+void HandleSnapshotPrintStats(const HANDLE_SNAPSHOT *Snapshot);
+void HandleSnapshotPrint(const HANDLE_SNAPSHOT *Snapshot);
+void HandleSnapshotBenchmark(void);
+
+#endif // TINYUEFI_HANDLE_SNAPSHOT_H
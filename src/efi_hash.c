@@ -0,0 +1,385 @@
+// efi_hash.c
+#include <immintrin.h>
+#include "efi_hash.h"
+#include "uefi_helpers.h"
+#include "efi_cpu.h"
+#include "efi_timer.h"
+
+// Size of the buffer hashed by Sha256Benchmark
+#define SHA256_BENCHMARK_SIZE         (16 * 1024 * 1024)
+#define SHA256_BENCHMARK_PASSES       4
+
+// Block compression function (one or more consecutive 64-byte blocks)
+typedef void (*SHA256_BLOCK_FUNCTION)(uint32_t State[8], const uint8_t *Data, uint64_t Blocks);
+
+// SHA-256 round constants
+static const uint32_t Sha256K[64] __attribute__((aligned(16))) = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+// SHA-256 initial hash value
+static const uint32_t Sha256H0[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+// Selected block function (chosen on first Sha256Init)
+static SHA256_BLOCK_FUNCTION Sha256Blocks = NULL;
+
+// Scalar helpers
+#define SHA256_ROTR(x, n)             (((x) >> (n)) | ((x) << (32 - (n))))
+#define SHA256_BSIG0(x)               (SHA256_ROTR(x, 2) ^ SHA256_ROTR(x, 13) ^ SHA256_ROTR(x, 22))
+#define SHA256_BSIG1(x)               (SHA256_ROTR(x, 6) ^ SHA256_ROTR(x, 11) ^ SHA256_ROTR(x, 25))
+#define SHA256_SSIG0(x)               (SHA256_ROTR(x, 7) ^ SHA256_ROTR(x, 18) ^ ((x) >> 3))
+#define SHA256_SSIG1(x)               (SHA256_ROTR(x, 17) ^ SHA256_ROTR(x, 19) ^ ((x) >> 10))
+#define SHA256_CH(x, y, z)            ((z) ^ ((x) & ((y) ^ (z))))
+#define SHA256_MAJ(x, y, z)           (((x) & (y)) | ((z) & ((x) | (y))))
+
+// Expand the next message word in place (16-entry circular schedule)
+#define SHA256_SCHEDULE(i) \
+    (W[(i) & 15] += SHA256_SSIG1(W[((i) - 2) & 15]) + W[((i) - 7) & 15] + SHA256_SSIG0(W[((i) - 15) & 15]))
+
+// One round; the caller rotates the working variables by renaming them
+#define SHA256_ROUND(a, b, c, d, e, f, g, h, i, w) { \
+    uint32_t T1 = (h) + SHA256_BSIG1(e) + SHA256_CH(e, f, g) + Sha256K[i] + (w); \
+    (d) += T1; \
+    (h) = T1 + SHA256_BSIG0(a) + SHA256_MAJ(a, b, c); \
+}
+
+// Eight rounds with the working variables fully rotated back into place
+#define SHA256_ROUNDS8(i, WORD) { \
+    SHA256_ROUND(A, B, C, D, E, F, G, H, (i) + 0, WORD((i) + 0)); \
+    SHA256_ROUND(H, A, B, C, D, E, F, G, (i) + 1, WORD((i) + 1)); \
+    SHA256_ROUND(G, H, A, B, C, D, E, F, (i) + 2, WORD((i) + 2)); \
+    SHA256_ROUND(F, G, H, A, B, C, D, E, (i) + 3, WORD((i) + 3)); \
+    SHA256_ROUND(E, F, G, H, A, B, C, D, (i) + 4, WORD((i) + 4)); \
+    SHA256_ROUND(D, E, F, G, H, A, B, C, (i) + 5, WORD((i) + 5)); \
+    SHA256_ROUND(C, D, E, F, G, H, A, B, (i) + 6, WORD((i) + 6)); \
+    SHA256_ROUND(B, C, D, E, F, G, H, A, (i) + 7, WORD((i) + 7)); \
+}
+
+#define SHA256_LOADED(i)              W[i]
+
+// Load a big-endian 32-bit word
+static inline uint32_t LoadBigEndian32(const uint8_t *Bytes) {
+    return ((uint32_t)Bytes[0] << 24) | ((uint32_t)Bytes[1] << 16) | 
+           ((uint32_t)Bytes[2] << 8) | (uint32_t)Bytes[3];
+}
+
+// Store a big-endian 32-bit word
+static inline void StoreBigEndian32(uint8_t *Bytes, uint32_t Value) {
+    Bytes[0] = (uint8_t)(Value >> 24);
+    Bytes[1] = (uint8_t)(Value >> 16);
+    Bytes[2] = (uint8_t)(Value >> 8);
+    Bytes[3] = (uint8_t)Value;
+}
+
+// Portable block function
+static void Sha256BlocksScalar(uint32_t State[8], const uint8_t *Data, uint64_t Blocks) {
+    uint32_t W[16];
+    
+    while (Blocks-- > 0) {
+        uint32_t A = State[0], B = State[1], C = State[2], D = State[3];
+        uint32_t E = State[4], F = State[5], G = State[6], H = State[7];
+        
+        for (int i = 0; i < 16; i++) {
+            W[i] = LoadBigEndian32(Data + i * 4);
+        }
+        
+        SHA256_ROUNDS8(0, SHA256_LOADED);
+        SHA256_ROUNDS8(8, SHA256_LOADED);
+        for (int i = 16; i < 64; i += 8) {
+            SHA256_ROUNDS8(i, SHA256_SCHEDULE);
+        }
+        
+        State[0] += A; State[1] += B; State[2] += C; State[3] += D;
+        State[4] += E; State[5] += F; State[6] += G; State[7] += H;
+        
+        Data += SHA256_BLOCK_SIZE;
+    }
+}
+
+// Block function using the Intel SHA extensions
+__attribute__((target("sha,sse4.1,ssse3")))
+static void Sha256BlocksShaNi(uint32_t State[8], const uint8_t *Data, uint64_t Blocks) {
+    const __m128i ByteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i Msg[4];
+    
+    // Rearrange the state into the ABEF/CDGH layout used by SHA256RNDS2
+    __m128i Tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&State[0]), 0xB1);
+    __m128i State1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&State[4]), 0x1B);
+    __m128i State0 = _mm_alignr_epi8(Tmp, State1, 8);
+    State1 = _mm_blend_epi16(State1, Tmp, 0xF0);
+    
+    while (Blocks-- > 0) {
+        __m128i SavedAbef = State0;
+        __m128i SavedCdgh = State1;
+        
+        for (int i = 0; i < 4; i++) {
+            Msg[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(Data + i * 16)), ByteSwap);
+        }
+        
+        // 16 groups of four rounds; Msg[] is a ring of the last 16 schedule words
+#pragma GCC unroll 16
+        for (int i = 0; i < 16; i++) {
+            __m128i Current = Msg[i & 3];
+            __m128i Words = _mm_add_epi32(Current, _mm_load_si128((const __m128i*)&Sha256K[i * 4]));
+            
+            State1 = _mm_sha256rnds2_epu32(State1, State0, Words);
+            
+            if (i >= 3 && i < 15) {
+                Tmp = _mm_alignr_epi8(Current, Msg[(i - 1) & 3], 4);
+                Msg[(i + 1) & 3] = _mm_add_epi32(Msg[(i + 1) & 3], Tmp);
+                Msg[(i + 1) & 3] = _mm_sha256msg2_epu32(Msg[(i + 1) & 3], Current);
+            }
+            
+            Words = _mm_shuffle_epi32(Words, 0x0E);
+            State0 = _mm_sha256rnds2_epu32(State0, State1, Words);
+            
+            if (i >= 1 && i < 13) {
+                Msg[(i - 1) & 3] = _mm_sha256msg1_epu32(Msg[(i - 1) & 3], Current);
+            }
+        }
+        
+        State0 = _mm_add_epi32(State0, SavedAbef);
+        State1 = _mm_add_epi32(State1, SavedCdgh);
+        
+        Data += SHA256_BLOCK_SIZE;
+    }
+    
+    // Back to the A..H word order
+    Tmp = _mm_shuffle_epi32(State0, 0x1B);
+    State1 = _mm_shuffle_epi32(State1, 0xB1);
+    State0 = _mm_blend_epi16(Tmp, State1, 0xF0);
+    State1 = _mm_alignr_epi8(State1, Tmp, 8);
+    
+    _mm_storeu_si128((__m128i*)&State[0], State0);
+    _mm_storeu_si128((__m128i*)&State[4], State1);
+}
+
+// Check whether the SHA extension path is available on this CPU
+bool Sha256UsingShaExtensions(void) {
+    return CpuHasFeature(CPU_FEATURE_SHA | CPU_FEATURE_SSE41 | CPU_FEATURE_SSSE3);
+}
+
+// Initialize a SHA-256 context
+void Sha256Init(SHA256_CONTEXT *Context) {
+    if (Context == NULL) {
+        return;
+    }
+    
+    if (Sha256Blocks == NULL) {
+        Sha256Blocks = Sha256UsingShaExtensions() ? Sha256BlocksShaNi : Sha256BlocksScalar;
+    }
+    
+    for (int i = 0; i < 8; i++) {
+        Context->State[i] = Sha256H0[i];
+    }
+    Context->Length = 0;
+    Context->BufferUsed = 0;
+}
+
+// Feed more data into a SHA-256 context
+void Sha256Update(SHA256_CONTEXT *Context, const void *Data, uint64_t Size) {
+    const uint8_t *Bytes = (const uint8_t*)Data;
+    
+    if (Context == NULL || (Data == NULL && Size != 0)) {
+        return;
+    }
+    
+    Context->Length += Size;
+    
+    // Top up a partially filled block first
+    if (Context->BufferUsed > 0) {
+        uint64_t Needed = SHA256_BLOCK_SIZE - Context->BufferUsed;
+        uint64_t Take = Size < Needed ? Size : Needed;
+        
+        MemCpy(Context->Buffer + Context->BufferUsed, Bytes, Take);
+        Context->BufferUsed += (uint32_t)Take;
+        Bytes += Take;
+        Size -= Take;
+        
+        if (Context->BufferUsed < SHA256_BLOCK_SIZE) {
+            return;
+        }
+        
+        Sha256Blocks(Context->State, Context->Buffer, 1);
+        Context->BufferUsed = 0;
+    }
+    
+    // Hash whole blocks straight from the caller's buffer
+    uint64_t Blocks = Size / SHA256_BLOCK_SIZE;
+    if (Blocks > 0) {
+        Sha256Blocks(Context->State, Bytes, Blocks);
+        Bytes += Blocks * SHA256_BLOCK_SIZE;
+        Size -= Blocks * SHA256_BLOCK_SIZE;
+    }
+    
+    // Keep the tail for the next call
+    if (Size > 0) {
+        MemCpy(Context->Buffer, Bytes, Size);
+        Context->BufferUsed = (uint32_t)Size;
+    }
+}
+
+// Finish the hash and write out the digest
+void Sha256Final(SHA256_CONTEXT *Context, uint8_t Digest[SHA256_DIGEST_SIZE]) {
+    if (Context == NULL || Digest == NULL) {
+        return;
+    }
+    
+    uint64_t BitLength = Context->Length * 8;
+    uint32_t Used = Context->BufferUsed;
+    
+    Context->Buffer[Used++] = 0x80;
+    
+    // Not enough room for the length: pad out this block and start another
+    if (Used > SHA256_BLOCK_SIZE - 8) {
+        MemSet(Context->Buffer + Used, 0, SHA256_BLOCK_SIZE - Used);
+        Sha256Blocks(Context->State, Context->Buffer, 1);
+        Used = 0;
+    }
+    
+    MemSet(Context->Buffer + Used, 0, SHA256_BLOCK_SIZE - 8 - Used);
+    StoreBigEndian32(Context->Buffer + 56, (uint32_t)(BitLength >> 32));
+    StoreBigEndian32(Context->Buffer + 60, (uint32_t)BitLength);
+    Sha256Blocks(Context->State, Context->Buffer, 1);
+    
+    for (int i = 0; i < 8; i++) {
+        StoreBigEndian32(Digest + i * 4, Context->State[i]);
+    }
+    
+    // Don't leave message bytes behind in the context
+    MemSet(Context, 0, sizeof(*Context));
+}
+
+// One-shot SHA-256
+void Sha256(const void *Data, uint64_t Size, uint8_t Digest[SHA256_DIGEST_SIZE]) {
+    SHA256_CONTEXT Context;
+    
+    Sha256Init(&Context);
+    Sha256Update(&Context, Data, Size);
+    Sha256Final(&Context, Digest);
+}
+
+// Read from a file and measure the bytes that were read
+EFI_STATUS ReadFileMeasured(EFI_FILE_PROTOCOL *File, void *Buffer, uint64_t *BufferSize, 
+                           SHA256_CONTEXT *Context) {
+    EFI_STATUS Status;
+    
+    if (Context == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    Status = ReadFile(File, Buffer, BufferSize);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    Sha256Update(Context, Buffer, *BufferSize);
+    return EFI_SUCCESS;
+}
+
+// Hash a file from its current position to the end
+EFI_STATUS Sha256File(EFI_FILE_PROTOCOL *File, uint8_t Digest[SHA256_DIGEST_SIZE]) {
+    EFI_STATUS Status;
+    SHA256_CONTEXT Context;
+    
+    if (File == NULL || Digest == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    uint8_t *Chunk = (uint8_t*)AllocatePool(SHA256_FILE_CHUNK_SIZE);
+    if (Chunk == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    
+    Sha256Init(&Context);
+    
+    for (;;) {
+        uint64_t ChunkSize = SHA256_FILE_CHUNK_SIZE;
+        
+        Status = ReadFileMeasured(File, Chunk, &ChunkSize, &Context);
+        if (EFI_ERROR(Status)) {
+            FreePool(Chunk);
+            return Status;
+        }
+        
+        // A zero-byte read means end of file
+        if (ChunkSize == 0) {
+            break;
+        }
+    }
+    
+    Sha256Final(&Context, Digest);
+    FreePool(Chunk);
+    return EFI_SUCCESS;
+}
+
+// Print a digest as lowercase hex
+void PrintDigest(const uint8_t *Digest, uint64_t Size) {
+    char16_t Hex[3];
+    char16_t *HexChars = u"0123456789abcdef";
+    
+    if (Digest == NULL) {
+        PRINT(u"NULL");
+        return;
+    }
+    
+    Hex[2] = 0;
+    for (uint64_t i = 0; i < Size; i++) {
+        Hex[0] = HexChars[Digest[i] >> 4];
+        Hex[1] = HexChars[Digest[i] & 0xF];
+        PRINT(Hex);
+    }
+}
+
+// Time one block function over the benchmark buffer
+static uint64_t TimeSha256Blocks(SHA256_BLOCK_FUNCTION Blocks, const uint8_t *Data) {
+    uint32_t State[8];
+    
+    for (int i = 0; i < 8; i++) {
+        State[i] = Sha256H0[i];
+    }
+    
+    uint64_t Start = ReadTimestamp();
+    for (int Pass = 0; Pass < SHA256_BENCHMARK_PASSES; Pass++) {
+        Blocks(State, Data, SHA256_BENCHMARK_SIZE / SHA256_BLOCK_SIZE);
+    }
+    return ReadTimestamp() - Start;
+}
+
+// Measure SHA-256 throughput for each available implementation
+void Sha256Benchmark(void) {
+    uint8_t *Data = (uint8_t*)AllocatePool(SHA256_BENCHMARK_SIZE);
+    uint64_t Bytes = (uint64_t)SHA256_BENCHMARK_SIZE * SHA256_BENCHMARK_PASSES;
+    
+    if (Data == NULL) {
+        PRINTL(u"SHA-256 benchmark: out of memory");
+        return;
+    }
+    
+    for (uint64_t i = 0; i < SHA256_BENCHMARK_SIZE; i++) {
+        Data[i] = (uint8_t)(i * 131 + 7);
+    }
+    
+    PRINT(u"SHA-256 scalar: ");
+    PrintThroughput(Bytes, TimeSha256Blocks(Sha256BlocksScalar, Data));
+    PRINTL(u"");
+    
+    PRINT(u"SHA-256 SHA-NI: ");
+    if (Sha256UsingShaExtensions()) {
+        PrintThroughput(Bytes, TimeSha256Blocks(Sha256BlocksShaNi, Data));
+        PRINTL(u"");
+    } else {
+        PRINTL(u"not supported");
+    }
+    
+    FreePool(Data);
+}
@@ -0,0 +1,35 @@
+// efi_hash.h
+#ifndef TINYUEFI_HASH_H
+#define TINYUEFI_HASH_H
+
+#include "uefi_types.h"
+#include "efi_file_protocol.h"
+
+// SHA-256 sizes
+#define SHA256_BLOCK_SIZE             64
+#define SHA256_DIGEST_SIZE            32
+
+// Chunk size used when hashing straight from a file
+#define SHA256_FILE_CHUNK_SIZE        (1024 * 1024)
+
+// Incremental SHA-256 state
+typedef struct {
+    uint32_t State[8];
+    uint64_t Length;
+    uint32_t BufferUsed;
+    uint8_t  Buffer[SHA256_BLOCK_SIZE];
+} SHA256_CONTEXT;
+
+// Helper functions
+void Sha256Init(SHA256_CONTEXT *Context);
+void Sha256Update(SHA256_CONTEXT *Context, const void *Data, uint64_t Size);
+void Sha256Final(SHA256_CONTEXT *Context, uint8_t Digest[SHA256_DIGEST_SIZE]);
+void Sha256(const void *Data, uint64_t Size, uint8_t Digest[SHA256_DIGEST_SIZE]);
+bool Sha256UsingShaExtensions(void);
+EFI_STATUS ReadFileMeasured(EFI_FILE_PROTOCOL *File, void *Buffer, uint64_t *BufferSize, 
+                           SHA256_CONTEXT *Context);
+EFI_STATUS Sha256File(EFI_FILE_PROTOCOL *File, uint8_t Digest[SHA256_DIGEST_SIZE]);
+void PrintDigest(const uint8_t *Digest, uint64_t Size);
+void Sha256Benchmark(void);
+
+#endif // TINYUEFI_HASH_H
@@ -0,0 +1,910 @@
+// efi_image.c
+#include "efi_image.h"
+#include "uefi_helpers.h"
+#include "efi_timer.h"
+
+// BMP compression types
+#define BMP_RGB                       0
+#define BMP_BITFIELDS                 3
+#define BMP_ALPHABITFIELDS            6
+
+// TGA image types
+#define TGA_COLOR_MAPPED              1
+#define TGA_TRUE_COLOR                2
+#define TGA_GRAYSCALE                 3
+#define TGA_RLE                       8
+
+// QOI chunk tags
+#define QOI_OP_INDEX                  0x00
+#define QOI_OP_DIFF                   0x40
+#define QOI_OP_LUMA                   0x80
+#define QOI_OP_RUN                    0xC0
+#define QOI_OP_RGB                    0xFE
+#define QOI_OP_RGBA                   0xFF
+#define QOI_MASK_2                    0xC0
+
+static inline uint16_t LoadLe16(const uint8_t *Bytes) {
+    return (uint16_t)(Bytes[0] | (Bytes[1] << 8));
+}
+
+static inline uint32_t LoadLe32(const uint8_t *Bytes) {
+    return (uint32_t)Bytes[0] | ((uint32_t)Bytes[1] << 8) |
+           ((uint32_t)Bytes[2] << 16) | ((uint32_t)Bytes[3] << 24);
+}
+
+static inline uint32_t LoadBe32(const uint8_t *Bytes) {
+    return ((uint32_t)Bytes[0] << 24) | ((uint32_t)Bytes[1] << 16) |
+           ((uint32_t)Bytes[2] << 8) | (uint32_t)Bytes[3];
+}
+
+static inline void SetPixel(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Pixel,
+                            uint8_t Red, uint8_t Green, uint8_t Blue, uint8_t Alpha) {
+    Pixel->Red = Red;
+    Pixel->Green = Green;
+    Pixel->Blue = Blue;
+    Pixel->Reserved = Alpha;
+}
+
+//
+// Chunked reader
+//
+
+// Keep the unread tail and top the buffer up to at least Needed bytes
+static bool ReaderEnsure(IMAGE_READER *Reader, uint64_t Needed) {
+    uint64_t Available = Reader->Length - Reader->Position;
+    
+    if (Available >= Needed) {
+        return true;
+    }
+    if (EFI_ERROR(Reader->Status) || Needed > IMAGE_READ_CHUNK_SIZE) {
+        return false;
+    }
+    
+    for (uint64_t i = 0; i < Available; i++) {
+        Reader->Buffer[i] = Reader->Buffer[Reader->Position + i];
+    }
+    Reader->Offset += Reader->Position;
+    Reader->Position = 0;
+    Reader->Length = Available;
+    
+    while (Reader->Length < Needed) {
+        uint64_t Size = IMAGE_READ_CHUNK_SIZE - Reader->Length;
+        EFI_STATUS Status = ReadFile(Reader->File, Reader->Buffer + Reader->Length, &Size);
+        
+        if (EFI_ERROR(Status)) {
+            Reader->Status = Status;
+            return false;
+        }
+        if (Size == 0) {
+            return false;
+        }
+        Reader->Length += Size;
+    }
+    
+    return true;
+}
+
+// Next byte; a truncated file records EFI_VOLUME_CORRUPTED and yields zeros
+static inline uint8_t ReaderByte(IMAGE_READER *Reader) {
+    if (Reader->Position == Reader->Length && !ReaderEnsure(Reader, 1)) {
+        if (!EFI_ERROR(Reader->Status)) {
+            Reader->Status = EFI_VOLUME_CORRUPTED;
+        }
+        return 0;
+    }
+    
+    return Reader->Buffer[Reader->Position++];
+}
+
+// Copy Count bytes (Dest may be NULL to skip them)
+static EFI_STATUS ReaderRead(IMAGE_READER *Reader, uint8_t *Dest, uint64_t Count) {
+    while (Count > 0) {
+        if (Reader->Position == Reader->Length && !ReaderEnsure(Reader, 1)) {
+            if (!EFI_ERROR(Reader->Status)) {
+                Reader->Status = EFI_VOLUME_CORRUPTED;
+            }
+            return Reader->Status;
+        }
+        
+        uint64_t Available = Reader->Length - Reader->Position;
+        uint64_t Step = Count < Available ? Count : Available;
+        
+        if (Dest != NULL) {
+            MemCpy(Dest, Reader->Buffer + Reader->Position, Step);
+            Dest += Step;
+        }
+        Reader->Position += Step;
+        Count -= Step;
+    }
+    
+    return EFI_SUCCESS;
+}
+
+static inline uint64_t ReaderTell(IMAGE_READER *Reader) {
+    return Reader->Offset + Reader->Position;
+}
+
+//
+// Header parsing
+//
+
+static void SetChannel(IMAGE_CHANNEL *Channel, uint32_t Mask) {
+    Channel->Mask = Mask;
+    Channel->Shift = Mask != 0 ? (uint32_t)__builtin_ctz(Mask) : 0;
+    Channel->Max = Mask >> Channel->Shift;
+}
+
+// Scale a bitfield value to 8 bits
+static inline uint8_t ExtractChannel(const IMAGE_CHANNEL *Channel, uint32_t Value, uint8_t Default) {
+    if (Channel->Mask == 0) {
+        return Default;
+    }
+    
+    uint32_t Field = (Value & Channel->Mask) >> Channel->Shift;
+    if (Channel->Max == 0xFF) {
+        return (uint8_t)Field;
+    }
+    
+    return (uint8_t)(((uint64_t)Field * 255 + Channel->Max / 2) / Channel->Max);
+}
+
+// Expand a 5-bit channel to 8 bits
+static inline uint8_t Expand5(uint32_t Value) {
+    return (uint8_t)((Value << 3) | (Value >> 2));
+}
+
+// Read Count palette entries of EntryBytes (BGR or BGRX)
+static EFI_STATUS ReadPalette(IMAGE_DECODER *Decoder, uint32_t Count, uint32_t EntryBytes) {
+    uint8_t Entry[4];
+    
+    Decoder->Palette = (EFI_GRAPHICS_OUTPUT_BLT_PIXEL*)AllocatePool(
+        (uint64_t)(Count ? Count : 1) * sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL));
+    if (Decoder->Palette == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    Decoder->PaletteSize = Count;
+    
+    for (uint32_t i = 0; i < Count; i++) {
+        EFI_STATUS Status = ReaderRead(&Decoder->Reader, Entry, EntryBytes);
+        if (EFI_ERROR(Status)) {
+            return Status;
+        }
+        SetPixel(&Decoder->Palette[i], Entry[2], Entry[1], Entry[0], 0);
+    }
+    
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS OpenBmp(IMAGE_DECODER *Decoder) {
+    IMAGE_READER *Reader = &Decoder->Reader;
+    uint8_t Header[14 + 124];
+    uint32_t Compression = BMP_RGB;
+    uint32_t ColorsUsed = 0;
+    uint32_t PaletteEntryBytes = 4;
+    int32_t Width, Height;
+    EFI_STATUS Status;
+    
+    Status = ReaderRead(Reader, Header, 18);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    uint32_t DataOffset = LoadLe32(Header + 10);
+    uint32_t HeaderSize = LoadLe32(Header + 14);
+    if (HeaderSize != 12 && (HeaderSize < 40 || HeaderSize > 124)) {
+        return EFI_UNSUPPORTED;
+    }
+    
+    Status = ReaderRead(Reader, Header + 18, HeaderSize - 4);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    if (HeaderSize == 12) {
+        // BITMAPCOREHEADER
+        Width = LoadLe16(Header + 18);
+        Height = (int16_t)LoadLe16(Header + 20);
+        Decoder->BitsPerPixel = LoadLe16(Header + 24);
+        PaletteEntryBytes = 3;
+    } else {
+        Width = (int32_t)LoadLe32(Header + 18);
+        Height = (int32_t)LoadLe32(Header + 22);
+        Decoder->BitsPerPixel = LoadLe16(Header + 28);
+        Compression = LoadLe32(Header + 30);
+        ColorsUsed = LoadLe32(Header + 46);
+    }
+    
+    if (Width <= 0 || Height == 0 || Height == INT32_MIN) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+    Decoder->TopDown = Height < 0;
+    Decoder->Info.Width = (uint32_t)Width;
+    Decoder->Info.Height = (uint32_t)(Height < 0 ? -Height : Height);
+    
+    // ImageDecoderOpen checks this too, but only after the row buffer below
+    // has been sized from the header's width
+    if (Decoder->Info.Width > IMAGE_MAX_DIMENSION || Decoder->Info.Height > IMAGE_MAX_DIMENSION) {
+        return EFI_UNSUPPORTED;
+    }
+    
+    // Default layouts, then any bitfields
+    switch (Decoder->BitsPerPixel) {
+    case 1:
+    case 4:
+    case 8:
+    case 24:
+        break;
+    case 16:
+        SetChannel(&Decoder->Channels[0], 0x7C00);
+        SetChannel(&Decoder->Channels[1], 0x03E0);
+        SetChannel(&Decoder->Channels[2], 0x001F);
+        break;
+    case 32:
+        SetChannel(&Decoder->Channels[0], 0x00FF0000);
+        SetChannel(&Decoder->Channels[1], 0x0000FF00);
+        SetChannel(&Decoder->Channels[2], 0x000000FF);
+        break;
+    default:
+        return EFI_UNSUPPORTED;
+    }
+    
+    if (Compression == BMP_BITFIELDS || Compression == BMP_ALPHABITFIELDS) {
+        uint32_t MaskCount = Compression == BMP_ALPHABITFIELDS ? 4 : 3;
+        uint8_t *Masks = Header + 14 + 40;
+        
+        if (Decoder->BitsPerPixel != 16 && Decoder->BitsPerPixel != 32) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+        
+        // A plain BITMAPINFOHEADER is followed by the masks
+        if (HeaderSize == 40) {
+            Status = ReaderRead(Reader, Masks, MaskCount * 4);
+            if (EFI_ERROR(Status)) {
+                return Status;
+            }
+        } else if (HeaderSize >= 56) {
+            MaskCount = 4;
+        } else if (HeaderSize < 40 + MaskCount * 4) {
+            // The masks would run past what was read into Header
+            return EFI_VOLUME_CORRUPTED;
+        }
+        
+        for (uint32_t i = 0; i < MaskCount; i++) {
+            SetChannel(&Decoder->Channels[i], LoadLe32(Masks + i * 4));
+        }
+    } else if (Compression != BMP_RGB) {
+        // RLE and embedded JPEG/PNG data are not handled
+        return EFI_UNSUPPORTED;
+    }
+    
+    Decoder->Info.HasAlpha = Decoder->Channels[3].Mask != 0;
+    Decoder->PlainBgr = Decoder->BitsPerPixel == 32 &&
+                        Decoder->Channels[0].Mask == 0x00FF0000 &&
+                        Decoder->Channels[1].Mask == 0x0000FF00 &&
+                        Decoder->Channels[2].Mask == 0x000000FF &&
+                        (Decoder->Channels[3].Mask == 0 || Decoder->Channels[3].Mask == 0xFF000000);
+    
+    if (Decoder->BitsPerPixel <= 8) {
+        uint32_t MaxColors = 1u << Decoder->BitsPerPixel;
+        uint32_t Colors = ColorsUsed != 0 && ColorsUsed < MaxColors ? ColorsUsed : MaxColors;
+        
+        Status = ReadPalette(Decoder, Colors, PaletteEntryBytes);
+        if (EFI_ERROR(Status)) {
+            return Status;
+        }
+        
+        // Skip palette entries beyond what the pixel depth can address
+        if (ColorsUsed > MaxColors) {
+            Status = ReaderRead(Reader, NULL, (uint64_t)(ColorsUsed - MaxColors) * PaletteEntryBytes);
+            if (EFI_ERROR(Status)) {
+                return Status;
+            }
+        }
+    }
+    
+    // Pixel data may start after a gap (e.g. an ICC profile)
+    if (DataOffset < ReaderTell(Reader)) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+    Status = ReaderRead(Reader, NULL, DataOffset - ReaderTell(Reader));
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    Decoder->RowBytes = (((uint64_t)Decoder->Info.Width * Decoder->BitsPerPixel + 31) / 32) * 4;
+    Decoder->RowData = (uint8_t*)AllocatePool(Decoder->RowBytes);
+    if (Decoder->RowData == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS OpenQoi(IMAGE_DECODER *Decoder) {
+    uint8_t Header[14];
+    EFI_STATUS Status = ReaderRead(&Decoder->Reader, Header, sizeof(Header));
+    
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    Decoder->Info.Width = LoadBe32(Header + 4);
+    Decoder->Info.Height = LoadBe32(Header + 8);
+    if (Header[12] != 3 && Header[12] != 4) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+    
+    Decoder->Info.HasAlpha = Header[12] == 4;
+    Decoder->TopDown = true;
+    SetPixel(&Decoder->RunPixel, 0, 0, 0, 255);
+    MemSet(Decoder->QoiIndex, 0, sizeof(Decoder->QoiIndex));
+    
+    return EFI_SUCCESS;
+}
+
+// TGA has no signature, so the header fields themselves are checked
+static bool LooksLikeTga(const uint8_t *Header) {
+    uint8_t ColorMapType = Header[1];
+    uint8_t ImageType = Header[2] & ~TGA_RLE;
+    uint8_t Depth = Header[16];
+    
+    if (ColorMapType > 1 || Header[2] & 0x04 || ImageType < TGA_COLOR_MAPPED || ImageType > TGA_GRAYSCALE) {
+        return false;
+    }
+    if (LoadLe16(Header + 12) == 0 || LoadLe16(Header + 14) == 0) {
+        return false;
+    }
+    if (ImageType == TGA_COLOR_MAPPED) {
+        return ColorMapType == 1 && (Depth == 8 || Depth == 16);
+    }
+    if (ImageType == TGA_GRAYSCALE) {
+        return Depth == 8 || Depth == 16;
+    }
+    
+    return Depth == 15 || Depth == 16 || Depth == 24 || Depth == 32;
+}
+
+// Read one TGA pixel of Bytes bytes in the file's layout
+static inline void ReadTgaValue(IMAGE_DECODER *Decoder, uint32_t Bytes, EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Pixel) {
+    IMAGE_READER *Reader = &Decoder->Reader;
+    uint8_t Byte0 = ReaderByte(Reader);
+    uint8_t Byte1, Byte2;
+    uint32_t Value;
+    
+    if (Decoder->ColorMapped) {
+        uint32_t Index = Bytes == 2 ? (uint32_t)(Byte0 | (ReaderByte(Reader) << 8)) : Byte0;
+        
+        Index -= Decoder->PaletteFirst;
+        if (Index < Decoder->PaletteSize) {
+            *Pixel = Decoder->Palette[Index];
+        } else {
+            SetPixel(Pixel, 0, 0, 0, 0);
+        }
+        return;
+    }
+    
+    if (Decoder->Grayscale) {
+        Byte1 = Bytes == 2 ? ReaderByte(Reader) : 0;
+        SetPixel(Pixel, Byte0, Byte0, Byte0, Decoder->Info.HasAlpha ? Byte1 : 0);
+        return;
+    }
+    
+    switch (Bytes) {
+    case 2:
+        Value = Byte0 | (ReaderByte(Reader) << 8);
+        SetPixel(Pixel, Expand5((Value >> 10) & 0x1F), Expand5((Value >> 5) & 0x1F), Expand5(Value & 0x1F),
+                 Decoder->Info.HasAlpha && (Value & 0x8000) ? 255 : 0);
+        break;
+    case 3:
+        Byte1 = ReaderByte(Reader);
+        Byte2 = ReaderByte(Reader);
+        SetPixel(Pixel, Byte2, Byte1, Byte0, 0);
+        break;
+    default:
+        Byte1 = ReaderByte(Reader);
+        Byte2 = ReaderByte(Reader);
+        Value = ReaderByte(Reader);
+        SetPixel(Pixel, Byte2, Byte1, Byte0, Decoder->Info.HasAlpha ? (uint8_t)Value : 0);
+        break;
+    }
+}
+
+static EFI_STATUS OpenTga(IMAGE_DECODER *Decoder) {
+    IMAGE_READER *Reader = &Decoder->Reader;
+    uint8_t Header[18];
+    EFI_STATUS Status = ReaderRead(Reader, Header, sizeof(Header));
+    
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    uint8_t ImageType = Header[2] & ~TGA_RLE;
+    uint8_t Descriptor = Header[17];
+    uint32_t MapFirst = LoadLe16(Header + 3);
+    uint32_t MapLength = LoadLe16(Header + 5);
+    uint32_t MapEntryBits = Header[7];
+    
+    Decoder->Info.Width = LoadLe16(Header + 12);
+    Decoder->Info.Height = LoadLe16(Header + 14);
+    Decoder->BitsPerPixel = Header[16];
+    Decoder->Compressed = (Header[2] & TGA_RLE) != 0;
+    Decoder->ColorMapped = ImageType == TGA_COLOR_MAPPED;
+    Decoder->Grayscale = ImageType == TGA_GRAYSCALE;
+    Decoder->TopDown = (Descriptor & 0x20) != 0;
+    Decoder->RightToLeft = (Descriptor & 0x10) != 0;
+    
+    // Attribute (alpha) bits in the descriptor
+    uint32_t AlphaBits = Descriptor & 0x0F;
+    Decoder->Info.HasAlpha = AlphaBits != 0 &&
+        (Decoder->BitsPerPixel == 32 || Decoder->BitsPerPixel == 16);
+    
+    // Image ID
+    Status = ReaderRead(Reader, NULL, Header[0]);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    // The color map is present (and must be skipped) even for non-mapped images
+    if (Header[1] == 1) {
+        uint32_t EntryBytes = (MapEntryBits + 7) / 8;
+        
+        if (!Decoder->ColorMapped) {
+            return ReaderRead(Reader, NULL, (uint64_t)MapLength * EntryBytes);
+        }
+        if (EntryBytes < 2 || EntryBytes > 4) {
+            return EFI_UNSUPPORTED;
+        }
+        
+        // Decode the map entries with the true-color path
+        Decoder->ColorMapped = false;
+        Decoder->Palette = (EFI_GRAPHICS_OUTPUT_BLT_PIXEL*)AllocatePool(
+            (uint64_t)(MapLength ? MapLength : 1) * sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL));
+        if (Decoder->Palette == NULL) {
+            return EFI_OUT_OF_RESOURCES;
+        }
+        bool HasAlpha = Decoder->Info.HasAlpha;
+        Decoder->Info.HasAlpha = AlphaBits != 0 && (EntryBytes == 4 || EntryBytes == 2);
+        for (uint32_t i = 0; i < MapLength; i++) {
+            ReadTgaValue(Decoder, EntryBytes, &Decoder->Palette[i]);
+        }
+        Decoder->PaletteSize = MapLength;
+        Decoder->PaletteFirst = MapFirst;
+        Decoder->ColorMapped = true;
+        Decoder->Info.HasAlpha = Decoder->Info.HasAlpha || HasAlpha;
+    }
+    
+    return Reader->Status;
+}
+
+// Identify the format and read its header
+EFI_STATUS ImageDecoderOpen(IMAGE_DECODER *Decoder, EFI_FILE_PROTOCOL *File) {
+    EFI_STATUS Status;
+    
+    if (Decoder == NULL || File == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    MemSet(Decoder, 0, sizeof(*Decoder));
+    Decoder->Reader.File = File;
+    Decoder->Reader.Status = EFI_SUCCESS;
+    Decoder->Reader.Buffer = (uint8_t*)AllocatePool(IMAGE_READ_CHUNK_SIZE);
+    if (Decoder->Reader.Buffer == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    
+    // The longest fixed header (TGA) is 18 bytes
+    if (!ReaderEnsure(&Decoder->Reader, 18)) {
+        Status = EFI_ERROR(Decoder->Reader.Status) ? Decoder->Reader.Status : EFI_UNSUPPORTED;
+        ImageDecoderClose(Decoder);
+        return Status;
+    }
+    
+    const uint8_t *Magic = Decoder->Reader.Buffer;
+    if (Magic[0] == 'B' && Magic[1] == 'M') {
+        Decoder->Info.Format = ImageFormatBmp;
+        Status = OpenBmp(Decoder);
+    } else if (Magic[0] == 'q' && Magic[1] == 'o' && Magic[2] == 'i' && Magic[3] == 'f') {
+        Decoder->Info.Format = ImageFormatQoi;
+        Status = OpenQoi(Decoder);
+    } else if (LooksLikeTga(Magic)) {
+        Decoder->Info.Format = ImageFormatTga;
+        Status = OpenTga(Decoder);
+    } else {
+        Status = EFI_UNSUPPORTED;
+    }
+    
+    if (!EFI_ERROR(Status) &&
+        (Decoder->Info.Width == 0 || Decoder->Info.Height == 0 ||
+         Decoder->Info.Width > IMAGE_MAX_DIMENSION || Decoder->Info.Height > IMAGE_MAX_DIMENSION)) {
+        Status = EFI_UNSUPPORTED;
+    }
+    
+    if (!EFI_ERROR(Status)) {
+        Decoder->Row = (EFI_GRAPHICS_OUTPUT_BLT_PIXEL*)AllocatePool(
+            (uint64_t)Decoder->Info.Width * sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL));
+        if (Decoder->Row == NULL) {
+            Status = EFI_OUT_OF_RESOURCES;
+        }
+    }
+    
+    if (EFI_ERROR(Status)) {
+        ImageDecoderClose(Decoder);
+    }
+    
+    return Status;
+}
+
+void ImageDecoderClose(IMAGE_DECODER *Decoder) {
+    if (Decoder == NULL) {
+        return;
+    }
+    
+    if (Decoder->Reader.Buffer != NULL) {
+        FreePool(Decoder->Reader.Buffer);
+        Decoder->Reader.Buffer = NULL;
+    }
+    if (Decoder->Palette != NULL) {
+        FreePool(Decoder->Palette);
+        Decoder->Palette = NULL;
+    }
+    if (Decoder->Row != NULL) {
+        FreePool(Decoder->Row);
+        Decoder->Row = NULL;
+    }
+    if (Decoder->RowData != NULL) {
+        FreePool(Decoder->RowData);
+        Decoder->RowData = NULL;
+    }
+}
+
+//
+// Row decoders (each fills Decoder->Row with the next row in file order)
+//
+
+static EFI_STATUS DecodeBmpRow(IMAGE_DECODER *Decoder) {
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Row = Decoder->Row;
+    const uint8_t *Data = Decoder->RowData;
+    uint32_t Width = Decoder->Info.Width;
+    EFI_STATUS Status = ReaderRead(&Decoder->Reader, Decoder->RowData, Decoder->RowBytes);
+    
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    switch (Decoder->BitsPerPixel) {
+    case 1:
+    case 4:
+    case 8: {
+        uint32_t Bits = Decoder->BitsPerPixel;
+        uint32_t PixelsPerByte = 8 / Bits;
+        uint32_t IndexMask = (1u << Bits) - 1;
+            
+        for (uint32_t x = 0; x < Width; x++) {
+            uint32_t Shift = 8 - Bits - (x % PixelsPerByte) * Bits;
+            uint32_t Index = (Data[x / PixelsPerByte] >> Shift) & IndexMask;
+                
+            if (Index < Decoder->PaletteSize) {
+                Row[x] = Decoder->Palette[Index];
+            } else {
+                SetPixel(&Row[x], 0, 0, 0, 0);
+            }
+        }
+        break;
+    }
+    case 24:
+        for (uint32_t x = 0; x < Width; x++, Data += 3) {
+            SetPixel(&Row[x], Data[2], Data[1], Data[0], 0);
+        }
+        break;
+    case 32:
+        if (Decoder->PlainBgr) {
+            // Already in Blt pixel order
+            MemCpy(Row, Data, (uint64_t)Width * 4);
+            if (!Decoder->Info.HasAlpha) {
+                for (uint32_t x = 0; x < Width; x++) {
+                    Row[x].Reserved = 0;
+                }
+            }
+            break;
+        }
+        for (uint32_t x = 0; x < Width; x++, Data += 4) {
+            uint32_t Value = LoadLe32(Data);
+            SetPixel(&Row[x], ExtractChannel(&Decoder->Channels[0], Value, 0),
+                     ExtractChannel(&Decoder->Channels[1], Value, 0),
+                     ExtractChannel(&Decoder->Channels[2], Value, 0),
+                     ExtractChannel(&Decoder->Channels[3], Value, 0));
+        }
+        break;
+    default:
+        for (uint32_t x = 0; x < Width; x++, Data += 2) {
+            uint32_t Value = LoadLe16(Data);
+            SetPixel(&Row[x], ExtractChannel(&Decoder->Channels[0], Value, 0),
+                     ExtractChannel(&Decoder->Channels[1], Value, 0),
+                     ExtractChannel(&Decoder->Channels[2], Value, 0),
+                     ExtractChannel(&Decoder->Channels[3], Value, 0));
+        }
+        break;
+    }
+    
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS DecodeQoiRow(IMAGE_DECODER *Decoder) {
+    IMAGE_READER *Reader = &Decoder->Reader;
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Row = Decoder->Row;
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL Pixel = Decoder->RunPixel;
+    uint32_t Run = Decoder->RunRemaining;
+    uint8_t AlphaMask = Decoder->Info.HasAlpha ? 0xFF : 0x00;
+    
+    for (uint32_t x = 0; x < Decoder->Info.Width; x++) {
+        if (Run > 0) {
+            Run--;
+        } else {
+            uint8_t Tag = ReaderByte(Reader);
+            
+            if (Tag == QOI_OP_RGB) {
+                Pixel.Red = ReaderByte(Reader);
+                Pixel.Green = ReaderByte(Reader);
+                Pixel.Blue = ReaderByte(Reader);
+            } else if (Tag == QOI_OP_RGBA) {
+                Pixel.Red = ReaderByte(Reader);
+                Pixel.Green = ReaderByte(Reader);
+                Pixel.Blue = ReaderByte(Reader);
+                Pixel.Reserved = ReaderByte(Reader);
+            } else if ((Tag & QOI_MASK_2) == QOI_OP_INDEX) {
+                Pixel = Decoder->QoiIndex[Tag];
+            } else if ((Tag & QOI_MASK_2) == QOI_OP_DIFF) {
+                Pixel.Red += ((Tag >> 4) & 0x03) - 2;
+                Pixel.Green += ((Tag >> 2) & 0x03) - 2;
+                Pixel.Blue += (Tag & 0x03) - 2;
+            } else if ((Tag & QOI_MASK_2) == QOI_OP_LUMA) {
+                uint8_t Next = ReaderByte(Reader);
+                int32_t GreenDelta = (Tag & 0x3F) - 32;
+                
+                Pixel.Red += GreenDelta - 8 + ((Next >> 4) & 0x0F);
+                Pixel.Green += GreenDelta;
+                Pixel.Blue += GreenDelta - 8 + (Next & 0x0F);
+            } else {
+                Run = Tag & 0x3F;
+            }
+            
+            Decoder->QoiIndex[(Pixel.Red * 3 + Pixel.Green * 5 + Pixel.Blue * 7 + Pixel.Reserved * 11) % 64] = Pixel;
+        }
+        
+        Row[x] = Pixel;
+        Row[x].Reserved &= AlphaMask;
+    }
+    
+    Decoder->RunPixel = Pixel;
+    Decoder->RunRemaining = Run;
+    return Reader->Status;
+}
+
+static EFI_STATUS DecodeTgaRow(IMAGE_DECODER *Decoder) {
+    IMAGE_READER *Reader = &Decoder->Reader;
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Row = Decoder->Row;
+    uint32_t Bytes = (Decoder->BitsPerPixel + 7) / 8;
+    uint32_t Width = Decoder->Info.Width;
+    
+    if (!Decoder->Compressed) {
+        for (uint32_t x = 0; x < Width; x++) {
+            ReadTgaValue(Decoder, Bytes, &Row[x]);
+        }
+    } else {
+        for (uint32_t x = 0; x < Width; x++) {
+            if (Decoder->RunRemaining == 0) {
+                uint8_t Packet = ReaderByte(Reader);
+                
+                Decoder->RunRemaining = (Packet & 0x7F) + 1;
+                Decoder->RunRepeats = (Packet & 0x80) != 0;
+                if (Decoder->RunRepeats) {
+                    ReadTgaValue(Decoder, Bytes, &Decoder->RunPixel);
+                }
+            }
+            
+            if (Decoder->RunRepeats) {
+                Row[x] = Decoder->RunPixel;
+            } else {
+                ReadTgaValue(Decoder, Bytes, &Row[x]);
+            }
+            Decoder->RunRemaining--;
+        }
+    }
+    
+    if (Decoder->RightToLeft) {
+        for (uint32_t Left = 0, Right = Width - 1; Left < Right; Left++, Right--) {
+            EFI_GRAPHICS_OUTPUT_BLT_PIXEL Swap = Row[Left];
+            Row[Left] = Row[Right];
+            Row[Right] = Swap;
+        }
+    }
+    
+    return Reader->Status;
+}
+
+// Decode every row and hand it to the surface or framebuffer
+static EFI_STATUS DecodeRows(IMAGE_DECODER *Decoder, GOP_SURFACE *Surface,
+                             GOP_FRAMEBUFFER *Framebuffer, uint32_t X, uint32_t Y) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    uint32_t Height = Decoder->Info.Height;
+    
+    if (Decoder->Row == NULL) {
+        return EFI_NOT_READY;
+    }
+    
+    for (uint32_t i = 0; i < Height && !EFI_ERROR(Status); i++) {
+        switch (Decoder->Info.Format) {
+        case ImageFormatBmp:
+            Status = DecodeBmpRow(Decoder);
+            break;
+        case ImageFormatQoi:
+            Status = DecodeQoiRow(Decoder);
+            break;
+        default:
+            Status = DecodeTgaRow(Decoder);
+            break;
+        }
+        if (EFI_ERROR(Status)) {
+            break;
+        }
+        
+        uint64_t RowY = (uint64_t)Y + (Decoder->TopDown ? i : Height - 1 - i);
+        if (RowY > 0xFFFFFFFF) {
+            continue;
+        }
+        
+        if (Surface != NULL) {
+            SurfaceBlit(Surface, X, (uint32_t)RowY, Decoder->Info.Width, 1, Decoder->Row, Decoder->Info.Width);
+        } else {
+            Status = FramebufferBlit(Framebuffer, X, (uint32_t)RowY, Decoder->Info.Width, 1,
+                                     Decoder->Row, Decoder->Info.Width);
+        }
+    }
+    
+    return Status;
+}
+
+// Decode the image into a surface at (X, Y), clipping to the surface
+EFI_STATUS ImageDecodeToSurface(IMAGE_DECODER *Decoder, GOP_SURFACE *Surface, uint32_t X, uint32_t Y) {
+    if (Decoder == NULL || Surface == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    return DecodeRows(Decoder, Surface, NULL, X, Y);
+}
+
+// Decode the image straight onto the screen at (X, Y)
+EFI_STATUS ImageDecodeToFramebuffer(IMAGE_DECODER *Decoder, GOP_FRAMEBUFFER *Framebuffer,
+                                    uint32_t X, uint32_t Y) {
+    if (Decoder == NULL || Framebuffer == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    return DecodeRows(Decoder, NULL, Framebuffer, X, Y);
+}
+
+// Load an image file into a newly created surface of its size
+EFI_STATUS ImageLoadFile(EFI_FILE_PROTOCOL *Root, const char16_t *FileName,
+                         GOP_SURFACE *Surface, IMAGE_INFO *Info) {
+    EFI_FILE_PROTOCOL *File = NULL;
+    IMAGE_DECODER Decoder;
+    EFI_STATUS Status;
+    
+    if (Root == NULL || FileName == NULL || Surface == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    Status = OpenFile(Root, FileName, &File, EFI_FILE_MODE_READ);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    Status = ImageDecoderOpen(&Decoder, File);
+    if (!EFI_ERROR(Status)) {
+        Status = CreateSurface(Surface, Decoder.Info.Width, Decoder.Info.Height);
+        if (!EFI_ERROR(Status)) {
+            Status = ImageDecodeToSurface(&Decoder, Surface, 0, 0);
+            if (EFI_ERROR(Status)) {
+                FreeSurface(Surface);
+            }
+        }
+        if (Info != NULL) {
+            *Info = Decoder.Info;
+        }
+        ImageDecoderClose(&Decoder);
+    }
+    
+    File->Close(File);
+    return Status;
+}
+
+// Print microseconds per megapixel
+static void PrintDecodeRate(const char16_t *Label, uint64_t Pixels, uint64_t Ticks) {
+    PRINT(Label);
+    PrintDec(TimestampToMicroseconds(Ticks) * 1000000 / (Pixels ? Pixels : 1));
+    PRINTL(u" us/Mpixel");
+}
+
+// Time decoding a file (including its reads) into a surface and onto the screen
+void ImageBenchmark(EFI_FILE_PROTOCOL *Root, const char16_t *FileName) {
+    static const char16_t *FormatNames[ImageFormatMax] = { u"BMP", u"QOI", u"TGA" };
+    EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop = NULL;
+    EFI_FILE_PROTOCOL *File = NULL;
+    GOP_FRAMEBUFFER Framebuffer;
+    GOP_SURFACE Surface;
+    IMAGE_DECODER Decoder;
+    IMAGE_INFO Info;
+    uint64_t SurfaceTicks = 0, FramebufferTicks = 0;
+    EFI_STATUS Status;
+    
+    if (EFI_ERROR(OpenFile(Root, FileName, &File, EFI_FILE_MODE_READ))) {
+        PRINTL(u"Image benchmark: cannot open file");
+        return;
+    }
+    
+    Status = ImageDecoderOpen(&Decoder, File);
+    if (EFI_ERROR(Status)) {
+        PRINTL(u"Image benchmark: unsupported image");
+        File->Close(File);
+        return;
+    }
+    Info = Decoder.Info;
+    ImageDecoderClose(&Decoder);
+    
+    if (EFI_ERROR(CreateSurface(&Surface, Info.Width, Info.Height))) {
+        PRINTL(u"Image benchmark: out of memory");
+        File->Close(File);
+        return;
+    }
+    
+    bool HaveScreen = !EFI_ERROR(GetGraphicsOutputProtocol(&Gop)) &&
+                      !EFI_ERROR(FramebufferInit(&Framebuffer, Gop));
+    
+    for (int Pass = 0; Pass < IMAGE_BENCHMARK_PASSES && !EFI_ERROR(Status); Pass++) {
+        uint64_t Start;
+        
+        File->SetPosition(File, 0);
+        Start = ReadTimestamp();
+        Status = ImageDecoderOpen(&Decoder, File);
+        if (!EFI_ERROR(Status)) {
+            Status = ImageDecodeToSurface(&Decoder, &Surface, 0, 0);
+            ImageDecoderClose(&Decoder);
+        }
+        SurfaceTicks += ReadTimestamp() - Start;
+        
+        if (HaveScreen && !EFI_ERROR(Status)) {
+            File->SetPosition(File, 0);
+            Start = ReadTimestamp();
+            Status = ImageDecoderOpen(&Decoder, File);
+            if (!EFI_ERROR(Status)) {
+                Status = ImageDecodeToFramebuffer(&Decoder, &Framebuffer, 0, 0);
+                ImageDecoderClose(&Decoder);
+            }
+            FramebufferTicks += ReadTimestamp() - Start;
+        }
+    }
+    
+    FreeSurface(&Surface);
+    File->Close(File);
+    
+    if (EFI_ERROR(Status)) {
+        PRINT(u"Image benchmark: decode failed: ");
+        PrintHex(Status);
+        PRINTL(u"");
+        return;
+    }
+    
+    uint64_t Pixels = (uint64_t)Info.Width * Info.Height * IMAGE_BENCHMARK_PASSES;
+    
+    CLEAR_SCREEN();
+    PRINT(FormatNames[Info.Format]);
+    PRINT(u" ");
+    PrintDec(Info.Width);
+    PRINT(u"x");
+    PrintDec(Info.Height);
+    PRINTL(u"");
+    PrintDecodeRate(u"Decode to surface:     ", Pixels, SurfaceTicks);
+    if (HaveScreen) {
+        PrintDecodeRate(u"Decode to framebuffer: ", Pixels, FramebufferTicks);
+    }
+}
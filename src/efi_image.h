@@ -0,0 +1,101 @@
+// efi_image.h
+#ifndef TINYUEFI_IMAGE_H
+#define TINYUEFI_IMAGE_H
+
+#include "uefi_types.h"
+#include "efi_file_protocol.h"
+#include "efi_gop_protocol.h"
+#include "efi_gop_surface.h"
+#include "efi_gop_framebuffer.h"
+
+// Bytes pulled from the file per read
+#define IMAGE_READ_CHUNK_SIZE         (64 * 1024)
+
+// Largest width or height accepted
+#define IMAGE_MAX_DIMENSION           16384
+
+// Decodes per measurement in ImageBenchmark
+#define IMAGE_BENCHMARK_PASSES        4
+
+// Supported image formats
+typedef enum {
+    ImageFormatBmp,
+    ImageFormatQoi,
+    ImageFormatTga,
+    ImageFormatMax
+} IMAGE_FORMAT;
+
+// Image properties read from the header
+typedef struct {
+    IMAGE_FORMAT Format;
+    uint32_t Width;
+    uint32_t Height;
+    bool HasAlpha;
+} IMAGE_INFO;
+
+// Chunked file reader; Status keeps the first read error or truncation
+typedef struct {
+    EFI_FILE_PROTOCOL *File;
+    uint8_t *Buffer;
+    uint64_t Length;
+    uint64_t Position;
+    uint64_t Offset;
+    EFI_STATUS Status;
+} IMAGE_READER;
+
+// One channel of a BMP bitfield layout
+typedef struct {
+    uint32_t Mask;
+    uint32_t Shift;
+    uint32_t Max;
+} IMAGE_CHANNEL;
+
+// Decoder state. Only one row of pixels is held at a time.
+typedef struct {
+    IMAGE_READER Reader;
+    IMAGE_INFO Info;
+    
+    // Layout
+    bool TopDown;
+    bool RightToLeft;
+    uint32_t BitsPerPixel;
+    uint64_t RowBytes;
+    
+    // BMP bitfields (Red, Green, Blue, Alpha) and plain 8-bit BGR(A) detection
+    IMAGE_CHANNEL Channels[4];
+    bool PlainBgr;
+    
+    // BMP palette or TGA color map
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Palette;
+    uint32_t PaletteSize;
+    uint32_t PaletteFirst;
+    
+    // TGA image type
+    bool Compressed;
+    bool ColorMapped;
+    bool Grayscale;
+    
+    // Runs (TGA RLE packets and QOI_OP_RUN) may cross rows
+    uint32_t RunRemaining;
+    bool RunRepeats;
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL RunPixel;
+    
+    // QOI state
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL QoiIndex[64];
+    
+    // Row buffers
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Row;
+    uint8_t *RowData;
+} IMAGE_DECODER;
+
+// Helper functions
+EFI_STATUS ImageDecoderOpen(IMAGE_DECODER *Decoder, EFI_FILE_PROTOCOL *File);
+EFI_STATUS ImageDecodeToSurface(IMAGE_DECODER *Decoder, GOP_SURFACE *Surface, uint32_t X, uint32_t Y);
+EFI_STATUS ImageDecodeToFramebuffer(IMAGE_DECODER *Decoder, GOP_FRAMEBUFFER *Framebuffer,
+                                    uint32_t X, uint32_t Y);
+void ImageDecoderClose(IMAGE_DECODER *Decoder);
+EFI_STATUS ImageLoadFile(EFI_FILE_PROTOCOL *Root, const char16_t *FileName,
+                         GOP_SURFACE *Surface, IMAGE_INFO *Info);
+void ImageBenchmark(EFI_FILE_PROTOCOL *Root, const char16_t *FileName);
+
+#endif // TINYUEFI_IMAGE_H
@@ -0,0 +1,367 @@
+// efi_log.c
+#include "efi_log.h"
+#include "uefi_helpers.h"
+
+// Set the on-disk size of the log file
+static EFI_STATUS SetLogFileSize(EFI_FILE_PROTOCOL *File, uint64_t Size) {
+    EFI_STATUS Status;
+    EFI_FILE_INFO *Info = NULL;
+    
+    Status = ReadFileInfo(File, &Info);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    Info->FileSize = Size;
+    Status = File->SetInfo(File, (EFI_GUID*)&gEfiFileInfoGuid, Info->Size, Info);
+    FreePool(Info);
+    return Status;
+}
+
+// Find the end of the log text, skipping a zero-filled tail reserved by a
+// session that never reached LogClose
+static EFI_STATUS FindLogEnd(LOG_SINK *Log, uint64_t FileSize) {
+    EFI_STATUS Status;
+    uint64_t Scanned = 0;
+    
+    Log->FileOffset = FileSize;
+    
+    while (Log->FileOffset > 0 && Scanned < LOG_PREALLOCATE_CHUNK) {
+        uint64_t Chunk = Log->BufferSize;
+        if (Chunk > Log->FileOffset) {
+            Chunk = Log->FileOffset;
+        }
+        
+        Status = Log->File->SetPosition(Log->File, Log->FileOffset - Chunk);
+        if (EFI_ERROR(Status)) {
+            return Status;
+        }
+        
+        uint64_t ReadSize = Chunk;
+        Status = ReadFile(Log->File, Log->Buffer, &ReadSize);
+        if (EFI_ERROR(Status)) {
+            return Status;
+        }
+        
+        uint64_t End = ReadSize;
+        while (End > 0 && Log->Buffer[End - 1] == 0) {
+            End--;
+        }
+        
+        if (End > 0) {
+            Log->FileOffset -= Chunk - End;
+            break;
+        }
+        
+        Log->FileOffset -= Chunk;
+        Scanned += Chunk;
+    }
+    
+    return EFI_SUCCESS;
+}
+
+// Drop the file and keep logging to memory only
+static void DetachLogFile(LOG_SINK *Log, EFI_STATUS Status) {
+    if (Log->File != NULL) {
+        Log->File->Close(Log->File);
+        Log->File = NULL;
+    }
+    
+    Log->FileStatus = Status;
+    Log->BufferUsed = 0;
+}
+
+// Reserve file space ahead of the write position in large steps so the
+// FAT driver does not extend the cluster chain on every write
+static EFI_STATUS ReserveLogSpace(LOG_SINK *Log, uint64_t Needed) {
+    if (Log->FileOffset + Needed <= Log->AllocatedSize) {
+        return EFI_SUCCESS;
+    }
+    
+    uint64_t NewSize = Log->FileOffset + Needed + LOG_PREALLOCATE_CHUNK;
+    NewSize -= NewSize % LOG_PREALLOCATE_CHUNK;
+    
+    EFI_STATUS Status = SetLogFileSize(Log->File, NewSize);
+    if (EFI_ERROR(Status)) {
+        // Preallocation is only an optimization; plain writes still extend the file
+        return EFI_SUCCESS;
+    }
+    
+    Log->AllocatedSize = NewSize;
+    Log->FileGrows++;
+    return EFI_SUCCESS;
+}
+
+// Write a block of bytes at the end of the log file
+static EFI_STATUS WriteLogFile(LOG_SINK *Log, const void *Data, uint64_t Size) {
+    EFI_STATUS Status;
+    
+    if (Log->File == NULL || Size == 0) {
+        return EFI_SUCCESS;
+    }
+    
+    ReserveLogSpace(Log, Size);
+    
+    Status = WriteFile(Log->File, (void*)Data, Size);
+    if (EFI_ERROR(Status)) {
+        DetachLogFile(Log, Status);
+        return Status;
+    }
+    
+    Log->FileOffset += Size;
+    Log->FileWrites++;
+    return EFI_SUCCESS;
+}
+
+// Hand buffered data to the file system without forcing it to disk
+static EFI_STATUS DrainLogBuffer(LOG_SINK *Log) {
+    EFI_STATUS Status = WriteLogFile(Log, Log->Buffer, Log->BufferUsed);
+    Log->BufferUsed = 0;
+    return Status;
+}
+
+// Append to the in-memory history ring
+static void RecordHistory(LOG_SINK *Log, const uint8_t *Data, uint64_t Size) {
+    if (Log->History == NULL || Log->HistorySize == 0) {
+        return;
+    }
+    
+    // Only the tail of an oversized write can survive
+    if (Size > Log->HistorySize) {
+        Data += Size - Log->HistorySize;
+        Size = Log->HistorySize;
+    }
+    
+    uint64_t First = Log->HistorySize - Log->HistoryHead;
+    if (First > Size) {
+        First = Size;
+    }
+    
+    MemCpy(Log->History + Log->HistoryHead, Data, First);
+    MemCpy(Log->History, Data + First, Size - First);
+    
+    Log->HistoryHead += Size;
+    if (Log->HistoryHead >= Log->HistorySize) {
+        Log->HistoryHead -= Log->HistorySize;
+        Log->HistoryWrapped = true;
+    }
+}
+
+// Open (or create) a log file for appending. If the file cannot be opened,
+// the sink still works in memory-only mode and FileStatus records why.
+EFI_STATUS LogOpen(LOG_SINK *Log, EFI_FILE_PROTOCOL *Root, const char16_t *FileName, 
+                  uint64_t BufferSize, uint64_t HistorySize) {
+    EFI_STATUS Status;
+    EFI_FILE_INFO *Info = NULL;
+    
+    if (Log == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    MemSet(Log, 0, sizeof(*Log));
+    Log->BufferSize = BufferSize != 0 ? BufferSize : LOG_DEFAULT_BUFFER_SIZE;
+    Log->FlushThreshold = Log->BufferSize - Log->BufferSize / 4;
+    Log->HistorySize = HistorySize;
+    
+    Log->Buffer = (uint8_t*)AllocatePool(Log->BufferSize);
+    if (Log->Buffer == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    
+    if (HistorySize > 0) {
+        Log->History = (uint8_t*)AllocatePool(HistorySize);
+        if (Log->History == NULL) {
+            FreePool(Log->Buffer);
+            Log->Buffer = NULL;
+            return EFI_OUT_OF_RESOURCES;
+        }
+    }
+    
+    if (Root == NULL || FileName == NULL) {
+        Log->FileStatus = EFI_NOT_FOUND;
+        return EFI_SUCCESS;
+    }
+    
+    Status = OpenFile(Root, FileName, &Log->File, 
+                      EFI_FILE_MODE_CREATE | EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE);
+    if (EFI_ERROR(Status)) {
+        Log->File = NULL;
+        Log->FileStatus = Status;
+        return EFI_SUCCESS;
+    }
+    
+    Status = ReadFileInfo(Log->File, &Info);
+    if (EFI_ERROR(Status)) {
+        DetachLogFile(Log, Status);
+        return EFI_SUCCESS;
+    }
+    
+    Log->AllocatedSize = Info->FileSize;
+    FreePool(Info);
+    
+    Status = FindLogEnd(Log, Log->AllocatedSize);
+    if (!EFI_ERROR(Status)) {
+        Status = Log->File->SetPosition(Log->File, Log->FileOffset);
+    }
+    if (EFI_ERROR(Status)) {
+        DetachLogFile(Log, Status);
+    }
+    
+    return EFI_SUCCESS;
+}
+
+// Coalesce bytes into the buffer, draining it to the file as needed
+static EFI_STATUS AppendLog(LOG_SINK *Log, const void *Data, uint64_t Size) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    
+    Log->BytesLogged += Size;
+    RecordHistory(Log, (const uint8_t*)Data, Size);
+    
+    if (Log->File == NULL) {
+        return EFI_SUCCESS;
+    }
+    
+    // Make room, then either coalesce or (for huge writes) go straight through
+    if (Log->BufferUsed + Size > Log->BufferSize) {
+        Status = DrainLogBuffer(Log);
+        if (EFI_ERROR(Status)) {
+            return Status;
+        }
+    }
+    
+    if (Size > Log->BufferSize) {
+        return WriteLogFile(Log, Data, Size);
+    }
+    
+    MemCpy(Log->Buffer + Log->BufferUsed, Data, Size);
+    Log->BufferUsed += Size;
+    
+    if (Log->BufferUsed >= Log->FlushThreshold) {
+        Status = DrainLogBuffer(Log);
+    }
+    
+    return Status;
+}
+
+// Append raw bytes to the log
+EFI_STATUS LogWrite(LOG_SINK *Log, const void *Data, uint64_t Size) {
+    if (Log == NULL || Log->Buffer == NULL || (Data == NULL && Size != 0)) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    Log->Messages++;
+    return AppendLog(Log, Data, Size);
+}
+
+// Append a UCS-2 string, stored as UTF-8
+EFI_STATUS LogPrint(LOG_SINK *Log, const char16_t *String) {
+    uint8_t Encoded[128];
+    uint64_t Used = 0;
+    EFI_STATUS Status;
+    
+    if (Log == NULL || Log->Buffer == NULL || String == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    Log->Messages++;
+    
+    for (; *String != 0; String++) {
+        if (Used + 3 > sizeof(Encoded)) {
+            Status = AppendLog(Log, Encoded, Used);
+            if (EFI_ERROR(Status)) {
+                return Status;
+            }
+            Used = 0;
+        }
+        
+        char16_t Char = *String;
+        if (Char < 0x80) {
+            Encoded[Used++] = (uint8_t)Char;
+        } else if (Char < 0x800) {
+            Encoded[Used++] = (uint8_t)(0xC0 | (Char >> 6));
+            Encoded[Used++] = (uint8_t)(0x80 | (Char & 0x3F));
+        } else {
+            Encoded[Used++] = (uint8_t)(0xE0 | (Char >> 12));
+            Encoded[Used++] = (uint8_t)(0x80 | ((Char >> 6) & 0x3F));
+            Encoded[Used++] = (uint8_t)(0x80 | (Char & 0x3F));
+        }
+    }
+    
+    return AppendLog(Log, Encoded, Used);
+}
+
+// Write out buffered data and ask the file system to commit it
+EFI_STATUS LogFlush(LOG_SINK *Log) {
+    EFI_STATUS Status;
+    
+    if (Log == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    Status = DrainLogBuffer(Log);
+    if (EFI_ERROR(Status) || Log->File == NULL) {
+        return Status;
+    }
+    
+    Status = Log->File->Flush(Log->File);
+    Log->FileFlushes++;
+    return Status;
+}
+
+// Flush, trim the preallocated tail and release the sink. Call before the
+// application exits; file I/O is not possible from ExitBootServices.
+EFI_STATUS LogClose(LOG_SINK *Log) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    
+    if (Log == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    if (Log->File != NULL) {
+        Status = DrainLogBuffer(Log);
+        
+        if (Log->File != NULL && Log->AllocatedSize > Log->FileOffset) {
+            SetLogFileSize(Log->File, Log->FileOffset);
+        }
+        
+        if (Log->File != NULL) {
+            Log->File->Flush(Log->File);
+            Log->File->Close(Log->File);
+            Log->File = NULL;
+        }
+    }
+    
+    FreePool(Log->Buffer);
+    FreePool(Log->History);
+    Log->Buffer = NULL;
+    Log->History = NULL;
+    return Status;
+}
+
+// Copy the retained history (oldest byte first); returns the bytes copied
+uint64_t LogGetHistory(LOG_SINK *Log, void *Buffer, uint64_t BufferSize) {
+    uint8_t *Out = (uint8_t*)Buffer;
+    
+    if (Log == NULL || Log->History == NULL || Buffer == NULL) {
+        return 0;
+    }
+    
+    uint64_t Available = Log->HistoryWrapped ? Log->HistorySize : Log->HistoryHead;
+    uint64_t Copy = Available < BufferSize ? Available : BufferSize;
+    
+    // Start at the oldest byte that still fits in the caller's buffer
+    uint64_t Start = Log->HistoryWrapped ? Log->HistoryHead : 0;
+    Start += Available - Copy;
+    if (Start >= Log->HistorySize) {
+        Start -= Log->HistorySize;
+    }
+    
+    uint64_t First = Log->HistorySize - Start;
+    if (First > Copy) {
+        First = Copy;
+    }
+    
+    MemCpy(Out, Log->History + Start, First);
+    MemCpy(Out + First, Log->History, Copy - First);
+    return Copy;
+}
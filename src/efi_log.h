@@ -0,0 +1,54 @@
+// efi_log.h
+#ifndef TINYUEFI_LOG_H
+#define TINYUEFI_LOG_H
+
+#include "uefi_types.h"
+#include "efi_file_protocol.h"
+
+// Default sizes for LogOpen
+#define LOG_DEFAULT_BUFFER_SIZE       (64 * 1024)
+#define LOG_DEFAULT_HISTORY_SIZE      (16 * 1024)
+#define LOG_PREALLOCATE_CHUNK         (1024 * 1024)
+
+// Buffered append-only log sink. Messages are coalesced in memory and
+// written when the buffer passes its threshold, on LogFlush, or on LogClose.
+// The most recent HistorySize bytes are always kept in memory, so the log
+// remains readable when the volume is read-only or missing.
+typedef struct {
+    EFI_FILE_PROTOCOL *File;
+    EFI_STATUS FileStatus;
+    
+    // Pending data not yet handed to the file system
+    uint8_t *Buffer;
+    uint64_t BufferSize;
+    uint64_t BufferUsed;
+    uint64_t FlushThreshold;
+    
+    // Logical end of the log and space reserved on disk
+    uint64_t FileOffset;
+    uint64_t AllocatedSize;
+    
+    // Ring of the most recent output
+    uint8_t *History;
+    uint64_t HistorySize;
+    uint64_t HistoryHead;
+    bool HistoryWrapped;
+    
+    // Statistics
+    uint64_t Messages;
+    uint64_t BytesLogged;
+    uint64_t FileWrites;
+    uint64_t FileFlushes;
+    uint64_t FileGrows;
+} LOG_SINK;
+
+// Helper functions
+EFI_STATUS LogOpen(LOG_SINK *Log, EFI_FILE_PROTOCOL *Root, const char16_t *FileName, 
+                  uint64_t BufferSize, uint64_t HistorySize);
+EFI_STATUS LogWrite(LOG_SINK *Log, const void *Data, uint64_t Size);
+EFI_STATUS LogPrint(LOG_SINK *Log, const char16_t *String);
+EFI_STATUS LogFlush(LOG_SINK *Log);
+EFI_STATUS LogClose(LOG_SINK *Log);
+uint64_t LogGetHistory(LOG_SINK *Log, void *Buffer, uint64_t BufferSize);
+
+#endif // TINYUEFI_LOG_H
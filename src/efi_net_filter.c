@@ -0,0 +1,349 @@
+// efi_net_filter.c
+#include "efi_net_filter.h"
+#include "efi_net_rx.h"
+#include "uefi_helpers.h"
+#include "efi_timer.h"
+
+// Every bit ReceiveFilters understands
+#define NET_FILTER_ALL_BITS           (EFI_SIMPLE_NETWORK_RECEIVE_UNICAST | \
+                                       EFI_SIMPLE_NETWORK_RECEIVE_MULTICAST | \
+                                       EFI_SIMPLE_NETWORK_RECEIVE_BROADCAST | \
+                                       EFI_SIMPLE_NETWORK_RECEIVE_PROMISCUOUS | \
+                                       EFI_SIMPLE_NETWORK_RECEIVE_PROMISCUOUS_MULTICAST)
+
+static bool SameMac(const uint8_t *First, const uint8_t *Second) {
+    for (uint32_t i = 0; i < 6; i++) {
+        if (First[i] != Second[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int32_t FindGroup(const NET_FILTER *Filter, const uint8_t *Mac) {
+    for (uint32_t i = 0; i < Filter->GroupCount; i++) {
+        if (SameMac(Filter->Groups[i].Addr, Mac)) {
+            return (int32_t)i;
+        }
+    }
+    return -1;
+}
+
+// Start with unicast only (plus broadcast when asked for) and no groups.
+// Nothing reaches the driver until NetFilterApply.
+EFI_STATUS NetFilterInit(NET_FILTER *Filter, EFI_SIMPLE_NETWORK_PROTOCOL *Snp, bool Broadcast) {
+    if (Filter == NULL || Snp == NULL || Snp->Mode == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    MemSet(Filter, 0, sizeof(*Filter));
+    Filter->Snp = Snp;
+    Filter->Broadcast = Broadcast;
+    MemCpy(Filter->Station, Snp->Mode->CurrentAddress.Addr, sizeof(Filter->Station));
+    return EFI_SUCCESS;
+}
+
+// Add a multicast MAC address. Joining a group twice is not an error.
+EFI_STATUS NetFilterJoin(NET_FILTER *Filter, const EFI_MAC_ADDRESS *Group) {
+    if (Filter == NULL || Group == NULL || (Group->Addr[0] & 0x01) == 0) {
+        return EFI_INVALID_PARAMETER;
+    }
+    if (FindGroup(Filter, Group->Addr) >= 0) {
+        return EFI_SUCCESS;
+    }
+    if (Filter->GroupCount == NET_FILTER_MAX_GROUPS) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    
+    MemSet(&Filter->Groups[Filter->GroupCount], 0, sizeof(EFI_MAC_ADDRESS));
+    MemCpy(Filter->Groups[Filter->GroupCount].Addr, Group->Addr, 6);
+    Filter->GroupCount++;
+    return EFI_SUCCESS;
+}
+
+EFI_STATUS NetFilterLeave(NET_FILTER *Filter, const EFI_MAC_ADDRESS *Group) {
+    if (Filter == NULL || Group == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    int32_t Index = FindGroup(Filter, Group->Addr);
+    if (Index < 0) {
+        return EFI_NOT_FOUND;
+    }
+    
+    Filter->GroupCount--;
+    Filter->Groups[Index] = Filter->Groups[Filter->GroupCount];
+    return EFI_SUCCESS;
+}
+
+// Join the MAC group an IPv4 multicast address (host order) maps to. The
+// driver's MCastIpToMac is asked first; without one, the RFC 1112 mapping
+// (01:00:5E plus the low 23 address bits) is used.
+EFI_STATUS NetFilterJoinIpv4(NET_FILTER *Filter, uint32_t Group) {
+    EFI_IP_ADDRESS Ip;
+    EFI_MAC_ADDRESS Mac;
+    EFI_STATUS Status = EFI_UNSUPPORTED;
+    
+    if (Filter == NULL || (Group >> 28) != 0xE) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    MemSet(&Ip, 0, sizeof(Ip));
+    MemSet(&Mac, 0, sizeof(Mac));
+    Ip.v4.Addr[0] = (uint8_t)(Group >> 24);
+    Ip.v4.Addr[1] = (uint8_t)(Group >> 16);
+    Ip.v4.Addr[2] = (uint8_t)(Group >> 8);
+    Ip.v4.Addr[3] = (uint8_t)Group;
+    
+    if (Filter->Snp->MCastIpToMac != NULL) {
+        Status = Filter->Snp->MCastIpToMac(Filter->Snp, false, &Ip, &Mac);
+    }
+    if (EFI_ERROR(Status)) {
+        Mac.Addr[0] = 0x01;
+        Mac.Addr[1] = 0x00;
+        Mac.Addr[2] = 0x5E;
+        Mac.Addr[3] = Ip.v4.Addr[1] & 0x7F;
+        Mac.Addr[4] = Ip.v4.Addr[2];
+        Mac.Addr[5] = Ip.v4.Addr[3];
+    }
+    
+    return NetFilterJoin(Filter, &Mac);
+}
+
+// Program the driver with unicast, broadcast when wanted, and the joined
+// groups, and switch off everything else it supports, promiscuous modes
+// included. When the groups do not fit the driver's table, all multicast is
+// enabled instead and NetFilterAccept drops the rest. The result is read
+// back from the mode data: EFI_DEVICE_ERROR means the driver reported
+// success but kept a different setting.
+EFI_STATUS NetFilterApply(NET_FILTER *Filter) {
+    if (Filter == NULL || Filter->Snp == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    EFI_SIMPLE_NETWORK_PROTOCOL *Snp = Filter->Snp;
+    EFI_SIMPLE_NETWORK_MODE *Mode = Snp->Mode;
+    uint32_t Supported = Mode->ReceiveFilterMask & NET_FILTER_ALL_BITS;
+    uint32_t Enable = EFI_SIMPLE_NETWORK_RECEIVE_UNICAST;
+    
+    MemCpy(Filter->Station, Mode->CurrentAddress.Addr, sizeof(Filter->Station));
+    Filter->Verified = false;
+    Filter->MulticastFallback = false;
+    
+    if (Snp->ReceiveFilters == NULL) {
+        return EFI_UNSUPPORTED;
+    }
+    
+    if (Filter->Broadcast) {
+        Enable |= EFI_SIMPLE_NETWORK_RECEIVE_BROADCAST;
+    }
+    if (Filter->GroupCount > 0) {
+        if ((Supported & EFI_SIMPLE_NETWORK_RECEIVE_MULTICAST) != 0 &&
+            Filter->GroupCount <= Mode->MaxMCastFilterCount) {
+            Enable |= EFI_SIMPLE_NETWORK_RECEIVE_MULTICAST;
+        } else {
+            Enable |= EFI_SIMPLE_NETWORK_RECEIVE_PROMISCUOUS_MULTICAST;
+            Filter->MulticastFallback = true;
+        }
+    }
+    if ((Enable & Supported) != Enable) {
+        return EFI_UNSUPPORTED;
+    }
+    
+    uint32_t Disable = Supported & ~Enable;
+    bool Table = (Enable & EFI_SIMPLE_NETWORK_RECEIVE_MULTICAST) != 0;
+    
+    Filter->Requested = Enable;
+    EFI_STATUS Status = Snp->ReceiveFilters(Snp, Enable, Disable, !Table,
+                                            Table ? Filter->GroupCount : 0,
+                                            Table ? Filter->Groups : NULL);
+    Filter->Setting = Mode->ReceiveFilterSetting;
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    // The driver must report exactly the requested bits and groups
+    bool Verified = (Filter->Setting & Supported) == Enable;
+    if (Table) {
+        Verified = Verified && Mode->MCastFilterCount == Filter->GroupCount;
+        for (uint32_t i = 0; Verified && i < Filter->GroupCount; i++) {
+            bool Found = false;
+            for (uint32_t j = 0; j < Mode->MCastFilterCount && j < MAX_MCAST_FILTER_CNT; j++) {
+                Found |= SameMac(Mode->MCastFilter[j].Addr, Filter->Groups[i].Addr);
+            }
+            Verified = Found;
+        }
+    }
+    
+    Filter->Verified = Verified;
+    return Verified ? EFI_SUCCESS : EFI_DEVICE_ERROR;
+}
+
+// Software check with the same rules as the hardware filter, counting
+// every frame as delivered or discarded. Frame starts with the media header.
+bool NetFilterAccept(NET_FILTER *Filter, const uint8_t *Frame, uint64_t Length) {
+    if (Filter == NULL || Frame == NULL) {
+        return false;
+    }
+    
+    if (Length < 6) {
+        Filter->DiscardedUnicast++;
+        return false;
+    }
+    
+    if ((Frame[0] & 0x01) == 0) {
+        if (!SameMac(Frame, Filter->Station)) {
+            Filter->DiscardedUnicast++;
+            return false;
+        }
+    } else if (Frame[0] == 0xFF && Frame[1] == 0xFF && Frame[2] == 0xFF &&
+               Frame[3] == 0xFF && Frame[4] == 0xFF && Frame[5] == 0xFF) {
+        if (!Filter->Broadcast) {
+            Filter->DiscardedBroadcast++;
+            return false;
+        }
+    } else if (FindGroup(Filter, Frame) < 0) {
+        Filter->DiscardedMulticast++;
+        return false;
+    }
+    
+    Filter->Delivered++;
+    return true;
+}
+
+uint64_t NetFilterDiscarded(const NET_FILTER *Filter) {
+    if (Filter == NULL) {
+        return 0;
+    }
+    return Filter->DiscardedUnicast + Filter->DiscardedBroadcast + Filter->DiscardedMulticast;
+}
+
+static void PrintFilterBits(uint32_t Bits) {
+    static const struct {
+        uint32_t Bit;
+        const char16_t *Name;
+    } Names[] = {
+        { EFI_SIMPLE_NETWORK_RECEIVE_UNICAST, u" unicast" },
+        { EFI_SIMPLE_NETWORK_RECEIVE_MULTICAST, u" multicast" },
+        { EFI_SIMPLE_NETWORK_RECEIVE_BROADCAST, u" broadcast" },
+        { EFI_SIMPLE_NETWORK_RECEIVE_PROMISCUOUS, u" promiscuous" },
+        { EFI_SIMPLE_NETWORK_RECEIVE_PROMISCUOUS_MULTICAST, u" all-multicast" },
+    };
+    
+    if (Bits == 0) {
+        PRINT(u" none");
+    }
+    for (uint32_t i = 0; i < sizeof(Names) / sizeof(Names[0]); i++) {
+        if ((Bits & Names[i].Bit) != 0) {
+            PRINT(Names[i].Name);
+        }
+    }
+}
+
+void NetFilterPrintStats(const NET_FILTER *Filter) {
+    const char16_t *Verified;
+    
+    if (Filter == NULL) {
+        return;
+    }
+    
+    Verified = Filter->Verified ? u"; verified" : u"; NOT verified";
+    
+    PRINT(u"Receive filter: requested");
+    PrintFilterBits(Filter->Requested);
+    PRINT(u"; driver reports");
+    PrintFilterBits(Filter->Setting);
+    if (Filter->GroupCount != 0) {
+        PRINT(u"; groups ");
+        PrintDec(Filter->GroupCount);
+    }
+    if (Filter->MulticastFallback) {
+        PRINT(u" (table too small)");
+    }
+    PRINTL(Verified);
+    
+    PRINT(u"  Delivered ");
+    PrintDec(Filter->Delivered);
+    PRINT(u", discarded in software ");
+    PrintDec(NetFilterDiscarded(Filter));
+    PRINT(u" (unicast ");
+    PrintDec(Filter->DiscardedUnicast);
+    PRINT(u", broadcast ");
+    PrintDec(Filter->DiscardedBroadcast);
+    PRINT(u", multicast ");
+    PrintDec(Filter->DiscardedMulticast);
+    PRINTL(u")");
+}
+
+// Receive for one phase and report frames pulled, how many the software
+// filter discarded, and the share of time spent in the receive path
+static void RunPhase(NET_RX_ENGINE *Engine, NET_FILTER *Filter, const char16_t *Label) {
+    uint64_t Frames = Engine->FramesReceived;
+    uint64_t PollTicks = Engine->PollTicks;
+    
+    Filter->Delivered = 0;
+    Filter->DiscardedUnicast = 0;
+    Filter->DiscardedBroadcast = 0;
+    Filter->DiscardedMulticast = 0;
+    
+    uint64_t Start = ReadTimestamp();
+    NetRxRun(Engine, NET_FILTER_BENCHMARK_US);
+    uint64_t Ticks = ReadTimestamp() - Start;
+    PollTicks = Engine->PollTicks - PollTicks;
+    
+    PRINT(Label);
+    PrintDec(Engine->FramesReceived - Frames);
+    PRINT(u" frames pulled, ");
+    PrintDec(Filter->Delivered);
+    PRINT(u" delivered, ");
+    PrintDec(NetFilterDiscarded(Filter));
+    PRINT(u" discarded; receive path busy ");
+    PrintDec(Ticks != 0 ? PollTicks * 1000 / Ticks / 10 : 0);
+    PRINT(u".");
+    PrintDec(Ticks != 0 ? PollTicks * 1000 / Ticks % 10 : 0);
+    PRINTL(u"% of the time");
+}
+
+// Receive with the driver in promiscuous mode, then with the filter
+// programmed, counting in both cases what software had to throw away
+void NetFilterBenchmark(EFI_SIMPLE_NETWORK_PROTOCOL *Snp) {
+    NET_RX_ENGINE Engine;
+    NET_FILTER Filter;
+    
+    if (Snp == NULL || EFI_ERROR(InitializeNetwork(Snp)) || EFI_ERROR(NetRxCreate(&Engine, Snp, 0))) {
+        PRINTL(u"Filter benchmark: network not available");
+        return;
+    }
+    
+    NetFilterInit(&Filter, Snp, true);
+    Engine.Filter = &Filter;
+    
+    PRINT(u"Driver supports");
+    PrintFilterBits(Snp->Mode->ReceiveFilterMask);
+    PRINT(u"; current");
+    PrintFilterBits(Snp->Mode->ReceiveFilterSetting);
+    PRINTL(u"");
+    
+    uint32_t Open = Snp->Mode->ReceiveFilterMask & (EFI_SIMPLE_NETWORK_RECEIVE_PROMISCUOUS |
+                                                    EFI_SIMPLE_NETWORK_RECEIVE_UNICAST |
+                                                    EFI_SIMPLE_NETWORK_RECEIVE_BROADCAST |
+                                                    EFI_SIMPLE_NETWORK_RECEIVE_PROMISCUOUS_MULTICAST);
+    if (Snp->ReceiveFilters != NULL && (Open & EFI_SIMPLE_NETWORK_RECEIVE_PROMISCUOUS) != 0 &&
+        !EFI_ERROR(Snp->ReceiveFilters(Snp, Open, 0, false, 0, NULL))) {
+        RunPhase(&Engine, &Filter, u"Promiscuous: ");
+    } else {
+        PRINTL(u"Promiscuous: not supported, skipped");
+    }
+    
+    EFI_STATUS Status = NetFilterApply(&Filter);
+    if (EFI_ERROR(Status) && Status != EFI_DEVICE_ERROR) {
+        PRINT(u"Filtered: ReceiveFilters failed ");
+        PrintHex(Status);
+        PRINTL(u"");
+    } else {
+        RunPhase(&Engine, &Filter, u"Filtered: ");
+        NetFilterPrintStats(&Filter);
+    }
+    
+    NetRxDestroy(&Engine);
+}
@@ -0,0 +1,51 @@
+// efi_net_filter.h
+#ifndef TINYUEFI_NET_FILTER_H
+#define TINYUEFI_NET_FILTER_H
+
+#include "uefi_types.h"
+#include "efi_network_protocol.h"
+
+// Multicast groups a filter holds, the size of the driver's table
+#define NET_FILTER_MAX_GROUPS         MAX_MCAST_FILTER_CNT
+
+// Length of each phase of NetFilterBenchmark
+#define NET_FILTER_BENCHMARK_US       5000000
+
+// Receive filter for one interface: unicast to the station address, plus
+// broadcast and the joined multicast groups when asked for. NetFilterApply
+// programs the driver; NetFilterAccept applies the same rules in software
+// to whatever the driver still lets through.
+typedef struct {
+    EFI_SIMPLE_NETWORK_PROTOCOL *Snp;
+    uint8_t Station[6];
+    bool Broadcast;
+    uint32_t GroupCount;
+    EFI_MAC_ADDRESS Groups[NET_FILTER_MAX_GROUPS];
+    
+    // Outcome of the last NetFilterApply
+    uint32_t Requested;           // Filter bits enabled
+    uint32_t Setting;             // ReceiveFilterSetting read back
+    bool Verified;                // Setting and multicast table match the request
+    bool MulticastFallback;       // Groups did not fit the driver; all multicast enabled
+    
+    // Frames seen by NetFilterAccept
+    uint64_t Delivered;
+    uint64_t DiscardedUnicast;    // Addressed to another station, or too short
+    uint64_t DiscardedBroadcast;
+    uint64_t DiscardedMulticast;  // Group not joined
+} NET_FILTER;
+
+// Filter setup
+EFI_STATUS NetFilterInit(NET_FILTER *Filter, EFI_SIMPLE_NETWORK_PROTOCOL *Snp, bool Broadcast);
+EFI_STATUS NetFilterJoin(NET_FILTER *Filter, const EFI_MAC_ADDRESS *Group);
+EFI_STATUS NetFilterLeave(NET_FILTER *Filter, const EFI_MAC_ADDRESS *Group);
+EFI_STATUS NetFilterJoinIpv4(NET_FILTER *Filter, uint32_t Group);
+EFI_STATUS NetFilterApply(NET_FILTER *Filter);
+
+// Software side
+bool NetFilterAccept(NET_FILTER *Filter, const uint8_t *Frame, uint64_t Length);
+uint64_t NetFilterDiscarded(const NET_FILTER *Filter);
+void NetFilterPrintStats(const NET_FILTER *Filter);
+void NetFilterBenchmark(EFI_SIMPLE_NETWORK_PROTOCOL *Snp);
+
+#endif // TINYUEFI_NET_FILTER_H
@@ -0,0 +1,1172 @@
+// efi_net_ip.c
+#include "efi_net_ip.h"
+#include "uefi_helpers.h"
+#include "efi_timer.h"
+#include "efi_checksum.h"
+#include "efi_net_loopback.h"
+
+// IPv4 header fields
+#define IP_PROTOCOL_UDP               17
+#define IP_DEFAULT_TTL                64
+#define IP_FLAG_DONT_FRAGMENT         0x4000
+#define IP_FRAGMENT_MASK              0x3FFF
+
+// ARP over Ethernet for IPv4
+#define ARP_PACKET_SIZE               28
+#define ARP_HARDWARE_ETHERNET         1
+#define ARP_REQUEST                   1
+#define ARP_REPLY                     2
+
+// DHCP message layout, options and message types
+#define DHCP_MAGIC_COOKIE             0x63825363
+#define DHCP_OPTIONS_OFFSET           240
+#define DHCP_MESSAGE_SIZE             300
+#define DHCP_OPTION_PAD               0
+#define DHCP_OPTION_SUBNET_MASK       1
+#define DHCP_OPTION_ROUTER            3
+#define DHCP_OPTION_DNS_SERVER        6
+#define DHCP_OPTION_REQUESTED_ADDRESS 50
+#define DHCP_OPTION_LEASE_TIME        51
+#define DHCP_OPTION_MESSAGE_TYPE      53
+#define DHCP_OPTION_SERVER_ID         54
+#define DHCP_OPTION_PARAMETER_LIST    55
+#define DHCP_OPTION_BOOT_FILE         67
+#define DHCP_OPTION_END               255
+#define DHCP_DISCOVER                 1
+#define DHCP_OFFER                    2
+#define DHCP_REQUEST                  3
+#define DHCP_ACK                      5
+#define DHCP_NAK                      6
+
+// Big-endian field access at any alignment
+static inline uint16_t Read16(const uint8_t *Bytes) {
+    return (uint16_t)((Bytes[0] << 8) | Bytes[1]);
+}
+
+static inline uint32_t Read32(const uint8_t *Bytes) {
+    return ((uint32_t)Bytes[0] << 24) | ((uint32_t)Bytes[1] << 16) | ((uint32_t)Bytes[2] << 8) | Bytes[3];
+}
+
+static inline void Write16(uint8_t *Bytes, uint16_t Value) {
+    Bytes[0] = (uint8_t)(Value >> 8);
+    Bytes[1] = (uint8_t)Value;
+}
+
+static inline void Write32(uint8_t *Bytes, uint32_t Value) {
+    Bytes[0] = (uint8_t)(Value >> 24);
+    Bytes[1] = (uint8_t)(Value >> 16);
+    Bytes[2] = (uint8_t)(Value >> 8);
+    Bytes[3] = (uint8_t)Value;
+}
+
+static bool IsBroadcast(NET_STACK *Stack, uint32_t Address) {
+    uint32_t Mask = Stack->Config.SubnetMask;
+    
+    if (Address == NET_IPV4_BROADCAST) {
+        return true;
+    }
+    return Mask != 0 && Stack->Config.Address != 0 &&
+           ((Address ^ Stack->Config.Address) & Mask) == 0 && (Address | Mask) == NET_IPV4_BROADCAST;
+}
+
+// Wait for traffic until Deadline; false once it has passed or the
+// interface fails
+static bool WaitBefore(NET_STACK *Stack, uint64_t Deadline) {
+    uint64_t Now = ReadTimestamp();
+    
+    if (Now >= Deadline) {
+        return false;
+    }
+    
+    uint64_t Remaining = (Deadline - Now) / Stack->TicksPerUs;
+    EFI_STATUS Status = NetStackWait(Stack, Remaining != 0 ? Remaining : 1);
+    return !EFI_ERROR(Status) || Status == EFI_TIMEOUT || Status == EFI_NOT_READY;
+}
+
+// Find the cache entry for Address among its probe slots. With Insert a
+// missing entry takes a free slot, or the one that expires first.
+static NET_ARP_ENTRY *ArpLookup(NET_STACK *Stack, uint32_t Address, bool Insert) {
+    uint32_t Hash = (Address * 2654435761u) >> 16;
+    NET_ARP_ENTRY *Victim = NULL;
+    
+    for (uint32_t Probe = 0; Probe < NET_ARP_CACHE_PROBES; Probe++) {
+        NET_ARP_ENTRY *Entry = &Stack->ArpCache[(Hash + Probe) & (NET_ARP_CACHE_SIZE - 1)];
+        
+        if (Entry->State != NetArpFree && Entry->Address == Address) {
+            return Entry;
+        }
+        if (Victim == NULL || (Victim->State != NetArpFree &&
+                               (Entry->State == NetArpFree || Entry->Expires < Victim->Expires))) {
+            Victim = Entry;
+        }
+    }
+    
+    if (!Insert) {
+        return NULL;
+    }
+    
+    uint64_t Now = ReadTimestamp();
+    if (Victim->State == NetArpResolved && Victim->Expires > Now) {
+        Stack->ArpEvictions++;
+    }
+    
+    MemSet(Victim, 0, sizeof(*Victim));
+    Victim->Address = Address;
+    Victim->State = NetArpPending;
+    Victim->Expires = Now;
+    return Victim;
+}
+
+static void ArpUpdate(NET_STACK *Stack, NET_ARP_ENTRY *Entry, const uint8_t *Mac) {
+    MemCpy(Entry->Mac, Mac, 6);
+    Entry->State = NetArpResolved;
+    Entry->Expires = ReadTimestamp() + (uint64_t)NET_ARP_LIFETIME_US * Stack->TicksPerUs;
+}
+
+// Broadcast a request (TargetMac NULL) or unicast a reply
+static EFI_STATUS SendArp(NET_STACK *Stack, uint16_t Operation, const uint8_t *TargetMac, uint32_t TargetAddress) {
+    uint8_t *Frame;
+    
+    EFI_STATUS Status = NetTxRingAcquire(&Stack->Tx, &Frame);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    uint8_t *Arp = Frame + NET_ETHER_HEADER_SIZE;
+    if (TargetMac != NULL) {
+        MemCpy(Frame, TargetMac, 6);
+    } else {
+        MemSet(Frame, 0xFF, 6);
+    }
+    MemCpy(Frame + 6, Stack->Mac, 6);
+    Write16(Frame + 12, NET_ETHERTYPE_ARP);
+    
+    Write16(Arp, ARP_HARDWARE_ETHERNET);
+    Write16(Arp + 2, NET_ETHERTYPE_IPV4);
+    Arp[4] = 6;
+    Arp[5] = 4;
+    Write16(Arp + 6, Operation);
+    MemCpy(Arp + 8, Stack->Mac, 6);
+    Write32(Arp + 14, Stack->Config.Address);
+    if (TargetMac != NULL) {
+        MemCpy(Arp + 18, TargetMac, 6);
+    } else {
+        MemSet(Arp + 18, 0, 6);
+    }
+    Write32(Arp + 24, TargetAddress);
+    
+    Status = NetTxRingSubmit(&Stack->Tx, NET_ETHER_HEADER_SIZE + ARP_PACKET_SIZE, NULL, 0);
+    if (!EFI_ERROR(Status)) {
+        if (Operation == ARP_REQUEST) {
+            Stack->ArpRequests++;
+        } else {
+            Stack->ArpReplies++;
+        }
+    }
+    return Status;
+}
+
+// Refresh a known sender, learn it when the packet is addressed to us
+// (RFC 826) and answer requests for our address
+static bool ArpInput(NET_RX_ENGINE *Engine, NET_RX_FRAME *Frame, void *Context) {
+    NET_STACK *Stack = (NET_STACK*)Context;
+    const uint8_t *Arp = Frame->Buffer + Frame->HeaderSize;
+    
+    if (Frame->Length < Frame->HeaderSize + ARP_PACKET_SIZE || Read16(Arp) != ARP_HARDWARE_ETHERNET ||
+        Read16(Arp + 2) != NET_ETHERTYPE_IPV4 || Arp[4] != 6 || Arp[5] != 4) {
+        Stack->BadHeaders++;
+        return false;
+    }
+    
+    uint16_t Operation = Read16(Arp + 6);
+    uint32_t SenderAddress = Read32(Arp + 14);
+    uint32_t TargetAddress = Read32(Arp + 24);
+    bool ForUs = Stack->Config.Address != 0 && TargetAddress == Stack->Config.Address;
+    
+    if (SenderAddress != 0) {
+        NET_ARP_ENTRY *Entry = ArpLookup(Stack, SenderAddress, ForUs);
+        if (Entry != NULL) {
+            ArpUpdate(Stack, Entry, Arp + 8);
+        }
+    }
+    
+    if (ForUs && Operation == ARP_REQUEST) {
+        SendArp(Stack, ARP_REPLY, Arp + 8, SenderAddress);
+    }
+    return false;
+}
+
+static NET_UDP_SOCKET *FindSocket(NET_STACK *Stack, uint16_t Port) {
+    for (uint32_t i = 0; i < Stack->SocketCount; i++) {
+        if (Stack->Sockets[i]->LocalPort == Port) {
+            return Stack->Sockets[i];
+        }
+    }
+    return NULL;
+}
+
+static void UdpInput(NET_STACK *Stack, NET_RX_FRAME *Frame, const uint8_t *Ip,
+                     uint32_t HeaderLength, uint32_t TotalLength) {
+    const uint8_t *Udp = Ip + HeaderLength;
+    uint32_t Length = TotalLength - HeaderLength;
+    
+    if (Length < NET_UDP_HEADER_SIZE || Read16(Udp + 4) < NET_UDP_HEADER_SIZE || Read16(Udp + 4) > Length) {
+        Stack->BadHeaders++;
+        return;
+    }
+    Length = Read16(Udp + 4);
+    
+    // A zero checksum means the sender did not compute one
+    if (Udp[6] != 0 || Udp[7] != 0) {
+        uint64_t Sum = ChecksumPseudoHeader(Read32(Ip + 12), Read32(Ip + 16), IP_PROTOCOL_UDP, (uint16_t)Length);
+        if (ChecksumFold(ChecksumPartial(Udp, Length, Sum)) != 0) {
+            Stack->BadChecksums++;
+            return;
+        }
+    }
+    
+    NET_UDP_SOCKET *Socket = FindSocket(Stack, Read16(Udp + 2));
+    if (Socket == NULL) {
+        Stack->NoSocket++;
+        return;
+    }
+    
+    NET_UDP_DATAGRAM Datagram;
+    Datagram.SrcAddress = Read32(Ip + 12);
+    Datagram.DestAddress = Read32(Ip + 16);
+    Datagram.SrcPort = Read16(Udp);
+    Datagram.DestPort = Read16(Udp + 2);
+    Datagram.Data = Udp + NET_UDP_HEADER_SIZE;
+    Datagram.Length = Length - NET_UDP_HEADER_SIZE;
+    MemCpy(Datagram.SrcMac, Frame->SrcAddr.Addr, 6);
+    
+    Socket->DatagramsReceived++;
+    Stack->DatagramsReceived++;
+    if (Socket->Receive != NULL) {
+        Socket->Receive(Socket, &Datagram, Socket->Context);
+    }
+}
+
+// Validate an IPv4 packet and pass UDP to its socket. Until an address is
+// configured every destination is accepted, so DHCP replies get through.
+static bool Ipv4Input(NET_RX_ENGINE *Engine, NET_RX_FRAME *Frame, void *Context) {
+    NET_STACK *Stack = (NET_STACK*)Context;
+    const uint8_t *Ip = Frame->Buffer + Frame->HeaderSize;
+    
+    Stack->PacketsReceived++;
+    if (Frame->Length < Frame->HeaderSize + NET_IPV4_HEADER_SIZE || (Ip[0] >> 4) != 4) {
+        Stack->BadHeaders++;
+        return false;
+    }
+    
+    // Frames may carry padding past TotalLength
+    uint64_t Available = Frame->Length - Frame->HeaderSize;
+    uint32_t HeaderLength = (uint32_t)(Ip[0] & 0x0F) * 4;
+    uint32_t TotalLength = Read16(Ip + 2);
+    if (HeaderLength < NET_IPV4_HEADER_SIZE || TotalLength < HeaderLength || TotalLength > Available) {
+        Stack->BadHeaders++;
+        return false;
+    }
+    if (ChecksumFold(ChecksumPartial(Ip, HeaderLength, 0)) != 0) {
+        Stack->BadChecksums++;
+        return false;
+    }
+    if ((Read16(Ip + 6) & IP_FRAGMENT_MASK) != 0) {
+        Stack->Fragments++;
+        return false;
+    }
+    
+    uint32_t DestAddress = Read32(Ip + 16);
+    if (Stack->Config.Address != 0 && DestAddress != Stack->Config.Address && !IsBroadcast(Stack, DestAddress)) {
+        Stack->NotForUs++;
+        return false;
+    }
+    
+    if (Ip[9] != IP_PROTOCOL_UDP) {
+        Stack->UnknownProtocols++;
+        return false;
+    }
+    
+    UdpInput(Stack, Frame, Ip, HeaderLength, TotalLength);
+    return false;
+}
+
+// Open the stack on Snp, starting the interface if needed. Config may be
+// NULL when the address comes from NetDhcpConfigure later.
+EFI_STATUS NetStackCreate(NET_STACK *Stack, EFI_SIMPLE_NETWORK_PROTOCOL *Snp, const NET_IPV4_CONFIG *Config) {
+    EFI_STATUS Status;
+    
+    if (Stack == NULL || Snp == NULL || Snp->Mode == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    MemSet(Stack, 0, sizeof(*Stack));
+    
+    Status = InitializeNetwork(Snp);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    // Only Ethernet framing is handled
+    if (Snp->Mode->HwAddressSize != 6 || Snp->Mode->MediaHeaderSize != NET_ETHER_HEADER_SIZE) {
+        return EFI_UNSUPPORTED;
+    }
+    
+    Status = NetRxCreate(&Stack->Rx, Snp, NET_STACK_RX_FRAMES);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    Status = NetTxRingCreate(&Stack->Tx, Snp, NET_STACK_TX_SLOTS);
+    if (EFI_ERROR(Status)) {
+        NetRxDestroy(&Stack->Rx);
+        return Status;
+    }
+    
+    // Drivers that default to promiscuous mode would otherwise hand every
+    // frame on the segment to the stack. A driver that cannot filter is
+    // backed by the same rules in software.
+    NetFilterInit(&Stack->Filter, Snp, true);
+    Stack->FilterStatus = NetFilterApply(&Stack->Filter);
+    Stack->Rx.Filter = &Stack->Filter;
+    if (EFI_ERROR(Stack->FilterStatus)) {
+        PRINT(u"Receive filter not applied by the driver ");
+        PrintHex(Stack->FilterStatus);
+        PRINTL(u"; filtering in software");
+    }
+    
+    NetRxRegister(&Stack->Rx, NET_ETHERTYPE_ARP, ArpInput, Stack);
+    NetRxRegister(&Stack->Rx, NET_ETHERTYPE_IPV4, Ipv4Input, Stack);
+    
+    Stack->Snp = Snp;
+    MemCpy(Stack->Mac, Snp->Mode->CurrentAddress.Addr, 6);
+    Stack->TicksPerUs = GetTimestampFrequency() / 1000000;
+    if (Stack->TicksPerUs == 0) {
+        Stack->TicksPerUs = 1;
+    }
+    
+    uint64_t Seed = ReadTimestamp();
+    Stack->NextIpId = (uint16_t)Seed;
+    Stack->NextPort = (uint16_t)(NET_UDP_EPHEMERAL_FIRST + (Seed >> 4) % 4096);
+    
+    if (Config != NULL) {
+        return NetStackConfigure(Stack, Config);
+    }
+    return EFI_SUCCESS;
+}
+
+void NetStackDestroy(NET_STACK *Stack) {
+    if (Stack == NULL || Stack->Snp == NULL) {
+        return;
+    }
+    
+    NetTxRingDestroy(&Stack->Tx);
+    NetRxDestroy(&Stack->Rx);
+    MemSet(Stack, 0, sizeof(*Stack));
+}
+
+static void BuildTemplate(NET_STACK *Stack, NET_UDP_TEMPLATE *Template, const uint8_t *DestMac,
+                          uint32_t DestAddress, uint16_t SrcPort, uint16_t DestPort) {
+    uint8_t *Ether = Template->Headers;
+    uint8_t *Ip = Ether + NET_ETHER_HEADER_SIZE;
+    uint8_t *Udp = Ip + NET_IPV4_HEADER_SIZE;
+    
+    MemSet(Template->Headers, 0, sizeof(Template->Headers));
+    MemCpy(Ether, DestMac, 6);
+    MemCpy(Ether + 6, Stack->Mac, 6);
+    Write16(Ether + 12, NET_ETHERTYPE_IPV4);
+    
+    // Total length, identification and checksum are filled per datagram
+    Ip[0] = 0x45;
+    Write16(Ip + 6, IP_FLAG_DONT_FRAGMENT);
+    Ip[8] = IP_DEFAULT_TTL;
+    Ip[9] = IP_PROTOCOL_UDP;
+    Write32(Ip + 12, Stack->Config.Address);
+    Write32(Ip + 16, DestAddress);
+    
+    Write16(Udp, SrcPort);
+    Write16(Udp + 2, DestPort);
+    
+    Template->IpSum = ChecksumPartial(Ip, NET_IPV4_HEADER_SIZE, 0);
+    Template->PseudoSum = ChecksumPseudoHeader(Stack->Config.Address, DestAddress, IP_PROTOCOL_UDP, 0) +
+                          ChecksumPartial(Udp, 4, 0);
+}
+
+// Replace the address configuration. The ARP cache is flushed and the
+// templates of connected sockets pick up the new source address.
+EFI_STATUS NetStackConfigure(NET_STACK *Stack, const NET_IPV4_CONFIG *Config) {
+    if (Stack == NULL || Config == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    Stack->Config = *Config;
+    NetArpFlush(Stack);
+    
+    for (uint32_t i = 0; i < Stack->SocketCount; i++) {
+        NET_UDP_SOCKET *Socket = Stack->Sockets[i];
+        if (Socket->Connected) {
+            uint8_t DestMac[6];
+            MemCpy(DestMac, Socket->Template.Headers, 6);
+            BuildTemplate(Stack, &Socket->Template, DestMac, Socket->RemoteAddress,
+                          Socket->LocalPort, Socket->RemotePort);
+        }
+    }
+    
+    return EFI_SUCCESS;
+}
+
+// Recycle transmitted buffers and dispatch whatever has arrived
+uint32_t NetStackPoll(NET_STACK *Stack) {
+    if (Stack == NULL || Stack->Snp == NULL) {
+        return 0;
+    }
+    
+    NetTxRingReclaim(&Stack->Tx);
+    return NetRxPoll(&Stack->Rx);
+}
+
+// Wait up to TimeoutUs for frames and dispatch them. With an Idle hook the
+// stack polls instead of sleeping and runs the hook between polls.
+EFI_STATUS NetStackWait(NET_STACK *Stack, uint64_t TimeoutUs) {
+    if (Stack == NULL || Stack->Snp == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    NetTxRingReclaim(&Stack->Tx);
+    if (Stack->Idle == NULL) {
+        return NetRxWait(&Stack->Rx, TimeoutUs);
+    }
+    
+    uint64_t Start = ReadTimestamp();
+    do {
+        Stack->Idle(Stack->IdleContext);
+        if (NetRxPoll(&Stack->Rx) > 0) {
+            return EFI_SUCCESS;
+        }
+    } while (ReadTimestamp() - Start < TimeoutUs * Stack->TicksPerUs);
+    
+    return TimeoutUs == 0 ? EFI_NOT_READY : EFI_TIMEOUT;
+}
+
+// Look up the MAC for an on-link Address, sending requests and waiting for
+// the reply on a miss. Frames that arrive meanwhile are dispatched.
+EFI_STATUS NetArpResolve(NET_STACK *Stack, uint32_t Address, uint8_t *Mac) {
+    if (Stack == NULL || Stack->Snp == NULL || Mac == NULL || Address == 0) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    NET_ARP_ENTRY *Entry = ArpLookup(Stack, Address, false);
+    if (Entry != NULL && Entry->State == NetArpResolved && ReadTimestamp() < Entry->Expires) {
+        Stack->ArpHits++;
+        MemCpy(Mac, Entry->Mac, 6);
+        return EFI_SUCCESS;
+    }
+    
+    Stack->ArpMisses++;
+    for (uint32_t Attempt = 0; Attempt < NET_ARP_ATTEMPTS; Attempt++) {
+        ArpLookup(Stack, Address, true);
+        
+        EFI_STATUS Status = SendArp(Stack, ARP_REQUEST, NULL, Address);
+        if (EFI_ERROR(Status)) {
+            return Status;
+        }
+        
+        // Other ARP traffic may move the entry while we wait, so look it up again
+        uint64_t Deadline = ReadTimestamp() + (uint64_t)NET_ARP_RETRY_US * Stack->TicksPerUs;
+        while (WaitBefore(Stack, Deadline)) {
+            Entry = ArpLookup(Stack, Address, false);
+            if (Entry != NULL && Entry->State == NetArpResolved && ReadTimestamp() < Entry->Expires) {
+                MemCpy(Mac, Entry->Mac, 6);
+                return EFI_SUCCESS;
+            }
+        }
+    }
+    
+    return EFI_TIMEOUT;
+}
+
+void NetArpFlush(NET_STACK *Stack) {
+    if (Stack != NULL) {
+        MemSet(Stack->ArpCache, 0, sizeof(Stack->ArpCache));
+    }
+}
+
+// MAC of the next hop towards Address
+static EFI_STATUS Route(NET_STACK *Stack, uint32_t Address, uint8_t *Mac) {
+    if (IsBroadcast(Stack, Address)) {
+        MemSet(Mac, 0xFF, 6);
+        return EFI_SUCCESS;
+    }
+    if (Stack->Config.Address == 0) {
+        return EFI_NO_MAPPING;
+    }
+    
+    uint32_t NextHop = Address;
+    if (((Address ^ Stack->Config.Address) & Stack->Config.SubnetMask) != 0) {
+        NextHop = Stack->Config.Gateway;
+        if (NextHop == 0) {
+            return EFI_NO_MAPPING;
+        }
+    }
+    
+    return NetArpResolve(Stack, NextHop, Mac);
+}
+
+// Bind Socket to LocalPort (an ephemeral port when 0). Receive may be NULL
+// for send-only sockets.
+EFI_STATUS NetUdpOpen(NET_STACK *Stack, NET_UDP_SOCKET *Socket, uint16_t LocalPort,
+                      NET_UDP_RECEIVE Receive, void *Context) {
+    if (Stack == NULL || Stack->Snp == NULL || Socket == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    if (Stack->SocketCount == NET_UDP_MAX_SOCKETS) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    
+    if (LocalPort == 0) {
+        do {
+            LocalPort = Stack->NextPort++;
+            if (Stack->NextPort < NET_UDP_EPHEMERAL_FIRST) {
+                Stack->NextPort = NET_UDP_EPHEMERAL_FIRST;
+            }
+        } while (FindSocket(Stack, LocalPort) != NULL);
+    } else if (FindSocket(Stack, LocalPort) != NULL) {
+        return EFI_ACCESS_DENIED;
+    }
+    
+    MemSet(Socket, 0, sizeof(*Socket));
+    Socket->Stack = Stack;
+    Socket->LocalPort = LocalPort;
+    Socket->Receive = Receive;
+    Socket->Context = Context;
+    Stack->Sockets[Stack->SocketCount++] = Socket;
+    return EFI_SUCCESS;
+}
+
+void NetUdpClose(NET_UDP_SOCKET *Socket) {
+    if (Socket == NULL || Socket->Stack == NULL) {
+        return;
+    }
+    
+    NET_STACK *Stack = Socket->Stack;
+    for (uint32_t i = 0; i < Stack->SocketCount; i++) {
+        if (Stack->Sockets[i] == Socket) {
+            Stack->Sockets[i] = Stack->Sockets[--Stack->SocketCount];
+            break;
+        }
+    }
+    
+    Socket->Stack = NULL;
+    Socket->Connected = false;
+}
+
+// Fix the destination of NetUdpSend and NetUdpAcquire/NetUdpSubmit. The
+// next hop is resolved once and the headers are prebuilt; connect again if
+// the peer's MAC may have changed.
+EFI_STATUS NetUdpConnect(NET_UDP_SOCKET *Socket, uint32_t RemoteAddress, uint16_t RemotePort) {
+    uint8_t Mac[6];
+    
+    if (Socket == NULL || Socket->Stack == NULL || RemoteAddress == 0 || RemotePort == 0) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    EFI_STATUS Status = Route(Socket->Stack, RemoteAddress, Mac);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    BuildTemplate(Socket->Stack, &Socket->Template, Mac, RemoteAddress, Socket->LocalPort, RemotePort);
+    Socket->RemoteAddress = RemoteAddress;
+    Socket->RemotePort = RemotePort;
+    Socket->Connected = true;
+    return EFI_SUCCESS;
+}
+
+// Largest payload that fits the interface MTU and a ring buffer
+static uint32_t MaxPayload(NET_STACK *Stack) {
+    uint32_t Mtu = Stack->Snp->Mode->MaxPacketSize != 0 ? Stack->Snp->Mode->MaxPacketSize : 1500;
+    uint32_t Limit = Mtu - NET_IPV4_HEADER_SIZE - NET_UDP_HEADER_SIZE;
+    uint32_t Room = Stack->Tx.FrameSize - NET_UDP_HEADERS_SIZE;
+    return Limit < Room ? Limit : Room;
+}
+
+// Copy the template in front of a payload already in Frame, fill in the
+// per-datagram fields and checksums, and transmit
+static EFI_STATUS SubmitDatagram(NET_STACK *Stack, const NET_UDP_TEMPLATE *Template,
+                                 uint8_t *Frame, uint32_t Length) {
+    uint8_t *Ip = Frame + NET_ETHER_HEADER_SIZE;
+    uint8_t *Udp = Ip + NET_IPV4_HEADER_SIZE;
+    uint16_t TotalLength = (uint16_t)(NET_IPV4_HEADER_SIZE + NET_UDP_HEADER_SIZE + Length);
+    uint16_t UdpLength = (uint16_t)(NET_UDP_HEADER_SIZE + Length);
+    uint16_t Id = Stack->NextIpId++;
+    uint16_t Checksum;
+    
+    __builtin_memcpy(Frame, Template->Headers, NET_UDP_HEADERS_SIZE);
+    Write16(Ip + 2, TotalLength);
+    Write16(Ip + 4, Id);
+    Checksum = ChecksumFold(Template->IpSum + HostToNet16(TotalLength) + HostToNet16(Id));
+    __builtin_memcpy(Ip + 10, &Checksum, sizeof(Checksum));
+    
+    // UDP length appears in both the pseudo-header and the UDP header
+    Write16(Udp + 4, UdpLength);
+    uint64_t Sum = Template->PseudoSum + 2 * (uint64_t)HostToNet16(UdpLength);
+    Checksum = ChecksumFold(ChecksumPartial(Udp + NET_UDP_HEADER_SIZE, Length, Sum));
+    if (Checksum == 0) {
+        Checksum = 0xFFFF;
+    }
+    __builtin_memcpy(Udp + 6, &Checksum, sizeof(Checksum));
+    
+    EFI_STATUS Status = NetTxRingSubmit(&Stack->Tx, NET_UDP_HEADERS_SIZE + Length, NULL, 0);
+    if (!EFI_ERROR(Status)) {
+        Stack->DatagramsSent++;
+    }
+    return Status;
+}
+
+// Hand out the payload area of a transmit buffer for a connected socket,
+// so the caller can build the datagram in place
+EFI_STATUS NetUdpAcquire(NET_UDP_SOCKET *Socket, uint8_t **Payload, uint32_t *MaxLength) {
+    uint8_t *Frame;
+    
+    if (Socket == NULL || Socket->Stack == NULL || Payload == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    if (!Socket->Connected) {
+        return EFI_NOT_READY;
+    }
+    
+    EFI_STATUS Status = NetTxRingAcquire(&Socket->Stack->Tx, &Frame);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    *Payload = Frame + NET_UDP_HEADERS_SIZE;
+    if (MaxLength != NULL) {
+        *MaxLength = MaxPayload(Socket->Stack);
+    }
+    return EFI_SUCCESS;
+}
+
+// Send the Length bytes written after NetUdpAcquire
+EFI_STATUS NetUdpSubmit(NET_UDP_SOCKET *Socket, uint32_t Length) {
+    uint8_t *Frame;
+    
+    if (Socket == NULL || Socket->Stack == NULL || Length > MaxPayload(Socket->Stack)) {
+        return EFI_INVALID_PARAMETER;
+    }
+    if (!Socket->Connected || Socket->Stack->Tx.Acquired < 0) {
+        return EFI_NOT_READY;
+    }
+    
+    // Returns the buffer already handed out by NetUdpAcquire
+    NetTxRingAcquire(&Socket->Stack->Tx, &Frame);
+    
+    EFI_STATUS Status = SubmitDatagram(Socket->Stack, &Socket->Template, Frame, Length);
+    if (!EFI_ERROR(Status)) {
+        Socket->DatagramsSent++;
+    }
+    return Status;
+}
+
+// Send to the connected destination
+EFI_STATUS NetUdpSend(NET_UDP_SOCKET *Socket, const void *Data, uint32_t Length) {
+    uint8_t *Payload;
+    uint32_t MaxLength;
+    
+    if (Data == NULL && Length != 0) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    EFI_STATUS Status = NetUdpAcquire(Socket, &Payload, &MaxLength);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    if (Length > MaxLength) {
+        return EFI_BAD_BUFFER_SIZE;
+    }
+    
+    MemCpy(Payload, Data, Length);
+    return NetUdpSubmit(Socket, Length);
+}
+
+// Send one datagram to any destination; the headers are built for this call
+EFI_STATUS NetUdpSendTo(NET_UDP_SOCKET *Socket, uint32_t RemoteAddress, uint16_t RemotePort,
+                        const void *Data, uint32_t Length) {
+    NET_UDP_TEMPLATE Template;
+    uint8_t Mac[6];
+    uint8_t *Frame;
+    
+    if (Socket == NULL || Socket->Stack == NULL || (Data == NULL && Length != 0) ||
+        RemoteAddress == 0 || RemotePort == 0) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    NET_STACK *Stack = Socket->Stack;
+    if (Length > MaxPayload(Stack)) {
+        return EFI_BAD_BUFFER_SIZE;
+    }
+    
+    EFI_STATUS Status = Route(Stack, RemoteAddress, Mac);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    Status = NetTxRingAcquire(&Stack->Tx, &Frame);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    BuildTemplate(Stack, &Template, Mac, RemoteAddress, Socket->LocalPort, RemotePort);
+    MemCpy(Frame + NET_UDP_HEADERS_SIZE, Data, Length);
+    
+    Status = SubmitDatagram(Stack, &Template, Frame, Length);
+    if (!EFI_ERROR(Status)) {
+        Socket->DatagramsSent++;
+    }
+    return Status;
+}
+
+// Read a BOOTP/DHCP reply into Config. MessageType is 0 for plain BOOTP;
+// ServerId is the DHCP server identifier option (0 when absent).
+static EFI_STATUS ParseDhcp(const uint8_t *Packet, uint64_t Length, NET_IPV4_CONFIG *Config,
+                            uint8_t *MessageType, uint32_t *ServerId) {
+    if (Length < DHCP_OPTIONS_OFFSET || Packet[0] != 2 || Read32(Packet + 236) != DHCP_MAGIC_COOKIE) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    MemSet(Config, 0, sizeof(*Config));
+    Config->Address = Read32(Packet + 16);
+    Config->ServerAddress = Read32(Packet + 20);
+    *MessageType = 0;
+    *ServerId = 0;
+    
+    // Boot file from the fixed field; option 67 takes precedence
+    uint32_t FileLength = 0;
+    while (FileLength < sizeof(Config->BootFile) - 1 && FileLength < 128 && Packet[108 + FileLength] != 0) {
+        Config->BootFile[FileLength] = (char)Packet[108 + FileLength];
+        FileLength++;
+    }
+    
+    uint64_t Offset = DHCP_OPTIONS_OFFSET;
+    while (Offset < Length) {
+        uint8_t Code = Packet[Offset++];
+        if (Code == DHCP_OPTION_PAD) {
+            continue;
+        }
+        if (Code == DHCP_OPTION_END || Offset >= Length) {
+            break;
+        }
+        
+        uint8_t OptionLength = Packet[Offset++];
+        if (Offset + OptionLength > Length) {
+            return EFI_INVALID_PARAMETER;
+        }
+        
+        const uint8_t *Value = Packet + Offset;
+        switch (Code) {
+            case DHCP_OPTION_SUBNET_MASK:
+                if (OptionLength >= 4) {
+                    Config->SubnetMask = Read32(Value);
+                }
+                break;
+            case DHCP_OPTION_ROUTER:
+                if (OptionLength >= 4) {
+                    Config->Gateway = Read32(Value);
+                }
+                break;
+            case DHCP_OPTION_DNS_SERVER:
+                if (OptionLength >= 4) {
+                    Config->DnsServer = Read32(Value);
+                }
+                break;
+            case DHCP_OPTION_LEASE_TIME:
+                if (OptionLength >= 4) {
+                    Config->LeaseSeconds = Read32(Value);
+                }
+                break;
+            case DHCP_OPTION_MESSAGE_TYPE:
+                if (OptionLength >= 1) {
+                    *MessageType = Value[0];
+                }
+                break;
+            case DHCP_OPTION_SERVER_ID:
+                if (OptionLength >= 4) {
+                    *ServerId = Read32(Value);
+                }
+                break;
+            case DHCP_OPTION_BOOT_FILE:
+                FileLength = OptionLength < sizeof(Config->BootFile) - 1 ? OptionLength : sizeof(Config->BootFile) - 1;
+                MemCpy(Config->BootFile, Value, FileLength);
+                break;
+            default:
+                break;
+        }
+        
+        Offset += OptionLength;
+    }
+    
+    Config->BootFile[FileLength] = 0;
+    if (Config->ServerAddress == 0) {
+        Config->ServerAddress = *ServerId;
+    }
+    return EFI_SUCCESS;
+}
+
+// Take the addressing from a DHCPACK or BOOTP reply, e.g. one cached by
+// an earlier PXE boot. EFI_NOT_FOUND when the packet grants no address.
+EFI_STATUS NetDhcpParseLease(const void *Packet, uint64_t Length, NET_IPV4_CONFIG *Config) {
+    uint8_t MessageType;
+    uint32_t ServerId;
+    
+    if (Packet == NULL || Config == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    EFI_STATUS Status = ParseDhcp((const uint8_t*)Packet, Length, Config, &MessageType, &ServerId);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    if ((MessageType != 0 && MessageType != DHCP_ACK) || Config->Address == 0) {
+        return EFI_NOT_FOUND;
+    }
+    return EFI_SUCCESS;
+}
+
+// State of one DHCP exchange
+typedef struct {
+    uint32_t Xid;
+    uint8_t Expected;             // Reply type being waited for
+    bool Received;
+    bool Rejected;                // DHCPNAK instead of DHCPACK
+    uint32_t ServerId;
+    uint32_t OfferedAddress;
+    NET_IPV4_CONFIG Lease;
+} DHCP_EXCHANGE;
+
+static void DhcpReceive(NET_UDP_SOCKET *Socket, const NET_UDP_DATAGRAM *Datagram, void *Context) {
+    DHCP_EXCHANGE *Exchange = (DHCP_EXCHANGE*)Context;
+    NET_IPV4_CONFIG Lease;
+    uint8_t MessageType;
+    uint32_t ServerId;
+    
+    if (Exchange->Received || Datagram->Length < DHCP_OPTIONS_OFFSET ||
+        Read32(Datagram->Data + 4) != Exchange->Xid) {
+        return;
+    }
+    for (uint32_t i = 0; i < 6; i++) {
+        if (Datagram->Data[28 + i] != Socket->Stack->Mac[i]) {
+            return;
+        }
+    }
+    
+    if (EFI_ERROR(ParseDhcp(Datagram->Data, Datagram->Length, &Lease, &MessageType, &ServerId))) {
+        return;
+    }
+    
+    if (MessageType == DHCP_NAK && Exchange->Expected == DHCP_ACK) {
+        Exchange->Rejected = true;
+        Exchange->Received = true;
+        return;
+    }
+    if (MessageType != Exchange->Expected || Lease.Address == 0) {
+        return;
+    }
+    
+    Exchange->Lease = Lease;
+    Exchange->ServerId = ServerId;
+    Exchange->Received = true;
+}
+
+static EFI_STATUS DhcpSend(NET_UDP_SOCKET *Socket, DHCP_EXCHANGE *Exchange, uint8_t MessageType) {
+    static const uint8_t Parameters[] = {
+        DHCP_OPTION_SUBNET_MASK, DHCP_OPTION_ROUTER, DHCP_OPTION_DNS_SERVER,
+        DHCP_OPTION_LEASE_TIME, DHCP_OPTION_SERVER_ID, DHCP_OPTION_BOOT_FILE
+    };
+    uint8_t Message[DHCP_MESSAGE_SIZE];
+    
+    // BOOTREQUEST over Ethernet, asking for broadcast replies
+    MemSet(Message, 0, sizeof(Message));
+    Message[0] = 1;
+    Message[1] = ARP_HARDWARE_ETHERNET;
+    Message[2] = 6;
+    Write32(Message + 4, Exchange->Xid);
+    Write16(Message + 10, 0x8000);
+    MemCpy(Message + 28, Socket->Stack->Mac, 6);
+    Write32(Message + 236, DHCP_MAGIC_COOKIE);
+    
+    uint8_t *Option = Message + DHCP_OPTIONS_OFFSET;
+    *Option++ = DHCP_OPTION_MESSAGE_TYPE;
+    *Option++ = 1;
+    *Option++ = MessageType;
+    if (MessageType == DHCP_REQUEST) {
+        *Option++ = DHCP_OPTION_REQUESTED_ADDRESS;
+        *Option++ = 4;
+        Write32(Option, Exchange->OfferedAddress);
+        Option += 4;
+        *Option++ = DHCP_OPTION_SERVER_ID;
+        *Option++ = 4;
+        Write32(Option, Exchange->ServerId);
+        Option += 4;
+    }
+    *Option++ = DHCP_OPTION_PARAMETER_LIST;
+    *Option++ = sizeof(Parameters);
+    MemCpy(Option, Parameters, sizeof(Parameters));
+    Option += sizeof(Parameters);
+    *Option = DHCP_OPTION_END;
+    
+    return NetUdpSendTo(Socket, NET_IPV4_BROADCAST, NET_DHCP_SERVER_PORT, Message, sizeof(Message));
+}
+
+// Send MessageType every NET_DHCP_RETRY_US until the Expected reply arrives
+static EFI_STATUS DhcpTransact(NET_UDP_SOCKET *Socket, DHCP_EXCHANGE *Exchange, uint8_t MessageType,
+                               uint8_t Expected, uint64_t Deadline) {
+    NET_STACK *Stack = Socket->Stack;
+    
+    Exchange->Expected = Expected;
+    Exchange->Received = false;
+    
+    while (!Exchange->Received) {
+        if (ReadTimestamp() >= Deadline) {
+            return EFI_TIMEOUT;
+        }
+        
+        EFI_STATUS Status = DhcpSend(Socket, Exchange, MessageType);
+        if (EFI_ERROR(Status)) {
+            return Status;
+        }
+        
+        uint64_t Retry = ReadTimestamp() + (uint64_t)NET_DHCP_RETRY_US * Stack->TicksPerUs;
+        if (Retry > Deadline) {
+            Retry = Deadline;
+        }
+        while (!Exchange->Received && WaitBefore(Stack, Retry)) {
+        }
+    }
+    
+    return EFI_SUCCESS;
+}
+
+// Obtain a lease with DISCOVER/OFFER/REQUEST/ACK and configure the stack
+// with it (TimeoutUs 0 uses NET_DHCP_TIMEOUT_US). The stack is left
+// unconfigured on failure.
+EFI_STATUS NetDhcpConfigure(NET_STACK *Stack, uint64_t TimeoutUs) {
+    NET_IPV4_CONFIG Unconfigured;
+    DHCP_EXCHANGE Exchange;
+    NET_UDP_SOCKET Socket;
+    
+    if (Stack == NULL || Stack->Snp == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    if (TimeoutUs == 0) {
+        TimeoutUs = NET_DHCP_TIMEOUT_US;
+    }
+    
+    // Send from 0.0.0.0 and accept replies to any address meanwhile
+    MemSet(&Unconfigured, 0, sizeof(Unconfigured));
+    NetStackConfigure(Stack, &Unconfigured);
+    
+    MemSet(&Exchange, 0, sizeof(Exchange));
+    Exchange.Xid = (uint32_t)ReadTimestamp() ^ Read32(Stack->Mac + 2);
+    
+    EFI_STATUS Status = NetUdpOpen(Stack, &Socket, NET_DHCP_CLIENT_PORT, DhcpReceive, &Exchange);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    uint64_t Deadline = ReadTimestamp() + TimeoutUs * Stack->TicksPerUs;
+    Status = DhcpTransact(&Socket, &Exchange, DHCP_DISCOVER, DHCP_OFFER, Deadline);
+    if (!EFI_ERROR(Status)) {
+        Exchange.OfferedAddress = Exchange.Lease.Address;
+        Status = DhcpTransact(&Socket, &Exchange, DHCP_REQUEST, DHCP_ACK, Deadline);
+    }
+    if (!EFI_ERROR(Status) && Exchange.Rejected) {
+        Status = EFI_ACCESS_DENIED;
+    }
+    
+    NetUdpClose(&Socket);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    return NetStackConfigure(Stack, &Exchange.Lease);
+}
+
+void PrintIpv4Address(uint32_t Address) {
+    for (int Shift = 24; Shift >= 0; Shift -= 8) {
+        PrintDec((Address >> Shift) & 0xFF);
+        if (Shift != 0) {
+            PRINT(u".");
+        }
+    }
+}
+
+void NetStackPrintStats(NET_STACK *Stack) {
+    if (Stack == NULL) {
+        return;
+    }
+    
+    PRINT(u"Address ");
+    PrintIpv4Address(Stack->Config.Address);
+    PRINT(u"  mask ");
+    PrintIpv4Address(Stack->Config.SubnetMask);
+    PRINT(u"  gateway ");
+    PrintIpv4Address(Stack->Config.Gateway);
+    PRINTL(u"");
+    
+    PRINT(u"UDP: sent ");
+    PrintDec(Stack->DatagramsSent);
+    PRINT(u", received ");
+    PrintDec(Stack->DatagramsReceived);
+    PRINT(u"  ARP: requests ");
+    PrintDec(Stack->ArpRequests);
+    PRINT(u", replies ");
+    PrintDec(Stack->ArpReplies);
+    PRINT(u", hits ");
+    PrintDec(Stack->ArpHits);
+    PRINT(u", misses ");
+    PrintDec(Stack->ArpMisses);
+    PRINT(u", evictions ");
+    PrintDec(Stack->ArpEvictions);
+    PRINTL(u"");
+    
+    PRINT(u"IP drops: header ");
+    PrintDec(Stack->BadHeaders);
+    PRINT(u", checksum ");
+    PrintDec(Stack->BadChecksums);
+    PRINT(u", fragment ");
+    PrintDec(Stack->Fragments);
+    PRINT(u", not for us ");
+    PrintDec(Stack->NotForUs);
+    PRINT(u", protocol ");
+    PrintDec(Stack->UnknownProtocols);
+    PRINT(u", no socket ");
+    PrintDec(Stack->NoSocket);
+    PRINTL(u"");
+    
+    NetFilterPrintStats(&Stack->Filter);
+}
+
+static void PollPeer(void *Context) {
+    NetStackPoll((NET_STACK*)Context);
+}
+
+static void EchoDatagram(NET_UDP_SOCKET *Socket, const NET_UDP_DATAGRAM *Datagram, void *Context) {
+    NetUdpSendTo(Socket, Datagram->SrcAddress, Datagram->SrcPort, Datagram->Data, Datagram->Length);
+}
+
+static void CountDatagram(NET_UDP_SOCKET *Socket, const NET_UDP_DATAGRAM *Datagram, void *Context) {
+    (*(uint64_t*)Context)++;
+}
+
+// Run two stacks over a pair of loopback ports: resolve the peer with ARP,
+// then echo NET_STACK_BENCHMARK_DATAGRAMS datagrams of several sizes and
+// report round-trip rates and the cost of building each datagram
+void NetStackBenchmark(void) {
+    static const uint32_t Sizes[] = { 18, 512, 1472 };
+    NET_LOOPBACK_PORT Ports[2];
+    NET_STACK Client, Server;
+    NET_UDP_SOCKET ClientSocket, ServerSocket;
+    NET_IPV4_CONFIG Config;
+    uint8_t Payload[1472];
+    uint64_t Replies = 0;
+    
+    if (EFI_ERROR(NetLoopbackCreate(&Ports[0], 1)) || EFI_ERROR(NetLoopbackCreate(&Ports[1], 2))) {
+        PRINTL(u"IP benchmark: out of memory");
+        return;
+    }
+    NetLoopbackConnect(&Ports[0], &Ports[1]);
+    
+    MemSet(&Config, 0, sizeof(Config));
+    Config.SubnetMask = NET_IPV4(255, 255, 255, 0);
+    Config.Address = NET_IPV4(10, 0, 0, 1);
+    EFI_STATUS Status = NetStackCreate(&Client, &Ports[0].Snp, &Config);
+    Config.Address = NET_IPV4(10, 0, 0, 2);
+    if (!EFI_ERROR(Status)) {
+        Status = NetStackCreate(&Server, &Ports[1].Snp, &Config);
+        if (EFI_ERROR(Status)) {
+            NetStackDestroy(&Client);
+        }
+    }
+    if (EFI_ERROR(Status)) {
+        PRINTL(u"IP benchmark: stack setup failed");
+        NetLoopbackDestroy(&Ports[0]);
+        NetLoopbackDestroy(&Ports[1]);
+        return;
+    }
+    
+    // Each side runs the other while it waits
+    Client.Idle = PollPeer;
+    Client.IdleContext = &Server;
+    Server.Idle = PollPeer;
+    Server.IdleContext = &Client;
+    
+    NetUdpOpen(&Server, &ServerSocket, 7, EchoDatagram, NULL);
+    NetUdpOpen(&Client, &ClientSocket, 0, CountDatagram, &Replies);
+    
+    uint64_t Start = ReadTimestamp();
+    Status = NetUdpConnect(&ClientSocket, Config.Address, 7);
+    PRINT(u"ARP resolve: ");
+    if (EFI_ERROR(Status)) {
+        PRINT(u"failed ");
+        PrintHex(Status);
+        PRINTL(u"");
+    } else {
+        PrintDec(TimestampToMicroseconds(ReadTimestamp() - Start));
+        PRINTL(u" us");
+    }
+    
+    for (uint32_t i = 0; i < sizeof(Payload); i++) {
+        Payload[i] = (uint8_t)(i * 7);
+    }
+    
+    for (uint32_t s = 0; s < sizeof(Sizes) / sizeof(Sizes[0]) && !EFI_ERROR(Status); s++) {
+        uint64_t SendTicks = 0;
+        
+        Replies = 0;
+        Start = ReadTimestamp();
+        for (uint32_t Count = 0; Count < NET_STACK_BENCHMARK_DATAGRAMS && !EFI_ERROR(Status); Count++) {
+            uint64_t SendStart = ReadTimestamp();
+            Status = NetUdpSend(&ClientSocket, Payload, Sizes[s]);
+            SendTicks += ReadTimestamp() - SendStart;
+            
+            // Keep the loopback queues from overflowing
+            if ((Count & 15) == 15) {
+                NetStackPoll(&Server);
+                NetStackPoll(&Client);
+            }
+        }
+        for (uint32_t Round = 0; Round < 16 && Replies < NET_STACK_BENCHMARK_DATAGRAMS; Round++) {
+            NetStackPoll(&Server);
+            NetStackPoll(&Client);
+        }
+        uint64_t Ticks = ReadTimestamp() - Start;
+        
+        PrintDec(Sizes[s]);
+        PRINT(u" bytes: ");
+        if (EFI_ERROR(Status)) {
+            PRINT(u"failed ");
+            PrintHex(Status);
+            PRINTL(u"");
+            break;
+        }
+        PrintDec(BytesPerSecond(Replies, Ticks));
+        PRINT(u" echoes/s, ");
+        PrintDec(BytesPerSecond(Replies * Sizes[s] * 2, Ticks) * 8 / 1000000);
+        PRINT(u" Mbit/s, ");
+        PrintDec(TimestampToMicroseconds(SendTicks * 1000) / NET_STACK_BENCHMARK_DATAGRAMS);
+        PRINT(u" ns per send, ");
+        PrintDec(Replies);
+        PRINT(u"/");
+        PrintDec(NET_STACK_BENCHMARK_DATAGRAMS);
+        PRINTL(u" echoed");
+    }
+    
+    NetStackPrintStats(&Client);
+    
+    NetUdpClose(&ClientSocket);
+    NetUdpClose(&ServerSocket);
+    NetStackDestroy(&Client);
+    NetStackDestroy(&Server);
+    NetLoopbackDestroy(&Ports[0]);
+    NetLoopbackDestroy(&Ports[1]);
+}
@@ -0,0 +1,205 @@
+// efi_net_ip.h
+#ifndef TINYUEFI_NET_IP_H
+#define TINYUEFI_NET_IP_H
+
+#include "uefi_types.h"
+#include "efi_network_protocol.h"
+#include "efi_net_rx.h"
+#include "efi_net_tx.h"
+#include "efi_net_filter.h"
+
+// EtherTypes handled by the stack
+#define NET_ETHERTYPE_IPV4            0x0800
+#define NET_ETHERTYPE_ARP             0x0806
+
+// Header sizes (IPv4 without options)
+#define NET_ETHER_HEADER_SIZE         14
+#define NET_IPV4_HEADER_SIZE          20
+#define NET_UDP_HEADER_SIZE           8
+#define NET_UDP_HEADERS_SIZE          (NET_ETHER_HEADER_SIZE + NET_IPV4_HEADER_SIZE + NET_UDP_HEADER_SIZE)
+
+// IPv4 address in host order from its dotted-quad parts
+#define NET_IPV4(A, B, C, D)          (((uint32_t)(A) << 24) | ((uint32_t)(B) << 16) | \
+                                       ((uint32_t)(C) << 8) | (uint32_t)(D))
+#define NET_IPV4_BROADCAST            0xFFFFFFFF
+
+// ARP cache slots (a power of two) and how many a lookup probes
+#define NET_ARP_CACHE_SIZE            64
+#define NET_ARP_CACHE_PROBES          4
+
+// ARP entry lifetime and request retransmission
+#define NET_ARP_LIFETIME_US           60000000
+#define NET_ARP_RETRY_US              250000
+#define NET_ARP_ATTEMPTS              4
+
+// Open UDP sockets per stack; ports handed out when the caller passes 0
+#define NET_UDP_MAX_SOCKETS           8
+#define NET_UDP_EPHEMERAL_FIRST       49152
+
+// DHCP ports and client timing
+#define NET_DHCP_SERVER_PORT          67
+#define NET_DHCP_CLIENT_PORT          68
+#define NET_DHCP_RETRY_US             2000000
+#define NET_DHCP_TIMEOUT_US           10000000
+
+// Buffers the stack sets up on its interface
+#define NET_STACK_TX_SLOTS            32
+#define NET_STACK_RX_FRAMES           64
+
+// Datagrams sent per payload size by NetStackBenchmark
+#define NET_STACK_BENCHMARK_DATAGRAMS 50000
+
+// Byte order (UEFI targets are little-endian)
+static inline uint16_t HostToNet16(uint16_t Value) {
+    return (uint16_t)((Value >> 8) | (Value << 8));
+}
+
+static inline uint32_t HostToNet32(uint32_t Value) {
+    return (Value >> 24) | ((Value >> 8) & 0xFF00) | ((Value << 8) & 0xFF0000) | (Value << 24);
+}
+
+static inline uint16_t NetToHost16(uint16_t Value) {
+    return HostToNet16(Value);
+}
+
+static inline uint32_t NetToHost32(uint32_t Value) {
+    return HostToNet32(Value);
+}
+
+// Interface addressing. Addresses are in host order; zero means unset.
+typedef struct {
+    uint32_t Address;
+    uint32_t SubnetMask;
+    uint32_t Gateway;
+    uint32_t DnsServer;
+    uint32_t ServerAddress;       // DHCP server, or next-server for booting
+    uint32_t LeaseSeconds;        // Zero for static configuration
+    char BootFile[128];           // DHCP boot file name, NUL-terminated
+} NET_IPV4_CONFIG;
+
+typedef enum {
+    NetArpFree,
+    NetArpPending,
+    NetArpResolved
+} NET_ARP_STATE;
+
+typedef struct {
+    uint32_t Address;
+    uint8_t Mac[6];
+    uint8_t State;
+    uint64_t Expires;             // ReadTimestamp after which the entry is stale
+} NET_ARP_ENTRY;
+
+// Prebuilt Ethernet, IPv4 and UDP headers for one destination, with the
+// checksum contributions of the fixed fields summed in advance
+typedef struct {
+    uint8_t Headers[NET_UDP_HEADERS_SIZE];
+    uint64_t IpSum;
+    uint64_t PseudoSum;
+} NET_UDP_TEMPLATE;
+
+typedef struct _NET_STACK NET_STACK;
+typedef struct _NET_UDP_SOCKET NET_UDP_SOCKET;
+
+// One received datagram. Data points into the receive pool and is only
+// valid during the callback.
+typedef struct {
+    uint32_t SrcAddress;
+    uint32_t DestAddress;
+    uint16_t SrcPort;
+    uint16_t DestPort;
+    const uint8_t *Data;
+    uint32_t Length;
+    uint8_t SrcMac[6];
+} NET_UDP_DATAGRAM;
+
+typedef void (*NET_UDP_RECEIVE)(NET_UDP_SOCKET *Socket, const NET_UDP_DATAGRAM *Datagram, void *Context);
+
+struct _NET_UDP_SOCKET {
+    NET_STACK *Stack;
+    uint16_t LocalPort;
+    NET_UDP_RECEIVE Receive;
+    void *Context;
+    
+    // Set by NetUdpConnect
+    bool Connected;
+    uint32_t RemoteAddress;
+    uint16_t RemotePort;
+    NET_UDP_TEMPLATE Template;
+    
+    // Statistics
+    uint64_t DatagramsSent;
+    uint64_t DatagramsReceived;
+};
+
+// IPv4/UDP/ARP stack over one Simple Network interface. It receives
+// through a NET_RX_ENGINE and transmits complete frames through a
+// NET_TX_RING; the firmware's own network stack is not used.
+struct _NET_STACK {
+    EFI_SIMPLE_NETWORK_PROTOCOL *Snp;
+    NET_RX_ENGINE Rx;
+    NET_TX_RING Tx;
+    NET_FILTER Filter;            // Unicast and broadcast; join groups and reapply for multicast
+    EFI_STATUS FilterStatus;      // NetFilterApply at creation; on error only software filters
+    NET_IPV4_CONFIG Config;
+    uint8_t Mac[6];
+    uint16_t NextIpId;
+    uint16_t NextPort;
+    uint64_t TicksPerUs;
+    NET_ARP_ENTRY ArpCache[NET_ARP_CACHE_SIZE];
+    NET_UDP_SOCKET *Sockets[NET_UDP_MAX_SOCKETS];
+    uint32_t SocketCount;
+    
+    // Called while the stack waits (e.g. to run a loopback peer)
+    void (*Idle)(void *Context);
+    void *IdleContext;
+    
+    // Statistics
+    uint64_t ArpRequests;
+    uint64_t ArpReplies;
+    uint64_t ArpHits;
+    uint64_t ArpMisses;
+    uint64_t ArpEvictions;
+    uint64_t PacketsReceived;
+    uint64_t BadHeaders;
+    uint64_t BadChecksums;
+    uint64_t Fragments;           // Dropped; reassembly is not supported
+    uint64_t NotForUs;
+    uint64_t UnknownProtocols;
+    uint64_t NoSocket;
+    uint64_t DatagramsSent;
+    uint64_t DatagramsReceived;
+};
+
+// Stack setup
+EFI_STATUS NetStackCreate(NET_STACK *Stack, EFI_SIMPLE_NETWORK_PROTOCOL *Snp, const NET_IPV4_CONFIG *Config);
+void NetStackDestroy(NET_STACK *Stack);
+EFI_STATUS NetStackConfigure(NET_STACK *Stack, const NET_IPV4_CONFIG *Config);
+uint32_t NetStackPoll(NET_STACK *Stack);
+EFI_STATUS NetStackWait(NET_STACK *Stack, uint64_t TimeoutUs);
+
+// ARP
+EFI_STATUS NetArpResolve(NET_STACK *Stack, uint32_t Address, uint8_t *Mac);
+void NetArpFlush(NET_STACK *Stack);
+
+// UDP
+EFI_STATUS NetUdpOpen(NET_STACK *Stack, NET_UDP_SOCKET *Socket, uint16_t LocalPort,
+                      NET_UDP_RECEIVE Receive, void *Context);
+void NetUdpClose(NET_UDP_SOCKET *Socket);
+EFI_STATUS NetUdpConnect(NET_UDP_SOCKET *Socket, uint32_t RemoteAddress, uint16_t RemotePort);
+EFI_STATUS NetUdpAcquire(NET_UDP_SOCKET *Socket, uint8_t **Payload, uint32_t *MaxLength);
+EFI_STATUS NetUdpSubmit(NET_UDP_SOCKET *Socket, uint32_t Length);
+EFI_STATUS NetUdpSend(NET_UDP_SOCKET *Socket, const void *Data, uint32_t Length);
+EFI_STATUS NetUdpSendTo(NET_UDP_SOCKET *Socket, uint32_t RemoteAddress, uint16_t RemotePort,
+                        const void *Data, uint32_t Length);
+
+// DHCP
+EFI_STATUS NetDhcpParseLease(const void *Packet, uint64_t Length, NET_IPV4_CONFIG *Config);
+EFI_STATUS NetDhcpConfigure(NET_STACK *Stack, uint64_t TimeoutUs);
+
+// Reporting
+void PrintIpv4Address(uint32_t Address);
+void NetStackPrintStats(NET_STACK *Stack);
+void NetStackBenchmark(void);
+
+#endif // TINYUEFI_NET_IP_H
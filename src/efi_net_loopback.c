@@ -0,0 +1,411 @@
+// efi_net_loopback.c
+#include "efi_net_loopback.h"
+#include "uefi_helpers.h"
+
+static EFI_STATUS LoopbackStart(EFI_SIMPLE_NETWORK_PROTOCOL *This) {
+    if (This == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    This->Mode->State = EfiSimpleNetworkStarted;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS LoopbackStop(EFI_SIMPLE_NETWORK_PROTOCOL *This) {
+    if (This == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    This->Mode->State = EfiSimpleNetworkStopped;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS LoopbackInitialize(EFI_SIMPLE_NETWORK_PROTOCOL *This,
+                                     uint64_t ExtraRxBufferSize, uint64_t ExtraTxBufferSize) {
+    if (This == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    if (This->Mode->State == EfiSimpleNetworkStopped) {
+        return EFI_NOT_READY;
+    }
+    
+    This->Mode->State = EfiSimpleNetworkInitialized;
+    return EFI_SUCCESS;
+}
+
+// Drop queued frames; TxBufs already recycled stay available to GetStatus
+static EFI_STATUS LoopbackReset(EFI_SIMPLE_NETWORK_PROTOCOL *This, bool ExtendedVerification) {
+    NET_LOOPBACK_PORT *Port = (NET_LOOPBACK_PORT*)This;
+    
+    if (Port == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    Port->Head = 0;
+    Port->Count = 0;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS LoopbackShutdown(EFI_SIMPLE_NETWORK_PROTOCOL *This) {
+    if (This == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    LoopbackReset(This, false);
+    This->Mode->State = EfiSimpleNetworkStarted;
+    return EFI_SUCCESS;
+}
+
+// Hand back one transmitted buffer per call, as real drivers do
+static EFI_STATUS LoopbackGetStatus(EFI_SIMPLE_NETWORK_PROTOCOL *This, uint32_t *InterruptStatus, void **TxBuf) {
+    NET_LOOPBACK_PORT *Port = (NET_LOOPBACK_PORT*)This;
+    
+    if (Port == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    if (InterruptStatus != NULL) {
+        *InterruptStatus = 0;
+    }
+    if (TxBuf != NULL) {
+        *TxBuf = NULL;
+        if (Port->RecycledCount > 0) {
+            *TxBuf = Port->Recycled[0];
+            Port->RecycledCount--;
+            for (uint32_t i = 0; i < Port->RecycledCount; i++) {
+                Port->Recycled[i] = Port->Recycled[i + 1];
+            }
+        }
+    }
+    
+    return EFI_SUCCESS;
+}
+
+static bool SameAddress(const uint8_t *Frame, const EFI_MAC_ADDRESS *Address) {
+    for (uint32_t i = 0; i < 6; i++) {
+        if (Frame[i] != Address->Addr[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Apply the port's receive filter setting to a frame's destination
+static bool LoopbackAccepts(NET_LOOPBACK_PORT *Port, const uint8_t *Frame) {
+    uint32_t Setting = Port->Mode.ReceiveFilterSetting;
+    
+    if ((Setting & EFI_SIMPLE_NETWORK_RECEIVE_PROMISCUOUS) != 0) {
+        return true;
+    }
+    if ((Frame[0] & 0x01) == 0) {
+        return (Setting & EFI_SIMPLE_NETWORK_RECEIVE_UNICAST) != 0 &&
+               SameAddress(Frame, &Port->Mode.CurrentAddress);
+    }
+    if (SameAddress(Frame, &Port->Mode.BroadcastAddress)) {
+        return (Setting & EFI_SIMPLE_NETWORK_RECEIVE_BROADCAST) != 0;
+    }
+    if ((Setting & EFI_SIMPLE_NETWORK_RECEIVE_PROMISCUOUS_MULTICAST) != 0) {
+        return true;
+    }
+    if ((Setting & EFI_SIMPLE_NETWORK_RECEIVE_MULTICAST) != 0) {
+        for (uint32_t i = 0; i < Port->Mode.MCastFilterCount; i++) {
+            if (SameAddress(Frame, &Port->Mode.MCastFilter[i])) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Validated like the UEFI specification asks of drivers: only supported
+// bits, and a non-empty table of multicast addresses when one is given
+static EFI_STATUS LoopbackReceiveFilters(EFI_SIMPLE_NETWORK_PROTOCOL *This, uint32_t Enable,
+                                         uint32_t Disable, bool ResetMCastFilter,
+                                         uint64_t MCastFilterCnt, EFI_MAC_ADDRESS *MCastFilter) {
+    NET_LOOPBACK_PORT *Port = (NET_LOOPBACK_PORT*)This;
+    
+    if (Port == NULL || ((Enable | Disable) & ~Port->Mode.ReceiveFilterMask) != 0) {
+        return EFI_INVALID_PARAMETER;
+    }
+    if (!ResetMCastFilter && MCastFilterCnt != 0) {
+        if (MCastFilterCnt > Port->Mode.MaxMCastFilterCount || MCastFilter == NULL) {
+            return EFI_INVALID_PARAMETER;
+        }
+        for (uint64_t i = 0; i < MCastFilterCnt; i++) {
+            if ((MCastFilter[i].Addr[0] & 0x01) == 0) {
+                return EFI_INVALID_PARAMETER;
+            }
+        }
+    }
+    if (Port->Mode.State != EfiSimpleNetworkInitialized) {
+        return EFI_NOT_READY;
+    }
+    
+    Port->Mode.ReceiveFilterSetting = (Port->Mode.ReceiveFilterSetting | Enable) & ~Disable;
+    if (ResetMCastFilter) {
+        Port->Mode.MCastFilterCount = 0;
+    } else if (MCastFilterCnt != 0) {
+        Port->Mode.MCastFilterCount = (uint32_t)MCastFilterCnt;
+        for (uint64_t i = 0; i < MCastFilterCnt; i++) {
+            Port->Mode.MCastFilter[i] = MCastFilter[i];
+        }
+    }
+    return EFI_SUCCESS;
+}
+
+// RFC 1112 and RFC 2464 mappings
+static EFI_STATUS LoopbackMCastIpToMac(EFI_SIMPLE_NETWORK_PROTOCOL *This, bool IPv6,
+                                       EFI_IP_ADDRESS *IP, EFI_MAC_ADDRESS *MAC) {
+    if (This == NULL || IP == NULL || MAC == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    MemSet(MAC, 0, sizeof(*MAC));
+    if (IPv6) {
+        if (IP->v6.Addr[0] != 0xFF) {
+            return EFI_INVALID_PARAMETER;
+        }
+        MAC->Addr[0] = 0x33;
+        MAC->Addr[1] = 0x33;
+        MemCpy(MAC->Addr + 2, IP->v6.Addr + 12, 4);
+    } else {
+        if ((IP->v4.Addr[0] & 0xF0) != 0xE0) {
+            return EFI_INVALID_PARAMETER;
+        }
+        MAC->Addr[0] = 0x01;
+        MAC->Addr[1] = 0x00;
+        MAC->Addr[2] = 0x5E;
+        MAC->Addr[3] = IP->v4.Addr[1] & 0x7F;
+        MAC->Addr[4] = IP->v4.Addr[2];
+        MAC->Addr[5] = IP->v4.Addr[3];
+    }
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS LoopbackTransmit(EFI_SIMPLE_NETWORK_PROTOCOL *This, uint64_t HeaderSize,
+                                   uint64_t BufferSize, void *Buffer, EFI_MAC_ADDRESS *SrcAddr,
+                                   EFI_MAC_ADDRESS *DestAddr, uint16_t *Protocol) {
+    NET_LOOPBACK_PORT *Port = (NET_LOOPBACK_PORT*)This;
+    uint8_t *Frame = (uint8_t*)Buffer;
+    
+    if (Port == NULL || Buffer == NULL || BufferSize < NET_LOOPBACK_HEADER_SIZE ||
+        BufferSize > NET_LOOPBACK_FRAME_SIZE) {
+        return EFI_INVALID_PARAMETER;
+    }
+    if (Port->Mode.State != EfiSimpleNetworkInitialized) {
+        return EFI_NOT_READY;
+    }
+    
+    // The recycle queue is the driver's transmit queue; it is full until
+    // the caller collects buffers with GetStatus
+    if (Port->RecycledCount == NET_LOOPBACK_QUEUE_FRAMES) {
+        return EFI_NOT_READY;
+    }
+    
+    if (HeaderSize != 0) {
+        if (HeaderSize != NET_LOOPBACK_HEADER_SIZE || DestAddr == NULL || Protocol == NULL) {
+            return EFI_INVALID_PARAMETER;
+        }
+        
+        EFI_MAC_ADDRESS *Source = SrcAddr != NULL ? SrcAddr : &Port->Mode.CurrentAddress;
+        MemCpy(Frame, DestAddr->Addr, 6);
+        MemCpy(Frame + 6, Source->Addr, 6);
+        Frame[12] = (uint8_t)(*Protocol >> 8);
+        Frame[13] = (uint8_t)*Protocol;
+    }
+    
+    Port->Recycled[Port->RecycledCount++] = Buffer;
+    Port->Transmitted++;
+    
+    NET_LOOPBACK_PORT *Target = Port->Peer != NULL ? Port->Peer : Port;
+    if (Port->LossInterval != 0 && Port->Transmitted % Port->LossInterval == 0) {
+        Port->Lost++;
+        return EFI_SUCCESS;
+    }
+    if (Target->Mode.State != EfiSimpleNetworkInitialized || !LoopbackAccepts(Target, Frame)) {
+        Target->Filtered++;
+        return EFI_SUCCESS;
+    }
+    if (Target->Count == NET_LOOPBACK_QUEUE_FRAMES) {
+        Target->QueueDrops++;
+        return EFI_SUCCESS;
+    }
+    
+    uint32_t Slot = (Target->Head + Target->Count) % NET_LOOPBACK_QUEUE_FRAMES;
+    MemCpy(Target->Frames + (uint64_t)Slot * NET_LOOPBACK_FRAME_SIZE, Frame, BufferSize);
+    Target->Lengths[Slot] = (uint32_t)BufferSize;
+    Target->Count++;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS LoopbackReceive(EFI_SIMPLE_NETWORK_PROTOCOL *This, uint64_t *HeaderSize,
+                                  uint64_t *BufferSize, void *Buffer, EFI_MAC_ADDRESS *SrcAddr,
+                                  EFI_MAC_ADDRESS *DestAddr, uint16_t *Protocol) {
+    NET_LOOPBACK_PORT *Port = (NET_LOOPBACK_PORT*)This;
+    
+    if (Port == NULL || BufferSize == NULL || Buffer == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    if (Port->Mode.State != EfiSimpleNetworkInitialized) {
+        return EFI_NOT_READY;
+    }
+    if (Port->Count == 0) {
+        return EFI_NOT_READY;
+    }
+    
+    uint8_t *Frame = Port->Frames + (uint64_t)Port->Head * NET_LOOPBACK_FRAME_SIZE;
+    uint32_t Length = Port->Lengths[Port->Head];
+    if (*BufferSize < Length) {
+        *BufferSize = Length;
+        return EFI_BUFFER_TOO_SMALL;
+    }
+    
+    MemCpy(Buffer, Frame, Length);
+    *BufferSize = Length;
+    if (HeaderSize != NULL) {
+        *HeaderSize = NET_LOOPBACK_HEADER_SIZE;
+    }
+    if (DestAddr != NULL) {
+        MemSet(DestAddr, 0, sizeof(*DestAddr));
+        MemCpy(DestAddr->Addr, Frame, 6);
+    }
+    if (SrcAddr != NULL) {
+        MemSet(SrcAddr, 0, sizeof(*SrcAddr));
+        MemCpy(SrcAddr->Addr, Frame + 6, 6);
+    }
+    if (Protocol != NULL) {
+        *Protocol = (uint16_t)((Frame[12] << 8) | Frame[13]);
+    }
+    
+    Port->Head = (Port->Head + 1) % NET_LOOPBACK_QUEUE_FRAMES;
+    Port->Count--;
+    Port->Delivered++;
+    return EFI_SUCCESS;
+}
+
+// Counters the port keeps; the rest are reported as unsupported. A port
+// cannot corrupt frames, so its error counters are always zero.
+static EFI_STATUS LoopbackStatistics(EFI_SIMPLE_NETWORK_PROTOCOL *This, bool Reset,
+                                     uint64_t *StatisticsSize, EFI_NETWORK_STATISTICS *StatisticsTable) {
+    NET_LOOPBACK_PORT *Port = (NET_LOOPBACK_PORT*)This;
+    EFI_NETWORK_STATISTICS Table;
+    EFI_STATUS Status = EFI_SUCCESS;
+    
+    if (Port == NULL || (!Reset && (StatisticsSize == NULL || StatisticsTable == NULL))) {
+        return EFI_INVALID_PARAMETER;
+    }
+    if (Port->Mode.State != EfiSimpleNetworkInitialized) {
+        return EFI_NOT_READY;
+    }
+    
+    if (StatisticsSize != NULL && StatisticsTable != NULL) {
+        MemSet(&Table, 0xFF, sizeof(Table));
+        Table.RxTotalFrames = Port->Delivered + Port->Count + Port->QueueDrops;
+        Table.RxGoodFrames = Port->Delivered;
+        Table.RxDroppedFrames = Port->QueueDrops;
+        Table.RxUndersizeFrames = 0;
+        Table.RxOversizeFrames = 0;
+        Table.RxCrcErrorFrames = 0;
+        Table.TxTotalFrames = Port->Transmitted;
+        Table.TxGoodFrames = Port->Transmitted;
+        Table.TxDroppedFrames = 0;
+        Table.TxUndersizeFrames = 0;
+        Table.TxOversizeFrames = 0;
+        Table.TxCrcErrorFrames = 0;
+        Table.TxCollisionCount = 0;
+        
+        uint64_t Size = *StatisticsSize < sizeof(Table) ? *StatisticsSize : sizeof(Table);
+        MemCpy(StatisticsTable, &Table, Size);
+        if (*StatisticsSize < sizeof(Table)) {
+            Status = EFI_BUFFER_TOO_SMALL;
+        }
+        *StatisticsSize = sizeof(Table);
+    }
+    
+    if (Reset) {
+        Port->Transmitted = 0;
+        Port->Delivered = 0;
+        Port->Filtered = 0;
+        Port->QueueDrops = 0;
+        Port->Lost = 0;
+    }
+    return Status;
+}
+
+// Set up an unpaired port with the locally administered MAC 02:00:00:00:00:Id.
+// Only the calls a driver needs for moving and filtering frames are provided;
+// the others are left NULL.
+EFI_STATUS NetLoopbackCreate(NET_LOOPBACK_PORT *Port, uint8_t Id) {
+    if (Port == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    MemSet(Port, 0, sizeof(*Port));
+    Port->Frames = (uint8_t*)AllocatePool((uint64_t)NET_LOOPBACK_QUEUE_FRAMES * NET_LOOPBACK_FRAME_SIZE);
+    if (Port->Frames == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    
+    Port->Mode.State = EfiSimpleNetworkStopped;
+    Port->Mode.HwAddressSize = 6;
+    Port->Mode.MediaHeaderSize = NET_LOOPBACK_HEADER_SIZE;
+    Port->Mode.MaxPacketSize = NET_LOOPBACK_MTU;
+    Port->Mode.IfType = 1;
+    Port->Mode.MultipleTxSupported = true;
+    Port->Mode.MediaPresentSupported = true;
+    Port->Mode.MediaPresent = true;
+    Port->Mode.CurrentAddress.Addr[0] = 0x02;
+    Port->Mode.CurrentAddress.Addr[5] = Id;
+    Port->Mode.PermanentAddress = Port->Mode.CurrentAddress;
+    MemSet(Port->Mode.BroadcastAddress.Addr, 0xFF, 6);
+    
+    // Like many firmware drivers, start out accepting all multicast
+    Port->Mode.ReceiveFilterMask = EFI_SIMPLE_NETWORK_RECEIVE_UNICAST |
+                                   EFI_SIMPLE_NETWORK_RECEIVE_MULTICAST |
+                                   EFI_SIMPLE_NETWORK_RECEIVE_BROADCAST |
+                                   EFI_SIMPLE_NETWORK_RECEIVE_PROMISCUOUS |
+                                   EFI_SIMPLE_NETWORK_RECEIVE_PROMISCUOUS_MULTICAST;
+    Port->Mode.ReceiveFilterSetting = EFI_SIMPLE_NETWORK_RECEIVE_UNICAST |
+                                      EFI_SIMPLE_NETWORK_RECEIVE_BROADCAST |
+                                      EFI_SIMPLE_NETWORK_RECEIVE_PROMISCUOUS_MULTICAST;
+    Port->Mode.MaxMCastFilterCount = NET_LOOPBACK_MCAST_FILTERS;
+    
+    Port->Snp.Revision = 0x00010000;
+    Port->Snp.Start = LoopbackStart;
+    Port->Snp.Stop = LoopbackStop;
+    Port->Snp.Initialize = LoopbackInitialize;
+    Port->Snp.Reset = LoopbackReset;
+    Port->Snp.Shutdown = LoopbackShutdown;
+    Port->Snp.ReceiveFilters = LoopbackReceiveFilters;
+    Port->Snp.Statistics = LoopbackStatistics;
+    Port->Snp.MCastIpToMac = LoopbackMCastIpToMac;
+    Port->Snp.GetStatus = LoopbackGetStatus;
+    Port->Snp.Transmit = LoopbackTransmit;
+    Port->Snp.Receive = LoopbackReceive;
+    Port->Snp.Mode = &Port->Mode;
+    return EFI_SUCCESS;
+}
+
+// Wire two ports together like a crossover cable
+void NetLoopbackConnect(NET_LOOPBACK_PORT *First, NET_LOOPBACK_PORT *Second) {
+    if (First == NULL || Second == NULL) {
+        return;
+    }
+    
+    First->Peer = Second;
+    Second->Peer = First;
+}
+
+void NetLoopbackDestroy(NET_LOOPBACK_PORT *Port) {
+    if (Port == NULL) {
+        return;
+    }
+    
+    if (Port->Peer != NULL && Port->Peer->Peer == Port) {
+        Port->Peer->Peer = NULL;
+    }
+    if (Port->Frames != NULL) {
+        FreePool(Port->Frames);
+    }
+    MemSet(Port, 0, sizeof(*Port));
+}
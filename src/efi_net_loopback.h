@@ -0,0 +1,50 @@
+// efi_net_loopback.h
+#ifndef TINYUEFI_NET_LOOPBACK_H
+#define TINYUEFI_NET_LOOPBACK_H
+
+#include "uefi_types.h"
+#include "efi_network_protocol.h"
+
+// Frames a port queues before further ones are dropped
+#define NET_LOOPBACK_QUEUE_FRAMES     64
+
+// Ethernet framing carried by a port (no FCS)
+#define NET_LOOPBACK_HEADER_SIZE      14
+#define NET_LOOPBACK_MTU              1500
+#define NET_LOOPBACK_FRAME_SIZE       (NET_LOOPBACK_HEADER_SIZE + NET_LOOPBACK_MTU)
+
+// Multicast addresses the port's receive filter table holds
+#define NET_LOOPBACK_MCAST_FILTERS    8
+
+typedef struct _NET_LOOPBACK_PORT NET_LOOPBACK_PORT;
+
+// In-memory Simple Network port. Frames transmitted on a port are queued on
+// its peer (or on itself when it has none) and come back through Receive,
+// so network code runs without a NIC or the firmware network stack. There
+// is no WaitForPacket event; receivers fall back to polling.
+struct _NET_LOOPBACK_PORT {
+    EFI_SIMPLE_NETWORK_PROTOCOL Snp;  // First, so This converts back to the port
+    EFI_SIMPLE_NETWORK_MODE Mode;
+    NET_LOOPBACK_PORT *Peer;
+    uint8_t *Frames;                  // NET_LOOPBACK_QUEUE_FRAMES buffers
+    uint32_t Lengths[NET_LOOPBACK_QUEUE_FRAMES];
+    uint32_t Head;
+    uint32_t Count;
+    void *Recycled[NET_LOOPBACK_QUEUE_FRAMES];
+    uint32_t RecycledCount;
+    uint32_t LossInterval;            // Lose every Nth transmitted frame (0 = none)
+    
+    // Statistics
+    uint64_t Transmitted;
+    uint64_t Delivered;
+    uint64_t Filtered;                // Rejected by the receiving port's filters
+    uint64_t QueueDrops;
+    uint64_t Lost;
+};
+
+// Helper functions
+EFI_STATUS NetLoopbackCreate(NET_LOOPBACK_PORT *Port, uint8_t Id);
+void NetLoopbackConnect(NET_LOOPBACK_PORT *First, NET_LOOPBACK_PORT *Second);
+void NetLoopbackDestroy(NET_LOOPBACK_PORT *Port);
+
+#endif // TINYUEFI_NET_LOOPBACK_H
@@ -0,0 +1,590 @@
+// efi_net_multi.c
+#include "efi_net_multi.h"
+#include "uefi_helpers.h"
+#include "efi_protocol_discovery.h"
+#include "efi_timer.h"
+
+// Part file name, suffix included
+#define STRIPE_NAME_SIZE              256
+
+// Downloaded by the benchmark when no name is given; see run-multi in the
+// GNUmakefile for how the parts are made
+#define NET_MULTI_BENCHMARK_FILE      "stripe.img"
+
+typedef enum {
+    PartPending,
+    PartActive,
+    PartDone
+} STRIPE_PART_STATE;
+
+// State of one NetStripeDownload
+typedef struct {
+    NET_STRIPE *Stripe;
+    uint64_t PartSize;
+    char Name[STRIPE_NAME_SIZE];
+    uint32_t NameLength;          // Up to and including the '.' before the suffix
+    uint8_t *States;
+    uint32_t Slots;               // Parts that fit the destination, plus one to find the end
+    uint32_t Next;                // Parts before this one are all done
+    uint32_t End;                 // Parts in the image, Slots until the last one is seen
+    bool EndKnown;
+    uint64_t LastSize;            // Bytes in part End - 1
+    EFI_STATUS Status;            // Error that ends the download
+    EFI_STATUS Failure;           // Outcome of the last failed attempt
+} STRIPE_JOB;
+
+// Read the link state again. Drivers refresh MediaPresent when GetStatus
+// is called with nothing to collect.
+EFI_STATUS NetNicRefresh(NET_NIC *Nic) {
+    if (Nic == NULL || Nic->Snp == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    if (!Nic->MediaPresentSupported) {
+        Nic->MediaPresent = true;
+        return EFI_SUCCESS;
+    }
+    
+    EFI_STATUS Status = Nic->Snp->GetStatus(Nic->Snp, NULL, NULL);
+    Nic->MediaPresent = Nic->Snp->Mode->MediaPresent;
+    return Status;
+}
+
+// Open and initialize every Simple Network handle. Interfaces that fail
+// stay in the list with their status.
+EFI_STATUS NetNicEnumerate(NET_NIC_LIST *List) {
+    EFI_HANDLE *Handles;
+    uint64_t HandleCount;
+    
+    if (List == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    MemSet(List, 0, sizeof(*List));
+    
+    EFI_STATUS Status = LocateHandles(&gEfiSimpleNetworkProtocolGuid, &Handles, &HandleCount);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    for (uint64_t i = 0; i < HandleCount; i++) {
+        if (List->Count == NET_NIC_MAX) {
+            List->Skipped++;
+            continue;
+        }
+        
+        NET_NIC *Nic = &List->Nics[List->Count++];
+        Nic->Handle = Handles[i];
+        Nic->Status = OpenProtocolOnHandle(Handles[i], &gEfiSimpleNetworkProtocolGuid, (void**)&Nic->Snp);
+        if (!EFI_ERROR(Nic->Status)) {
+            Nic->Status = InitializeNetwork(Nic->Snp);
+        }
+        if (EFI_ERROR(Nic->Status)) {
+            continue;
+        }
+        
+        MemCpy(&Nic->Mac, &Nic->Snp->Mode->CurrentAddress, sizeof(Nic->Mac));
+        Nic->MediaPresentSupported = Nic->Snp->Mode->MediaPresentSupported;
+        NetNicRefresh(Nic);
+    }
+    
+    FreePool(Handles);
+    return EFI_SUCCESS;
+}
+
+// Interfaces that initialized and have a link
+uint32_t NetNicUsable(const NET_NIC_LIST *List) {
+    uint32_t Count = 0;
+    
+    if (List == NULL) {
+        return 0;
+    }
+    
+    for (uint32_t i = 0; i < List->Count; i++) {
+        if (!EFI_ERROR(List->Nics[i].Status) && List->Nics[i].MediaPresent) {
+            Count++;
+        }
+    }
+    return Count;
+}
+
+void NetNicPrintList(const NET_NIC_LIST *List) {
+    if (List == NULL) {
+        return;
+    }
+    
+    for (uint32_t i = 0; i < List->Count; i++) {
+        const NET_NIC *Nic = &List->Nics[i];
+        
+        PRINT(u"NIC ");
+        PrintDec(i);
+        PRINT(u": ");
+        if (EFI_ERROR(Nic->Status)) {
+            PRINT(u"failed to initialize: ");
+            PrintHex(Nic->Status);
+            PRINTL(u"");
+            continue;
+        }
+        
+        const char16_t *Link = u", link down";
+        if (!Nic->MediaPresentSupported) {
+            Link = u", link state not reported";
+        } else if (Nic->MediaPresent) {
+            Link = u", link up";
+        }
+        
+        PrintMacAddress((EFI_MAC_ADDRESS*)&Nic->Mac, Nic->Snp->Mode->HwAddressSize);
+        PRINT(Link);
+        PRINTL(u"");
+    }
+    
+    if (List->Skipped != 0) {
+        PRINT(u"Skipped ");
+        PrintDec(List->Skipped);
+        PRINTL(u" more");
+    }
+}
+
+// Add a configured stack that reaches Server (host order)
+EFI_STATUS NetStripeAddLink(NET_STRIPE *Stripe, NET_STACK *Stack, uint32_t Server) {
+    if (Stripe == NULL || Stack == NULL || Stack->Snp == NULL || Server == 0) {
+        return EFI_INVALID_PARAMETER;
+    }
+    if (Stripe->LinkCount == NET_NIC_MAX) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    
+    NET_STRIPE_LINK *Link = &Stripe->Links[Stripe->LinkCount++];
+    MemSet(Link, 0, sizeof(*Link));
+    Link->Stack = Stack;
+    Link->Server = Server;
+    return EFI_SUCCESS;
+}
+
+// Bytes per second, from finished parts or else from the part in flight
+static uint64_t LinkRate(const NET_STRIPE_LINK *Link) {
+    if (Link->Rate != 0 || !Link->Busy) {
+        return Link->Rate;
+    }
+    return BytesPerSecond(Link->Transfer.Size, ReadTimestamp() - Link->Session.Start);
+}
+
+// Another link fetching the same part, if any
+static NET_STRIPE_LINK *OtherHolder(STRIPE_JOB *Job, const NET_STRIPE_LINK *Link) {
+    NET_STRIPE *Stripe = Job->Stripe;
+    
+    for (uint32_t i = 0; i < Stripe->LinkCount; i++) {
+        NET_STRIPE_LINK *Other = &Stripe->Links[i];
+        if (Other != Link && Other->Busy && Other->Part == Link->Part) {
+            return Other;
+        }
+    }
+    return NULL;
+}
+
+static void CancelPart(NET_STRIPE_LINK *Link) {
+    TftpCancel(&Link->Session);
+    TftpFinish(&Link->Session);
+    Link->Ticks += Link->Transfer.Ticks;
+    Link->Cancelled++;
+    Link->Busy = false;
+}
+
+// The image has End parts, the last holding LastSize bytes; work past it is
+// dropped
+static void SetEnd(STRIPE_JOB *Job, uint32_t End, uint64_t LastSize) {
+    NET_STRIPE *Stripe = Job->Stripe;
+    
+    if (End > Job->End) {
+        return;
+    }
+    
+    Job->End = End;
+    Job->LastSize = LastSize;
+    Job->EndKnown = true;
+    
+    for (uint32_t i = 0; i < Stripe->LinkCount; i++) {
+        if (Stripe->Links[i].Busy && Stripe->Links[i].Part >= End) {
+            CancelPart(&Stripe->Links[i]);
+        }
+    }
+}
+
+static void StartPart(STRIPE_JOB *Job, NET_STRIPE_LINK *Link, uint32_t Part) {
+    NET_STRIPE *Stripe = Job->Stripe;
+    uint64_t Offset = Part * Job->PartSize;
+    uint64_t Capacity = Stripe->Capacity - Offset;
+    
+    // The slot past a full destination has no room; it only shows whether
+    // another part exists
+    if (Capacity > Job->PartSize) {
+        Capacity = Job->PartSize;
+    }
+    
+    MemSet(&Link->Transfer, 0, sizeof(Link->Transfer));
+    Link->Transfer.Buffer = Stripe->Buffer + Offset;
+    Link->Transfer.Capacity = Capacity;
+    Link->Transfer.BlockSize = Stripe->BlockSize;
+    Link->Transfer.WindowSize = Stripe->WindowSize;
+    Link->Transfer.TimeoutUs = Stripe->TimeoutUs;
+    
+    char *Suffix = Job->Name + Job->NameLength;
+    uint32_t Number = Part;
+    for (uint32_t i = NET_STRIPE_SUFFIX_DIGITS; i > 0; i--) {
+        Suffix[i - 1] = (char)('0' + Number % 10);
+        Number /= 10;
+    }
+    Suffix[NET_STRIPE_SUFFIX_DIGITS] = 0;
+    
+    EFI_STATUS Status = TftpStart(&Link->Session, Link->Stack, Link->Server, Job->Name, &Link->Transfer);
+    if (EFI_ERROR(Status)) {
+        Job->Failure = Status;
+        if (++Link->Failures >= NET_STRIPE_LINK_FAILURES) {
+            Link->Disabled = true;
+        }
+        return;
+    }
+    
+    if (Job->States[Part] == PartActive) {
+        Stripe->Duplicated++;
+    }
+    Job->States[Part] = PartActive;
+    Link->Part = Part;
+    Link->Busy = true;
+}
+
+static void FinishPart(STRIPE_JOB *Job, NET_STRIPE_LINK *Link) {
+    NET_STRIPE *Stripe = Job->Stripe;
+    EFI_STATUS Status = TftpFinish(&Link->Session);
+    uint32_t Part = Link->Part;
+    uint64_t Size = Link->Transfer.Size;
+    NET_STRIPE_LINK *Other = OtherHolder(Job, Link);
+    
+    Link->Busy = false;
+    Link->Ticks += Link->Transfer.Ticks;
+    
+    if (Status == EFI_SUCCESS || (Status == EFI_NOT_FOUND && Part > 0)) {
+        Link->Failures = 0;
+        Job->States[Part] = PartDone;
+        if (Other != NULL) {
+            CancelPart(Other);
+        }
+        
+        // A missing part ends the image before it, a short one after it
+        if (Status == EFI_NOT_FOUND) {
+            SetEnd(Job, Part, Job->PartSize);
+            return;
+        }
+        
+        uint64_t Rate = BytesPerSecond(Size, Link->Transfer.Ticks);
+        Link->Rate = Link->Rate != 0 ? (Link->Rate * 3 + Rate) / 4 : Rate;
+        Link->Parts++;
+        Link->Bytes += Size;
+        if (Size == 0 && Part > 0) {
+            SetEnd(Job, Part, Job->PartSize);
+        } else if (Size < Job->PartSize) {
+            SetEnd(Job, Part + 1, Size);
+        }
+        return;
+    }
+    
+    // The image itself is wrong: part 0 missing, a part larger than the
+    // part size, or more parts than fit the destination
+    if (Status == EFI_NOT_FOUND || Status == EFI_BUFFER_TOO_SMALL || Status == EFI_ACCESS_DENIED) {
+        Job->Status = Status;
+        return;
+    }
+    
+    Job->Failure = Status;
+    if (++Link->Failures >= NET_STRIPE_LINK_FAILURES) {
+        Link->Disabled = true;
+    }
+    if (Other == NULL) {
+        Job->States[Part] = PartPending;
+        Stripe->Reassigned++;
+    }
+}
+
+// Give an idle link the lowest part nobody holds. With none left, take over
+// the part whose holder will take longest to finish, when this link can
+// fetch all of it sooner.
+static void AssignPart(STRIPE_JOB *Job, NET_STRIPE_LINK *Link) {
+    NET_STRIPE *Stripe = Job->Stripe;
+    NET_STRIPE_LINK *Slowest = NULL;
+    uint64_t SlowestUs = 0;
+    
+    for (uint32_t Part = Job->Next; Part < Job->End; Part++) {
+        if (Job->States[Part] == PartPending) {
+            StartPart(Job, Link, Part);
+            return;
+        }
+    }
+    
+    for (uint32_t i = 0; i < Stripe->LinkCount; i++) {
+        NET_STRIPE_LINK *Holder = &Stripe->Links[i];
+        if (!Holder->Busy || OtherHolder(Job, Holder) != NULL) {
+            continue;
+        }
+        
+        const TFTP_TRANSFER *Transfer = &Holder->Transfer;
+        uint64_t Total = Transfer->TransferSize != 0 ? Transfer->TransferSize : Transfer->Capacity;
+        uint64_t Remaining = Total > Transfer->Size ? Total - Transfer->Size : 0;
+        uint64_t Rate = LinkRate(Holder);
+        uint64_t RemainingUs = (uint64_t)-1;
+        
+        // A holder that has not been heard from yet is only overtaken once
+        // its first timeout has passed
+        if (Rate != 0) {
+            RemainingUs = Remaining * 1000000 / Rate;
+        } else if (TimestampToMicroseconds(ReadTimestamp() - Holder->Session.Start) < Holder->Session.TimeoutUs) {
+            continue;
+        }
+        
+        if (Slowest == NULL || RemainingUs > SlowestUs) {
+            Slowest = Holder;
+            SlowestUs = RemainingUs;
+        }
+    }
+    
+    if (Slowest == NULL) {
+        return;
+    }
+    
+    // Without a rate of its own the link only steps in for a stalled holder
+    uint64_t OwnUs = (uint64_t)-1;
+    if (Link->Rate != 0) {
+        OwnUs = Slowest->Transfer.Capacity * 1000000 / Link->Rate;
+    }
+    if (OwnUs < SlowestUs || (Link->Rate == 0 && SlowestUs == (uint64_t)-1)) {
+        StartPart(Job, Link, Slowest->Part);
+    }
+}
+
+// Fetch FileName.000, FileName.001, ... over every link into the
+// destination, one after the other in place, until a part is short or
+// missing. The parts must all be PartSize bytes except the last.
+EFI_STATUS NetStripeDownload(NET_STRIPE *Stripe, const char *FileName) {
+    STRIPE_JOB Job;
+    
+    if (Stripe == NULL || FileName == NULL || Stripe->Buffer == NULL || Stripe->LinkCount == 0) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    MemSet(&Job, 0, sizeof(Job));
+    Job.Stripe = Stripe;
+    Job.PartSize = Stripe->PartSize != 0 ? Stripe->PartSize : NET_STRIPE_DEFAULT_PART_SIZE;
+    
+    uint64_t Slots = Stripe->Capacity / Job.PartSize + 1;
+    Job.Slots = Slots < NET_STRIPE_MAX_PARTS ? (uint32_t)Slots : NET_STRIPE_MAX_PARTS;
+    Job.End = Job.Slots;
+    
+    while (FileName[Job.NameLength] != 0) {
+        if (Job.NameLength + 2 + NET_STRIPE_SUFFIX_DIGITS > STRIPE_NAME_SIZE) {
+            return EFI_BAD_BUFFER_SIZE;
+        }
+        Job.Name[Job.NameLength] = FileName[Job.NameLength];
+        Job.NameLength++;
+    }
+    Job.Name[Job.NameLength++] = '.';
+    
+    Job.States = (uint8_t*)AllocatePool(Job.Slots);
+    if (Job.States == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    MemSet(Job.States, PartPending, Job.Slots);
+    
+    Stripe->Size = 0;
+    Stripe->PartCount = 0;
+    Stripe->Duplicated = 0;
+    Stripe->Reassigned = 0;
+    for (uint32_t i = 0; i < Stripe->LinkCount; i++) {
+        NET_STRIPE_LINK *Link = &Stripe->Links[i];
+        NET_STACK *Stack = Link->Stack;
+        uint32_t Server = Link->Server;
+        
+        MemSet(Link, 0, sizeof(*Link));
+        Link->Stack = Stack;
+        Link->Server = Server;
+    }
+    
+    uint64_t Start = ReadTimestamp();
+    while (!EFI_ERROR(Job.Status)) {
+        bool Busy = false;
+        
+        for (uint32_t i = 0; i < Stripe->LinkCount && !EFI_ERROR(Job.Status); i++) {
+            NET_STRIPE_LINK *Link = &Stripe->Links[i];
+            if (Link->Busy && TftpPoll(&Link->Session) != EFI_NOT_READY) {
+                FinishPart(&Job, Link);
+            }
+        }
+        if (EFI_ERROR(Job.Status)) {
+            break;
+        }
+        
+        while (Job.Next < Job.End && Job.States[Job.Next] == PartDone) {
+            Job.Next++;
+        }
+        if (Job.Next == Job.End) {
+            break;
+        }
+        
+        for (uint32_t i = 0; i < Stripe->LinkCount; i++) {
+            NET_STRIPE_LINK *Link = &Stripe->Links[i];
+            if (!Link->Busy && !Link->Disabled) {
+                AssignPart(&Job, Link);
+            }
+            Busy = Busy || Link->Busy;
+        }
+        
+        // Every link has given up
+        if (!Busy) {
+            Job.Status = Job.Failure;
+        }
+    }
+    
+    for (uint32_t i = 0; i < Stripe->LinkCount; i++) {
+        if (Stripe->Links[i].Busy) {
+            CancelPart(&Stripe->Links[i]);
+        }
+    }
+    Stripe->Ticks = ReadTimestamp() - Start;
+    FreePool(Job.States);
+    
+    if (EFI_ERROR(Job.Status)) {
+        return Job.Status;
+    }
+    if (!Job.EndKnown) {
+        return EFI_BUFFER_TOO_SMALL;
+    }
+    
+    Stripe->PartCount = Job.End;
+    Stripe->Size = (Job.End - 1) * Job.PartSize + Job.LastSize;
+    return EFI_SUCCESS;
+}
+
+static void PrintRate(uint64_t Bytes, uint64_t Ticks) {
+    PrintDec(BytesPerSecond(Bytes, Ticks) * 8 / 1000000);
+    PRINT(u" Mbit/s");
+}
+
+void NetStripePrintStats(const NET_STRIPE *Stripe) {
+    if (Stripe == NULL) {
+        return;
+    }
+    
+    PrintDec(Stripe->Size);
+    PRINT(u" bytes in ");
+    PrintDec(TimestampToMicroseconds(Stripe->Ticks) / 1000);
+    PRINT(u" ms, ");
+    PrintRate(Stripe->Size, Stripe->Ticks);
+    PRINT(u" over ");
+    PrintDec(Stripe->LinkCount);
+    PRINT(u" links (parts ");
+    PrintDec(Stripe->PartCount);
+    PRINT(u", duplicated ");
+    PrintDec(Stripe->Duplicated);
+    PRINT(u", requeued ");
+    PrintDec(Stripe->Reassigned);
+    PRINTL(u")");
+    
+    for (uint32_t i = 0; i < Stripe->LinkCount; i++) {
+        const NET_STRIPE_LINK *Link = &Stripe->Links[i];
+        
+        PRINT(u"  Link ");
+        PrintDec(i);
+        PRINT(u": parts ");
+        PrintDec(Link->Parts);
+        PRINT(u", bytes ");
+        PrintDec(Link->Bytes);
+        PRINT(u", ");
+        PrintRate(Link->Bytes, Link->Ticks);
+        PRINT(u", cancelled ");
+        PrintDec(Link->Cancelled);
+        if (Link->Disabled) {
+            PRINT(u", disabled");
+        }
+        PRINTL(u"");
+    }
+}
+
+// Bring up every interface with a link through DHCP and fetch the split
+// image FileName (NET_MULTI_BENCHMARK_FILE when NULL) from each lease's
+// server, first over all links and then over the first one alone
+void NetMultiBenchmark(const char *FileName) {
+    NET_NIC_LIST List;
+    NET_STRIPE Stripe;
+    
+    if (EFI_ERROR(NetNicEnumerate(&List))) {
+        PRINTL(u"Multi-NIC benchmark: no network interfaces");
+        return;
+    }
+    NetNicPrintList(&List);
+    
+    uint32_t Usable = NetNicUsable(&List);
+    NET_STACK *Stacks = Usable != 0 ? (NET_STACK*)AllocatePool(Usable * sizeof(NET_STACK)) : NULL;
+    uint8_t *Buffer = (uint8_t*)AllocatePool(NET_MULTI_BENCHMARK_CAPACITY);
+    if (Stacks == NULL || Buffer == NULL) {
+        PRINTL(u"Multi-NIC benchmark: no usable interfaces or out of memory");
+        if (Stacks != NULL) {
+            FreePool(Stacks);
+        }
+        if (Buffer != NULL) {
+            FreePool(Buffer);
+        }
+        return;
+    }
+    
+    if (FileName == NULL) {
+        FileName = NET_MULTI_BENCHMARK_FILE;
+    }
+    
+    MemSet(&Stripe, 0, sizeof(Stripe));
+    Stripe.Buffer = Buffer;
+    Stripe.Capacity = NET_MULTI_BENCHMARK_CAPACITY;
+    
+    uint32_t Created = 0;
+    for (uint32_t i = 0; i < List.Count; i++) {
+        NET_NIC *Nic = &List.Nics[i];
+        NET_STACK *Stack = &Stacks[Created];
+        
+        if (EFI_ERROR(Nic->Status) || !Nic->MediaPresent || EFI_ERROR(NetStackCreate(Stack, Nic->Snp, NULL))) {
+            continue;
+        }
+        Created++;
+        
+        PRINT(u"NIC ");
+        PrintDec(i);
+        if (EFI_ERROR(NetDhcpConfigure(Stack, 0)) || Stack->Config.ServerAddress == 0) {
+            PRINTL(u": no DHCP lease naming a server");
+            continue;
+        }
+        PRINT(u": ");
+        PrintIpv4Address(Stack->Config.Address);
+        PRINT(u", server ");
+        PrintIpv4Address(Stack->Config.ServerAddress);
+        PRINTL(u"");
+        NetStripeAddLink(&Stripe, Stack, Stack->Config.ServerAddress);
+    }
+    
+    for (uint32_t Run = 0; Run < 2 && Stripe.LinkCount != 0; Run++) {
+        EFI_STATUS Status = NetStripeDownload(&Stripe, FileName);
+        if (EFI_ERROR(Status)) {
+            PRINT(u"Striped download failed: ");
+            PrintHex(Status);
+            PRINTL(u"");
+        }
+        NetStripePrintStats(&Stripe);
+        
+        // Then the same image over one link for comparison
+        if (Stripe.LinkCount == 1) {
+            break;
+        }
+        Stripe.LinkCount = 1;
+    }
+    
+    for (uint32_t i = 0; i < Created; i++) {
+        NetStackDestroy(&Stacks[i]);
+    }
+    FreePool(Stacks);
+    FreePool(Buffer);
+}
@@ -0,0 +1,100 @@
+// efi_net_multi.h
+#ifndef TINYUEFI_NET_MULTI_H
+#define TINYUEFI_NET_MULTI_H
+
+#include "uefi_types.h"
+#include "efi_network_protocol.h"
+#include "efi_net_ip.h"
+#include "efi_tftp.h"
+
+// Interfaces NetNicEnumerate keeps; further handles are counted and skipped
+#define NET_NIC_MAX                   8
+
+// Part size when the caller does not choose; images are split with
+// `split -b 4M -d -a 3 image image.` into image.000, image.001, ...
+#define NET_STRIPE_DEFAULT_PART_SIZE  (4 * 1024 * 1024)
+#define NET_STRIPE_SUFFIX_DIGITS      3
+#define NET_STRIPE_MAX_PARTS          1000
+
+// Failed parts in a row after which a link is given no more work
+#define NET_STRIPE_LINK_FAILURES      2
+
+// Destination NetMultiBenchmark allocates, the largest image it fetches
+#define NET_MULTI_BENCHMARK_CAPACITY  (256 * 1024 * 1024)
+
+// One Simple Network handle
+typedef struct {
+    EFI_HANDLE Handle;
+    EFI_SIMPLE_NETWORK_PROTOCOL *Snp;
+    EFI_STATUS Status;            // Outcome of opening and initializing the interface
+    bool MediaPresentSupported;
+    bool MediaPresent;            // Link up; assumed when the driver cannot tell
+    EFI_MAC_ADDRESS Mac;
+} NET_NIC;
+
+typedef struct {
+    NET_NIC Nics[NET_NIC_MAX];
+    uint32_t Count;
+    uint32_t Skipped;             // Handles past NET_NIC_MAX
+} NET_NIC_LIST;
+
+// One link of a striped download: a configured stack and the server it
+// fetches parts from
+typedef struct {
+    NET_STACK *Stack;
+    uint32_t Server;
+    
+    // Part in flight
+    bool Busy;
+    uint32_t Part;
+    TFTP_SESSION Session;
+    TFTP_TRANSFER Transfer;
+    
+    // Statistics
+    uint64_t Rate;                // Bytes per second over finished parts, 0 until one finishes
+    uint64_t Parts;
+    uint64_t Bytes;
+    uint64_t Ticks;               // Time spent fetching
+    uint32_t Failures;            // In a row
+    uint32_t Cancelled;           // Lost the race for a duplicated part
+    bool Disabled;
+} NET_STRIPE_LINK;
+
+// Striped download. The image is fetched as numbered part files, each link
+// taking the lowest part nobody holds as soon as it is idle, so faster links
+// take more parts. Once no part is left, an idle link also fetches a part a
+// slower link is still on when it would finish it sooner; whichever copy
+// completes first wins.
+typedef struct {
+    // Destination of Capacity bytes, and options (0 picks the default)
+    uint8_t *Buffer;
+    uint64_t Capacity;
+    uint64_t PartSize;
+    uint32_t BlockSize;
+    uint32_t WindowSize;
+    uint64_t TimeoutUs;
+    
+    NET_STRIPE_LINK Links[NET_NIC_MAX];
+    uint32_t LinkCount;
+    
+    // Results
+    uint64_t Size;
+    uint32_t PartCount;
+    uint32_t Duplicated;          // Parts also fetched by a faster link
+    uint32_t Reassigned;          // Parts handed on after a link failed
+    uint64_t Ticks;
+} NET_STRIPE;
+
+// Interfaces
+EFI_STATUS NetNicEnumerate(NET_NIC_LIST *List);
+EFI_STATUS NetNicRefresh(NET_NIC *Nic);
+uint32_t NetNicUsable(const NET_NIC_LIST *List);
+void NetNicPrintList(const NET_NIC_LIST *List);
+
+// Striping
+EFI_STATUS NetStripeAddLink(NET_STRIPE *Stripe, NET_STACK *Stack, uint32_t Server);
+EFI_STATUS NetStripeDownload(NET_STRIPE *Stripe, const char *FileName);
+void NetStripePrintStats(const NET_STRIPE *Stripe);
+void NetMultiBenchmark(const char *FileName);
+
+#endif // TINYUEFI_NET_MULTI_H
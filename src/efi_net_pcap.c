@@ -0,0 +1,642 @@
+// efi_net_pcap.c
+#include "efi_net_pcap.h"
+#include "uefi_helpers.h"
+#include "efi_timer.h"
+
+// pcapng block types
+#define PCAPNG_SECTION_HEADER         0x0A0D0D0A
+#define PCAPNG_INTERFACE_DESCRIPTION  0x00000001
+#define PCAPNG_INTERFACE_STATISTICS   0x00000005
+#define PCAPNG_ENHANCED_PACKET        0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC       0x1A2B3C4D
+
+// pcapng option codes
+#define PCAPNG_OPT_END                0
+#define PCAPNG_OPT_SHB_USERAPPL       4
+#define PCAPNG_OPT_IF_MACADDR         6
+#define PCAPNG_OPT_IF_TSRESOL         9
+#define PCAPNG_OPT_EPB_FLAGS          2
+#define PCAPNG_OPT_ISB_STARTTIME      2
+#define PCAPNG_OPT_ISB_ENDTIME        3
+#define PCAPNG_OPT_ISB_IFRECV         4
+#define PCAPNG_OPT_ISB_FILTERACCEPT   6
+#define PCAPNG_OPT_ISB_OSDROP         7
+
+// Ethernet link type and nanosecond timestamps (if_tsresol 9)
+#define PCAPNG_LINKTYPE_ETHERNET      1
+#define PCAPNG_TSRESOL_NANOSECONDS    9
+
+// Enhanced packet block bytes around the frame data
+#define PCAPNG_EPB_HEADER_SIZE        28
+#define PCAPNG_EPB_TRAILER_SIZE       16
+
+// Marks the unused end of the ring where the next record did not fit
+#define PCAP_RECORD_WRAP              0xFFFF
+
+// Largest fixed block this module builds (section, interface, statistics)
+#define PCAP_BLOCK_SIZE               128
+
+// Ring record; the captured bytes follow, and records are 8-byte aligned
+typedef struct {
+    uint16_t Captured;
+    uint16_t Flags;               // Tap direction, or PCAP_RECORD_WRAP
+    uint32_t Length;              // Frame length on the wire
+    uint64_t Timestamp;
+} PCAP_RECORD;
+
+// A block assembled in memory before it goes to the writer
+typedef struct {
+    uint8_t Bytes[PCAP_BLOCK_SIZE];
+    uint32_t Length;
+} PCAP_BLOCK;
+
+static inline uint64_t RecordSize(uint64_t Captured) {
+    return (sizeof(PCAP_RECORD) + Captured + 7) & ~7ull;
+}
+
+static inline uint32_t Pad4(uint64_t Length) {
+    return (uint32_t)((4 - (Length & 3)) & 3);
+}
+
+static inline uint64_t TicksToNanoseconds(uint64_t Ticks) {
+    return (uint64_t)(((unsigned __int128)Ticks * 1000000000) / GetTimestampFrequency());
+}
+
+// Word-at-a-time copy; MemCpy moves one byte per iteration, which would
+// dominate the cost of the tap on full-size frames
+static void CopyFrame(uint8_t *Dest, const uint8_t *Src, uint64_t Length) {
+    while (Length >= 8) {
+        uint64_t Word;
+        __builtin_memcpy(&Word, Src, 8);
+        __builtin_memcpy(Dest, &Word, 8);
+        Dest += 8;
+        Src += 8;
+        Length -= 8;
+    }
+    while (Length-- > 0) {
+        *Dest++ = *Src++;
+    }
+}
+
+//
+// Blocks (pcapng is written in host byte order, announced by the magic)
+//
+
+static void BlockPut(PCAP_BLOCK *Block, const void *Data, uint32_t Length) {
+    CopyFrame(Block->Bytes + Block->Length, (const uint8_t*)Data, Length);
+    Block->Length += Length;
+}
+
+static void BlockPut16(PCAP_BLOCK *Block, uint16_t Value) {
+    BlockPut(Block, &Value, sizeof(Value));
+}
+
+static void BlockPut32(PCAP_BLOCK *Block, uint32_t Value) {
+    BlockPut(Block, &Value, sizeof(Value));
+}
+
+static void BlockPut64(PCAP_BLOCK *Block, uint64_t Value) {
+    BlockPut(Block, &Value, sizeof(Value));
+}
+
+// Timestamps are split into high and low 32-bit halves
+static void BlockPutTimestamp(PCAP_BLOCK *Block, uint64_t Nanoseconds) {
+    BlockPut32(Block, (uint32_t)(Nanoseconds >> 32));
+    BlockPut32(Block, (uint32_t)Nanoseconds);
+}
+
+static void BlockBegin(PCAP_BLOCK *Block, uint32_t Type) {
+    Block->Length = 0;
+    BlockPut32(Block, Type);
+    BlockPut32(Block, 0);           // Total length, filled in by BlockEnd
+}
+
+static void BlockOption(PCAP_BLOCK *Block, uint16_t Code, const void *Data, uint16_t Length) {
+    static const uint8_t Zero[4] = { 0 };
+    
+    BlockPut16(Block, Code);
+    BlockPut16(Block, Length);
+    BlockPut(Block, Data, Length);
+    BlockPut(Block, Zero, Pad4(Length));
+}
+
+static void BlockOption64(PCAP_BLOCK *Block, uint16_t Code, uint64_t Value) {
+    BlockOption(Block, Code, &Value, sizeof(Value));
+}
+
+static void BlockOptionTimestamp(PCAP_BLOCK *Block, uint16_t Code, uint64_t Nanoseconds) {
+    uint32_t Halves[2] = { (uint32_t)(Nanoseconds >> 32), (uint32_t)Nanoseconds };
+    BlockOption(Block, Code, Halves, sizeof(Halves));
+}
+
+static void BlockEnd(PCAP_BLOCK *Block) {
+    BlockOption(Block, PCAPNG_OPT_END, NULL, 0);
+    uint32_t Total = Block->Length + 4;
+    __builtin_memcpy(Block->Bytes + 4, &Total, sizeof(Total));
+    BlockPut32(Block, Total);
+}
+
+//
+// Buffered writer
+//
+
+static EFI_STATUS WriterFlush(NET_PCAP *Pcap) {
+    if (EFI_ERROR(Pcap->WriteStatus) || Pcap->WriteUsed == 0) {
+        return Pcap->WriteStatus;
+    }
+    
+    Pcap->WriteStatus = WriteFile(Pcap->File, Pcap->WriteBuffer, Pcap->WriteUsed);
+    Pcap->BytesWritten += Pcap->WriteUsed;
+    Pcap->FileWrites++;
+    Pcap->WriteUsed = 0;
+    return Pcap->WriteStatus;
+}
+
+static EFI_STATUS WriterWrite(NET_PCAP *Pcap, const void *Data, uint64_t Size) {
+    const uint8_t *Bytes = (const uint8_t*)Data;
+    
+    while (Size > 0 && !EFI_ERROR(Pcap->WriteStatus)) {
+        uint64_t Step = NET_PCAP_WRITE_BUFFER_SIZE - Pcap->WriteUsed;
+        if (Step > Size) {
+            Step = Size;
+        }
+        
+        CopyFrame(Pcap->WriteBuffer + Pcap->WriteUsed, Bytes, Step);
+        Pcap->WriteUsed += Step;
+        Bytes += Step;
+        Size -= Step;
+        
+        if (Pcap->WriteUsed == NET_PCAP_WRITE_BUFFER_SIZE) {
+            WriterFlush(Pcap);
+        }
+    }
+    
+    return Pcap->WriteStatus;
+}
+
+static EFI_STATUS WriteBlock(NET_PCAP *Pcap, const PCAP_BLOCK *Block) {
+    return WriterWrite(Pcap, Block->Bytes, Block->Length);
+}
+
+static EFI_STATUS WriteFileHeader(NET_PCAP *Pcap) {
+    static const char Application[] = "TinyUEFI";
+    PCAP_BLOCK Block;
+    uint8_t TsResol = PCAPNG_TSRESOL_NANOSECONDS;
+    bool HaveMac = false;
+    
+    BlockBegin(&Block, PCAPNG_SECTION_HEADER);
+    BlockPut32(&Block, PCAPNG_BYTE_ORDER_MAGIC);
+    BlockPut16(&Block, 1);          // Version 1.0
+    BlockPut16(&Block, 0);
+    BlockPut64(&Block, ~0ull);      // Section length not known in advance
+    BlockOption(&Block, PCAPNG_OPT_SHB_USERAPPL, Application, sizeof(Application) - 1);
+    BlockEnd(&Block);
+    WriteBlock(Pcap, &Block);
+    
+    BlockBegin(&Block, PCAPNG_INTERFACE_DESCRIPTION);
+    BlockPut16(&Block, PCAPNG_LINKTYPE_ETHERNET);
+    BlockPut16(&Block, 0);
+    BlockPut32(&Block, Pcap->Config.SnapLength);
+    for (uint32_t i = 0; i < sizeof(Pcap->Mac); i++) {
+        HaveMac |= Pcap->Mac[i] != 0;
+    }
+    if (HaveMac) {
+        BlockOption(&Block, PCAPNG_OPT_IF_MACADDR, Pcap->Mac, sizeof(Pcap->Mac));
+    }
+    BlockOption(&Block, PCAPNG_OPT_IF_TSRESOL, &TsResol, sizeof(TsResol));
+    BlockEnd(&Block);
+    return WriteBlock(Pcap, &Block);
+}
+
+// Capture totals, written last. Timestamps count from NetPcapCreate because
+// firmware has no reliable wall clock to anchor them to.
+static EFI_STATUS WriteStatistics(NET_PCAP *Pcap) {
+    PCAP_BLOCK Block;
+    uint64_t Now = TicksToNanoseconds(ReadTimestamp() - Pcap->StartTimestamp);
+    
+    BlockBegin(&Block, PCAPNG_INTERFACE_STATISTICS);
+    BlockPut32(&Block, 0);          // Interface ID
+    BlockPutTimestamp(&Block, Now);
+    BlockOptionTimestamp(&Block, PCAPNG_OPT_ISB_STARTTIME, 0);
+    BlockOptionTimestamp(&Block, PCAPNG_OPT_ISB_ENDTIME, Now);
+    BlockOption64(&Block, PCAPNG_OPT_ISB_IFRECV, Pcap->Seen);
+    BlockOption64(&Block, PCAPNG_OPT_ISB_FILTERACCEPT, Pcap->Seen - Pcap->Filtered);
+    BlockOption64(&Block, PCAPNG_OPT_ISB_OSDROP, Pcap->RingDrops);
+    BlockEnd(&Block);
+    return WriteBlock(Pcap, &Block);
+}
+
+// One enhanced packet block, with the frame bytes taken straight from the ring
+static EFI_STATUS WriteRecord(NET_PCAP *Pcap, const PCAP_RECORD *Record) {
+    static const uint8_t Zero[4] = { 0 };
+    PCAP_BLOCK Block;
+    uint32_t Padded = Record->Captured + Pad4(Record->Captured);
+    uint32_t Total = PCAPNG_EPB_HEADER_SIZE + Padded + PCAPNG_EPB_TRAILER_SIZE;
+    uint32_t Flags = Record->Flags;
+    
+    Block.Length = 0;
+    BlockPut32(&Block, PCAPNG_ENHANCED_PACKET);
+    BlockPut32(&Block, Total);
+    BlockPut32(&Block, 0);          // Interface ID
+    BlockPutTimestamp(&Block, TicksToNanoseconds(Record->Timestamp - Pcap->StartTimestamp));
+    BlockPut32(&Block, Record->Captured);
+    BlockPut32(&Block, Record->Length);
+    WriteBlock(Pcap, &Block);
+    
+    WriterWrite(Pcap, Record + 1, Record->Captured);
+    WriterWrite(Pcap, Zero, Padded - Record->Captured);
+    
+    Block.Length = 0;
+    BlockOption(&Block, PCAPNG_OPT_EPB_FLAGS, &Flags, sizeof(Flags));
+    BlockOption(&Block, PCAPNG_OPT_END, NULL, 0);
+    BlockPut32(&Block, Total);
+    return WriteBlock(Pcap, &Block);
+}
+
+//
+// Capture setup
+//
+
+// Allocate the record ring. Snp, when given, supplies the interface address
+// recorded in the file; the capture works on any frames handed to NetPcapTap.
+EFI_STATUS NetPcapCreate(NET_PCAP *Pcap, EFI_SIMPLE_NETWORK_PROTOCOL *Snp, const NET_PCAP_CONFIG *Config) {
+    if (Pcap == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    MemSet(Pcap, 0, sizeof(*Pcap));
+    if (Config != NULL) {
+        Pcap->Config = *Config;
+    }
+    if (Pcap->Config.RingSize == 0) {
+        Pcap->Config.RingSize = NET_PCAP_DEFAULT_RING_SIZE;
+    }
+    if (Pcap->Config.SnapLength == 0 || Pcap->Config.SnapLength > NET_PCAP_MAX_SNAPLEN) {
+        Pcap->Config.SnapLength = NET_PCAP_MAX_SNAPLEN;
+    }
+    if (Pcap->Config.Directions == 0) {
+        Pcap->Config.Directions = NET_TAP_INBOUND | NET_TAP_OUTBOUND;
+    }
+    
+    // The ring must hold at least one full-length record
+    Pcap->RingSize = Pcap->Config.RingSize & ~7ull;
+    if (Pcap->RingSize < RecordSize(Pcap->Config.SnapLength)) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    Pcap->Ring = (uint8_t*)AllocatePool(Pcap->RingSize + NET_PCAP_WRITE_BUFFER_SIZE);
+    if (Pcap->Ring == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    Pcap->WriteBuffer = Pcap->Ring + Pcap->RingSize;
+    
+    if (Snp != NULL && Snp->Mode != NULL) {
+        MemCpy(Pcap->Mac, Snp->Mode->CurrentAddress.Addr, sizeof(Pcap->Mac));
+    }
+    
+    Pcap->StartTimestamp = ReadTimestamp();
+    return EFI_SUCCESS;
+}
+
+// Close any open file (writing out what the ring still holds) and free it
+void NetPcapDestroy(NET_PCAP *Pcap) {
+    if (Pcap == NULL) {
+        return;
+    }
+    
+    if (Pcap->File != NULL) {
+        NetPcapClose(Pcap);
+    }
+    if (Pcap->Ring != NULL) {
+        FreePool(Pcap->Ring);
+    }
+    MemSet(Pcap, 0, sizeof(*Pcap));
+}
+
+// Record what a receive engine and a transmit ring move; either may be NULL
+void NetPcapAttach(NET_PCAP *Pcap, NET_RX_ENGINE *Rx, NET_TX_RING *Tx) {
+    if (Rx != NULL) {
+        Rx->Tap = NetPcapTap;
+        Rx->TapContext = Pcap;
+    }
+    if (Tx != NULL) {
+        Tx->Tap = NetPcapTap;
+        Tx->TapContext = Pcap;
+    }
+}
+
+void NetPcapDetach(NET_RX_ENGINE *Rx, NET_TX_RING *Tx) {
+    if (Rx != NULL) {
+        Rx->Tap = NULL;
+        Rx->TapContext = NULL;
+    }
+    if (Tx != NULL) {
+        Tx->Tap = NULL;
+        Tx->TapContext = NULL;
+    }
+}
+
+//
+// Recording
+//
+
+// Filter on direction, EtherType (looking past one 802.1Q tag) and address
+static bool FrameMatches(const NET_PCAP *Pcap, const uint8_t *Frame, uint64_t Length, uint32_t Direction) {
+    const NET_PCAP_CONFIG *Config = &Pcap->Config;
+    
+    if ((Config->Directions & Direction) == 0) {
+        return false;
+    }
+    if (Config->Protocol == NET_PCAP_ANY_PROTOCOL && !Config->MatchAddress) {
+        return true;
+    }
+    if (Length < 14) {
+        return false;
+    }
+    
+    if (Config->Protocol != NET_PCAP_ANY_PROTOCOL) {
+        uint16_t Protocol = (uint16_t)(Frame[12] << 8 | Frame[13]);
+        if (Protocol == 0x8100 && Length >= 18) {
+            Protocol = (uint16_t)(Frame[16] << 8 | Frame[17]);
+        }
+        if (Protocol != Config->Protocol) {
+            return false;
+        }
+    }
+    
+    if (Config->MatchAddress) {
+        bool Destination = true, Source = true;
+        for (uint32_t i = 0; i < 6; i++) {
+            Destination &= Frame[i] == Config->Address.Addr[i];
+            Source &= Frame[6 + i] == Config->Address.Addr[i];
+        }
+        return Destination || Source;
+    }
+    
+    return true;
+}
+
+// Frame tap for receive engines and transmit rings (Context is the
+// NET_PCAP). Copies up to the snap length into the ring; when the ring is
+// full the frame is counted in RingDrops rather than overwriting records
+// that have not been flushed yet.
+void NetPcapTap(void *Context, const uint8_t *Frame, uint64_t Length, uint32_t Direction) {
+    NET_PCAP *Pcap = (NET_PCAP*)Context;
+    
+    if (Pcap == NULL || Pcap->Ring == NULL || Frame == NULL) {
+        return;
+    }
+    
+    uint64_t Start = ReadTimestamp();
+    Pcap->Seen++;
+    
+    if (!FrameMatches(Pcap, Frame, Length, Direction)) {
+        Pcap->Filtered++;
+        Pcap->TapTicks += ReadTimestamp() - Start;
+        return;
+    }
+    
+    uint64_t Captured = Length < Pcap->Config.SnapLength ? Length : Pcap->Config.SnapLength;
+    uint64_t Size = RecordSize(Captured);
+    uint64_t Offset = Pcap->Write % Pcap->RingSize;
+    uint64_t Skip = Pcap->RingSize - Offset < Size ? Pcap->RingSize - Offset : 0;
+    
+    if (Pcap->RingSize - (Pcap->Write - Pcap->Read) < Skip + Size) {
+        Pcap->RingDrops++;
+        Pcap->TapTicks += ReadTimestamp() - Start;
+        return;
+    }
+    
+    // Records never wrap; the rest of the ring is skipped instead
+    if (Skip != 0) {
+        ((PCAP_RECORD*)(Pcap->Ring + Offset))->Flags = PCAP_RECORD_WRAP;
+        Pcap->Write += Skip;
+        Offset = 0;
+    }
+    
+    PCAP_RECORD *Record = (PCAP_RECORD*)(Pcap->Ring + Offset);
+    Record->Captured = (uint16_t)Captured;
+    Record->Flags = (uint16_t)Direction;
+    Record->Length = Length < 0xFFFFFFFF ? (uint32_t)Length : 0xFFFFFFFF;
+    Record->Timestamp = Start;
+    CopyFrame((uint8_t*)(Record + 1), Frame, Captured);
+    Pcap->Write += Size;
+    
+    Pcap->Captured++;
+    Pcap->BytesCaptured += Captured;
+    if (Captured < Length) {
+        Pcap->Truncated++;
+    }
+    Pcap->TapTicks += ReadTimestamp() - Start;
+}
+
+// Ring bytes waiting for NetPcapFlush. Flushing from the caller's idle
+// time once this passes half the ring keeps RingDrops at zero.
+uint64_t NetPcapPending(const NET_PCAP *Pcap) {
+    return Pcap != NULL ? Pcap->Write - Pcap->Read : 0;
+}
+
+// Start a pcapng file. An existing file is replaced. Frames captured
+// before the file was opened are kept and go out with the next flush.
+EFI_STATUS NetPcapOpen(NET_PCAP *Pcap, EFI_FILE_PROTOCOL *Root, const char16_t *FileName) {
+    EFI_FILE_PROTOCOL *File = NULL;
+    EFI_FILE_INFO *Info = NULL;
+    
+    if (Pcap == NULL || Pcap->Ring == NULL || Root == NULL || FileName == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    if (Pcap->File != NULL) {
+        return EFI_ALREADY_STARTED;
+    }
+    
+    EFI_STATUS Status = OpenFile(Root, FileName, &File, EFI_FILE_MODE_CREATE | EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    if (!EFI_ERROR(ReadFileInfo(File, &Info))) {
+        if (Info->FileSize != 0) {
+            Info->FileSize = 0;
+            Status = File->SetInfo(File, (EFI_GUID*)&gEfiFileInfoGuid, Info->Size, Info);
+        }
+        FreePool(Info);
+    }
+    if (EFI_ERROR(Status)) {
+        File->Close(File);
+        return Status;
+    }
+    
+    Pcap->File = File;
+    Pcap->WriteUsed = 0;
+    Pcap->WriteStatus = EFI_SUCCESS;
+    WriteFileHeader(Pcap);
+    return WriterFlush(Pcap);
+}
+
+// Write every record in the ring to the file. Call it from idle time (a
+// NET_STACK Idle hook, between polls, or when NetPcapPending grows), never
+// from inside a handler.
+EFI_STATUS NetPcapFlush(NET_PCAP *Pcap) {
+    if (Pcap == NULL || Pcap->Ring == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    if (Pcap->File == NULL) {
+        return EFI_NOT_READY;
+    }
+    
+    uint64_t Start = ReadTimestamp();
+    
+    while (Pcap->Read != Pcap->Write && !EFI_ERROR(Pcap->WriteStatus)) {
+        uint64_t Offset = Pcap->Read % Pcap->RingSize;
+        const PCAP_RECORD *Record = (const PCAP_RECORD*)(Pcap->Ring + Offset);
+        
+        if (Record->Flags == PCAP_RECORD_WRAP) {
+            Pcap->Read += Pcap->RingSize - Offset;
+            continue;
+        }
+        
+        WriteRecord(Pcap, Record);
+        Pcap->Read += RecordSize(Record->Captured);
+        Pcap->Flushed++;
+    }
+    WriterFlush(Pcap);
+    
+    Pcap->FlushTicks += ReadTimestamp() - Start;
+    return Pcap->WriteStatus;
+}
+
+// Flush, append the capture totals and close the file. Recording into the
+// ring continues; another file can be opened later.
+EFI_STATUS NetPcapClose(NET_PCAP *Pcap) {
+    if (Pcap == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    if (Pcap->File == NULL) {
+        return EFI_NOT_READY;
+    }
+    
+    NetPcapFlush(Pcap);
+    WriteStatistics(Pcap);
+    EFI_STATUS Status = WriterFlush(Pcap);
+    
+    Pcap->File->Flush(Pcap->File);
+    Pcap->File->Close(Pcap->File);
+    Pcap->File = NULL;
+    return Status;
+}
+
+static void PrintNanoseconds(uint64_t Ticks, uint64_t Count) {
+    PrintDec(Count != 0 ? TicksToNanoseconds(Ticks) / Count : 0);
+    PRINT(u" ns");
+}
+
+void NetPcapPrintStats(const NET_PCAP *Pcap) {
+    if (Pcap == NULL) {
+        return;
+    }
+    
+    PRINT(u"Capture: ");
+    PrintDec(Pcap->Seen);
+    PRINT(u" frames seen, ");
+    PrintDec(Pcap->Captured);
+    PRINT(u" captured (");
+    PrintDec(Pcap->Truncated);
+    PRINT(u" truncated), ");
+    PrintDec(Pcap->Filtered);
+    PRINT(u" filtered, ");
+    PrintDec(Pcap->RingDrops);
+    PRINTL(u" ring drops");
+    
+    PRINT(u"  Tap ");
+    PrintNanoseconds(Pcap->TapTicks, Pcap->Seen);
+    PRINT(u"/frame, flush ");
+    PrintNanoseconds(Pcap->FlushTicks, Pcap->Flushed);
+    PRINT(u"/record; ");
+    PrintDec(Pcap->Flushed);
+    PRINT(u" records, ");
+    PrintDec(Pcap->BytesWritten / 1024);
+    PRINT(u" KiB in ");
+    PrintDec(Pcap->FileWrites);
+    PRINTL(u" writes");
+}
+
+// Tap synthetic frames of several sizes, snap lengths and filter outcomes
+// into a file on Root, flushing whenever half the ring is used, and report
+// the cost per frame of the tap and of the flush. The file is deleted
+// afterwards.
+void NetPcapBenchmark(EFI_FILE_PROTOCOL *Root) {
+    static const struct {
+        uint32_t FrameSize;
+        uint32_t SnapLength;
+        uint16_t Protocol;
+    } Cases[] = {
+        { 60, 0, NET_PCAP_ANY_PROTOCOL },
+        { 590, 0, NET_PCAP_ANY_PROTOCOL },
+        { 1514, 0, NET_PCAP_ANY_PROTOCOL },
+        { 1514, 128, NET_PCAP_ANY_PROTOCOL },
+        { 1514, 0, 0x0800 },          // Filtered out: frames carry the benchmark EtherType
+    };
+    uint8_t Frame[1514];
+    NET_PCAP_CONFIG Config;
+    NET_PCAP Pcap;
+    
+    if (Root == NULL) {
+        PRINTL(u"Capture benchmark: no volume to write to");
+        return;
+    }
+    
+    MemSet(Frame, 0xFF, 6);
+    MemSet(Frame + 6, 0, sizeof(Frame) - 6);
+    Frame[11] = 0x01;
+    Frame[12] = (uint8_t)(NET_TX_BENCHMARK_ETHERTYPE >> 8);
+    Frame[13] = (uint8_t)NET_TX_BENCHMARK_ETHERTYPE;
+    
+    for (uint32_t i = 0; i < sizeof(Cases) / sizeof(Cases[0]); i++) {
+        MemSet(&Config, 0, sizeof(Config));
+        Config.SnapLength = Cases[i].SnapLength;
+        Config.Protocol = Cases[i].Protocol;
+        
+        EFI_STATUS Status = NetPcapCreate(&Pcap, NULL, &Config);
+        if (!EFI_ERROR(Status)) {
+            Status = NetPcapOpen(&Pcap, Root, NET_PCAP_BENCHMARK_FILE);
+        }
+        if (EFI_ERROR(Status)) {
+            PRINT(u"Capture benchmark: failed ");
+            PrintHex(Status);
+            PRINTL(u"");
+            NetPcapDestroy(&Pcap);
+            return;
+        }
+        
+        for (uint32_t n = 0; n < NET_PCAP_BENCHMARK_FRAMES; n++) {
+            NetPcapTap(&Pcap, Frame, Cases[i].FrameSize, (n & 1) != 0 ? NET_TAP_OUTBOUND : NET_TAP_INBOUND);
+            if (NetPcapPending(&Pcap) > Pcap.RingSize / 2) {
+                NetPcapFlush(&Pcap);
+            }
+        }
+        Status = NetPcapClose(&Pcap);
+        
+        PrintDec(Cases[i].FrameSize);
+        PRINT(u" bytes");
+        if (Cases[i].SnapLength != 0) {
+            PRINT(u", snap ");
+            PrintDec(Cases[i].SnapLength);
+        }
+        if (Cases[i].Protocol != NET_PCAP_ANY_PROTOCOL) {
+            PRINT(u", filtered");
+        }
+        PRINT(u": ");
+        if (EFI_ERROR(Status)) {
+            PRINT(u"write failed ");
+            PrintHex(Status);
+            PRINTL(u"");
+        }
+        NetPcapPrintStats(&Pcap);
+        NetPcapDestroy(&Pcap);
+    }
+    
+    EFI_FILE_PROTOCOL *File = NULL;
+    if (!EFI_ERROR(OpenFile(Root, NET_PCAP_BENCHMARK_FILE, &File, EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE))) {
+        File->Delete(File);
+    }
+}
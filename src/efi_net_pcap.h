@@ -0,0 +1,86 @@
+// efi_net_pcap.h
+#ifndef TINYUEFI_NET_PCAP_H
+#define TINYUEFI_NET_PCAP_H
+
+#include "uefi_types.h"
+#include "efi_file_protocol.h"
+#include "efi_network_protocol.h"
+#include "efi_net_rx.h"
+#include "efi_net_tx.h"
+
+// Record ring size when the caller does not choose
+#define NET_PCAP_DEFAULT_RING_SIZE    (4 * 1024 * 1024)
+
+// Encoded blocks collected before each file write
+#define NET_PCAP_WRITE_BUFFER_SIZE    (64 * 1024)
+
+// Longest frame prefix a record holds; a snap length of 0 means this
+#define NET_PCAP_MAX_SNAPLEN          65535
+
+// Filter values that match every frame
+#define NET_PCAP_ANY_PROTOCOL         0
+
+// Frames tapped for each case of NetPcapBenchmark
+#define NET_PCAP_BENCHMARK_FRAMES     20000
+
+// Written and removed again by NetPcapBenchmark
+#define NET_PCAP_BENCHMARK_FILE       u"pcapbench.pcapng"
+
+// What to record. Fields left zero take the defaults.
+typedef struct {
+    uint64_t RingSize;
+    uint32_t SnapLength;          // Bytes kept per frame, media header included
+    uint16_t Protocol;            // EtherType in host order
+    bool MatchAddress;            // Keep only frames from or to Address
+    EFI_MAC_ADDRESS Address;
+    uint32_t Directions;          // NET_TAP_INBOUND and/or NET_TAP_OUTBOUND; 0 records both
+} NET_PCAP_CONFIG;
+
+// Packet capture. Taps copy frames into an in-memory ring; NetPcapFlush
+// turns the ring into pcapng blocks and writes them out, so file I/O never
+// happens on the receive or transmit path.
+typedef struct {
+    NET_PCAP_CONFIG Config;
+    uint8_t Mac[6];               // Interface address for the description block
+    uint8_t *Ring;
+    uint64_t RingSize;
+    uint64_t Write;               // Ring positions; offsets are taken modulo RingSize
+    uint64_t Read;
+    uint64_t StartTimestamp;
+    
+    // Output
+    EFI_FILE_PROTOCOL *File;
+    uint8_t *WriteBuffer;
+    uint64_t WriteUsed;
+    EFI_STATUS WriteStatus;       // First write error
+    
+    // Statistics
+    uint64_t Seen;                // Frames offered by the taps
+    uint64_t Filtered;            // Rejected by the filter
+    uint64_t Captured;
+    uint64_t Truncated;           // Captured shorter than the frame
+    uint64_t RingDrops;           // Ring full; flush more often or grow it
+    uint64_t BytesCaptured;
+    uint64_t Flushed;             // Records written to the file
+    uint64_t BytesWritten;
+    uint64_t FileWrites;
+    uint64_t TapTicks;            // Time spent inside the taps
+    uint64_t FlushTicks;
+} NET_PCAP;
+
+// Capture setup
+EFI_STATUS NetPcapCreate(NET_PCAP *Pcap, EFI_SIMPLE_NETWORK_PROTOCOL *Snp, const NET_PCAP_CONFIG *Config);
+void NetPcapDestroy(NET_PCAP *Pcap);
+void NetPcapAttach(NET_PCAP *Pcap, NET_RX_ENGINE *Rx, NET_TX_RING *Tx);
+void NetPcapDetach(NET_RX_ENGINE *Rx, NET_TX_RING *Tx);
+
+// Recording
+void NetPcapTap(void *Context, const uint8_t *Frame, uint64_t Length, uint32_t Direction);
+uint64_t NetPcapPending(const NET_PCAP *Pcap);
+EFI_STATUS NetPcapOpen(NET_PCAP *Pcap, EFI_FILE_PROTOCOL *Root, const char16_t *FileName);
+EFI_STATUS NetPcapFlush(NET_PCAP *Pcap);
+EFI_STATUS NetPcapClose(NET_PCAP *Pcap);
+void NetPcapPrintStats(const NET_PCAP *Pcap);
+void NetPcapBenchmark(EFI_FILE_PROTOCOL *Root);
+
+#endif // TINYUEFI_NET_PCAP_H
@@ -0,0 +1,67 @@
+// efi_net_pktgen.h
+#ifndef TINYUEFI_NET_PKTGEN_H
+#define TINYUEFI_NET_PKTGEN_H
+
+#include "uefi_types.h"
+#include "efi_network_protocol.h"
+#include "efi_net_tx.h"
+
+// Frames sent when the caller does not choose
+#define NET_PKTGEN_DEFAULT_FRAMES     100000
+
+// How long echoes are still collected after the last frame is sent
+#define NET_PKTGEN_ECHO_WAIT_US       500000
+
+// EtherType of generated frames, shared with the TX benchmark
+#define NET_PKTGEN_ETHERTYPE          NET_TX_BENCHMARK_ETHERTYPE
+
+// Marks generated frames so echoes are told apart from other traffic
+#define NET_PKTGEN_MAGIC              0x544E4750
+
+// Frames between receive polls while sending with echo counting
+#define NET_PKTGEN_POLL_INTERVAL      16
+
+// What to send. Fields left zero take the defaults.
+typedef struct {
+    EFI_MAC_ADDRESS DestAddr;     // All zero sends to broadcast
+    uint32_t FrameSize;           // Media header included, no FCS
+    uint64_t Frames;
+    uint64_t RatePps;             // 0 sends as fast as the driver accepts
+    bool CountEchoes;             // Count frames a reflector sends back
+    uint64_t EchoWaitUs;
+} NET_PKTGEN_CONFIG;
+
+typedef struct {
+    // Generator side
+    uint64_t Sent;
+    uint64_t Bytes;
+    uint64_t SendErrors;          // Transmit failures other than a busy driver
+    uint64_t DriverBusy;
+    uint64_t LateFrames;          // Sent more than one interval after their slot
+    uint64_t Ticks;               // First to last transmit
+    
+    // Echoes, when counted
+    uint64_t Echoes;
+    uint64_t EchoDuplicates;
+    uint64_t EchoReordered;
+    uint64_t ForeignFrames;       // Our EtherType, but not from this run
+    uint64_t MinRttTicks;
+    uint64_t MaxRttTicks;
+    uint64_t TotalRttTicks;
+    
+    // Driver counters sampled with Statistics before and after the run
+    EFI_STATUS StatisticsStatus;  // EFI_UNSUPPORTED when the driver keeps none
+    EFI_NETWORK_STATISTICS Before;
+    EFI_NETWORK_STATISTICS After;
+    uint64_t DriverTxDropped;
+    uint64_t DriverRxDropped;
+    uint64_t DriverErrors;        // CRC, size and collision counters together
+} NET_PKTGEN_RESULT;
+
+// Helper functions
+EFI_STATUS NetPktgenRun(EFI_SIMPLE_NETWORK_PROTOCOL *Snp, const NET_PKTGEN_CONFIG *Config, NET_PKTGEN_RESULT *Result);
+EFI_STATUS NetPktgenReflect(EFI_SIMPLE_NETWORK_PROTOCOL *Snp, uint64_t DurationUs, uint64_t *Reflected);
+void NetPktgenPrintResult(const NET_PKTGEN_RESULT *Result);
+void NetPktgenBenchmark(EFI_SIMPLE_NETWORK_PROTOCOL *Snp);
+
+#endif // TINYUEFI_NET_PKTGEN_H
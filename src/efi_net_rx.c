@@ -0,0 +1,486 @@
+// efi_net_rx.c
+#include "efi_net_rx.h"
+#include "uefi_helpers.h"
+#include "efi_timer.h"
+
+// Ethernet frame without FCS when the mode does not report one
+#define NET_RX_DEFAULT_FRAME          1514
+
+// SetTimer units per microsecond
+#define TIMER_UNITS_PER_US            10
+
+// Longest single wait in NetRxRun when it runs until stopped
+#define NET_RX_IDLE_WAIT_US           1000000
+
+// Allocate a pool of PoolSize frame buffers (NET_RX_POOL_DEFAULT_FRAMES when 0)
+EFI_STATUS NetRxCreate(NET_RX_ENGINE *Engine, EFI_SIMPLE_NETWORK_PROTOCOL *Snp, uint32_t PoolSize) {
+    EFI_STATUS Status;
+    
+    if (Engine == NULL || Snp == NULL || Snp->Mode == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    if (Snp->Mode->State != EfiSimpleNetworkInitialized) {
+        return EFI_NOT_READY;
+    }
+    
+    if (PoolSize == 0) {
+        PoolSize = NET_RX_POOL_DEFAULT_FRAMES;
+    }
+    
+    MemSet(Engine, 0, sizeof(*Engine));
+    
+    uint64_t Frame = Snp->Mode->MaxPacketSize != 0
+                   ? (uint64_t)Snp->Mode->MediaHeaderSize + Snp->Mode->MaxPacketSize
+                   : NET_RX_DEFAULT_FRAME;
+    Engine->FrameSize = (uint32_t)((Frame + NET_RX_FRAME_ALIGNMENT - 1) & ~(uint64_t)(NET_RX_FRAME_ALIGNMENT - 1));
+    
+    // Frame records, free list, then PoolSize + 1 aligned buffers (the last is Scratch)
+    uint64_t Records = (uint64_t)PoolSize * (sizeof(NET_RX_FRAME) + sizeof(uint32_t));
+    Engine->Memory = (uint8_t*)AllocatePool(Records + NET_RX_FRAME_ALIGNMENT +
+                                            (uint64_t)(PoolSize + 1) * Engine->FrameSize);
+    if (Engine->Memory == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    
+    Engine->Frames = (NET_RX_FRAME*)Engine->Memory;
+    Engine->FreeList = (uint32_t*)(Engine->Frames + PoolSize);
+    uint8_t *Buffers = (uint8_t*)(((uintptr_t)Engine->Memory + Records + NET_RX_FRAME_ALIGNMENT - 1) &
+                                  ~(uintptr_t)(NET_RX_FRAME_ALIGNMENT - 1));
+    
+    for (uint32_t i = 0; i < PoolSize; i++) {
+        MemSet(&Engine->Frames[i], 0, sizeof(NET_RX_FRAME));
+        Engine->Frames[i].Buffer = Buffers + (uint64_t)i * Engine->FrameSize;
+        Engine->Frames[i].Index = i;
+        Engine->FreeList[i] = PoolSize - 1 - i;
+    }
+    Engine->Scratch = Buffers + (uint64_t)PoolSize * Engine->FrameSize;
+    
+    Status = ST->BootServices->CreateEvent(EVT_TIMER, TPL_CALLBACK, NULL, NULL, &Engine->Timer);
+    if (EFI_ERROR(Status)) {
+        FreePool(Engine->Memory);
+        Engine->Memory = NULL;
+        return Status;
+    }
+    
+    Engine->Snp = Snp;
+    Engine->PoolSize = PoolSize;
+    Engine->FreeCount = PoolSize;
+    Engine->LowestFree = PoolSize;
+    return EFI_SUCCESS;
+}
+
+// Free the pool; frames still held by handlers become invalid
+void NetRxDestroy(NET_RX_ENGINE *Engine) {
+    if (Engine == NULL) {
+        return;
+    }
+    
+    if (Engine->Timer != NULL) {
+        ST->BootServices->SetTimer(Engine->Timer, TimerCancel, 0);
+        ST->BootServices->CloseEvent(Engine->Timer);
+    }
+    if (Engine->Memory != NULL) {
+        FreePool(Engine->Memory);
+    }
+    MemSet(Engine, 0, sizeof(*Engine));
+}
+
+// Route frames of one EtherType (or NET_RX_ANY_PROTOCOL) to Handler,
+// replacing any handler already registered for it
+EFI_STATUS NetRxRegister(NET_RX_ENGINE *Engine, uint16_t Protocol, NET_RX_HANDLER Handler, void *Context) {
+    if (Engine == NULL || Handler == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    uint32_t Slot = 0;
+    while (Slot < Engine->HandlerCount && Engine->Handlers[Slot].Protocol != Protocol) {
+        Slot++;
+    }
+    if (Slot == NET_RX_MAX_HANDLERS) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    if (Slot == Engine->HandlerCount) {
+        Engine->HandlerCount++;
+    }
+    
+    Engine->Handlers[Slot].Protocol = Protocol;
+    Engine->Handlers[Slot].Handler = Handler;
+    Engine->Handlers[Slot].Context = Context;
+    Engine->Handlers[Slot].Frames = 0;
+    return EFI_SUCCESS;
+}
+
+EFI_STATUS NetRxUnregister(NET_RX_ENGINE *Engine, uint16_t Protocol) {
+    if (Engine == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    for (uint32_t i = 0; i < Engine->HandlerCount; i++) {
+        if (Engine->Handlers[i].Protocol == Protocol) {
+            Engine->Handlers[i] = Engine->Handlers[--Engine->HandlerCount];
+            return EFI_SUCCESS;
+        }
+    }
+    
+    return EFI_NOT_FOUND;
+}
+
+// Return a frame a handler kept. Releasing it twice would put its buffer on
+// the free list twice and let two later frames share it, so a frame that
+// is already free (or not from this pool) is counted and ignored.
+void NetRxFrameRelease(NET_RX_ENGINE *Engine, NET_RX_FRAME *Frame) {
+    if (Engine == NULL || Frame == NULL) {
+        return;
+    }
+    if (Frame->Index >= Engine->PoolSize || Frame != &Engine->Frames[Frame->Index] || !Frame->InUse) {
+        Engine->BadReleases++;
+        return;
+    }
+    
+    Frame->InUse = false;
+    Engine->FreeList[Engine->FreeCount++] = Frame->Index;
+}
+
+// Hand a frame to its handler and take it back unless the handler keeps it
+static void DispatchFrame(NET_RX_ENGINE *Engine, NET_RX_FRAME *Frame) {
+    NET_RX_HANDLER_ENTRY *Entry = NULL;
+    
+    for (uint32_t i = 0; i < Engine->HandlerCount; i++) {
+        if (Engine->Handlers[i].Protocol == Frame->Protocol) {
+            Entry = &Engine->Handlers[i];
+            break;
+        }
+        if (Engine->Handlers[i].Protocol == NET_RX_ANY_PROTOCOL) {
+            Entry = &Engine->Handlers[i];
+        }
+    }
+    
+    if (Entry == NULL) {
+        Engine->Unhandled++;
+        NetRxFrameRelease(Engine, Frame);
+        return;
+    }
+    
+    Entry->Frames++;
+    if (!Entry->Handler(Engine, Frame, Entry->Context)) {
+        NetRxFrameRelease(Engine, Frame);
+    }
+}
+
+// Pull a frame larger than FrameSize out of the driver and discard it, so
+// it does not block the frames behind it
+static void DiscardOversize(NET_RX_ENGINE *Engine, uint64_t Size) {
+    uint8_t *Buffer = (uint8_t*)AllocatePool(Size);
+    
+    Engine->OversizeDrops++;
+    if (Buffer != NULL) {
+        Engine->Snp->Receive(Engine->Snp, NULL, &Size, Buffer, NULL, NULL, NULL);
+        FreePool(Buffer);
+    }
+}
+
+// Receive one frame into Buffer. Frames larger than FrameSize are pulled
+// into a temporary buffer and dropped, so they do not block the queue; the
+// caller still sees EFI_BUFFER_TOO_SMALL for them.
+static EFI_STATUS ReceiveFrame(NET_RX_ENGINE *Engine, uint8_t *Buffer, NET_RX_FRAME *Frame) {
+    EFI_MAC_ADDRESS SrcAddr, DestAddr;
+    uint64_t HeaderSize = 0;
+    uint64_t Size = Engine->FrameSize;
+    uint16_t Protocol = 0;
+    
+    EFI_STATUS Status = Engine->Snp->Receive(Engine->Snp, &HeaderSize, &Size, Buffer,
+                                             &SrcAddr, &DestAddr, &Protocol);
+    if (Status == EFI_BUFFER_TOO_SMALL) {
+        DiscardOversize(Engine, Size);
+        return Status;
+    }
+    if (EFI_ERROR(Status)) {
+        if (Status != EFI_NOT_READY) {
+            Engine->DriverErrors++;
+        }
+        return Status;
+    }
+    
+    if (Engine->Tap != NULL) {
+        Engine->Tap(Engine->TapContext, Buffer, Size, NET_TAP_INBOUND);
+    }
+    
+    if (Frame != NULL) {
+        Frame->Length = Size;
+        Frame->HeaderSize = HeaderSize;
+        Frame->SrcAddr = SrcAddr;
+        Frame->DestAddr = DestAddr;
+        Frame->Protocol = Protocol;
+        Frame->Timestamp = ReadTimestamp();
+        Engine->FramesReceived++;
+        Engine->BytesReceived += Size;
+    }
+    
+    return EFI_SUCCESS;
+}
+
+// Pull every pending frame (up to NET_RX_MAX_BURST) into the pool and
+// dispatch them, a pool-full batch at a time. Frames are dropped only when
+// handlers hold every buffer. Returns the number of frames taken from the
+// driver, dropped ones included.
+uint32_t NetRxPoll(NET_RX_ENGINE *Engine) {
+    NET_RX_FRAME *Batch[NET_RX_MAX_BURST];
+    uint32_t Pulled = 0;
+    bool Pending = true;
+    
+    if (Engine == NULL || Engine->Snp == NULL) {
+        return 0;
+    }
+    
+    uint64_t Start = ReadTimestamp();
+    
+    while (Pending && Pulled < NET_RX_MAX_BURST) {
+        uint32_t Count = 0;
+        
+        // Drain into free buffers first, so the driver's queue empties quickly
+        while (Pulled < NET_RX_MAX_BURST && Engine->FreeCount > 0) {
+            NET_RX_FRAME *Frame = &Engine->Frames[Engine->FreeList[Engine->FreeCount - 1]];
+            EFI_STATUS Status = ReceiveFrame(Engine, Frame->Buffer, Frame);
+            
+            if (Status == EFI_BUFFER_TOO_SMALL) {
+                Pulled++;
+                continue;
+            }
+            if (EFI_ERROR(Status)) {
+                Pending = false;
+                break;
+            }
+            
+            Engine->FreeCount--;
+            Frame->InUse = true;
+            Batch[Count++] = Frame;
+            Pulled++;
+        }
+        
+        if (Engine->FreeCount < Engine->LowestFree) {
+            Engine->LowestFree = Engine->FreeCount;
+        }
+        
+        for (uint32_t i = 0; i < Count; i++) {
+            if (Engine->Filter != NULL && !NetFilterAccept(Engine->Filter, Batch[i]->Buffer, Batch[i]->Length)) {
+                NetRxFrameRelease(Engine, Batch[i]);
+                continue;
+            }
+            DispatchFrame(Engine, Batch[i]);
+        }
+        
+        // Handlers kept every buffer; drop the next frame
+        if (Pending && Pulled < NET_RX_MAX_BURST && Engine->FreeCount == 0) {
+            EFI_STATUS Status = ReceiveFrame(Engine, Engine->Scratch, NULL);
+            if (Status == EFI_SUCCESS) {
+                Engine->PoolDrops++;
+            }
+            if (EFI_ERROR(Status) && Status != EFI_BUFFER_TOO_SMALL) {
+                Pending = false;
+            } else {
+                Pulled++;
+            }
+        }
+    }
+    
+    if (Pulled > Engine->LargestBurst) {
+        Engine->LargestBurst = Pulled;
+    }
+    
+    Engine->PollTicks += ReadTimestamp() - Start;
+    return Pulled;
+}
+
+// Sleep until a frame arrives or TimeoutUs passes, then drain and dispatch.
+// Returns EFI_TIMEOUT when nothing arrived (EFI_NOT_READY for TimeoutUs 0).
+EFI_STATUS NetRxWait(NET_RX_ENGINE *Engine, uint64_t TimeoutUs) {
+    EFI_EVENT Events[2];
+    uint64_t EventCount = 0;
+    uint64_t Index;
+    
+    if (Engine == NULL || Engine->Snp == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    if (TimeoutUs == 0) {
+        return NetRxPoll(Engine) > 0 ? EFI_SUCCESS : EFI_NOT_READY;
+    }
+    
+    // Without WaitForPacket the timer becomes a poll interval
+    uint64_t Interval = TimeoutUs;
+    if (Engine->Snp->WaitForPacket != NULL) {
+        Events[EventCount++] = Engine->Snp->WaitForPacket;
+    } else if (Interval > NET_RX_POLL_INTERVAL_US) {
+        Interval = NET_RX_POLL_INTERVAL_US;
+    }
+    Events[EventCount++] = Engine->Timer;
+    
+    uint64_t Start = ReadTimestamp();
+    uint64_t Elapsed = 0;
+    
+    // Each wait is cut to what is left, so empty wakeups do not extend the call
+    for (;;) {
+        uint64_t Wait = TimeoutUs - Elapsed < Interval ? TimeoutUs - Elapsed : Interval;
+        EFI_STATUS Status = ST->BootServices->SetTimer(Engine->Timer, TimerRelative, Wait * TIMER_UNITS_PER_US);
+        if (!EFI_ERROR(Status)) {
+            Status = ST->BootServices->WaitForEvent(EventCount, Events, &Index);
+        }
+        if (EFI_ERROR(Status)) {
+            return Status;
+        }
+        
+        Engine->Wakeups++;
+        if (NetRxPoll(Engine) > 0) {
+            ST->BootServices->SetTimer(Engine->Timer, TimerCancel, 0);
+            return EFI_SUCCESS;
+        }
+        Engine->EmptyWakeups++;
+        
+        Elapsed = TimestampToMicroseconds(ReadTimestamp() - Start);
+        if (Elapsed >= TimeoutUs) {
+            return EFI_TIMEOUT;
+        }
+    }
+}
+
+// Receive and dispatch until NetRxStop (from a handler) or DurationUs passes
+// (0 runs until stopped)
+EFI_STATUS NetRxRun(NET_RX_ENGINE *Engine, uint64_t DurationUs) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    
+    if (Engine == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    uint64_t Start = ReadTimestamp();
+    Engine->Running = true;
+    
+    while (Engine->Running) {
+        uint64_t Elapsed = TimestampToMicroseconds(ReadTimestamp() - Start);
+        if (DurationUs != 0 && Elapsed >= DurationUs) {
+            break;
+        }
+        
+        uint64_t Timeout = DurationUs != 0 ? DurationUs - Elapsed : NET_RX_IDLE_WAIT_US;
+        Status = NetRxWait(Engine, Timeout);
+        if (EFI_ERROR(Status) && Status != EFI_TIMEOUT) {
+            break;
+        }
+        Status = EFI_SUCCESS;
+    }
+    
+    Engine->Running = false;
+    return Status;
+}
+
+void NetRxStop(NET_RX_ENGINE *Engine) {
+    if (Engine != NULL) {
+        Engine->Running = false;
+    }
+}
+
+void NetRxPrintStats(NET_RX_ENGINE *Engine) {
+    if (Engine == NULL) {
+        return;
+    }
+    
+    PRINT(u"RX frames: ");
+    PrintDec(Engine->FramesReceived);
+    PRINT(u" (");
+    PrintDec(Engine->BytesReceived);
+    PRINT(u" bytes)  Wakeups: ");
+    PrintDec(Engine->Wakeups);
+    PRINT(u" (");
+    PrintDec(Engine->EmptyWakeups);
+    PRINT(u" empty)  Largest burst: ");
+    PrintDec(Engine->LargestBurst);
+    PRINTL(u"");
+    
+    PRINT(u"Drops: pool ");
+    PrintDec(Engine->PoolDrops);
+    PRINT(u", oversize ");
+    PrintDec(Engine->OversizeDrops);
+    PRINT(u", unhandled ");
+    PrintDec(Engine->Unhandled);
+    PRINT(u", driver errors ");
+    PrintDec(Engine->DriverErrors);
+    if (Engine->BadReleases != 0) {
+        PRINT(u", bad releases ");
+        PrintDec(Engine->BadReleases);
+    }
+    PRINT(u"  Lowest free: ");
+    PrintDec(Engine->LowestFree);
+    PRINT(u"/");
+    PrintDec(Engine->PoolSize);
+    PRINTL(u"");
+}
+
+// Frame counters for NetRxBenchmark
+typedef struct {
+    uint64_t Ipv4;
+    uint64_t Arp;
+    uint64_t Ipv6;
+    uint64_t Other;
+} RX_PROTOCOL_COUNTS;
+
+static bool CountFrame(NET_RX_ENGINE *Engine, NET_RX_FRAME *Frame, void *Context) {
+    RX_PROTOCOL_COUNTS *Counts = (RX_PROTOCOL_COUNTS*)Context;
+    
+    if (Frame->Protocol == 0x0800) {
+        Counts->Ipv4++;
+    } else if (Frame->Protocol == 0x0806) {
+        Counts->Arp++;
+    } else if (Frame->Protocol == 0x86DD) {
+        Counts->Ipv6++;
+    } else {
+        Counts->Other++;
+    }
+    return false;
+}
+
+// Receive whatever arrives for NET_RX_BENCHMARK_US and report rates, burst
+// sizes and how much of the time the CPU was idle
+void NetRxBenchmark(EFI_SIMPLE_NETWORK_PROTOCOL *Snp) {
+    RX_PROTOCOL_COUNTS Counts;
+    NET_RX_ENGINE Engine;
+    
+    if (Snp == NULL || EFI_ERROR(InitializeNetwork(Snp)) || EFI_ERROR(NetRxCreate(&Engine, Snp, 0))) {
+        PRINTL(u"RX benchmark: network not available");
+        return;
+    }
+    
+    MemSet(&Counts, 0, sizeof(Counts));
+    NetRxRegister(&Engine, NET_RX_ANY_PROTOCOL, CountFrame, &Counts);
+    
+    uint64_t Start = ReadTimestamp();
+    EFI_STATUS Status = NetRxRun(&Engine, NET_RX_BENCHMARK_US);
+    uint64_t Ticks = ReadTimestamp() - Start;
+    
+    if (EFI_ERROR(Status)) {
+        PRINT(u"RX benchmark failed: ");
+        PrintHex(Status);
+        PRINTL(u"");
+    }
+    
+    NetRxPrintStats(&Engine);
+    PRINT(u"IPv4 ");
+    PrintDec(Counts.Ipv4);
+    PRINT(u"  ARP ");
+    PrintDec(Counts.Arp);
+    PRINT(u"  IPv6 ");
+    PrintDec(Counts.Ipv6);
+    PRINT(u"  Other ");
+    PrintDec(Counts.Other);
+    PRINTL(u"");
+    
+    PrintDec(BytesPerSecond(Engine.FramesReceived, Ticks));
+    PRINT(u" pkt/s, ");
+    PrintDec(BytesPerSecond(Engine.BytesReceived, Ticks) * 8 / 1000000);
+    PRINT(u" Mbit/s, ");
+    PrintDec(Engine.Wakeups ? Engine.FramesReceived / Engine.Wakeups : 0);
+    PRINT(u" frames/wakeup, CPU busy ");
+    PrintDec(Ticks ? Engine.PollTicks * 100 / Ticks : 0);
+    PRINTL(u"%");
+    
+    NetRxDestroy(&Engine);
+}
@@ -0,0 +1,106 @@
+// efi_net_rx.h
+#ifndef TINYUEFI_NET_RX_H
+#define TINYUEFI_NET_RX_H
+
+#include "uefi_types.h"
+#include "efi_network_protocol.h"
+#include "efi_net_filter.h"
+
+// Receive buffers in the pool when the caller does not choose
+#define NET_RX_POOL_DEFAULT_FRAMES    64
+
+// Frame buffers are rounded up to this many bytes
+#define NET_RX_FRAME_ALIGNMENT        64
+
+// Most frames pulled from the driver per wakeup
+#define NET_RX_MAX_BURST              64
+
+// Per-EtherType handlers an engine can hold
+#define NET_RX_MAX_HANDLERS           8
+
+// Handler protocol that matches frames no other handler takes
+#define NET_RX_ANY_PROTOCOL           0
+
+// Poll interval when the driver provides no WaitForPacket event
+#define NET_RX_POLL_INTERVAL_US       1000
+
+// Length of NetRxBenchmark
+#define NET_RX_BENCHMARK_US           5000000
+
+typedef struct _NET_RX_ENGINE NET_RX_ENGINE;
+
+// One received frame with its media header fields (Protocol in host order)
+typedef struct {
+    uint8_t *Buffer;              // Whole frame, media header first
+    uint64_t Length;
+    uint64_t HeaderSize;
+    EFI_MAC_ADDRESS SrcAddr;
+    EFI_MAC_ADDRESS DestAddr;
+    uint16_t Protocol;
+    uint64_t Timestamp;           // ReadTimestamp when the frame was pulled
+    uint32_t Index;               // Position in the pool
+    bool InUse;                   // Taken from the free list and not yet released
+} NET_RX_FRAME;
+
+// Frame handler. Return true to keep the frame past the call; it must then
+// be given back with NetRxFrameRelease.
+typedef bool (*NET_RX_HANDLER)(NET_RX_ENGINE *Engine, NET_RX_FRAME *Frame, void *Context);
+
+typedef struct {
+    uint16_t Protocol;
+    NET_RX_HANDLER Handler;
+    void *Context;
+    uint64_t Frames;
+} NET_RX_HANDLER_ENTRY;
+
+// Receive engine: pulls every pending frame into pooled buffers on each
+// wakeup, then hands them to the handler registered for their EtherType
+struct _NET_RX_ENGINE {
+    EFI_SIMPLE_NETWORK_PROTOCOL *Snp;
+    uint8_t *Memory;
+    NET_RX_FRAME *Frames;
+    uint32_t *FreeList;
+    uint32_t FreeCount;
+    uint32_t PoolSize;
+    uint32_t FrameSize;
+    uint8_t *Scratch;             // Drains frames that arrive while the pool is empty
+    EFI_EVENT Timer;
+    bool Running;
+    NET_FRAME_TAP Tap;            // Optional; sees every frame pulled from the driver
+    void *TapContext;
+    NET_FILTER *Filter;           // Optional; frames it rejects are released undispatched
+    
+    NET_RX_HANDLER_ENTRY Handlers[NET_RX_MAX_HANDLERS];
+    uint32_t HandlerCount;
+    
+    // Statistics
+    uint64_t FramesReceived;
+    uint64_t BytesReceived;
+    uint64_t Unhandled;           // No handler for the EtherType
+    uint64_t PoolDrops;           // Pulled into Scratch and discarded
+    uint64_t OversizeDrops;       // Receive reported EFI_BUFFER_TOO_SMALL
+    uint64_t DriverErrors;
+    uint64_t BadReleases;         // NetRxFrameRelease of a free or foreign frame, ignored
+    uint64_t Wakeups;
+    uint64_t EmptyWakeups;
+    uint32_t LargestBurst;
+    uint32_t LowestFree;
+    uint64_t PollTicks;           // Time spent pulling and dispatching frames
+};
+
+// Engine setup
+EFI_STATUS NetRxCreate(NET_RX_ENGINE *Engine, EFI_SIMPLE_NETWORK_PROTOCOL *Snp, uint32_t PoolSize);
+void NetRxDestroy(NET_RX_ENGINE *Engine);
+EFI_STATUS NetRxRegister(NET_RX_ENGINE *Engine, uint16_t Protocol, NET_RX_HANDLER Handler, void *Context);
+EFI_STATUS NetRxUnregister(NET_RX_ENGINE *Engine, uint16_t Protocol);
+void NetRxFrameRelease(NET_RX_ENGINE *Engine, NET_RX_FRAME *Frame);
+
+// Receiving
+uint32_t NetRxPoll(NET_RX_ENGINE *Engine);
+EFI_STATUS NetRxWait(NET_RX_ENGINE *Engine, uint64_t TimeoutUs);
+EFI_STATUS NetRxRun(NET_RX_ENGINE *Engine, uint64_t DurationUs);
+void NetRxStop(NET_RX_ENGINE *Engine);
+void NetRxPrintStats(NET_RX_ENGINE *Engine);
+void NetRxBenchmark(EFI_SIMPLE_NETWORK_PROTOCOL *Snp);
+
+#endif // TINYUEFI_NET_RX_H
@@ -0,0 +1,332 @@
+// efi_net_tx.c
+#include "efi_net_tx.h"
+#include "uefi_helpers.h"
+#include "efi_timer.h"
+
+// Ethernet frame without FCS when the mode does not report one
+#define NET_TX_DEFAULT_FRAME          1514
+
+static inline uint64_t TimeoutTicks(void) {
+    return GetTimestampFrequency() / 1000000 * NET_TX_TIMEOUT_US;
+}
+
+// Allocate SlotCount frame buffers (NET_TX_RING_DEFAULT_SLOTS when 0)
+EFI_STATUS NetTxRingCreate(NET_TX_RING *Ring, EFI_SIMPLE_NETWORK_PROTOCOL *Snp, uint32_t SlotCount) {
+    if (Ring == NULL || Snp == NULL || Snp->Mode == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    if (Snp->Mode->State != EfiSimpleNetworkInitialized) {
+        return EFI_NOT_READY;
+    }
+    
+    if (SlotCount == 0) {
+        SlotCount = NET_TX_RING_DEFAULT_SLOTS;
+    }
+    
+    MemSet(Ring, 0, sizeof(*Ring));
+    
+    uint64_t Frame = Snp->Mode->MaxPacketSize != 0
+                   ? (uint64_t)Snp->Mode->MediaHeaderSize + Snp->Mode->MaxPacketSize
+                   : NET_TX_DEFAULT_FRAME;
+    Ring->FrameSize = (uint32_t)((Frame + NET_TX_FRAME_ALIGNMENT - 1) & ~(uint64_t)(NET_TX_FRAME_ALIGNMENT - 1));
+    
+    uint64_t SlotBytes = (uint64_t)SlotCount * sizeof(NET_TX_SLOT);
+    Ring->Memory = (uint8_t*)AllocatePool(SlotBytes + NET_TX_FRAME_ALIGNMENT + (uint64_t)SlotCount * Ring->FrameSize);
+    if (Ring->Memory == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    
+    Ring->Slots = (NET_TX_SLOT*)Ring->Memory;
+    uintptr_t Buffers = ((uintptr_t)Ring->Memory + SlotBytes + NET_TX_FRAME_ALIGNMENT - 1) &
+                        ~(uintptr_t)(NET_TX_FRAME_ALIGNMENT - 1);
+    for (uint32_t i = 0; i < SlotCount; i++) {
+        Ring->Slots[i].Buffer = (uint8_t*)Buffers + (uint64_t)i * Ring->FrameSize;
+        Ring->Slots[i].InFlight = false;
+    }
+    
+    Ring->Snp = Snp;
+    Ring->SlotCount = SlotCount;
+    Ring->Acquired = -1;
+    Ring->MaxInFlight = Snp->Mode->MultipleTxSupported ? SlotCount : 1;
+    return EFI_SUCCESS;
+}
+
+// Wait for every frame in flight, then free the buffers. If the driver
+// never returns some of them the memory is left allocated, since the
+// device may still read from it.
+EFI_STATUS NetTxRingDestroy(NET_TX_RING *Ring) {
+    if (Ring == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    EFI_STATUS Status = NetTxRingFlush(Ring);
+    if (!EFI_ERROR(Status) && Ring->Memory != NULL) {
+        FreePool(Ring->Memory);
+    }
+    
+    Ring->Memory = NULL;
+    Ring->Slots = NULL;
+    Ring->SlotCount = 0;
+    return Status;
+}
+
+// Collect recycled buffers from GetStatus and return how many were ours
+uint32_t NetTxRingReclaim(NET_TX_RING *Ring) {
+    uint32_t Reclaimed = 0;
+    
+    if (Ring == NULL || Ring->InFlight == 0) {
+        return 0;
+    }
+    
+    uint8_t *First = Ring->Slots[0].Buffer;
+    uint64_t Span = (uint64_t)Ring->SlotCount * Ring->FrameSize;
+    
+    // GetStatus hands back one buffer per call; bound the loop in case a
+    // driver keeps returning the same one
+    for (uint32_t Calls = 0; Calls <= Ring->SlotCount * 2; Calls++) {
+        uint32_t InterruptStatus = 0;
+        void *TxBuf = NULL;
+        
+        if (EFI_ERROR(Ring->Snp->GetStatus(Ring->Snp, &InterruptStatus, &TxBuf)) || TxBuf == NULL) {
+            break;
+        }
+        
+        uint64_t Offset = (uint64_t)((uint8_t*)TxBuf - First);
+        if ((uint8_t*)TxBuf < First || Offset >= Span || Offset % Ring->FrameSize != 0 ||
+            !Ring->Slots[Offset / Ring->FrameSize].InFlight) {
+            Ring->ForeignTxBufs++;
+            continue;
+        }
+        
+        Ring->Slots[Offset / Ring->FrameSize].InFlight = false;
+        Ring->InFlight--;
+        Reclaimed++;
+        
+        if (Ring->InFlight == 0) {
+            break;
+        }
+    }
+    
+    Ring->Recycled += Reclaimed;
+    return Reclaimed;
+}
+
+// Find a slot that is neither in flight nor handed out
+static int32_t FindFreeSlot(NET_TX_RING *Ring) {
+    if (Ring->InFlight >= Ring->MaxInFlight) {
+        return -1;
+    }
+    
+    for (uint32_t i = 0; i < Ring->SlotCount; i++) {
+        uint32_t Slot = (Ring->Next + i) % Ring->SlotCount;
+        if (!Ring->Slots[Slot].InFlight && (int32_t)Slot != Ring->Acquired) {
+            return (int32_t)Slot;
+        }
+    }
+    
+    return -1;
+}
+
+// Hand out a frame buffer of FrameSize bytes. When every slot is in flight
+// this polls GetStatus until one comes back (EFI_TIMEOUT if none does).
+EFI_STATUS NetTxRingAcquire(NET_TX_RING *Ring, uint8_t **Frame) {
+    if (Ring == NULL || Frame == NULL || Ring->Slots == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    if (Ring->Acquired >= 0) {
+        *Frame = Ring->Slots[Ring->Acquired].Buffer;
+        return EFI_SUCCESS;
+    }
+    
+    int32_t Slot = FindFreeSlot(Ring);
+    if (Slot < 0) {
+        uint64_t Start = ReadTimestamp();
+        uint64_t Timeout = TimeoutTicks();
+        
+        Ring->RingFull++;
+        do {
+            NetTxRingReclaim(Ring);
+            Slot = FindFreeSlot(Ring);
+        } while (Slot < 0 && ReadTimestamp() - Start < Timeout);
+        
+        if (Slot < 0) {
+            return EFI_TIMEOUT;
+        }
+    }
+    
+    Ring->Acquired = Slot;
+    *Frame = Ring->Slots[Slot].Buffer;
+    return EFI_SUCCESS;
+}
+
+// Transmit the acquired frame. With DestAddr the driver fills in the media
+// header (the first MediaHeaderSize bytes) for Protocol; without it the
+// frame must already be complete. Length includes the header either way.
+EFI_STATUS NetTxRingSubmit(NET_TX_RING *Ring, uint64_t Length,
+                           EFI_MAC_ADDRESS *DestAddr, uint16_t Protocol) {
+    EFI_STATUS Status;
+    
+    if (Ring == NULL || Ring->Acquired < 0 || Length > Ring->FrameSize) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    NET_TX_SLOT *Slot = &Ring->Slots[Ring->Acquired];
+    uint64_t HeaderSize = DestAddr != NULL ? Ring->Snp->Mode->MediaHeaderSize : 0;
+    
+    if (Length < NET_TX_MIN_FRAME) {
+        MemSet(Slot->Buffer + Length, 0, NET_TX_MIN_FRAME - Length);
+        Length = NET_TX_MIN_FRAME;
+    }
+    
+    // EFI_NOT_READY means the driver's own queue is full; recycle and retry
+    uint64_t Start = ReadTimestamp();
+    uint64_t Timeout = TimeoutTicks();
+    for (;;) {
+        Status = Ring->Snp->Transmit(Ring->Snp, HeaderSize, Length, Slot->Buffer, NULL,
+                                     DestAddr, DestAddr != NULL ? &Protocol : NULL);
+        if (Status != EFI_NOT_READY) {
+            break;
+        }
+        
+        Ring->DriverBusy++;
+        NetTxRingReclaim(Ring);
+        if (ReadTimestamp() - Start >= Timeout) {
+            return EFI_TIMEOUT;
+        }
+    }
+    
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    // The driver has filled in the media header, so the tap sees the whole frame
+    if (Ring->Tap != NULL) {
+        Ring->Tap(Ring->TapContext, Slot->Buffer, Length, NET_TAP_OUTBOUND);
+    }
+    
+    Slot->InFlight = true;
+    Ring->InFlight++;
+    Ring->Next = ((uint32_t)Ring->Acquired + 1) % Ring->SlotCount;
+    Ring->Acquired = -1;
+    Ring->FramesSent++;
+    Ring->BytesSent += Length;
+    if (Ring->InFlight > Ring->PeakInFlight) {
+        Ring->PeakInFlight = Ring->InFlight;
+    }
+    
+    // Opportunistic recycling keeps slots available without extra waits
+    if (Ring->InFlight * 2 >= Ring->MaxInFlight) {
+        NetTxRingReclaim(Ring);
+    }
+    
+    return EFI_SUCCESS;
+}
+
+// Copy Data into a slot and transmit it
+EFI_STATUS NetTxRingSend(NET_TX_RING *Ring, const void *Data, uint64_t Length,
+                         EFI_MAC_ADDRESS *DestAddr, uint16_t Protocol) {
+    uint8_t *Frame;
+    
+    if (Ring == NULL || Data == NULL || Length > Ring->FrameSize) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    EFI_STATUS Status = NetTxRingAcquire(Ring, &Frame);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    MemCpy(Frame, Data, Length);
+    return NetTxRingSubmit(Ring, Length, DestAddr, Protocol);
+}
+
+// Wait until every submitted frame has been recycled
+EFI_STATUS NetTxRingFlush(NET_TX_RING *Ring) {
+    if (Ring == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    uint64_t Start = ReadTimestamp();
+    uint64_t Timeout = TimeoutTicks();
+    
+    while (Ring->InFlight > 0) {
+        NetTxRingReclaim(Ring);
+        if (Ring->InFlight > 0 && ReadTimestamp() - Start >= Timeout) {
+            return EFI_TIMEOUT;
+        }
+    }
+    
+    return EFI_SUCCESS;
+}
+
+// Broadcast NET_TX_BENCHMARK_FRAMES frames of several sizes through a ring
+// and report packet and bit rates
+void NetTxBenchmark(EFI_SIMPLE_NETWORK_PROTOCOL *Snp) {
+    static const uint32_t Sizes[] = { 60, 128, 256, 512, 1024, 1514 };
+    NET_TX_RING Ring;
+    const char16_t *Multiple;
+    
+    if (Snp == NULL || EFI_ERROR(InitializeNetwork(Snp))) {
+        PRINTL(u"TX benchmark: network not available");
+        return;
+    }
+    
+    Multiple = Snp->Mode->MultipleTxSupported ? u"supported" : u"not supported";
+    PRINT(u"TX ring: multiple TX ");
+    PRINTL(Multiple);
+    
+    for (uint32_t i = 0; i < sizeof(Sizes) / sizeof(Sizes[0]); i++) {
+        EFI_STATUS Status = NetTxRingCreate(&Ring, Snp, 0);
+        if (EFI_ERROR(Status)) {
+            PRINTL(u"TX benchmark: ring allocation failed");
+            return;
+        }
+        
+        uint32_t Size = Sizes[i] < Ring.FrameSize ? Sizes[i] : Ring.FrameSize;
+        uint64_t Start = ReadTimestamp();
+        
+        for (uint32_t Count = 0; Count < NET_TX_BENCHMARK_FRAMES && !EFI_ERROR(Status); Count++) {
+            uint8_t *Frame;
+            
+            Status = NetTxRingAcquire(&Ring, &Frame);
+            if (EFI_ERROR(Status)) {
+                break;
+            }
+            
+            // Broadcast destination, our source and the experimental EtherType
+            MemSet(Frame, 0xFF, 6);
+            MemCpy(Frame + 6, Snp->Mode->CurrentAddress.Addr, 6);
+            Frame[12] = (uint8_t)(NET_TX_BENCHMARK_ETHERTYPE >> 8);
+            Frame[13] = (uint8_t)NET_TX_BENCHMARK_ETHERTYPE;
+            MemCpy(Frame + 14, &Count, sizeof(Count));
+            
+            Status = NetTxRingSubmit(&Ring, Size, NULL, 0);
+        }
+        if (!EFI_ERROR(Status)) {
+            Status = NetTxRingFlush(&Ring);
+        }
+        uint64_t Ticks = ReadTimestamp() - Start;
+        
+        PrintDec(Size);
+        PRINT(u" bytes: ");
+        if (EFI_ERROR(Status)) {
+            PRINT(u"failed ");
+            PrintHex(Status);
+            PRINTL(u"");
+        } else {
+            PrintDec(BytesPerSecond(Ring.FramesSent, Ticks));
+            PRINT(u" pkt/s, ");
+            PrintDec(BytesPerSecond(Ring.BytesSent, Ticks) * 8 / 1000000);
+            PRINT(u" Mbit/s  peak in flight ");
+            PrintDec(Ring.PeakInFlight);
+            PRINT(u", ring full ");
+            PrintDec(Ring.RingFull);
+            PRINT(u", driver busy ");
+            PrintDec(Ring.DriverBusy);
+            PRINTL(u"");
+        }
+        
+        NetTxRingDestroy(&Ring);
+    }
+}
@@ -0,0 +1,69 @@
+// efi_net_tx.h
+#ifndef TINYUEFI_NET_TX_H
+#define TINYUEFI_NET_TX_H
+
+#include "uefi_types.h"
+#include "efi_network_protocol.h"
+
+// Frame buffers in a ring when the caller does not choose
+#define NET_TX_RING_DEFAULT_SLOTS     64
+
+// Frame buffers are rounded up to this many bytes
+#define NET_TX_FRAME_ALIGNMENT        64
+
+// Longest a full ring waits for the driver to recycle a buffer
+#define NET_TX_TIMEOUT_US             100000
+
+// Smallest Ethernet frame without FCS; shorter frames are zero-padded
+#define NET_TX_MIN_FRAME              60
+
+// Work done by NetTxBenchmark for each frame size
+#define NET_TX_BENCHMARK_FRAMES       20000
+
+// EtherType used for benchmark traffic (IEEE 802 local experimental)
+#define NET_TX_BENCHMARK_ETHERTYPE    0x88B5
+
+// One preallocated frame buffer
+typedef struct {
+    uint8_t *Buffer;
+    bool InFlight;
+} NET_TX_SLOT;
+
+// Transmit ring. Frames are built in place in a slot buffer and handed to
+// Transmit; slots come back when GetStatus returns their buffer as TxBuf.
+typedef struct {
+    EFI_SIMPLE_NETWORK_PROTOCOL *Snp;
+    uint8_t *Memory;
+    NET_TX_SLOT *Slots;
+    uint32_t SlotCount;
+    uint32_t FrameSize;
+    uint32_t Next;                // Where the search for a free slot starts
+    int32_t Acquired;             // Slot handed out by NetTxRingAcquire, or -1
+    uint32_t InFlight;
+    uint32_t MaxInFlight;         // 1 without MultipleTxSupported
+    NET_FRAME_TAP Tap;            // Optional; sees every frame the driver accepts
+    void *TapContext;
+    
+    // Statistics
+    uint64_t FramesSent;
+    uint64_t BytesSent;
+    uint64_t Recycled;
+    uint64_t DriverBusy;          // Transmit calls that returned EFI_NOT_READY
+    uint64_t RingFull;            // Acquires that had to wait for a recycled slot
+    uint64_t ForeignTxBufs;       // Recycled buffers that did not belong to the ring
+    uint32_t PeakInFlight;
+} NET_TX_RING;
+
+// Helper functions
+EFI_STATUS NetTxRingCreate(NET_TX_RING *Ring, EFI_SIMPLE_NETWORK_PROTOCOL *Snp, uint32_t SlotCount);
+EFI_STATUS NetTxRingDestroy(NET_TX_RING *Ring);
+uint32_t NetTxRingReclaim(NET_TX_RING *Ring);
+EFI_STATUS NetTxRingAcquire(NET_TX_RING *Ring, uint8_t **Frame);
+EFI_STATUS NetTxRingSubmit(NET_TX_RING *Ring, uint64_t Length,
+                           EFI_MAC_ADDRESS *DestAddr, uint16_t Protocol);
+EFI_STATUS NetTxRingSend(NET_TX_RING *Ring, const void *Data, uint64_t Length,
+                         EFI_MAC_ADDRESS *DestAddr, uint16_t Protocol);
+EFI_STATUS NetTxRingFlush(NET_TX_RING *Ring);
+void NetTxBenchmark(EFI_SIMPLE_NETWORK_PROTOCOL *Snp);
+
+#endif // TINYUEFI_NET_TX_H
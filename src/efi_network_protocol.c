@@ -2,15 +2,17 @@
 #include "efi_network_protocol.h"
 #include "uefi_helpers.h"
 #include "efi_protocol_discovery.h"
+#include "efi_protocol_cache.h"
+#include "efi_timer.h"
 
 // GUID for simple network protocol
 EFI_GUID gEfiSimpleNetworkProtocolGuid = {
     0xA19832B9, 0xAC25, 0x11D3, {0x9A, 0x2D, 0x00, 0x90, 0x27, 0x3F, 0xC1, 0x4D}
 };
 
-// Get the simple network protocol
+// Get the simple network protocol, cached until another one is installed
 EFI_STATUS GetNetworkProtocol(EFI_SIMPLE_NETWORK_PROTOCOL **SimpleNetwork) {
-    return LocateProtocol(&gEfiSimpleNetworkProtocolGuid, (void**)SimpleNetwork);
+    return CachedLocateProtocol(&gEfiSimpleNetworkProtocolGuid, (void**)SimpleNetwork);
 }
 
 // Initialize the network interface
@@ -42,9 +44,14 @@ EFI_STATUS InitializeNetwork(EFI_SIMPLE_NETWORK_PROTOCOL *SimpleNetwork) {
     }
 }
 
-// Send a packet through the network interface
+// Send a packet through the network interface and wait until the driver
+// hands the buffer back through GetStatus, so Data can be reused on return.
+// Recycled buffers that are not Data are dropped, so do not mix this with a
+// NET_TX_RING on the same interface.
 EFI_STATUS SendPacket(EFI_SIMPLE_NETWORK_PROTOCOL *SimpleNetwork, void *Data, 
                      uint64_t DataSize, EFI_MAC_ADDRESS *DestMacAddress) {
+    EFI_STATUS Status;
+    
     if (SimpleNetwork == NULL || Data == NULL) {
         return EFI_INVALID_PARAMETER;
     }
@@ -58,7 +65,7 @@ EFI_STATUS SendPacket(EFI_SIMPLE_NETWORK_PROTOCOL *SimpleNetwork, void *Data,
     uint16_t Protocol = 0x0800;
     
     // Send the packet
-    return SimpleNetwork->Transmit(
+    Status = SimpleNetwork->Transmit(
         SimpleNetwork,
         0,          // HeaderSize (0 for default Ethernet header)
         DataSize,   // BufferSize
@@ -67,6 +74,25 @@ EFI_STATUS SendPacket(EFI_SIMPLE_NETWORK_PROTOCOL *SimpleNetwork, void *Data,
         DestMacAddress,  // Destination MAC
         &Protocol   // Protocol (EtherType)
     );
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    // Wait for the buffer to be recycled
+    uint64_t Timeout = GetTimestampFrequency() / 1000000 * NETWORK_TX_RECYCLE_TIMEOUT_US;
+    uint64_t Start = ReadTimestamp();
+    
+    do {
+        void *TxBuf = NULL;
+        uint32_t InterruptStatus;
+        
+        Status = SimpleNetwork->GetStatus(SimpleNetwork, &InterruptStatus, &TxBuf);
+        if (EFI_ERROR(Status) || TxBuf == Data) {
+            return Status;
+        }
+    } while (ReadTimestamp() - Start < Timeout);
+    
+    return EFI_TIMEOUT;
 }
 
 // Receive a packet from the network interface
@@ -101,6 +127,27 @@ EFI_STATUS ReceivePacket(EFI_SIMPLE_NETWORK_PROTOCOL *SimpleNetwork, void *Buffe
     return Status;
 }
 
+// Read the driver's counters without resetting them. Counters the driver
+// does not report, including any past the end of an older, shorter table,
+// read as EFI_NETWORK_STATISTIC_UNSUPPORTED.
+EFI_STATUS GetNetworkStatistics(EFI_SIMPLE_NETWORK_PROTOCOL *SimpleNetwork,
+                                EFI_NETWORK_STATISTICS *Statistics) {
+    if (SimpleNetwork == NULL || Statistics == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    MemSet(Statistics, 0xFF, sizeof(*Statistics));
+    if (SimpleNetwork->Statistics == NULL) {
+        return EFI_UNSUPPORTED;
+    }
+    
+    // A driver with a newer, longer table fills what fits and reports
+    // EFI_BUFFER_TOO_SMALL
+    uint64_t Size = sizeof(*Statistics);
+    EFI_STATUS Status = SimpleNetwork->Statistics(SimpleNetwork, false, &Size, Statistics);
+    return Status == EFI_BUFFER_TOO_SMALL ? EFI_SUCCESS : Status;
+}
+
 // Print a MAC address
 void PrintMacAddress(EFI_MAC_ADDRESS *MacAddress, uint32_t Size) {
     if (MacAddress == NULL) {
@@ -4,6 +4,9 @@
 
 #include "uefi_types.h"
 
+// Longest SendPacket waits for the driver to recycle its buffer
+#define NETWORK_TX_RECYCLE_TIMEOUT_US 100000
+
 // MAC Address structure
 typedef struct {
     uint8_t Addr[32];
@@ -33,6 +36,9 @@ typedef struct {
     uint64_t UnsupportedProtocol;
 } EFI_NETWORK_STATISTICS;
 
+// Value of a statistics counter the driver does not maintain
+#define EFI_NETWORK_STATISTIC_UNSUPPORTED 0xFFFFFFFFFFFFFFFFull
+
 // Network state
 typedef enum {
     EfiSimpleNetworkStopped,
@@ -41,6 +47,16 @@ typedef enum {
     EfiSimpleNetworkMaxState
 } EFI_SIMPLE_NETWORK_STATE;
 
+// Receive filter bits (ReceiveFilterMask, ReceiveFilterSetting, ReceiveFilters)
+#define EFI_SIMPLE_NETWORK_RECEIVE_UNICAST               0x01
+#define EFI_SIMPLE_NETWORK_RECEIVE_MULTICAST             0x02
+#define EFI_SIMPLE_NETWORK_RECEIVE_BROADCAST             0x04
+#define EFI_SIMPLE_NETWORK_RECEIVE_PROMISCUOUS           0x08
+#define EFI_SIMPLE_NETWORK_RECEIVE_PROMISCUOUS_MULTICAST 0x10
+
+// Size of the multicast filter table in the mode data
+#define MAX_MCAST_FILTER_CNT          16
+
 // Network mode data
 typedef struct {
     uint32_t State;
@@ -53,7 +69,7 @@ typedef struct {
     uint32_t ReceiveFilterSetting;
     uint32_t MaxMCastFilterCount;
     uint32_t MCastFilterCount;
-    EFI_MAC_ADDRESS MCastFilter[16];
+    EFI_MAC_ADDRESS MCastFilter[MAX_MCAST_FILTER_CNT];
     EFI_MAC_ADDRESS CurrentAddress;
     EFI_MAC_ADDRESS BroadcastAddress;
     EFI_MAC_ADDRESS PermanentAddress;
@@ -177,6 +193,14 @@ struct _EFI_SIMPLE_NETWORK_PROTOCOL {
 // GUID for simple network protocol
 extern EFI_GUID gEfiSimpleNetworkProtocolGuid;
 
+// Directions reported to a frame tap
+#define NET_TAP_INBOUND               1
+#define NET_TAP_OUTBOUND              2
+
+// Sees every frame a receive engine or transmit ring moves, media header
+// included, right after the driver accepted or delivered it
+typedef void (*NET_FRAME_TAP)(void *Context, const uint8_t *Frame, uint64_t Length, uint32_t Direction);
+
 // Helper functions
 EFI_STATUS GetNetworkProtocol(EFI_SIMPLE_NETWORK_PROTOCOL **SimpleNetwork);
 EFI_STATUS InitializeNetwork(EFI_SIMPLE_NETWORK_PROTOCOL *SimpleNetwork);
@@ -184,6 +208,8 @@ EFI_STATUS SendPacket(EFI_SIMPLE_NETWORK_PROTOCOL *SimpleNetwork, void *Data,
                      uint64_t DataSize, EFI_MAC_ADDRESS *DestMacAddress);
 EFI_STATUS ReceivePacket(EFI_SIMPLE_NETWORK_PROTOCOL *SimpleNetwork, void *Buffer, 
                         uint64_t *BufferSize);
+EFI_STATUS GetNetworkStatistics(EFI_SIMPLE_NETWORK_PROTOCOL *SimpleNetwork,
+                                EFI_NETWORK_STATISTICS *Statistics);
 void PrintMacAddress(EFI_MAC_ADDRESS *MacAddress, uint32_t Size);
 
 #endif // TINYUEFI_NETWORK_PROTOCOL_H
\ No newline at end of file
@@ -0,0 +1,1041 @@
+// efi_pixel.c
+#include <immintrin.h>
+#include "efi_pixel.h"
+#include "uefi_helpers.h"
+#include "efi_cpu.h"
+#include "efi_timer.h"
+
+// Largest span and guard area used by PixelKernelSelfTest
+#define PIXEL_TEST_PIXELS             320
+#define PIXEL_TEST_GUARD              16
+
+// Kernels chosen on first use
+static const PIXEL_KERNELS *SelectedKernels = NULL;
+
+static inline uint32_t LoadPixel(const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Pixel) {
+    return *(const uint32_t*)Pixel;
+}
+
+static inline void StorePixel(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Pixel, uint32_t Value) {
+    *(uint32_t*)Pixel = Value;
+}
+
+// Exact round(x / 255) for x <= 255 * 255
+static inline uint32_t Div255(uint32_t Value) {
+    Value += 128;
+    return (Value + (Value >> 8)) >> 8;
+}
+
+static inline uint8_t BlendChannel(uint8_t Src, uint8_t Dest, uint32_t Alpha) {
+    return (uint8_t)Div255(Src * Alpha + Dest * (255 - Alpha));
+}
+
+static inline uint32_t SwapRedBluePixel(uint32_t Pixel) {
+    return (Pixel & 0xFF00FF00) | ((Pixel >> 16) & 0xFF) | ((Pixel & 0xFF) << 16);
+}
+
+// (A * (256 - Weight) + B * Weight) >> 8 on all four channels at once; each
+// 16-bit partial sum is at most 255 * 256, so the lanes never carry into each other
+static inline uint32_t LerpPixel(uint32_t A, uint32_t B, uint32_t Weight) {
+    uint32_t Inverse = PIXEL_LERP_ONE - Weight;
+    uint32_t Even = (A & 0x00FF00FF) * Inverse + (B & 0x00FF00FF) * Weight;
+    uint32_t Odd = ((A >> 8) & 0x00FF00FF) * Inverse + ((B >> 8) & 0x00FF00FF) * Weight;
+    
+    return ((Even >> 8) & 0x00FF00FF) | (Odd & 0xFF00FF00);
+}
+
+// Store the low BytesPerPixel bytes of a converted pixel
+static inline void StoreBitmaskPixel(uint8_t *Dest, uint32_t Value, uint32_t BytesPerPixel) {
+    Dest[0] = (uint8_t)Value;
+    Dest[1] = (uint8_t)(Value >> 8);
+    if (BytesPerPixel > 2) Dest[2] = (uint8_t)(Value >> 16);
+    if (BytesPerPixel > 3) Dest[3] = (uint8_t)(Value >> 24);
+}
+
+// Describe one destination channel fed from the 8-bit source channel at SourceShift
+static void SetBitmaskChannel(PIXEL_BITMASK_LAYOUT *Layout, uint32_t Index,
+                              uint32_t Mask, uint32_t SourceShift) {
+    uint32_t Bits = (uint32_t)__builtin_popcount(Mask);
+    uint32_t Shift = Mask != 0 ? (uint32_t)__builtin_ctz(Mask) : 0;
+    
+    if (Bits == 0) {
+        Layout->RightShift[Index] = 0;
+        Layout->Mask[Index] = 0;
+        Layout->LeftShift[Index] = 0;
+    } else if (Bits <= 8) {
+        // Keep the top Bits of the source channel
+        Layout->RightShift[Index] = SourceShift + 8 - Bits;
+        Layout->Mask[Index] = (1u << Bits) - 1;
+        Layout->LeftShift[Index] = Shift;
+    } else {
+        // Wider than 8 bits: place the source in the top of the field
+        Layout->RightShift[Index] = SourceShift;
+        Layout->Mask[Index] = 0xFF;
+        Layout->LeftShift[Index] = Shift + Bits - 8;
+    }
+}
+
+// Precompute the shifts for converting Blt pixels into a bitmask layout
+EFI_STATUS PixelBitmaskLayoutInit(PIXEL_BITMASK_LAYOUT *Layout, const EFI_PIXEL_BITMASK *Mask) {
+    if (Layout == NULL || Mask == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    uint32_t AllMasks = Mask->RedMask | Mask->GreenMask | Mask->BlueMask | Mask->ReservedMask;
+    if (AllMasks == 0) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    SetBitmaskChannel(Layout, 0, Mask->BlueMask, 0);
+    SetBitmaskChannel(Layout, 1, Mask->GreenMask, 8);
+    SetBitmaskChannel(Layout, 2, Mask->RedMask, 16);
+    
+    // Pixel size follows from the highest bit any mask uses
+    Layout->BytesPerPixel = (32 - __builtin_clz(AllMasks) + 7) / 8;
+    if (Layout->BytesPerPixel < 2) {
+        Layout->BytesPerPixel = 2;
+    }
+    
+    return EFI_SUCCESS;
+}
+
+// Convert one Blt pixel into a bitmask layout
+uint32_t PixelToBitmask(const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Pixel, const PIXEL_BITMASK_LAYOUT *Layout) {
+    uint32_t Value = LoadPixel(Pixel);
+    uint32_t Result = 0;
+    
+    for (int i = 0; i < 3; i++) {
+        Result |= ((Value >> Layout->RightShift[i]) & Layout->Mask[i]) << Layout->LeftShift[i];
+    }
+    
+    return Result;
+}
+
+// Convert a bitmask pixel back into a Blt pixel, replicating the top bits of
+// narrow channels so full scale maps to 255 (Reserved is cleared)
+void PixelFromBitmask(uint32_t Value, const PIXEL_BITMASK_LAYOUT *Layout, EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Pixel) {
+    uint32_t Result = 0;
+    
+    for (int i = 0; i < 3; i++) {
+        uint32_t Bits = (uint32_t)__builtin_popcount(Layout->Mask[i]);
+        uint32_t Field = (Value >> Layout->LeftShift[i]) & Layout->Mask[i];
+        uint32_t Channel = 0;
+        
+        if (Bits == 0) {
+            continue;
+        }
+        for (int Shift = 8 - (int)Bits; Shift > -(int)Bits; Shift -= (int)Bits) {
+            Channel |= Shift >= 0 ? Field << Shift : Field >> -Shift;
+        }
+        Result |= (Channel & 0xFF) << (8 * i);
+    }
+    
+    StorePixel(Pixel, Result);
+}
+
+//
+// Scalar reference kernels
+//
+
+static void FillScalar(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Color,
+                       uint64_t Count) {
+    uint32_t Value = LoadPixel(Color);
+    
+    for (uint64_t i = 0; i < Count; i++) {
+        StorePixel(&Dest[i], Value);
+    }
+}
+
+static void CopyScalar(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src,
+                       uint64_t Count) {
+    if (Dest == Src) {
+        return;
+    }
+    
+    if (Dest < Src || Dest >= Src + Count) {
+        for (uint64_t i = 0; i < Count; i++) {
+            StorePixel(&Dest[i], LoadPixel(&Src[i]));
+        }
+    } else {
+        while (Count-- > 0) {
+            StorePixel(&Dest[Count], LoadPixel(&Src[Count]));
+        }
+    }
+}
+
+static void BlendScalar(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src,
+                        uint64_t Count) {
+    for (uint64_t i = 0; i < Count; i++) {
+        uint32_t Alpha = Src[i].Reserved;
+        
+        Dest[i].Blue = BlendChannel(Src[i].Blue, Dest[i].Blue, Alpha);
+        Dest[i].Green = BlendChannel(Src[i].Green, Dest[i].Green, Alpha);
+        Dest[i].Red = BlendChannel(Src[i].Red, Dest[i].Red, Alpha);
+        Dest[i].Reserved = BlendChannel(Src[i].Reserved, Dest[i].Reserved, Alpha);
+    }
+}
+
+static void BlendConstantScalar(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src,
+                                uint64_t Count, uint8_t Alpha) {
+    for (uint64_t i = 0; i < Count; i++) {
+        Dest[i].Blue = BlendChannel(Src[i].Blue, Dest[i].Blue, Alpha);
+        Dest[i].Green = BlendChannel(Src[i].Green, Dest[i].Green, Alpha);
+        Dest[i].Red = BlendChannel(Src[i].Red, Dest[i].Red, Alpha);
+        Dest[i].Reserved = BlendChannel(Src[i].Reserved, Dest[i].Reserved, Alpha);
+    }
+}
+
+static void SwapRedBlueScalar(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src,
+                              uint64_t Count) {
+    for (uint64_t i = 0; i < Count; i++) {
+        StorePixel(&Dest[i], SwapRedBluePixel(LoadPixel(&Src[i])));
+    }
+}
+
+static void ConvertBitmaskScalar(void *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src, uint64_t Count,
+                                 const PIXEL_BITMASK_LAYOUT *Layout) {
+    uint8_t *Out = (uint8_t*)Dest;
+    
+    for (uint64_t i = 0; i < Count; i++) {
+        StoreBitmaskPixel(Out, PixelToBitmask(&Src[i], Layout), Layout->BytesPerPixel);
+        Out += Layout->BytesPerPixel;
+    }
+}
+
+static void LerpScalar(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *A,
+                       const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *B, uint64_t Count, uint32_t Weight) {
+    for (uint64_t i = 0; i < Count; i++) {
+        StorePixel(&Dest[i], LerpPixel(LoadPixel(&A[i]), LoadPixel(&B[i]), Weight));
+    }
+}
+
+static void ResampleScalar(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src,
+                           uint64_t Count, const uint32_t *Index, const uint16_t *Weight) {
+    for (uint64_t i = 0; i < Count; i++) {
+        const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Pair = &Src[Index[i]];
+        StorePixel(&Dest[i], LerpPixel(LoadPixel(&Pair[0]), LoadPixel(&Pair[1]), Weight[i]));
+    }
+}
+
+static const PIXEL_KERNELS PixelKernelsScalar = {
+    u"scalar", FillScalar, CopyScalar, BlendScalar, BlendConstantScalar,
+    SwapRedBlueScalar, ConvertBitmaskScalar, LerpScalar, ResampleScalar
+};
+
+//
+// SSE2 kernels (4 pixels per vector, scalar tails)
+//
+
+// round((S * A + D * (255 - A)) / 255) on 16-bit lanes
+static inline __m128i BlendWordsSse2(__m128i Src, __m128i Dest, __m128i Alpha) {
+    __m128i Inverse = _mm_sub_epi16(_mm_set1_epi16(255), Alpha);
+    __m128i Sum = _mm_add_epi16(_mm_mullo_epi16(Src, Alpha), _mm_mullo_epi16(Dest, Inverse));
+    
+    Sum = _mm_add_epi16(Sum, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(Sum, _mm_srli_epi16(Sum, 8)), 8);
+}
+
+static inline __m128i BlendPixelsSse2(__m128i Src, __m128i Dest, bool PerPixel, __m128i Alpha) {
+    __m128i Zero = _mm_setzero_si128();
+    __m128i SrcLow = _mm_unpacklo_epi8(Src, Zero);
+    __m128i SrcHigh = _mm_unpackhi_epi8(Src, Zero);
+    __m128i AlphaLow = Alpha;
+    __m128i AlphaHigh = Alpha;
+    
+    if (PerPixel) {
+        // Broadcast each pixel's Reserved word across its four lanes
+        AlphaLow = _mm_shufflehi_epi16(_mm_shufflelo_epi16(SrcLow, 0xFF), 0xFF);
+        AlphaHigh = _mm_shufflehi_epi16(_mm_shufflelo_epi16(SrcHigh, 0xFF), 0xFF);
+    }
+    
+    return _mm_packus_epi16(BlendWordsSse2(SrcLow, _mm_unpacklo_epi8(Dest, Zero), AlphaLow),
+                            BlendWordsSse2(SrcHigh, _mm_unpackhi_epi8(Dest, Zero), AlphaHigh));
+}
+
+static inline __m128i SwapRedBlueSse2(__m128i Pixels) {
+    __m128i Low = _mm_set1_epi32(0xFF);
+    
+    return _mm_or_si128(_mm_and_si128(Pixels, _mm_set1_epi32((int)0xFF00FF00)),
+           _mm_or_si128(_mm_and_si128(_mm_srli_epi32(Pixels, 16), Low),
+                        _mm_slli_epi32(_mm_and_si128(Pixels, Low), 16)));
+}
+
+static inline __m128i ConvertBitmaskSse2(__m128i Pixels, const __m128i Right[3],
+                                         const __m128i Mask[3], const __m128i Left[3]) {
+    __m128i Result = _mm_setzero_si128();
+    
+    for (int i = 0; i < 3; i++) {
+        Result = _mm_or_si128(Result,
+                 _mm_sll_epi32(_mm_and_si128(_mm_srl_epi32(Pixels, Right[i]), Mask[i]), Left[i]));
+    }
+    
+    return Result;
+}
+
+// (A * (256 - Weight) + B * Weight) >> 8 on 16-bit lanes
+static inline __m128i LerpWordsSse2(__m128i A, __m128i B, __m128i Weight) {
+    __m128i Inverse = _mm_sub_epi16(_mm_set1_epi16(PIXEL_LERP_ONE), Weight);
+    
+    return _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(A, Inverse), _mm_mullo_epi16(B, Weight)), 8);
+}
+
+// Pack the low 16 bits of eight 32-bit lanes
+static inline __m128i PackLow16Sse2(__m128i A, __m128i B) {
+    A = _mm_srai_epi32(_mm_slli_epi32(A, 16), 16);
+    B = _mm_srai_epi32(_mm_slli_epi32(B, 16), 16);
+    return _mm_packs_epi32(A, B);
+}
+
+static void FillSse2(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Color,
+                     uint64_t Count) {
+    __m128i Value = _mm_set1_epi32((int)LoadPixel(Color));
+    __m128i *Out = (__m128i*)Dest;
+    
+    for (; Count >= 16; Count -= 16, Out += 4) {
+        _mm_storeu_si128(Out + 0, Value);
+        _mm_storeu_si128(Out + 1, Value);
+        _mm_storeu_si128(Out + 2, Value);
+        _mm_storeu_si128(Out + 3, Value);
+    }
+    for (; Count >= 4; Count -= 4, Out++) {
+        _mm_storeu_si128(Out, Value);
+    }
+    FillScalar((EFI_GRAPHICS_OUTPUT_BLT_PIXEL*)Out, Color, Count);
+}
+
+static void CopySse2(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src,
+                     uint64_t Count) {
+    if (Dest == Src || Count == 0) {
+        return;
+    }
+    
+    // Each group is loaded completely before it is stored, so copying towards
+    // lower addresses front to back (and higher addresses back to front) is safe
+    if (Dest < Src || Dest >= Src + Count) {
+        for (; Count >= 16; Count -= 16, Src += 16, Dest += 16) {
+            __m128i A = _mm_loadu_si128((const __m128i*)Src + 0);
+            __m128i B = _mm_loadu_si128((const __m128i*)Src + 1);
+            __m128i C = _mm_loadu_si128((const __m128i*)Src + 2);
+            __m128i D = _mm_loadu_si128((const __m128i*)Src + 3);
+            _mm_storeu_si128((__m128i*)Dest + 0, A);
+            _mm_storeu_si128((__m128i*)Dest + 1, B);
+            _mm_storeu_si128((__m128i*)Dest + 2, C);
+            _mm_storeu_si128((__m128i*)Dest + 3, D);
+        }
+        for (; Count >= 4; Count -= 4, Src += 4, Dest += 4) {
+            _mm_storeu_si128((__m128i*)Dest, _mm_loadu_si128((const __m128i*)Src));
+        }
+        CopyScalar(Dest, Src, Count);
+    } else {
+        while (Count >= 16) {
+            Count -= 16;
+            __m128i A = _mm_loadu_si128((const __m128i*)(Src + Count) + 0);
+            __m128i B = _mm_loadu_si128((const __m128i*)(Src + Count) + 1);
+            __m128i C = _mm_loadu_si128((const __m128i*)(Src + Count) + 2);
+            __m128i D = _mm_loadu_si128((const __m128i*)(Src + Count) + 3);
+            _mm_storeu_si128((__m128i*)(Dest + Count) + 3, D);
+            _mm_storeu_si128((__m128i*)(Dest + Count) + 2, C);
+            _mm_storeu_si128((__m128i*)(Dest + Count) + 1, B);
+            _mm_storeu_si128((__m128i*)(Dest + Count) + 0, A);
+        }
+        while (Count >= 4) {
+            Count -= 4;
+            _mm_storeu_si128((__m128i*)(Dest + Count), _mm_loadu_si128((const __m128i*)(Src + Count)));
+        }
+        CopyScalar(Dest, Src, Count);
+    }
+}
+
+static void BlendSse2(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src,
+                      uint64_t Count) {
+    for (; Count >= 4; Count -= 4, Src += 4, Dest += 4) {
+        __m128i Pixels = BlendPixelsSse2(_mm_loadu_si128((const __m128i*)Src),
+                                         _mm_loadu_si128((const __m128i*)Dest), true, _mm_setzero_si128());
+        _mm_storeu_si128((__m128i*)Dest, Pixels);
+    }
+    BlendScalar(Dest, Src, Count);
+}
+
+static void BlendConstantSse2(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src,
+                              uint64_t Count, uint8_t Alpha) {
+    __m128i AlphaWords = _mm_set1_epi16(Alpha);
+    
+    for (; Count >= 4; Count -= 4, Src += 4, Dest += 4) {
+        __m128i Pixels = BlendPixelsSse2(_mm_loadu_si128((const __m128i*)Src),
+                                         _mm_loadu_si128((const __m128i*)Dest), false, AlphaWords);
+        _mm_storeu_si128((__m128i*)Dest, Pixels);
+    }
+    BlendConstantScalar(Dest, Src, Count, Alpha);
+}
+
+static void SwapRedBlueKernelSse2(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src,
+                                  uint64_t Count) {
+    for (; Count >= 4; Count -= 4, Src += 4, Dest += 4) {
+        _mm_storeu_si128((__m128i*)Dest, SwapRedBlueSse2(_mm_loadu_si128((const __m128i*)Src)));
+    }
+    SwapRedBlueScalar(Dest, Src, Count);
+}
+
+static void ConvertBitmaskKernelSse2(void *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src, uint64_t Count,
+                                     const PIXEL_BITMASK_LAYOUT *Layout) {
+    uint8_t *Out = (uint8_t*)Dest;
+    __m128i Right[3], Mask[3], Left[3];
+    
+    for (int i = 0; i < 3; i++) {
+        Right[i] = _mm_cvtsi32_si128((int)Layout->RightShift[i]);
+        Mask[i] = _mm_set1_epi32((int)Layout->Mask[i]);
+        Left[i] = _mm_cvtsi32_si128((int)Layout->LeftShift[i]);
+    }
+    
+    if (Layout->BytesPerPixel == 4) {
+        for (; Count >= 4; Count -= 4, Src += 4, Out += 16) {
+            _mm_storeu_si128((__m128i*)Out,
+                ConvertBitmaskSse2(_mm_loadu_si128((const __m128i*)Src), Right, Mask, Left));
+        }
+    } else if (Layout->BytesPerPixel == 2) {
+        for (; Count >= 8; Count -= 8, Src += 8, Out += 16) {
+            __m128i A = ConvertBitmaskSse2(_mm_loadu_si128((const __m128i*)Src + 0), Right, Mask, Left);
+            __m128i B = ConvertBitmaskSse2(_mm_loadu_si128((const __m128i*)Src + 1), Right, Mask, Left);
+            _mm_storeu_si128((__m128i*)Out, PackLow16Sse2(A, B));
+        }
+    }
+    ConvertBitmaskScalar(Out, Src, Count, Layout);
+}
+
+static void LerpSse2(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *A,
+                     const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *B, uint64_t Count, uint32_t Weight) {
+    __m128i Zero = _mm_setzero_si128();
+    __m128i Words = _mm_set1_epi16((short)Weight);
+    
+    for (; Count >= 4; Count -= 4, A += 4, B += 4, Dest += 4) {
+        __m128i PixelsA = _mm_loadu_si128((const __m128i*)A);
+        __m128i PixelsB = _mm_loadu_si128((const __m128i*)B);
+        
+        _mm_storeu_si128((__m128i*)Dest,
+            _mm_packus_epi16(LerpWordsSse2(_mm_unpacklo_epi8(PixelsA, Zero), _mm_unpacklo_epi8(PixelsB, Zero), Words),
+                             LerpWordsSse2(_mm_unpackhi_epi8(PixelsA, Zero), _mm_unpackhi_epi8(PixelsB, Zero), Words)));
+    }
+    LerpScalar(Dest, A, B, Count, Weight);
+}
+
+// Each neighboring pair is loaded with one 64-bit read and interleaved so a
+// single multiply-add weighs both pixels of every channel
+static void ResampleSse2(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src,
+                         uint64_t Count, const uint32_t *Index, const uint16_t *Weight) {
+    __m128i Zero = _mm_setzero_si128();
+    
+    for (; Count >= 4; Count -= 4, Index += 4, Weight += 4, Dest += 4) {
+        __m128i Sums[4];
+        
+        for (int i = 0; i < 4; i++) {
+            __m128i Pair = _mm_loadl_epi64((const __m128i*)&Src[Index[i]]);
+            __m128i Words = _mm_unpacklo_epi8(_mm_unpacklo_epi8(Pair, _mm_srli_si128(Pair, 4)), Zero);
+            __m128i Weights = _mm_set1_epi32((int)(((uint32_t)Weight[i] << 16) | (PIXEL_LERP_ONE - Weight[i])));
+            
+            Sums[i] = _mm_srli_epi32(_mm_madd_epi16(Words, Weights), 8);
+        }
+        
+        _mm_storeu_si128((__m128i*)Dest, _mm_packus_epi16(_mm_packs_epi32(Sums[0], Sums[1]),
+                                                          _mm_packs_epi32(Sums[2], Sums[3])));
+    }
+    ResampleScalar(Dest, Src, Count, Index, Weight);
+}
+
+static const PIXEL_KERNELS PixelKernelsSse2 = {
+    u"SSE2", FillSse2, CopySse2, BlendSse2, BlendConstantSse2,
+    SwapRedBlueKernelSse2, ConvertBitmaskKernelSse2, LerpSse2, ResampleSse2
+};
+
+//
+// AVX2 kernels (8 pixels per vector, SSE2 tails)
+//
+
+__attribute__((target("avx2")))
+static inline __m256i BlendWordsAvx2(__m256i Src, __m256i Dest, __m256i Alpha) {
+    __m256i Inverse = _mm256_sub_epi16(_mm256_set1_epi16(255), Alpha);
+    __m256i Sum = _mm256_add_epi16(_mm256_mullo_epi16(Src, Alpha), _mm256_mullo_epi16(Dest, Inverse));
+    
+    Sum = _mm256_add_epi16(Sum, _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(Sum, _mm256_srli_epi16(Sum, 8)), 8);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i BlendPixelsAvx2(__m256i Src, __m256i Dest, bool PerPixel, __m256i Alpha) {
+    __m256i Zero = _mm256_setzero_si256();
+    __m256i SrcLow = _mm256_unpacklo_epi8(Src, Zero);
+    __m256i SrcHigh = _mm256_unpackhi_epi8(Src, Zero);
+    __m256i AlphaLow = Alpha;
+    __m256i AlphaHigh = Alpha;
+    
+    if (PerPixel) {
+        AlphaLow = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(SrcLow, 0xFF), 0xFF);
+        AlphaHigh = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(SrcHigh, 0xFF), 0xFF);
+    }
+    
+    // Unpack and pack both work within 128-bit lanes, so pixel order is preserved
+    return _mm256_packus_epi16(BlendWordsAvx2(SrcLow, _mm256_unpacklo_epi8(Dest, Zero), AlphaLow),
+                               BlendWordsAvx2(SrcHigh, _mm256_unpackhi_epi8(Dest, Zero), AlphaHigh));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i LerpWordsAvx2(__m256i A, __m256i B, __m256i Weight) {
+    __m256i Inverse = _mm256_sub_epi16(_mm256_set1_epi16(PIXEL_LERP_ONE), Weight);
+    
+    return _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(A, Inverse), _mm256_mullo_epi16(B, Weight)), 8);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i LerpPixelsAvx2(__m256i A, __m256i B, __m256i WeightLow, __m256i WeightHigh) {
+    __m256i Zero = _mm256_setzero_si256();
+    
+    return _mm256_packus_epi16(
+        LerpWordsAvx2(_mm256_unpacklo_epi8(A, Zero), _mm256_unpacklo_epi8(B, Zero), WeightLow),
+        LerpWordsAvx2(_mm256_unpackhi_epi8(A, Zero), _mm256_unpackhi_epi8(B, Zero), WeightHigh));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i ConvertBitmaskAvx2(__m256i Pixels, const __m128i Right[3],
+                                         const __m256i Mask[3], const __m128i Left[3]) {
+    __m256i Result = _mm256_setzero_si256();
+    
+    for (int i = 0; i < 3; i++) {
+        Result = _mm256_or_si256(Result,
+                 _mm256_sll_epi32(_mm256_and_si256(_mm256_srl_epi32(Pixels, Right[i]), Mask[i]), Left[i]));
+    }
+    
+    return Result;
+}
+
+__attribute__((target("avx2")))
+static void FillAvx2(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Color,
+                     uint64_t Count) {
+    __m256i Value = _mm256_set1_epi32((int)LoadPixel(Color));
+    __m256i *Out = (__m256i*)Dest;
+    
+    for (; Count >= 32; Count -= 32, Out += 4) {
+        _mm256_storeu_si256(Out + 0, Value);
+        _mm256_storeu_si256(Out + 1, Value);
+        _mm256_storeu_si256(Out + 2, Value);
+        _mm256_storeu_si256(Out + 3, Value);
+    }
+    for (; Count >= 8; Count -= 8, Out++) {
+        _mm256_storeu_si256(Out, Value);
+    }
+    FillSse2((EFI_GRAPHICS_OUTPUT_BLT_PIXEL*)Out, Color, Count);
+}
+
+__attribute__((target("avx2")))
+static void CopyAvx2(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src,
+                     uint64_t Count) {
+    if (Dest == Src || Count == 0) {
+        return;
+    }
+    
+    if (Dest < Src || Dest >= Src + Count) {
+        for (; Count >= 32; Count -= 32, Src += 32, Dest += 32) {
+            __m256i A = _mm256_loadu_si256((const __m256i*)Src + 0);
+            __m256i B = _mm256_loadu_si256((const __m256i*)Src + 1);
+            __m256i C = _mm256_loadu_si256((const __m256i*)Src + 2);
+            __m256i D = _mm256_loadu_si256((const __m256i*)Src + 3);
+            _mm256_storeu_si256((__m256i*)Dest + 0, A);
+            _mm256_storeu_si256((__m256i*)Dest + 1, B);
+            _mm256_storeu_si256((__m256i*)Dest + 2, C);
+            _mm256_storeu_si256((__m256i*)Dest + 3, D);
+        }
+        for (; Count >= 8; Count -= 8, Src += 8, Dest += 8) {
+            _mm256_storeu_si256((__m256i*)Dest, _mm256_loadu_si256((const __m256i*)Src));
+        }
+        CopySse2(Dest, Src, Count);
+    } else {
+        while (Count >= 32) {
+            Count -= 32;
+            __m256i A = _mm256_loadu_si256((const __m256i*)(Src + Count) + 0);
+            __m256i B = _mm256_loadu_si256((const __m256i*)(Src + Count) + 1);
+            __m256i C = _mm256_loadu_si256((const __m256i*)(Src + Count) + 2);
+            __m256i D = _mm256_loadu_si256((const __m256i*)(Src + Count) + 3);
+            _mm256_storeu_si256((__m256i*)(Dest + Count) + 3, D);
+            _mm256_storeu_si256((__m256i*)(Dest + Count) + 2, C);
+            _mm256_storeu_si256((__m256i*)(Dest + Count) + 1, B);
+            _mm256_storeu_si256((__m256i*)(Dest + Count) + 0, A);
+        }
+        while (Count >= 8) {
+            Count -= 8;
+            _mm256_storeu_si256((__m256i*)(Dest + Count), _mm256_loadu_si256((const __m256i*)(Src + Count)));
+        }
+        CopySse2(Dest, Src, Count);
+    }
+}
+
+__attribute__((target("avx2")))
+static void BlendAvx2(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src,
+                      uint64_t Count) {
+    for (; Count >= 8; Count -= 8, Src += 8, Dest += 8) {
+        __m256i Pixels = BlendPixelsAvx2(_mm256_loadu_si256((const __m256i*)Src),
+                                         _mm256_loadu_si256((const __m256i*)Dest), true, _mm256_setzero_si256());
+        _mm256_storeu_si256((__m256i*)Dest, Pixels);
+    }
+    BlendSse2(Dest, Src, Count);
+}
+
+__attribute__((target("avx2")))
+static void BlendConstantAvx2(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src,
+                              uint64_t Count, uint8_t Alpha) {
+    __m256i AlphaWords = _mm256_set1_epi16(Alpha);
+    
+    for (; Count >= 8; Count -= 8, Src += 8, Dest += 8) {
+        __m256i Pixels = BlendPixelsAvx2(_mm256_loadu_si256((const __m256i*)Src),
+                                         _mm256_loadu_si256((const __m256i*)Dest), false, AlphaWords);
+        _mm256_storeu_si256((__m256i*)Dest, Pixels);
+    }
+    BlendConstantSse2(Dest, Src, Count, Alpha);
+}
+
+__attribute__((target("avx2")))
+static void SwapRedBlueAvx2(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src,
+                            uint64_t Count) {
+    const __m256i Shuffle = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+                                             2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    
+    for (; Count >= 8; Count -= 8, Src += 8, Dest += 8) {
+        _mm256_storeu_si256((__m256i*)Dest,
+            _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)Src), Shuffle));
+    }
+    SwapRedBlueKernelSse2(Dest, Src, Count);
+}
+
+__attribute__((target("avx2")))
+static void ConvertBitmaskKernelAvx2(void *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src, uint64_t Count,
+                                     const PIXEL_BITMASK_LAYOUT *Layout) {
+    uint8_t *Out = (uint8_t*)Dest;
+    __m128i Right[3], Left[3];
+    __m256i Mask[3];
+    
+    for (int i = 0; i < 3; i++) {
+        Right[i] = _mm_cvtsi32_si128((int)Layout->RightShift[i]);
+        Mask[i] = _mm256_set1_epi32((int)Layout->Mask[i]);
+        Left[i] = _mm_cvtsi32_si128((int)Layout->LeftShift[i]);
+    }
+    
+    if (Layout->BytesPerPixel == 4) {
+        for (; Count >= 8; Count -= 8, Src += 8, Out += 32) {
+            _mm256_storeu_si256((__m256i*)Out,
+                ConvertBitmaskAvx2(_mm256_loadu_si256((const __m256i*)Src), Right, Mask, Left));
+        }
+    } else if (Layout->BytesPerPixel == 2) {
+        for (; Count >= 16; Count -= 16, Src += 16, Out += 32) {
+            __m256i A = ConvertBitmaskAvx2(_mm256_loadu_si256((const __m256i*)Src + 0), Right, Mask, Left);
+            __m256i B = ConvertBitmaskAvx2(_mm256_loadu_si256((const __m256i*)Src + 1), Right, Mask, Left);
+            A = _mm256_srai_epi32(_mm256_slli_epi32(A, 16), 16);
+            B = _mm256_srai_epi32(_mm256_slli_epi32(B, 16), 16);
+            // The pack interleaves 128-bit lanes; put the quarters back in order
+            _mm256_storeu_si256((__m256i*)Out, _mm256_permute4x64_epi64(_mm256_packs_epi32(A, B), 0xD8));
+        }
+    }
+    ConvertBitmaskKernelSse2(Out, Src, Count, Layout);
+}
+
+__attribute__((target("avx2")))
+static void LerpAvx2(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *A,
+                     const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *B, uint64_t Count, uint32_t Weight) {
+    __m256i Words = _mm256_set1_epi16((short)Weight);
+    
+    for (; Count >= 8; Count -= 8, A += 8, B += 8, Dest += 8) {
+        _mm256_storeu_si256((__m256i*)Dest,
+            LerpPixelsAvx2(_mm256_loadu_si256((const __m256i*)A), _mm256_loadu_si256((const __m256i*)B),
+                           Words, Words));
+    }
+    LerpSse2(Dest, A, B, Count, Weight);
+}
+
+// Both neighbors of eight pixels are fetched with two gathers
+__attribute__((target("avx2")))
+static void ResampleAvx2(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src,
+                         uint64_t Count, const uint32_t *Index, const uint16_t *Weight) {
+    for (; Count >= 8; Count -= 8, Index += 8, Weight += 8, Dest += 8) {
+        __m256i Offsets = _mm256_loadu_si256((const __m256i*)Index);
+        __m256i PixelsA = _mm256_i32gather_epi32((const int*)Src, Offsets, 4);
+        __m256i PixelsB = _mm256_i32gather_epi32((const int*)(Src + 1), Offsets, 4);
+        
+        // Repeat each weight across its pixel's four 16-bit lanes
+        __m256i Weights = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)Weight));
+        Weights = _mm256_or_si256(Weights, _mm256_slli_epi32(Weights, 16));
+        
+        _mm256_storeu_si256((__m256i*)Dest,
+            LerpPixelsAvx2(PixelsA, PixelsB, _mm256_unpacklo_epi32(Weights, Weights),
+                           _mm256_unpackhi_epi32(Weights, Weights)));
+    }
+    ResampleSse2(Dest, Src, Count, Index, Weight);
+}
+
+static const PIXEL_KERNELS PixelKernelsAvx2 = {
+    u"AVX2", FillAvx2, CopyAvx2, BlendAvx2, BlendConstantAvx2,
+    SwapRedBlueAvx2, ConvertBitmaskKernelAvx2, LerpAvx2, ResampleAvx2
+};
+
+// Every implementation the CPU can run, slowest first
+static uint32_t GetAvailableKernels(const PIXEL_KERNELS *Kernels[3]) {
+    uint32_t Count = 0;
+    
+    Kernels[Count++] = &PixelKernelsScalar;
+    if (CpuHasFeature(CPU_FEATURE_SSE2)) {
+        Kernels[Count++] = &PixelKernelsSse2;
+    }
+    if (CpuHasFeature(CPU_FEATURE_AVX2)) {
+        Kernels[Count++] = &PixelKernelsAvx2;
+    }
+    
+    return Count;
+}
+
+// Fastest kernels the CPU supports (chosen once)
+const PIXEL_KERNELS *GetPixelKernels(void) {
+    if (SelectedKernels == NULL) {
+        const PIXEL_KERNELS *Kernels[3];
+        SelectedKernels = Kernels[GetAvailableKernels(Kernels) - 1];
+    }
+    
+    return SelectedKernels;
+}
+
+const PIXEL_KERNELS *GetScalarPixelKernels(void) {
+    return &PixelKernelsScalar;
+}
+
+void PixelFill(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Color, uint64_t Count) {
+    GetPixelKernels()->Fill(Dest, Color, Count);
+}
+
+void PixelCopy(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src, uint64_t Count) {
+    GetPixelKernels()->Copy(Dest, Src, Count);
+}
+
+void PixelBlend(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src, uint64_t Count) {
+    GetPixelKernels()->Blend(Dest, Src, Count);
+}
+
+void PixelBlendConstant(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src,
+                        uint64_t Count, uint8_t Alpha) {
+    GetPixelKernels()->BlendConstant(Dest, Src, Count, Alpha);
+}
+
+void PixelSwapRedBlue(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src, uint64_t Count) {
+    GetPixelKernels()->SwapRedBlue(Dest, Src, Count);
+}
+
+void PixelConvertBitmask(void *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src, uint64_t Count,
+                         const PIXEL_BITMASK_LAYOUT *Layout) {
+    GetPixelKernels()->ConvertBitmask(Dest, Src, Count, Layout);
+}
+
+void PixelLerp(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *A,
+               const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *B, uint64_t Count, uint32_t Weight) {
+    GetPixelKernels()->Lerp(Dest, A, B, Count, Weight);
+}
+
+void PixelResample(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src,
+                   uint64_t Count, const uint32_t *Index, const uint16_t *Weight) {
+    GetPixelKernels()->Resample(Dest, Src, Count, Index, Weight);
+}
+
+//
+// Self-test: every kernel against the scalar reference
+//
+
+typedef enum {
+    PixelTestFill,
+    PixelTestCopy,
+    PixelTestCopyOverlap,
+    PixelTestBlend,
+    PixelTestBlendConstant,
+    PixelTestSwapRedBlue,
+    PixelTestSwapRedBlueInPlace,
+    PixelTestConvertBitmask,
+    PixelTestLerp,
+    PixelTestResample,
+    PixelTestMax
+} PIXEL_TEST;
+
+static const char16_t *PixelTestNames[PixelTestMax] = {
+    u"Fill", u"Copy", u"Copy (overlapping)", u"Blend", u"BlendConstant",
+    u"SwapRedBlue", u"SwapRedBlue (in place)", u"ConvertBitmask", u"Lerp", u"Resample"
+};
+
+// Bitmask layouts exercised by the self-test
+static const EFI_PIXEL_BITMASK PixelTestMasks[] = {
+    { 0x0000F800, 0x000007E0, 0x0000001F, 0x00000000 },    // RGB 5:6:5
+    { 0x00007C00, 0x000003E0, 0x0000001F, 0x00008000 },    // XRGB 1:5:5:5
+    { 0x000000FF, 0x0000FF00, 0x00FF0000, 0x00000000 },    // Packed 24-bit RGB
+    { 0x3FF00000, 0x000FFC00, 0x000003FF, 0xC0000000 },    // XRGB 2:10:10:10
+    { 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000 },    // BGRX 8:8:8:8
+};
+
+static uint32_t PixelTestRandom(uint32_t *Seed) {
+    *Seed = *Seed * 1664525 + 1013904223;
+    return *Seed;
+}
+
+static void PixelTestRandomize(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Pixels, uint64_t Count, uint32_t Seed) {
+    for (uint64_t i = 0; i < Count; i++) {
+        StorePixel(&Pixels[i], PixelTestRandom(&Seed));
+    }
+}
+
+// Random neighbor indices below Count - 1 and weights in [0, 256] for Resample
+static void PixelTestResampleTable(uint32_t *Index, uint16_t *Weight, uint64_t Count, uint32_t Seed) {
+    for (uint64_t i = 0; i < Count; i++) {
+        Index[i] = PixelTestRandom(&Seed) % (uint32_t)(Count - 1);
+        Weight[i] = (uint16_t)((PixelTestRandom(&Seed) >> 8) % (PIXEL_LERP_ONE + 1));
+    }
+}
+
+static bool PixelBuffersEqual(const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *A, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *B,
+                              uint64_t Count) {
+    for (uint64_t i = 0; i < Count; i++) {
+        if (LoadPixel(&A[i]) != LoadPixel(&B[i])) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+// Run one kernel on a buffer; Offset misaligns the spans, Param is the
+// alpha, overlap distance, layout index or weight depending on the test
+static void PixelTestRun(const PIXEL_KERNELS *Kernels, PIXEL_TEST Test,
+                         EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src,
+                         uint64_t Count, uint32_t Param, const uint32_t *Index, const uint16_t *Weight) {
+    PIXEL_BITMASK_LAYOUT Layout;
+    
+    switch (Test) {
+    case PixelTestFill:
+        Kernels->Fill(Dest, Src, Count);
+        break;
+    case PixelTestCopy:
+        Kernels->Copy(Dest, Src, Count);
+        break;
+    case PixelTestCopyOverlap:
+        // Both spans live in Dest; Param encodes a signed distance around 8
+        Kernels->Copy(Dest + Param, Dest + 8, Count);
+        break;
+    case PixelTestBlend:
+        Kernels->Blend(Dest, Src, Count);
+        break;
+    case PixelTestBlendConstant:
+        Kernels->BlendConstant(Dest, Src, Count, (uint8_t)Param);
+        break;
+    case PixelTestSwapRedBlue:
+        Kernels->SwapRedBlue(Dest, Src, Count);
+        break;
+    case PixelTestSwapRedBlueInPlace:
+        Kernels->SwapRedBlue(Dest, Dest, Count);
+        break;
+    case PixelTestConvertBitmask:
+        PixelBitmaskLayoutInit(&Layout, &PixelTestMasks[Param]);
+        Kernels->ConvertBitmask(Dest, Src, Count, &Layout);
+        break;
+    case PixelTestLerp:
+        Kernels->Lerp(Dest, Src, Dest, Count, Param);
+        break;
+    case PixelTestResample:
+        Kernels->Resample(Dest, Src, Count, Index, Weight);
+        break;
+    default:
+        break;
+    }
+}
+
+// Number of Param values each test is run with
+static uint32_t PixelTestParamCount(PIXEL_TEST Test) {
+    switch (Test) {
+    case PixelTestCopyOverlap:
+        return 17;
+    case PixelTestBlendConstant:
+    case PixelTestLerp:
+        return 5;
+    case PixelTestConvertBitmask:
+        return sizeof(PixelTestMasks) / sizeof(PixelTestMasks[0]);
+    default:
+        return 1;
+    }
+}
+
+static uint32_t PixelTestParam(PIXEL_TEST Test, uint32_t Index, uint32_t *Seed) {
+    static const uint8_t Alphas[5] = { 0, 1, 128, 255, 0 };
+    static const uint16_t Weights[5] = { 0, 1, 128, 255, PIXEL_LERP_ONE };
+    
+    switch (Test) {
+    case PixelTestBlendConstant:
+        return Index < 4 ? Alphas[Index] : (PixelTestRandom(Seed) >> 24);
+    case PixelTestLerp:
+        return Weights[Index];
+    default:
+        return Index;
+    }
+}
+
+// Compare every available kernel with the scalar reference over many
+// lengths and alignments, including the guard pixels around each span
+EFI_STATUS PixelKernelSelfTest(void) {
+    static const uint32_t Counts[] = { 0, 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 32, 33,
+                                       63, 64, 65, 100, 255, 257, 300 };
+    const uint64_t Total = PIXEL_TEST_PIXELS + 2 * PIXEL_TEST_GUARD;
+    const PIXEL_KERNELS *Kernels[3];
+    uint32_t KernelCount = GetAvailableKernels(Kernels);
+    uint32_t Seed = 0x12345678;
+    uint64_t Checks = 0;
+    EFI_STATUS Status = EFI_SUCCESS;
+    
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src = (EFI_GRAPHICS_OUTPUT_BLT_PIXEL*)AllocatePool(
+        Total * 3 * sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL) + PIXEL_TEST_PIXELS * (sizeof(uint32_t) + sizeof(uint16_t)));
+    if (Src == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Expected = Src + Total;
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Actual = Expected + Total;
+    uint32_t *Index = (uint32_t*)(Actual + Total);
+    uint16_t *Weight = (uint16_t*)(Index + PIXEL_TEST_PIXELS);
+    
+    for (uint32_t k = 1; k < KernelCount && Status == EFI_SUCCESS; k++) {
+        for (int Test = 0; Test < PixelTestMax && Status == EFI_SUCCESS; Test++) {
+            for (uint32_t p = 0; p < PixelTestParamCount(Test) && Status == EFI_SUCCESS; p++) {
+                uint32_t Param = PixelTestParam(Test, p, &Seed);
+                
+                for (uint32_t c = 0; c < sizeof(Counts) / sizeof(Counts[0]); c++) {
+                    uint32_t Offset = c & 3;
+                    uint32_t DataSeed = PixelTestRandom(&Seed);
+                    
+                    PixelTestRandomize(Src, Total, DataSeed);
+                    PixelTestRandomize(Expected, Total, DataSeed ^ 0x5A5A5A5A);
+                    PixelTestRandomize(Actual, Total, DataSeed ^ 0x5A5A5A5A);
+                    PixelTestResampleTable(Index, Weight, PIXEL_TEST_PIXELS, DataSeed);
+                    
+                    PixelTestRun(&PixelKernelsScalar, Test, Expected + PIXEL_TEST_GUARD + Offset,
+                                 Src + PIXEL_TEST_GUARD, Counts[c], Param, Index, Weight);
+                    PixelTestRun(Kernels[k], Test, Actual + PIXEL_TEST_GUARD + Offset,
+                                 Src + PIXEL_TEST_GUARD, Counts[c], Param, Index, Weight);
+                    Checks++;
+                    
+                    if (!PixelBuffersEqual(Expected, Actual, Total)) {
+                        PRINT(u"Pixel self-test: ");
+                        PRINT(Kernels[k]->Name);
+                        PRINT(u" ");
+                        PRINT(PixelTestNames[Test]);
+                        PRINT(u" failed for ");
+                        PrintDec(Counts[c]);
+                        PRINTL(u" pixels");
+                        Status = EFI_DEVICE_ERROR;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+    
+    FreePool(Src);
+    
+    if (Status == EFI_SUCCESS) {
+        PRINT(u"Pixel self-test: ");
+        PrintDec(Checks);
+        PRINTL(u" checks passed");
+    }
+    
+    return Status;
+}
+
+//
+// Benchmark
+//
+
+static uint64_t TimePixelKernel(const PIXEL_KERNELS *Kernels, PIXEL_TEST Test,
+                                EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src,
+                                const uint32_t *Index, const uint16_t *Weight) {
+    PIXEL_BITMASK_LAYOUT Layout;
+    uint64_t Start = ReadTimestamp();
+    
+    // 5:6:5 is the layout most likely to need conversion in practice
+    PixelBitmaskLayoutInit(&Layout, &PixelTestMasks[0]);
+    
+    for (int Pass = 0; Pass < PIXEL_BENCHMARK_PASSES; Pass++) {
+        switch (Test) {
+        case PixelTestFill:
+            Kernels->Fill(Dest, &Src[Pass], PIXEL_BENCHMARK_PIXELS);
+            break;
+        case PixelTestCopy:
+            Kernels->Copy(Dest, Src, PIXEL_BENCHMARK_PIXELS);
+            break;
+        case PixelTestCopyOverlap:
+            Kernels->Copy(Dest + 1, Dest, PIXEL_BENCHMARK_PIXELS - 1);
+            break;
+        case PixelTestBlend:
+            Kernels->Blend(Dest, Src, PIXEL_BENCHMARK_PIXELS);
+            break;
+        case PixelTestBlendConstant:
+            Kernels->BlendConstant(Dest, Src, PIXEL_BENCHMARK_PIXELS, 0x80);
+            break;
+        case PixelTestSwapRedBlue:
+            Kernels->SwapRedBlue(Dest, Src, PIXEL_BENCHMARK_PIXELS);
+            break;
+        case PixelTestSwapRedBlueInPlace:
+            Kernels->SwapRedBlue(Dest, Dest, PIXEL_BENCHMARK_PIXELS);
+            break;
+        case PixelTestConvertBitmask:
+            Kernels->ConvertBitmask(Dest, Src, PIXEL_BENCHMARK_PIXELS, &Layout);
+            break;
+        case PixelTestLerp:
+            Kernels->Lerp(Dest, Src, Dest, PIXEL_BENCHMARK_PIXELS, 0x60);
+            break;
+        case PixelTestResample:
+            Kernels->Resample(Dest, Src, PIXEL_BENCHMARK_PIXELS, Index, Weight);
+            break;
+        default:
+            break;
+        }
+    }
+    
+    return ReadTimestamp() - Start;
+}
+
+// Print Mpixel/s for every kernel and implementation
+void PixelKernelBenchmark(void) {
+    const uint64_t Pixels = (uint64_t)PIXEL_BENCHMARK_PIXELS * PIXEL_BENCHMARK_PASSES;
+    const PIXEL_KERNELS *Kernels[3];
+    uint32_t KernelCount = GetAvailableKernels(Kernels);
+    
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src = (EFI_GRAPHICS_OUTPUT_BLT_PIXEL*)AllocatePool(
+        (uint64_t)PIXEL_BENCHMARK_PIXELS * (2 * sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL) + sizeof(uint32_t) + sizeof(uint16_t)));
+    if (Src == NULL) {
+        PRINTL(u"Pixel benchmark: out of memory");
+        return;
+    }
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest = Src + PIXEL_BENCHMARK_PIXELS;
+    uint32_t *Index = (uint32_t*)(Dest + PIXEL_BENCHMARK_PIXELS);
+    uint16_t *Weight = (uint16_t*)(Index + PIXEL_BENCHMARK_PIXELS);
+    
+    PixelTestRandomize(Src, PIXEL_BENCHMARK_PIXELS, 1);
+    PixelTestRandomize(Dest, PIXEL_BENCHMARK_PIXELS, 2);
+    
+    // A 3:4 upscale, so the gathers walk forward through the source like a real row
+    for (uint32_t i = 0; i < PIXEL_BENCHMARK_PIXELS; i++) {
+        uint64_t Position = (uint64_t)i * 3 * PIXEL_LERP_ONE / 4;
+        Index[i] = (uint32_t)(Position / PIXEL_LERP_ONE);
+        Weight[i] = (uint16_t)(Position % PIXEL_LERP_ONE);
+    }
+    
+    for (int Test = 0; Test < PixelTestMax; Test++) {
+        PRINT(PixelTestNames[Test]);
+        PRINT(u":");
+        
+        for (uint32_t k = 0; k < KernelCount; k++) {
+            uint64_t Ticks = TimePixelKernel(Kernels[k], Test, Dest, Src, Index, Weight);
+            
+            PRINT(u" ");
+            PRINT(Kernels[k]->Name);
+            PRINT(u" ");
+            PrintDec(BytesPerSecond(Pixels, Ticks) / 1000000);
+        }
+        
+        PRINTL(u" Mpixel/s");
+    }
+    
+    FreePool(Src);
+}
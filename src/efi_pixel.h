@@ -0,0 +1,71 @@
+// efi_pixel.h
+#ifndef TINYUEFI_PIXEL_H
+#define TINYUEFI_PIXEL_H
+
+#include "uefi_types.h"
+#include "efi_gop_protocol.h"
+
+// Span size and repetitions used by PixelKernelBenchmark
+#define PIXEL_BENCHMARK_PIXELS        (1024 * 1024)
+#define PIXEL_BENCHMARK_PASSES        16
+
+// Precomputed conversion from a Blt pixel into a PixelBitMask layout.
+// Each channel (Blue, Green, Red) is produced as ((Pixel >> RightShift) & Mask) << LeftShift.
+typedef struct {
+    uint32_t RightShift[3];
+    uint32_t Mask[3];
+    uint32_t LeftShift[3];
+    uint32_t BytesPerPixel;
+} PIXEL_BITMASK_LAYOUT;
+
+// Largest interpolation weight taken by Lerp and Resample (weights are in 1/256ths)
+#define PIXEL_LERP_ONE                256
+
+// One implementation of every pixel kernel.
+// Spans are Count pixels; Blend treats Src->Reserved as alpha and blends all four
+// channels, Copy allows overlapping spans and SwapRedBlue allows Dest == Src.
+// Lerp computes (A * (256 - Weight) + B * Weight) >> 8 per channel and allows
+// Dest == A or Dest == B; Resample does the same between Src[Index[i]] and
+// Src[Index[i] + 1] with Weight[i], so both of those pixels must be readable.
+typedef struct {
+    const char16_t *Name;
+    void (*Fill)(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Color, uint64_t Count);
+    void (*Copy)(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src, uint64_t Count);
+    void (*Blend)(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src, uint64_t Count);
+    void (*BlendConstant)(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src,
+                          uint64_t Count, uint8_t Alpha);
+    void (*SwapRedBlue)(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src, uint64_t Count);
+    void (*ConvertBitmask)(void *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src, uint64_t Count,
+                           const PIXEL_BITMASK_LAYOUT *Layout);
+    void (*Lerp)(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *A,
+                 const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *B, uint64_t Count, uint32_t Weight);
+    void (*Resample)(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src,
+                     uint64_t Count, const uint32_t *Index, const uint16_t *Weight);
+} PIXEL_KERNELS;
+
+// Kernel selection
+const PIXEL_KERNELS *GetPixelKernels(void);
+const PIXEL_KERNELS *GetScalarPixelKernels(void);
+
+// Helper functions (use the kernels chosen by GetPixelKernels)
+EFI_STATUS PixelBitmaskLayoutInit(PIXEL_BITMASK_LAYOUT *Layout, const EFI_PIXEL_BITMASK *Mask);
+uint32_t PixelToBitmask(const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Pixel, const PIXEL_BITMASK_LAYOUT *Layout);
+void PixelFromBitmask(uint32_t Value, const PIXEL_BITMASK_LAYOUT *Layout, EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Pixel);
+void PixelFill(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Color, uint64_t Count);
+void PixelCopy(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src, uint64_t Count);
+void PixelBlend(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src, uint64_t Count);
+void PixelBlendConstant(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src,
+                        uint64_t Count, uint8_t Alpha);
+void PixelSwapRedBlue(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src, uint64_t Count);
+void PixelConvertBitmask(void *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src, uint64_t Count,
+                         const PIXEL_BITMASK_LAYOUT *Layout);
+void PixelLerp(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *A,
+               const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *B, uint64_t Count, uint32_t Weight);
+void PixelResample(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Dest, const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src,
+                   uint64_t Count, const uint32_t *Index, const uint16_t *Weight);
+
+// Verification and measurement
+EFI_STATUS PixelKernelSelfTest(void);
+void PixelKernelBenchmark(void);
+
+#endif // TINYUEFI_PIXEL_H
@@ -0,0 +1,201 @@
+// efi_protocol_cache.c
+#include "efi_protocol_cache.h"
+#include "uefi_helpers.h"
+#include "efi_timer.h"
+
+static PROTOCOL_CACHE Cache;
+
+// Installed on fresh handles by ProtocolCacheBenchmark
+static EFI_GUID BenchmarkProtocolGuid = {
+    0x6c1a3f27, 0x9e04, 0x4b8d, {0xa5, 0x13, 0x2f, 0x7e, 0x90, 0xc4, 0x5b, 0x1d}
+};
+
+static inline void LoadGuid(const EFI_GUID *Guid, uint64_t *Words) {
+    __builtin_memcpy(Words, Guid, 2 * sizeof(uint64_t));
+}
+
+// Runs at TPL_CALLBACK when an interface for the entry's protocol is
+// installed or reinstalled
+static void ProtocolInstalled(EFI_EVENT Event, void *Context) {
+    PROTOCOL_CACHE_ENTRY *Entry = (PROTOCOL_CACHE_ENTRY*)Context;
+    
+    Entry->Generation++;
+    Entry->Valid = false;
+    Cache.Invalidations++;
+}
+
+static PROTOCOL_CACHE_ENTRY *FindEntry(const uint64_t *Words) {
+    for (uint32_t i = 0; i < Cache.Count; i++) {
+        PROTOCOL_CACHE_ENTRY *Entry = &Cache.Entries[i];
+        if (Entry->Guid[0] == Words[0] && Entry->Guid[1] == Words[1]) {
+            return Entry;
+        }
+    }
+    return NULL;
+}
+
+// Take a free entry and register for installs of Protocol; NULL when the
+// table is full or the firmware cannot notify
+static PROTOCOL_CACHE_ENTRY *AddEntry(const EFI_GUID *Protocol, const uint64_t *Words) {
+    if (Cache.Count == PROTOCOL_CACHE_SIZE) {
+        return NULL;
+    }
+    
+    PROTOCOL_CACHE_ENTRY *Entry = &Cache.Entries[Cache.Count];
+    MemSet(Entry, 0, sizeof(*Entry));
+    Entry->Guid[0] = Words[0];
+    Entry->Guid[1] = Words[1];
+    
+    EFI_STATUS Status = ST->BootServices->CreateEvent(EVT_NOTIFY_SIGNAL, TPL_CALLBACK, ProtocolInstalled,
+                                                      Entry, &Entry->Event);
+    if (EFI_ERROR(Status)) {
+        return NULL;
+    }
+    
+    EFI_REGISTER_PROTOCOL_NOTIFY RegisterProtocolNotify =
+        (EFI_REGISTER_PROTOCOL_NOTIFY)ST->BootServices->RegisterProtocolNotify;
+    Status = RegisterProtocolNotify((EFI_GUID*)Protocol, Entry->Event, &Entry->Registration);
+    if (EFI_ERROR(Status)) {
+        ST->BootServices->CloseEvent(Entry->Event);
+        return NULL;
+    }
+    
+    Cache.Count++;
+    return Entry;
+}
+
+// LocateProtocol answered from the cache while no interface for Protocol
+// has been installed since the last firmware lookup
+EFI_STATUS CachedLocateProtocol(const EFI_GUID *Protocol, void **Interface) {
+    uint64_t Words[2];
+    
+    if (Protocol == NULL || Interface == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    LoadGuid(Protocol, Words);
+    PROTOCOL_CACHE_ENTRY *Entry = FindEntry(Words);
+    if (Entry != NULL && Entry->Valid) {
+        Cache.Hits++;
+        *Interface = Entry->Interface;
+        return Entry->Status;
+    }
+    
+    if (Entry == NULL) {
+        Entry = AddEntry(Protocol, Words);
+    }
+    if (Entry == NULL) {
+        Cache.Uncached++;
+        return LocateProtocol((EFI_GUID*)Protocol, Interface);
+    }
+    
+    // A notification while the firmware looks leaves the entry stale
+    uint32_t Generation = Entry->Generation;
+    Cache.Misses++;
+    Entry->Status = LocateProtocol((EFI_GUID*)Protocol, &Entry->Interface);
+    Entry->Valid = Entry->Generation == Generation;
+    
+    *Interface = Entry->Interface;
+    return Entry->Status;
+}
+
+// Forget the lookup for Protocol, or for every protocol when NULL
+void ProtocolCacheInvalidate(const EFI_GUID *Protocol) {
+    uint64_t Words[2] = { 0, 0 };
+    
+    if (Protocol != NULL) {
+        LoadGuid(Protocol, Words);
+    }
+    
+    for (uint32_t i = 0; i < Cache.Count; i++) {
+        PROTOCOL_CACHE_ENTRY *Entry = &Cache.Entries[i];
+        if (Protocol == NULL || (Entry->Guid[0] == Words[0] && Entry->Guid[1] == Words[1])) {
+            Entry->Generation++;
+            Entry->Valid = false;
+            Cache.Invalidations++;
+        }
+    }
+}
+
+// Drop every entry and its notification, and clear the statistics
+void ProtocolCacheReset(void) {
+    for (uint32_t i = 0; i < Cache.Count; i++) {
+        ST->BootServices->CloseEvent(Cache.Entries[i].Event);
+    }
+    MemSet(&Cache, 0, sizeof(Cache));
+}
+
+const PROTOCOL_CACHE *GetProtocolCache(void) {
+    return &Cache;
+}
+
+void ProtocolCachePrintStats(void) {
+    PRINT(u"Protocol cache: ");
+    PrintDec(Cache.Count);
+    PRINT(u" protocols, firmware lookups avoided ");
+    PrintDec(Cache.Hits);
+    PRINT(u", made ");
+    PrintDec(Cache.Misses);
+    PRINT(u", uncached ");
+    PrintDec(Cache.Uncached);
+    PRINT(u", invalidations ");
+    PrintDec(Cache.Invalidations);
+    PRINTL(u"");
+}
+
+static void PrintLookupCost(const char16_t *Label, uint64_t Ticks) {
+    PRINT(Label);
+    PrintDec(TimestampToMicroseconds(Ticks) * 1000 / PROTOCOL_CACHE_BENCHMARK_LOOKUPS);
+    PRINTL(u" ns per lookup");
+}
+
+// Install a test protocol, time firmware against cached lookups of it, then
+// check that a second install invalidates the entry and that an explicit
+// invalidation after uninstalling is seen
+void ProtocolCacheBenchmark(void) {
+    static uint8_t Interfaces[2];
+    EFI_INSTALL_PROTOCOL_INTERFACE InstallProtocolInterface =
+        (EFI_INSTALL_PROTOCOL_INTERFACE)ST->BootServices->InstallProtocolInterface;
+    EFI_UNINSTALL_PROTOCOL_INTERFACE UninstallProtocolInterface =
+        (EFI_UNINSTALL_PROTOCOL_INTERFACE)ST->BootServices->UninstallProtocolInterface;
+    EFI_HANDLE Handles[2] = { NULL, NULL };
+    void *Interface = NULL;
+    
+    if (EFI_ERROR(InstallProtocolInterface(&Handles[0], &BenchmarkProtocolGuid, EFI_NATIVE_INTERFACE, &Interfaces[0]))) {
+        PRINTL(u"Protocol cache benchmark: cannot install the test protocol");
+        return;
+    }
+    
+    CachedLocateProtocol(&BenchmarkProtocolGuid, &Interface);
+    
+    uint64_t Start = ReadTimestamp();
+    for (uint32_t i = 0; i < PROTOCOL_CACHE_BENCHMARK_LOOKUPS; i++) {
+        LocateProtocol(&BenchmarkProtocolGuid, &Interface);
+    }
+    uint64_t FirmwareTicks = ReadTimestamp() - Start;
+    
+    Start = ReadTimestamp();
+    for (uint32_t i = 0; i < PROTOCOL_CACHE_BENCHMARK_LOOKUPS; i++) {
+        CachedLocateProtocol(&BenchmarkProtocolGuid, &Interface);
+    }
+    uint64_t CachedTicks = ReadTimestamp() - Start;
+    
+    PrintLookupCost(u"LocateProtocol: ", FirmwareTicks);
+    PrintLookupCost(u"Cached: ", CachedTicks);
+    
+    // The notification runs as the install returns to our TPL
+    uint64_t Invalidations = Cache.Invalidations;
+    InstallProtocolInterface(&Handles[1], &BenchmarkProtocolGuid, EFI_NATIVE_INTERFACE, &Interfaces[1]);
+    bool Notified = Cache.Invalidations > Invalidations;
+    CachedLocateProtocol(&BenchmarkProtocolGuid, &Interface);
+    
+    UninstallProtocolInterface(Handles[0], &BenchmarkProtocolGuid, &Interfaces[0]);
+    UninstallProtocolInterface(Handles[1], &BenchmarkProtocolGuid, &Interfaces[1]);
+    ProtocolCacheInvalidate(&BenchmarkProtocolGuid);
+    bool Removed = CachedLocateProtocol(&BenchmarkProtocolGuid, &Interface) == EFI_NOT_FOUND;
+    
+    const char16_t *Result = Notified && Removed ? u"Install notification and invalidation: ok" :
+                                                  u"Install notification and invalidation: FAILED";
+    PRINTL(Result);
+    ProtocolCachePrintStats();
+}
@@ -0,0 +1,50 @@
+// efi_protocol_cache.h
+#ifndef TINYUEFI_PROTOCOL_CACHE_H
+#define TINYUEFI_PROTOCOL_CACHE_H
+
+#include "uefi_types.h"
+#include "efi_protocol_discovery.h"
+
+// Protocols the cache holds; lookups for further ones go to the firmware
+#define PROTOCOL_CACHE_SIZE           16
+
+// Lookups timed each way by ProtocolCacheBenchmark
+#define PROTOCOL_CACHE_BENCHMARK_LOOKUPS 100000
+
+// One protocol. The GUID is kept as two 64-bit words so a probe is two
+// compares. Installing or reinstalling the protocol on any handle signals
+// Event, which marks the entry stale.
+typedef struct {
+    uint64_t Guid[2];
+    EFI_EVENT Event;
+    void *Registration;
+    void *Interface;
+    EFI_STATUS Status;            // Outcome of the last firmware lookup
+    volatile uint32_t Generation; // Bumped by each notification
+    volatile bool Valid;
+} PROTOCOL_CACHE_ENTRY;
+
+// Results of LocateProtocol by GUID, failures included. The firmware does
+// not notify on uninstall; code that removes or disconnects an interface
+// calls ProtocolCacheInvalidate.
+typedef struct {
+    PROTOCOL_CACHE_ENTRY Entries[PROTOCOL_CACHE_SIZE];
+    uint32_t Count;
+    uint64_t Hits;                // Firmware lookups avoided
+    uint64_t Misses;              // Firmware lookups made to fill an entry
+    uint64_t Uncached;            // Passed through: table full or no notification
+    uint64_t Invalidations;       // Install notifications and explicit invalidations
+} PROTOCOL_CACHE;
+
+// Cached lookups. ProtocolCacheReset closes the notification events and
+// must run before the image exits.
+EFI_STATUS CachedLocateProtocol(const EFI_GUID *Protocol, void **Interface);
+void ProtocolCacheInvalidate(const EFI_GUID *Protocol);
+void ProtocolCacheReset(void);
+const PROTOCOL_CACHE *GetProtocolCache(void);
+
+// Reporting
+void ProtocolCachePrintStats(void);
+void ProtocolCacheBenchmark(void);
+
+#endif // TINYUEFI_PROTOCOL_CACHE_H
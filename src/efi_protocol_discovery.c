@@ -12,41 +12,23 @@ EFI_STATUS LocateProtocol(EFI_GUID *Protocol, void **Interface) {
     return LocateProtocol(Protocol, NULL, Interface);
 }
 
-// Locate all handles that support a specified protocol
+// Locate all handles that support a specified protocol. The firmware sizes
+// and allocates the buffer in one call; free it with FreePool.
 EFI_STATUS LocateHandles(EFI_GUID *Protocol, EFI_HANDLE **HandleBuffer, uint64_t *HandleCount) {
     EFI_STATUS Status;
-    uint64_t BufferSize = 0;
     
     if (Protocol == NULL || HandleBuffer == NULL || HandleCount == NULL) {
         return EFI_INVALID_PARAMETER;
     }
     
-    EFI_LOCATE_HANDLE LocateHandle = (EFI_LOCATE_HANDLE)ST->BootServices->LocateHandleBuffer;
-    
-    // Get the size needed for handles
-    Status = LocateHandle(ByProtocol, Protocol, NULL, &BufferSize, NULL);
-    if (Status != EFI_BUFFER_TOO_SMALL) {
-        *HandleCount = 0;
-        *HandleBuffer = NULL;
-        return EFI_NOT_FOUND;
-    }
-    
-    // Allocate memory for handles
-    *HandleBuffer = (EFI_HANDLE*)AllocatePool(BufferSize);
-    if (*HandleBuffer == NULL) {
-        return EFI_OUT_OF_RESOURCES;
-    }
-    
-    // Get all handles
-    Status = LocateHandle(ByProtocol, Protocol, NULL, &BufferSize, *HandleBuffer);
+    EFI_LOCATE_HANDLE_BUFFER LocateHandleBuffer = (EFI_LOCATE_HANDLE_BUFFER)ST->BootServices->LocateHandleBuffer;
+    Status = LocateHandleBuffer(ByProtocol, Protocol, NULL, HandleCount, HandleBuffer);
     if (EFI_ERROR(Status)) {
-        FreePool(*HandleBuffer);
-        *HandleBuffer = NULL;
         *HandleCount = 0;
+        *HandleBuffer = NULL;
         return Status;
     }
     
-    *HandleCount = BufferSize / sizeof(EFI_HANDLE);
     return EFI_SUCCESS;
 }
 
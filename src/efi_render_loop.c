@@ -0,0 +1,299 @@
+// efi_render_loop.c
+#include "efi_render_loop.h"
+#include "uefi_helpers.h"
+#include "efi_timer.h"
+#include "efi_gop_protocol.h"
+#include "efi_gop_surface.h"
+
+// SetTimer units per second
+#define TIMER_UNITS_PER_SECOND        10000000ull
+
+// Prepare a loop that wakes TargetFps times per second
+EFI_STATUS RenderLoopInit(RENDER_LOOP *Loop, uint32_t TargetFps,
+                          const RENDER_LOOP_CALLBACKS *Callbacks, void *Context) {
+    if (Loop == NULL || Callbacks == NULL || Callbacks->Update == NULL || Callbacks->Present == NULL ||
+        TargetFps == 0 || TargetFps > RENDER_LOOP_MAX_FPS) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    MemSet(Loop, 0, sizeof(*Loop));
+    Loop->Callbacks = *Callbacks;
+    Loop->Context = Context;
+    Loop->TargetFps = TargetFps;
+    Loop->FrameInterval = TIMER_UNITS_PER_SECOND / TargetFps;
+    
+    // The first frame always presents
+    Loop->Dirty = true;
+    return EFI_SUCCESS;
+}
+
+// Ask RenderLoopRun to return after the current frame
+void RenderLoopStop(RENDER_LOOP *Loop) {
+    if (Loop != NULL) {
+        Loop->Running = false;
+    }
+}
+
+// Request a present at the end of the current frame
+void RenderLoopMarkDirty(RENDER_LOOP *Loop) {
+    if (Loop != NULL) {
+        Loop->Dirty = true;
+    }
+}
+
+const RENDER_FRAME_TIMES *RenderLoopLastFrame(RENDER_LOOP *Loop) {
+    if (Loop == NULL || Loop->Frames == 0) {
+        return NULL;
+    }
+    
+    return &Loop->History[(Loop->Frames - 1) % RENDER_LOOP_HISTORY];
+}
+
+// Deliver every queued key to the Input callback
+static EFI_STATUS DrainInput(RENDER_LOOP *Loop) {
+    EFI_INPUT_KEY Key;
+    
+    while (Loop->Running && ST->ConIn->ReadKeyStroke(ST->ConIn, &Key) == EFI_SUCCESS) {
+        EFI_STATUS Status = Loop->Callbacks.Input(Loop, Loop->Context, &Key);
+        Loop->InputEvents++;
+        if (EFI_ERROR(Status)) {
+            return Status;
+        }
+    }
+    
+    return EFI_SUCCESS;
+}
+
+// Run one frame: update, then present only if something changed
+static EFI_STATUS RunFrame(RENDER_LOOP *Loop, uint64_t ExpectedTicks) {
+    RENDER_FRAME_TIMES *Times = &Loop->History[Loop->Frames % RENDER_LOOP_HISTORY];
+    uint64_t Start = ReadTimestamp();
+    EFI_STATUS Status;
+    
+    Times->IntervalTicks = Start - Loop->LastFrameStart;
+    Times->PresentTicks = 0;
+    Loop->LastFrameStart = Start;
+    
+    // A late wake-up means the timer fired more than once since the last frame
+    if (Loop->Frames > 0 && ExpectedTicks > 0) {
+        uint64_t Periods = (Times->IntervalTicks + ExpectedTicks / 2) / ExpectedTicks;
+        if (Periods > 1) {
+            Loop->MissedFrames += Periods - 1;
+        }
+    }
+    
+    Status = Loop->Callbacks.Update(Loop, Loop->Context);
+    uint64_t Updated = ReadTimestamp();
+    Times->UpdateTicks = Updated - Start;
+    
+    if (!EFI_ERROR(Status) && Loop->Dirty) {
+        Loop->Dirty = false;
+        Status = Loop->Callbacks.Present(Loop, Loop->Context);
+        Times->PresentTicks = ReadTimestamp() - Updated;
+        Loop->Presents++;
+    } else if (!EFI_ERROR(Status)) {
+        Loop->SkippedPresents++;
+    }
+    
+    Loop->Frames++;
+    Loop->TotalUpdateTicks += Times->UpdateTicks;
+    Loop->TotalPresentTicks += Times->PresentTicks;
+    if (Times->UpdateTicks > Loop->MaxUpdateTicks) {
+        Loop->MaxUpdateTicks = Times->UpdateTicks;
+    }
+    if (Times->PresentTicks > Loop->MaxPresentTicks) {
+        Loop->MaxPresentTicks = Times->PresentTicks;
+    }
+    
+    if (Loop->FrameLimit != 0 && Loop->Frames >= Loop->FrameLimit) {
+        Loop->Running = false;
+    }
+    
+    return Status;
+}
+
+// Run frames on a periodic timer until RenderLoopStop, the frame limit or a
+// callback error. The CPU sleeps in WaitForEvent between frames; keyboard
+// input wakes it through the same wait.
+EFI_STATUS RenderLoopRun(RENDER_LOOP *Loop) {
+    EFI_EVENT Events[2];
+    uint64_t EventCount = 1;
+    uint64_t Index;
+    EFI_STATUS Status;
+    
+    if (Loop == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    Status = ST->BootServices->CreateEvent(EVT_TIMER, TPL_CALLBACK, NULL, NULL, &Loop->Timer);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    Status = ST->BootServices->SetTimer(Loop->Timer, TimerPeriodic, Loop->FrameInterval);
+    if (EFI_ERROR(Status)) {
+        ST->BootServices->CloseEvent(Loop->Timer);
+        Loop->Timer = NULL;
+        return Status;
+    }
+    
+    Events[0] = Loop->Timer;
+    if (Loop->Callbacks.Input != NULL) {
+        Events[EventCount++] = ST->ConIn->WaitForKey;
+    }
+    
+    uint64_t ExpectedTicks = GetTimestampFrequency() / Loop->TargetFps;
+    Loop->StartTicks = ReadTimestamp();
+    Loop->LastFrameStart = Loop->StartTicks;
+    Loop->Running = true;
+    
+    while (Loop->Running) {
+        Status = ST->BootServices->WaitForEvent(EventCount, Events, &Index);
+        if (EFI_ERROR(Status)) {
+            break;
+        }
+        
+        Status = Index == 0 ? RunFrame(Loop, ExpectedTicks) : DrainInput(Loop);
+        if (EFI_ERROR(Status)) {
+            break;
+        }
+    }
+    
+    Loop->Running = false;
+    Loop->ElapsedTicks = ReadTimestamp() - Loop->StartTicks;
+    
+    ST->BootServices->SetTimer(Loop->Timer, TimerCancel, 0);
+    ST->BootServices->CloseEvent(Loop->Timer);
+    Loop->Timer = NULL;
+    return Status;
+}
+
+void RenderLoopPrintStats(RENDER_LOOP *Loop) {
+    if (Loop == NULL) {
+        return;
+    }
+    
+    uint64_t Frames = Loop->Frames ? Loop->Frames : 1;
+    uint64_t Presents = Loop->Presents ? Loop->Presents : 1;
+    uint64_t Busy = Loop->TotalUpdateTicks + Loop->TotalPresentTicks;
+    uint64_t Elapsed = Loop->ElapsedTicks ? Loop->ElapsedTicks : 1;
+    
+    PRINT(u"Frames: ");
+    PrintDec(Loop->Frames);
+    PRINT(u" at ");
+    PrintDec(Loop->TargetFps);
+    PRINT(u" fps target, ");
+    PrintDec(Loop->Frames * 1000000 / (TimestampToMicroseconds(Elapsed) + 1));
+    PRINT(u" achieved  Presents: ");
+    PrintDec(Loop->Presents);
+    PRINT(u" (");
+    PrintDec(Loop->SkippedPresents);
+    PRINT(u" skipped)  Missed: ");
+    PrintDec(Loop->MissedFrames);
+    PRINT(u"  Input: ");
+    PrintDec(Loop->InputEvents);
+    PRINTL(u"");
+    
+    PRINT(u"Update: ");
+    PrintDec(TimestampToMicroseconds(Loop->TotalUpdateTicks / Frames));
+    PRINT(u" us avg, ");
+    PrintDec(TimestampToMicroseconds(Loop->MaxUpdateTicks));
+    PRINT(u" us max  Present: ");
+    PrintDec(TimestampToMicroseconds(Loop->TotalPresentTicks / Presents));
+    PRINT(u" us avg, ");
+    PrintDec(TimestampToMicroseconds(Loop->MaxPresentTicks));
+    PRINT(u" us max  Idle: ");
+    PrintDec(Busy >= Elapsed ? 0 : 100 - Busy * 100 / Elapsed);
+    PRINTL(u"%");
+}
+
+//
+// Demo
+//
+
+// Progress bar that advances in whole segments, so most frames have nothing to present
+typedef struct {
+    GOP_BACK_BUFFER BackBuffer;
+    GOP_RECT Bar;
+    uint32_t Segments;
+    uint32_t SegmentsDrawn;
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL Fill;
+} PROGRESS_DEMO;
+
+static EFI_STATUS ProgressUpdate(RENDER_LOOP *Loop, void *Context) {
+    PROGRESS_DEMO *Demo = (PROGRESS_DEMO*)Context;
+    uint32_t Segments = (uint32_t)((Loop->Frames + 1) * Demo->Segments / RENDER_LOOP_DEMO_FRAMES);
+    uint32_t SegmentWidth = Demo->Bar.Width / Demo->Segments;
+    
+    if (Segments > Demo->Segments) {
+        Segments = Demo->Segments;
+    }
+    if (Segments == Demo->SegmentsDrawn) {
+        return EFI_SUCCESS;
+    }
+    
+    BackBufferDrawRectangle(&Demo->BackBuffer, Demo->Bar.X + Demo->SegmentsDrawn * SegmentWidth, Demo->Bar.Y,
+                            (Segments - Demo->SegmentsDrawn) * SegmentWidth, Demo->Bar.Height, &Demo->Fill);
+    Demo->SegmentsDrawn = Segments;
+    RenderLoopMarkDirty(Loop);
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS ProgressPresent(RENDER_LOOP *Loop, void *Context) {
+    return BackBufferPresent(&((PROGRESS_DEMO*)Context)->BackBuffer);
+}
+
+static EFI_STATUS ProgressInput(RENDER_LOOP *Loop, void *Context, const EFI_INPUT_KEY *Key) {
+    RenderLoopStop(Loop);
+    return EFI_SUCCESS;
+}
+
+// Animate a progress bar for a few seconds (any key ends it early)
+void RenderLoopDemo(void) {
+    static const RENDER_LOOP_CALLBACKS Callbacks = { ProgressUpdate, ProgressPresent, ProgressInput };
+    EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop;
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL Background, Track;
+    PROGRESS_DEMO Demo;
+    RENDER_LOOP Loop;
+    
+    MemSet(&Demo, 0, sizeof(Demo));
+    if (EFI_ERROR(GetGraphicsOutputProtocol(&Gop)) || EFI_ERROR(BackBufferCreate(&Demo.BackBuffer, Gop))) {
+        PRINTL(u"Render loop demo: graphics output not available");
+        return;
+    }
+    
+    uint32_t Width = Demo.BackBuffer.Surface.Width;
+    uint32_t Height = Demo.BackBuffer.Surface.Height;
+    Demo.Bar.X = Width / 8;
+    Demo.Bar.Y = Height / 2 - 12;
+    Demo.Bar.Width = Width * 3 / 4;
+    Demo.Bar.Height = 24;
+    Demo.Segments = Demo.Bar.Width / 8 < 40 ? Demo.Bar.Width / 8 : 40;
+    
+    GetPixelForRGB(0x10, 0x10, 0x18, &Background);
+    GetPixelForRGB(0x30, 0x30, 0x40, &Track);
+    GetPixelForRGB(0x40, 0xA0, 0xF0, &Demo.Fill);
+    
+    if (Demo.Segments == 0) {
+        BackBufferDestroy(&Demo.BackBuffer);
+        PRINTL(u"Render loop demo: screen too small");
+        return;
+    }
+    
+    BackBufferClear(&Demo.BackBuffer, &Background);
+    BackBufferDrawRectangle(&Demo.BackBuffer, Demo.Bar.X, Demo.Bar.Y, Demo.Bar.Width, Demo.Bar.Height, &Track);
+    
+    RenderLoopInit(&Loop, RENDER_LOOP_DEMO_FPS, &Callbacks, &Demo);
+    Loop.FrameLimit = RENDER_LOOP_DEMO_FRAMES;
+    EFI_STATUS Status = RenderLoopRun(&Loop);
+    
+    BackBufferDestroy(&Demo.BackBuffer);
+    CLEAR_SCREEN();
+    if (EFI_ERROR(Status)) {
+        PRINT(u"Render loop demo failed: ");
+        PrintHex(Status);
+        PRINTL(u"");
+        return;
+    }
+    RenderLoopPrintStats(&Loop);
+}
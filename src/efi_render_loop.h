@@ -0,0 +1,72 @@
+// efi_render_loop.h
+#ifndef TINYUEFI_RENDER_LOOP_H
+#define TINYUEFI_RENDER_LOOP_H
+
+#include "uefi_types.h"
+
+// Frames whose timings are kept for RenderLoopPrintStats
+#define RENDER_LOOP_HISTORY           128
+
+// Highest frame rate RenderLoopInit accepts
+#define RENDER_LOOP_MAX_FPS           1000
+
+// Length of RenderLoopDemo
+#define RENDER_LOOP_DEMO_FPS          60
+#define RENDER_LOOP_DEMO_FRAMES       180
+
+typedef struct _RENDER_LOOP RENDER_LOOP;
+
+// Callbacks run by RenderLoopRun. Update runs on every timer tick and calls
+// RenderLoopMarkDirty when it changed something; Present runs only for dirty
+// frames; Input (optional) gets each key as it arrives. An error from any
+// callback ends the loop and is returned by RenderLoopRun.
+typedef struct {
+    EFI_STATUS (*Update)(RENDER_LOOP *Loop, void *Context);
+    EFI_STATUS (*Present)(RENDER_LOOP *Loop, void *Context);
+    EFI_STATUS (*Input)(RENDER_LOOP *Loop, void *Context, const EFI_INPUT_KEY *Key);
+} RENDER_LOOP_CALLBACKS;
+
+// Timings of one frame in timestamp ticks
+typedef struct {
+    uint64_t IntervalTicks;       // Since the previous frame started
+    uint64_t UpdateTicks;
+    uint64_t PresentTicks;        // Zero when the present was skipped
+} RENDER_FRAME_TIMES;
+
+struct _RENDER_LOOP {
+    RENDER_LOOP_CALLBACKS Callbacks;
+    void *Context;
+    uint32_t TargetFps;
+    uint64_t FrameInterval;       // 100 ns units, as SetTimer expects
+    uint64_t FrameLimit;          // Stop after this many frames (0 = never)
+    EFI_EVENT Timer;
+    bool Running;
+    bool Dirty;
+    
+    // Statistics
+    uint64_t Frames;
+    uint64_t Presents;
+    uint64_t SkippedPresents;
+    uint64_t MissedFrames;        // Ticks that passed while a frame was still running
+    uint64_t InputEvents;
+    uint64_t TotalUpdateTicks;
+    uint64_t TotalPresentTicks;
+    uint64_t MaxUpdateTicks;
+    uint64_t MaxPresentTicks;
+    uint64_t StartTicks;
+    uint64_t ElapsedTicks;
+    uint64_t LastFrameStart;
+    RENDER_FRAME_TIMES History[RENDER_LOOP_HISTORY];
+};
+
+// Helper functions
+EFI_STATUS RenderLoopInit(RENDER_LOOP *Loop, uint32_t TargetFps,
+                          const RENDER_LOOP_CALLBACKS *Callbacks, void *Context);
+EFI_STATUS RenderLoopRun(RENDER_LOOP *Loop);
+void RenderLoopStop(RENDER_LOOP *Loop);
+void RenderLoopMarkDirty(RENDER_LOOP *Loop);
+const RENDER_FRAME_TIMES *RenderLoopLastFrame(RENDER_LOOP *Loop);
+void RenderLoopPrintStats(RENDER_LOOP *Loop);
+void RenderLoopDemo(void);
+
+#endif // TINYUEFI_RENDER_LOOP_H
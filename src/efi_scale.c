@@ -0,0 +1,394 @@
+// efi_scale.c
+#include "efi_scale.h"
+#include "efi_pixel.h"
+#include "uefi_helpers.h"
+#include "efi_timer.h"
+
+// 1.0 in 32.32 fixed point
+#define SCALE_FIXED_ONE               (1ull << 32)
+
+// Source index and neighbor weight for output position Position.
+// Pixel centers are aligned, so output pixel d samples source position
+// (d + 0.5) * Step - 0.5.
+static void MapPosition(uint64_t Step, uint32_t Position, uint32_t Size, SCALE_FILTER Filter,
+                        uint32_t *Index, uint16_t *Weight) {
+    uint64_t Center = Position * Step + Step / 2;
+    
+    *Weight = 0;
+    
+    if (Filter == ScaleFilterNearest || Size == 1) {
+        uint64_t Nearest = Center >> 32;
+        *Index = Nearest < Size ? (uint32_t)Nearest : Size - 1;
+        return;
+    }
+    
+    if (Center <= SCALE_FIXED_ONE / 2) {
+        *Index = 0;
+    } else if (Center - SCALE_FIXED_ONE / 2 >= (uint64_t)(Size - 1) << 32) {
+        // Past the last center: all weight on the last pixel
+        *Index = Size - 2;
+        *Weight = PIXEL_LERP_ONE;
+    } else {
+        uint64_t Sample = Center - SCALE_FIXED_ONE / 2;
+        *Index = (uint32_t)(Sample >> 32);
+        *Weight = (uint16_t)((Sample >> 24) & 0xFF);
+    }
+}
+
+// Initialize a scaler from Source to Width x Height
+EFI_STATUS ScalerInit(SCALER *Scaler, const GOP_SURFACE *Source,
+                      uint32_t Width, uint32_t Height, SCALE_FILTER Filter) {
+    if (Scaler == NULL || Source == NULL || Source->Pixels == NULL ||
+        Source->Width == 0 || Source->Height == 0 || Filter >= ScaleFilterMax) {
+        return EFI_INVALID_PARAMETER;
+    }
+    if (Width == 0 || Height == 0 || Width > SCALE_MAX_DIMENSION || Height > SCALE_MAX_DIMENSION) {
+        return EFI_UNSUPPORTED;
+    }
+    
+    MemSet(Scaler, 0, sizeof(*Scaler));
+    Scaler->Source = Source;
+    Scaler->Width = Width;
+    Scaler->Height = Height;
+    Scaler->Filter = Filter;
+    Scaler->StepX = ((uint64_t)Source->Width << 32) / Width;
+    Scaler->StepY = ((uint64_t)Source->Height << 32) / Height;
+    Scaler->RowSource[0] = 0xFFFFFFFF;
+    Scaler->RowSource[1] = 0xFFFFFFFF;
+    
+    // Column tables, two resampled rows and the output row in one allocation
+    uint64_t RowBytes = (uint64_t)Width * sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL);
+    uint8_t *Memory = (uint8_t*)AllocatePool(RowBytes * 3 + (uint64_t)Width * (sizeof(uint32_t) + sizeof(uint16_t)));
+    if (Memory == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    Scaler->Rows[0] = (EFI_GRAPHICS_OUTPUT_BLT_PIXEL*)Memory;
+    Scaler->Rows[1] = (EFI_GRAPHICS_OUTPUT_BLT_PIXEL*)(Memory + RowBytes);
+    Scaler->Output = (EFI_GRAPHICS_OUTPUT_BLT_PIXEL*)(Memory + RowBytes * 2);
+    Scaler->ColumnIndex = (uint32_t*)(Memory + RowBytes * 3);
+    Scaler->ColumnWeight = (uint16_t*)(Scaler->ColumnIndex + Width);
+    
+    for (uint32_t x = 0; x < Width; x++) {
+        MapPosition(Scaler->StepX, x, Source->Width, Filter, &Scaler->ColumnIndex[x], &Scaler->ColumnWeight[x]);
+    }
+    
+    return EFI_SUCCESS;
+}
+
+void ScalerFree(SCALER *Scaler) {
+    if (Scaler == NULL) {
+        return;
+    }
+    
+    if (Scaler->Rows[0] != NULL) {
+        FreePool(Scaler->Rows[0]);
+    }
+    MemSet(Scaler, 0, sizeof(*Scaler));
+}
+
+// Source row SourceY resampled to the output width
+static const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *ScaledSourceRow(SCALER *Scaler, uint32_t SourceY) {
+    const GOP_SURFACE *Source = Scaler->Source;
+    const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src = Source->Pixels + (uint64_t)SourceY * Source->Stride;
+    uint32_t Slot = SourceY & 1;
+    
+    // No horizontal scaling: the source row is already the answer
+    if (Source->Width == Scaler->Width) {
+        return Src;
+    }
+    
+    if (Scaler->RowSource[Slot] != SourceY) {
+        EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Row = Scaler->Rows[Slot];
+        
+        if (Scaler->Filter == ScaleFilterBilinear && Source->Width > 1) {
+            PixelResample(Row, Src, Scaler->Width, Scaler->ColumnIndex, Scaler->ColumnWeight);
+        } else {
+            for (uint32_t x = 0; x < Scaler->Width; x++) {
+                Row[x] = Src[Scaler->ColumnIndex[x]];
+            }
+        }
+        Scaler->RowSource[Slot] = SourceY;
+    }
+    
+    return Scaler->Rows[Slot];
+}
+
+// Output row Y (valid until the next call)
+const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *ScalerRow(SCALER *Scaler, uint32_t Y) {
+    uint32_t Index;
+    uint16_t Weight;
+    
+    if (Scaler == NULL || Scaler->Output == NULL || Y >= Scaler->Height) {
+        return NULL;
+    }
+    
+    MapPosition(Scaler->StepY, Y, Scaler->Source->Height, Scaler->Filter, &Index, &Weight);
+    
+    if (Weight == 0) {
+        return ScaledSourceRow(Scaler, Index);
+    }
+    if (Weight == PIXEL_LERP_ONE) {
+        return ScaledSourceRow(Scaler, Index + 1);
+    }
+    
+    const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Top = ScaledSourceRow(Scaler, Index);
+    const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Bottom = ScaledSourceRow(Scaler, Index + 1);
+    PixelLerp(Scaler->Output, Top, Bottom, Scaler->Width, Weight);
+    
+    return Scaler->Output;
+}
+
+// Number of output rows that land inside a target of TargetHeight at Y
+static uint32_t VisibleRows(SCALER *Scaler, uint32_t Y, uint32_t TargetHeight) {
+    if (Y >= TargetHeight) {
+        return 0;
+    }
+    
+    return Scaler->Height < TargetHeight - Y ? Scaler->Height : TargetHeight - Y;
+}
+
+// Scale into a surface at (X, Y), clipping to the surface
+EFI_STATUS ScaleToSurface(SCALER *Scaler, GOP_SURFACE *Surface, uint32_t X, uint32_t Y) {
+    if (Scaler == NULL || Scaler->Output == NULL || Surface == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    if (X >= Surface->Width) {
+        return EFI_SUCCESS;
+    }
+    
+    uint32_t Rows = VisibleRows(Scaler, Y, Surface->Height);
+    for (uint32_t Row = 0; Row < Rows; Row++) {
+        SurfaceBlit(Surface, X, Y + Row, Scaler->Width, 1, ScalerRow(Scaler, Row), Scaler->Width);
+    }
+    
+    return EFI_SUCCESS;
+}
+
+// Scale straight onto the screen at (X, Y)
+EFI_STATUS ScaleToFramebuffer(SCALER *Scaler, GOP_FRAMEBUFFER *Framebuffer, uint32_t X, uint32_t Y) {
+    EFI_STATUS Status = EFI_SUCCESS;
+    
+    if (Scaler == NULL || Scaler->Output == NULL || Framebuffer == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    if (X >= Framebuffer->Width) {
+        return EFI_SUCCESS;
+    }
+    
+    uint32_t Rows = VisibleRows(Scaler, Y, Framebuffer->Height);
+    for (uint32_t Row = 0; Row < Rows && !EFI_ERROR(Status); Row++) {
+        Status = FramebufferBlit(Framebuffer, X, Y + Row, Scaler->Width, 1,
+                                 ScalerRow(Scaler, Row), Scaler->Width);
+    }
+    
+    return Status;
+}
+
+// Scale into a back buffer at (X, Y) and mark the area dirty
+EFI_STATUS ScaleToBackBuffer(SCALER *Scaler, GOP_BACK_BUFFER *BackBuffer, uint32_t X, uint32_t Y) {
+    if (BackBuffer == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    EFI_STATUS Status = ScaleToSurface(Scaler, &BackBuffer->Surface, X, Y);
+    if (!EFI_ERROR(Status)) {
+        BackBufferMarkDirty(BackBuffer, X, Y, Scaler->Width, Scaler->Height);
+    }
+    
+    return Status;
+}
+
+//
+// Cache of scaled copies
+//
+
+void ScaleCacheInit(SCALE_CACHE *Cache) {
+    if (Cache != NULL) {
+        MemSet(Cache, 0, sizeof(*Cache));
+    }
+}
+
+static void ScaleCacheEvict(SCALE_CACHE_ENTRY *Entry) {
+    if (Entry->Surface.Pixels != NULL) {
+        FreeSurface(&Entry->Surface);
+    }
+    MemSet(Entry, 0, sizeof(*Entry));
+}
+
+// Scaled copy of Source, created on first request for each size and filter.
+// The returned surface stays valid until it is evicted or the cache is freed.
+EFI_STATUS ScaleCacheGet(SCALE_CACHE *Cache, const GOP_SURFACE *Source, uint32_t Width, uint32_t Height,
+                         SCALE_FILTER Filter, const GOP_SURFACE **Scaled) {
+    SCALE_CACHE_ENTRY *Victim = NULL;
+    SCALER Scaler;
+    EFI_STATUS Status;
+    
+    if (Cache == NULL || Source == NULL || Scaled == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    Cache->Clock++;
+    
+    for (uint32_t i = 0; i < SCALE_CACHE_ENTRIES; i++) {
+        SCALE_CACHE_ENTRY *Entry = &Cache->Entries[i];
+        
+        if (Entry->Source == Source && Entry->SourcePixels == Source->Pixels &&
+            Entry->Width == Width && Entry->Height == Height && Entry->Filter == Filter) {
+            Entry->LastUsed = Cache->Clock;
+            Cache->Hits++;
+            *Scaled = &Entry->Surface;
+            return EFI_SUCCESS;
+        }
+        
+        if (Victim == NULL || Entry->LastUsed < Victim->LastUsed) {
+            Victim = Entry;
+        }
+    }
+    
+    Cache->Misses++;
+    
+    Status = ScalerInit(&Scaler, Source, Width, Height, Filter);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    ScaleCacheEvict(Victim);
+    Status = CreateSurface(&Victim->Surface, Width, Height);
+    if (!EFI_ERROR(Status)) {
+        ScaleToSurface(&Scaler, &Victim->Surface, 0, 0);
+        Victim->Source = Source;
+        Victim->SourcePixels = Source->Pixels;
+        Victim->Width = Width;
+        Victim->Height = Height;
+        Victim->Filter = Filter;
+        Victim->LastUsed = Cache->Clock;
+        *Scaled = &Victim->Surface;
+    }
+    
+    ScalerFree(&Scaler);
+    return Status;
+}
+
+// Drop every scaled copy of Source (call after changing its pixels)
+void ScaleCacheInvalidate(SCALE_CACHE *Cache, const GOP_SURFACE *Source) {
+    if (Cache == NULL) {
+        return;
+    }
+    
+    for (uint32_t i = 0; i < SCALE_CACHE_ENTRIES; i++) {
+        if (Cache->Entries[i].Source == Source) {
+            ScaleCacheEvict(&Cache->Entries[i]);
+        }
+    }
+}
+
+void ScaleCacheFree(SCALE_CACHE *Cache) {
+    if (Cache == NULL) {
+        return;
+    }
+    
+    for (uint32_t i = 0; i < SCALE_CACHE_ENTRIES; i++) {
+        ScaleCacheEvict(&Cache->Entries[i]);
+    }
+}
+
+//
+// Benchmark
+//
+
+// Output Mpixel/s for one filter and size
+static void TimeScale(const GOP_SURFACE *Source, GOP_SURFACE *Target, uint32_t Width, uint32_t Height,
+                      SCALE_FILTER Filter) {
+    SCALER Scaler;
+    uint64_t Start, Ticks;
+    
+    if (EFI_ERROR(ScalerInit(&Scaler, Source, Width, Height, Filter))) {
+        return;
+    }
+    
+    Start = ReadTimestamp();
+    for (int Pass = 0; Pass < SCALE_BENCHMARK_PASSES; Pass++) {
+        ScaleToSurface(&Scaler, Target, 0, 0);
+    }
+    Ticks = ReadTimestamp() - Start;
+    ScalerFree(&Scaler);
+    
+    PRINT(u" ");
+    PrintDec(BytesPerSecond((uint64_t)Width * Height * SCALE_BENCHMARK_PASSES, Ticks) / 1000000);
+}
+
+// Scale a generated source to common panel sizes with both filters
+void ScaleBenchmark(void) {
+    static const uint32_t Sizes[][2] = { { 640, 480 }, { 1280, 720 }, { 1920, 1080 }, { 3840, 2160 } };
+    EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop = NULL;
+    GOP_FRAMEBUFFER Framebuffer;
+    GOP_SURFACE Source, Target;
+    SCALE_CACHE Cache;
+    const GOP_SURFACE *Scaled;
+    uint64_t Start, MissTicks, HitTicks;
+    
+    if (EFI_ERROR(CreateSurface(&Source, SCALE_BENCHMARK_WIDTH, SCALE_BENCHMARK_HEIGHT))) {
+        PRINTL(u"Scale benchmark: out of memory");
+        return;
+    }
+    if (EFI_ERROR(CreateSurface(&Target, 3840, 2160))) {
+        FreeSurface(&Source);
+        PRINTL(u"Scale benchmark: out of memory");
+        return;
+    }
+    
+    for (uint32_t y = 0; y < Source.Height; y++) {
+        for (uint32_t x = 0; x < Source.Width; x++) {
+            EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Pixel = &Source.Pixels[(uint64_t)y * Source.Stride + x];
+            GetPixelForRGB((uint8_t)x, (uint8_t)y, (uint8_t)(x ^ y), Pixel);
+        }
+    }
+    
+    CLEAR_SCREEN();
+    PRINTL(u"Scaling 800x600 (Mpixel/s out, nearest bilinear):");
+    
+    for (uint32_t i = 0; i < sizeof(Sizes) / sizeof(Sizes[0]); i++) {
+        PrintDec(Sizes[i][0]);
+        PRINT(u"x");
+        PrintDec(Sizes[i][1]);
+        PRINT(u":");
+        TimeScale(&Source, &Target, Sizes[i][0], Sizes[i][1], ScaleFilterNearest);
+        TimeScale(&Source, &Target, Sizes[i][0], Sizes[i][1], ScaleFilterBilinear);
+        PRINTL(u"");
+    }
+    
+    // A cache hit should cost nothing next to a fresh scale
+    ScaleCacheInit(&Cache);
+    Start = ReadTimestamp();
+    ScaleCacheGet(&Cache, &Source, 1920, 1080, ScaleFilterBilinear, &Scaled);
+    MissTicks = ReadTimestamp() - Start;
+    Start = ReadTimestamp();
+    ScaleCacheGet(&Cache, &Source, 1920, 1080, ScaleFilterBilinear, &Scaled);
+    HitTicks = ReadTimestamp() - Start;
+    ScaleCacheFree(&Cache);
+    
+    PRINT(u"Cache miss / hit: ");
+    PrintDec(TimestampToMicroseconds(MissTicks));
+    PRINT(u" / ");
+    PrintDec(TimestampToMicroseconds(HitTicks));
+    PRINTL(u" us");
+    
+    // Stream straight to the screen at its native size
+    if (!EFI_ERROR(GetGraphicsOutputProtocol(&Gop)) && !EFI_ERROR(FramebufferInit(&Framebuffer, Gop))) {
+        SCALER Scaler;
+        
+        if (!EFI_ERROR(ScalerInit(&Scaler, &Source, Framebuffer.Width, Framebuffer.Height, ScaleFilterBilinear))) {
+            Start = ReadTimestamp();
+            ScaleToFramebuffer(&Scaler, &Framebuffer, 0, 0);
+            uint64_t Ticks = ReadTimestamp() - Start;
+            ScalerFree(&Scaler);
+            
+            PRINT(u"Bilinear to framebuffer: ");
+            PrintDec(BytesPerSecond((uint64_t)Framebuffer.Width * Framebuffer.Height, Ticks) / 1000000);
+            PRINTL(u" Mpixel/s");
+        }
+    }
+    
+    FreeSurface(&Target);
+    FreeSurface(&Source);
+}
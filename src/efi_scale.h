@@ -0,0 +1,94 @@
+// efi_scale.h
+#ifndef TINYUEFI_SCALE_H
+#define TINYUEFI_SCALE_H
+
+#include "uefi_types.h"
+#include "efi_gop_protocol.h"
+#include "efi_gop_surface.h"
+#include "efi_gop_framebuffer.h"
+
+// Largest destination width or height accepted
+#define SCALE_MAX_DIMENSION           16384
+
+// Scaled copies kept by a SCALE_CACHE (one per panel resolution in practice)
+#define SCALE_CACHE_ENTRIES           4
+
+// Source size and repetitions used by ScaleBenchmark
+#define SCALE_BENCHMARK_WIDTH         800
+#define SCALE_BENCHMARK_HEIGHT        600
+#define SCALE_BENCHMARK_PASSES        4
+
+// Resampling filters
+typedef enum {
+    ScaleFilterNearest,
+    ScaleFilterBilinear,
+    ScaleFilterMax
+} SCALE_FILTER;
+
+// Resamples a source surface to Width x Height one output row at a time.
+// Source positions are stepped in 32.32 fixed point; bilinear weights are
+// in 1/256ths (PIXEL_LERP_ONE).
+typedef struct {
+    const GOP_SURFACE *Source;
+    uint32_t Width;
+    uint32_t Height;
+    SCALE_FILTER Filter;
+    
+    // Source pixels per output pixel (32.32)
+    uint64_t StepX;
+    uint64_t StepY;
+    
+    // Per-column source index and weight of its right-hand neighbor
+    uint32_t *ColumnIndex;
+    uint16_t *ColumnWeight;
+    
+    // Horizontally resampled source rows. A row lives in slot (row & 1), so
+    // the two rows a bilinear output row needs never evict each other.
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Rows[2];
+    uint32_t RowSource[2];
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Output;
+} SCALER;
+
+// One scaled copy of a source
+typedef struct {
+    const GOP_SURFACE *Source;
+    const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *SourcePixels;
+    uint32_t Width;
+    uint32_t Height;
+    SCALE_FILTER Filter;
+    GOP_SURFACE Surface;
+    uint64_t LastUsed;
+} SCALE_CACHE_ENTRY;
+
+// Least-recently-used cache of scaled copies
+typedef struct {
+    SCALE_CACHE_ENTRY Entries[SCALE_CACHE_ENTRIES];
+    uint64_t Clock;
+    
+    // Statistics
+    uint64_t Hits;
+    uint64_t Misses;
+} SCALE_CACHE;
+
+// Scaler functions
+EFI_STATUS ScalerInit(SCALER *Scaler, const GOP_SURFACE *Source,
+                      uint32_t Width, uint32_t Height, SCALE_FILTER Filter);
+const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *ScalerRow(SCALER *Scaler, uint32_t Y);
+void ScalerFree(SCALER *Scaler);
+
+// Streaming output
+EFI_STATUS ScaleToSurface(SCALER *Scaler, GOP_SURFACE *Surface, uint32_t X, uint32_t Y);
+EFI_STATUS ScaleToFramebuffer(SCALER *Scaler, GOP_FRAMEBUFFER *Framebuffer, uint32_t X, uint32_t Y);
+EFI_STATUS ScaleToBackBuffer(SCALER *Scaler, GOP_BACK_BUFFER *BackBuffer, uint32_t X, uint32_t Y);
+
+// Cache functions
+void ScaleCacheInit(SCALE_CACHE *Cache);
+EFI_STATUS ScaleCacheGet(SCALE_CACHE *Cache, const GOP_SURFACE *Source, uint32_t Width, uint32_t Height,
+                         SCALE_FILTER Filter, const GOP_SURFACE **Scaled);
+void ScaleCacheInvalidate(SCALE_CACHE *Cache, const GOP_SURFACE *Source);
+void ScaleCacheFree(SCALE_CACHE *Cache);
+
+// Measurement
+void ScaleBenchmark(void);
+
+#endif // TINYUEFI_SCALE_H
@@ -0,0 +1,858 @@
+// efi_tftp.c
+#include "efi_tftp.h"
+#include "uefi_helpers.h"
+#include "efi_timer.h"
+#include "efi_net_loopback.h"
+
+// Opcodes
+#define TFTP_OPCODE_RRQ               1
+#define TFTP_OPCODE_DATA              3
+#define TFTP_OPCODE_ACK               4
+#define TFTP_OPCODE_ERROR             5
+#define TFTP_OPCODE_OACK              6
+
+// Error codes
+#define TFTP_ERROR_UNDEFINED          0
+#define TFTP_ERROR_NOT_FOUND          1
+#define TFTP_ERROR_ACCESS             2
+#define TFTP_ERROR_DISK_FULL          3
+#define TFTP_ERROR_ILLEGAL            4
+#define TFTP_ERROR_UNKNOWN_TID        5
+#define TFTP_ERROR_OPTION             8
+
+// Opcode plus block number in front of each DATA payload
+#define TFTP_DATA_HEADER_SIZE         4
+
+// SetTimer units per microsecond
+#define TIMER_UNITS_PER_US            10
+
+static inline uint16_t Read16(const uint8_t *Bytes) {
+    return (uint16_t)((Bytes[0] << 8) | Bytes[1]);
+}
+
+static inline void Write16(uint8_t *Bytes, uint16_t Value) {
+    Bytes[0] = (uint8_t)(Value >> 8);
+    Bytes[1] = (uint8_t)Value;
+}
+
+// Append a NUL-terminated string; false when it does not fit
+static bool AppendString(uint8_t *Packet, uint32_t *Length, uint32_t Capacity, const char *String) {
+    do {
+        if (*Length == Capacity) {
+            return false;
+        }
+        Packet[(*Length)++] = (uint8_t)*String;
+    } while (*String++ != 0);
+    
+    return true;
+}
+
+static bool AppendNumber(uint8_t *Packet, uint32_t *Length, uint32_t Capacity, uint64_t Value) {
+    char Digits[21];
+    char Text[21];
+    uint32_t Count = 0;
+    
+    do {
+        Digits[Count++] = (char)('0' + Value % 10);
+        Value /= 10;
+    } while (Value != 0);
+    
+    for (uint32_t i = 0; i < Count; i++) {
+        Text[i] = Digits[Count - 1 - i];
+    }
+    Text[Count] = 0;
+    
+    return AppendString(Packet, Length, Capacity, Text);
+}
+
+// Read a NUL-terminated string at Offset; NULL when it runs past Length
+static const char *NextString(const uint8_t *Data, uint32_t Length, uint32_t *Offset) {
+    const char *String = (const char*)Data + *Offset;
+    
+    while (*Offset < Length) {
+        if (Data[(*Offset)++] == 0) {
+            return String;
+        }
+    }
+    return NULL;
+}
+
+static bool ParseNumber(const char *Text, uint64_t *Value) {
+    *Value = 0;
+    if (*Text == 0) {
+        return false;
+    }
+    
+    for (; *Text != 0; Text++) {
+        if (*Text < '0' || *Text > '9' || *Value > 0xFFFFFFFFFFFull) {
+            return false;
+        }
+        *Value = *Value * 10 + (uint64_t)(*Text - '0');
+    }
+    return true;
+}
+
+// Case-insensitive compare of option names
+static bool OptionIs(const char *Name, const char *Expected) {
+    for (; *Name != 0 && *Expected != 0; Name++, Expected++) {
+        char Lower = (*Name >= 'A' && *Name <= 'Z') ? (char)(*Name + 'a' - 'A') : *Name;
+        if (Lower != *Expected) {
+            return false;
+        }
+    }
+    return *Name == *Expected;
+}
+
+// Restart the retransmission timer, clearing a signal that is still pending
+static void ArmTimer(TFTP_SESSION *Session) {
+    ST->BootServices->CheckEvent(Session->Timer);
+    ST->BootServices->SetTimer(Session->Timer, TimerRelative, Session->TimeoutUs * TIMER_UNITS_PER_US);
+    Session->Progressed = false;
+}
+
+// Acknowledge through the connected socket, building the packet in place
+static EFI_STATUS SendAck(TFTP_SESSION *Session, uint16_t Block) {
+    uint8_t *Payload;
+    
+    EFI_STATUS Status = NetUdpAcquire(&Session->Socket, &Payload, NULL);
+    if (!EFI_ERROR(Status)) {
+        Write16(Payload, TFTP_OPCODE_ACK);
+        Write16(Payload + 2, Block);
+        Status = NetUdpSubmit(&Session->Socket, 4);
+    }
+    
+    Session->Transfer->Acks++;
+    Session->WindowReceived = 0;
+    ArmTimer(Session);
+    return Status;
+}
+
+static void SendError(TFTP_SESSION *Session, uint16_t Port, uint16_t Code, const char *Message) {
+    uint8_t Packet[64];
+    uint32_t Length = 4;
+    
+    Write16(Packet, TFTP_OPCODE_ERROR);
+    Write16(Packet + 2, Code);
+    if (AppendString(Packet, &Length, sizeof(Packet), Message)) {
+        NetUdpSendTo(&Session->Socket, Session->Server, Port, Packet, Length);
+    }
+}
+
+// End the transfer, telling the server why when Message is given
+static void Fail(TFTP_SESSION *Session, EFI_STATUS Status, uint16_t Code, const char *Message) {
+    if (Message != NULL && Session->ServerPort != 0) {
+        SendError(Session, Session->ServerPort, Code, Message);
+    }
+    
+    Session->Status = Status;
+    Session->State = TftpDone;
+}
+
+static EFI_STATUS FlushFile(TFTP_SESSION *Session) {
+    if (Session->FileUsed == 0) {
+        return EFI_SUCCESS;
+    }
+    
+    EFI_STATUS Status = WriteFile(Session->Transfer->File, Session->FileBuffer, Session->FileUsed);
+    Session->FileUsed = 0;
+    return Status;
+}
+
+// Set up the destination once the transfer size is known (or known to be
+// unknown)
+static EFI_STATUS PrepareDestination(TFTP_SESSION *Session) {
+    TFTP_TRANSFER *Transfer = Session->Transfer;
+    
+    if (Transfer->File != NULL) {
+        Session->FileBuffer = (uint8_t*)AllocatePool(TFTP_FILE_BUFFER_SIZE);
+        return Session->FileBuffer != NULL ? EFI_SUCCESS : EFI_OUT_OF_RESOURCES;
+    }
+    
+    if (Transfer->Buffer != NULL) {
+        return Transfer->TransferSize <= Transfer->Capacity ? EFI_SUCCESS : EFI_BUFFER_TOO_SMALL;
+    }
+    
+    uint64_t Capacity = Transfer->TransferSize != 0 ? Transfer->TransferSize : TFTP_INITIAL_BUFFER_SIZE;
+    Transfer->Buffer = (uint8_t*)AllocatePool(Capacity);
+    if (Transfer->Buffer == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    
+    Transfer->Capacity = Capacity;
+    Transfer->Allocated = true;
+    return EFI_SUCCESS;
+}
+
+// Copy a block from the receive buffer straight to its place in the
+// destination; only file destinations are staged
+static EFI_STATUS StoreBlock(TFTP_SESSION *Session, const uint8_t *Data, uint32_t Length) {
+    TFTP_TRANSFER *Transfer = Session->Transfer;
+    
+    if (Transfer->File != NULL) {
+        if (Session->FileUsed + Length > TFTP_FILE_BUFFER_SIZE) {
+            EFI_STATUS Status = FlushFile(Session);
+            if (EFI_ERROR(Status)) {
+                return Status;
+            }
+        }
+        MemCpy(Session->FileBuffer + Session->FileUsed, Data, Length);
+        Session->FileUsed += Length;
+        Transfer->Size += Length;
+        return EFI_SUCCESS;
+    }
+    
+    if (Transfer->Size + Length > Transfer->Capacity) {
+        if (!Transfer->Allocated) {
+            return EFI_BUFFER_TOO_SMALL;
+        }
+        
+        // The server did not report tsize (or reported too little); grow
+        // the buffer until the block fits, however far off tsize was
+        uint64_t Capacity = Transfer->Capacity;
+        while (Capacity < Transfer->Size + Length) {
+            Capacity *= 2;
+        }
+        uint8_t *Buffer = (uint8_t*)AllocatePool(Capacity);
+        if (Buffer == NULL) {
+            return EFI_OUT_OF_RESOURCES;
+        }
+        MemCpy(Buffer, Transfer->Buffer, Transfer->Size);
+        FreePool(Transfer->Buffer);
+        Transfer->Buffer = Buffer;
+        Transfer->Capacity = Capacity;
+    }
+    
+    MemCpy(Transfer->Buffer + Transfer->Size, Data, Length);
+    Transfer->Size += Length;
+    return EFI_SUCCESS;
+}
+
+static void BeginTransfer(TFTP_SESSION *Session) {
+    EFI_STATUS Status = PrepareDestination(Session);
+    
+    if (EFI_ERROR(Status)) {
+        Fail(Session, Status, TFTP_ERROR_DISK_FULL, "Not enough space");
+        return;
+    }
+    Session->State = TftpTransferring;
+}
+
+// Options the server accepted. Those it left out fall back to RFC 1350.
+static void HandleOptionAck(TFTP_SESSION *Session, const uint8_t *Data, uint32_t Length) {
+    TFTP_TRANSFER *Transfer = Session->Transfer;
+    uint32_t Offset = 2;
+    
+    // A repeated OACK means our ACK of block 0 was lost
+    if (Session->State == TftpTransferring && Session->LastBlock == 0) {
+        SendAck(Session, 0);
+        return;
+    }
+    if (Session->State != TftpRequested) {
+        return;
+    }
+    
+    while (Offset < Length) {
+        const char *Name = NextString(Data, Length, &Offset);
+        const char *Text = Name != NULL ? NextString(Data, Length, &Offset) : NULL;
+        uint64_t Value;
+        
+        if (Text == NULL || !ParseNumber(Text, &Value)) {
+            Fail(Session, EFI_PROTOCOL_ERROR, TFTP_ERROR_OPTION, "Malformed option");
+            return;
+        }
+        
+        if (OptionIs(Name, "blksize")) {
+            if (Value < 8 || Value > Session->RequestedBlockSize) {
+                Fail(Session, EFI_PROTOCOL_ERROR, TFTP_ERROR_OPTION, "Bad blksize");
+                return;
+            }
+            Transfer->NegotiatedBlockSize = (uint32_t)Value;
+        } else if (OptionIs(Name, "windowsize")) {
+            if (Value < 1 || Value > Session->RequestedWindowSize) {
+                Fail(Session, EFI_PROTOCOL_ERROR, TFTP_ERROR_OPTION, "Bad windowsize");
+                return;
+            }
+            Transfer->NegotiatedWindowSize = (uint32_t)Value;
+        } else if (OptionIs(Name, "tsize")) {
+            Transfer->TransferSize = Value;
+        }
+    }
+    
+    BeginTransfer(Session);
+    if (Session->State == TftpTransferring) {
+        SendAck(Session, 0);
+    }
+}
+
+static void HandleData(TFTP_SESSION *Session, const uint8_t *Data, uint32_t Length) {
+    TFTP_TRANSFER *Transfer = Session->Transfer;
+    
+    if (Length < TFTP_DATA_HEADER_SIZE) {
+        return;
+    }
+    
+    // DATA in reply to the request: the server ignored every option
+    if (Session->State == TftpRequested) {
+        BeginTransfer(Session);
+    }
+    if (Session->State != TftpTransferring) {
+        return;
+    }
+    
+    uint16_t Block = Read16(Data + 2);
+    uint16_t Expected = (uint16_t)(Session->LastBlock + 1);
+    uint32_t Payload = Length - TFTP_DATA_HEADER_SIZE;
+    
+    // After a gap or a lost ACK, tell the server once where we are so it
+    // restarts the window from there (RFC 7440)
+    if (Block != Expected) {
+        if ((uint16_t)(Block - Expected) < 0x8000) {
+            Transfer->OutOfOrder++;
+        } else {
+            Transfer->Duplicates++;
+        }
+        if (!Session->Reacked) {
+            Session->Reacked = true;
+            SendAck(Session, (uint16_t)Session->LastBlock);
+        }
+        return;
+    }
+    
+    if (Payload > Transfer->NegotiatedBlockSize) {
+        Fail(Session, EFI_PROTOCOL_ERROR, TFTP_ERROR_ILLEGAL, "Block too large");
+        return;
+    }
+    
+    // TftpFinish would reject the size mismatch anyway; stop before the
+    // destination sized from tsize has to take the excess
+    if (Transfer->TransferSize != 0 && Transfer->Size + Payload > Transfer->TransferSize) {
+        Fail(Session, EFI_PROTOCOL_ERROR, TFTP_ERROR_DISK_FULL, "Larger than tsize");
+        return;
+    }
+    
+    EFI_STATUS Status = StoreBlock(Session, Data + TFTP_DATA_HEADER_SIZE, Payload);
+    if (EFI_ERROR(Status)) {
+        Fail(Session, Status, TFTP_ERROR_DISK_FULL, "Not enough space");
+        return;
+    }
+    
+    Session->LastBlock++;
+    Session->WindowReceived++;
+    Session->Progressed = true;
+    Session->Reacked = false;
+    Session->Attempts = 0;
+    Transfer->Blocks++;
+    
+    // A short block ends the file
+    if (Payload < Transfer->NegotiatedBlockSize) {
+        SendAck(Session, Block);
+        if (Transfer->File != NULL) {
+            Status = FlushFile(Session);
+        }
+        Session->Status = Status;
+        Session->State = TftpDone;
+        return;
+    }
+    
+    if (Session->WindowReceived == Transfer->NegotiatedWindowSize) {
+        SendAck(Session, Block);
+    }
+}
+
+static void HandleError(TFTP_SESSION *Session, const uint8_t *Data, uint32_t Length) {
+    TFTP_TRANSFER *Transfer = Session->Transfer;
+    uint32_t Count = 0;
+    
+    Transfer->ErrorCode = Length >= 4 ? Read16(Data + 2) : TFTP_ERROR_UNDEFINED;
+    for (uint32_t i = 4; i < Length && Data[i] != 0 && Count < sizeof(Transfer->ErrorMessage) - 1; i++) {
+        Transfer->ErrorMessage[Count++] = (char)Data[i];
+    }
+    Transfer->ErrorMessage[Count] = 0;
+    
+    switch (Transfer->ErrorCode) {
+        case TFTP_ERROR_NOT_FOUND:
+            Session->Status = EFI_NOT_FOUND;
+            break;
+        case TFTP_ERROR_ACCESS:
+            Session->Status = EFI_ACCESS_DENIED;
+            break;
+        case TFTP_ERROR_DISK_FULL:
+            Session->Status = EFI_VOLUME_FULL;
+            break;
+        default:
+            Session->Status = EFI_TFTP_ERROR;
+            break;
+    }
+    Session->State = TftpDone;
+}
+
+static void TftpReceive(NET_UDP_SOCKET *Socket, const NET_UDP_DATAGRAM *Datagram, void *Context) {
+    TFTP_SESSION *Session = (TFTP_SESSION*)Context;
+    
+    if (Session->State == TftpDone || Datagram->SrcAddress != Session->Server || Datagram->Length < 2) {
+        return;
+    }
+    
+    // The first reply fixes the server's transfer ID; from then on ACKs go
+    // out through the socket's prebuilt headers
+    if (Session->ServerPort == 0) {
+        EFI_STATUS Status = NetUdpConnect(Socket, Session->Server, Datagram->SrcPort);
+        if (EFI_ERROR(Status)) {
+            Fail(Session, Status, 0, NULL);
+            return;
+        }
+        Session->ServerPort = Datagram->SrcPort;
+    } else if (Datagram->SrcPort != Session->ServerPort) {
+        Session->Transfer->ForeignPackets++;
+        SendError(Session, Datagram->SrcPort, TFTP_ERROR_UNKNOWN_TID, "Unknown transfer ID");
+        return;
+    }
+    
+    switch (Read16(Datagram->Data)) {
+        case TFTP_OPCODE_DATA:
+            HandleData(Session, Datagram->Data, Datagram->Length);
+            break;
+        case TFTP_OPCODE_OACK:
+            HandleOptionAck(Session, Datagram->Data, Datagram->Length);
+            break;
+        case TFTP_OPCODE_ERROR:
+            HandleError(Session, Datagram->Data, Datagram->Length);
+            break;
+        default:
+            Fail(Session, EFI_PROTOCOL_ERROR, TFTP_ERROR_ILLEGAL, "Illegal operation");
+            break;
+    }
+}
+
+// Read request asking for octet mode, the block and window sizes and tsize
+static EFI_STATUS BuildRequest(TFTP_SESSION *Session, const char *FileName) {
+    uint8_t *Packet = Session->Request;
+    uint32_t Length = 2;
+    bool Fits;
+    
+    Write16(Packet, TFTP_OPCODE_RRQ);
+    Fits = AppendString(Packet, &Length, TFTP_REQUEST_SIZE, FileName) &&
+           AppendString(Packet, &Length, TFTP_REQUEST_SIZE, "octet") &&
+           AppendString(Packet, &Length, TFTP_REQUEST_SIZE, "blksize") &&
+           AppendNumber(Packet, &Length, TFTP_REQUEST_SIZE, Session->RequestedBlockSize) &&
+           AppendString(Packet, &Length, TFTP_REQUEST_SIZE, "tsize") &&
+           AppendNumber(Packet, &Length, TFTP_REQUEST_SIZE, 0);
+    if (Fits && Session->RequestedWindowSize > 1) {
+        Fits = AppendString(Packet, &Length, TFTP_REQUEST_SIZE, "windowsize") &&
+               AppendNumber(Packet, &Length, TFTP_REQUEST_SIZE, Session->RequestedWindowSize);
+    }
+    
+    Session->RequestLength = Length;
+    return Fits ? EFI_SUCCESS : EFI_BAD_BUFFER_SIZE;
+}
+
+// Resend whatever the server has not answered
+static EFI_STATUS Retransmit(TFTP_SESSION *Session) {
+    if (Session->State == TftpRequested) {
+        ArmTimer(Session);
+        return NetUdpSendTo(&Session->Socket, Session->Server, TFTP_SERVER_PORT,
+                            Session->Request, Session->RequestLength);
+    }
+    return SendAck(Session, (uint16_t)Session->LastBlock);
+}
+
+// Largest block that fits one unfragmented datagram on the interface
+static uint32_t MaxBlockSize(NET_STACK *Stack) {
+    uint32_t Mtu = Stack->Snp->Mode->MaxPacketSize != 0 ? Stack->Snp->Mode->MaxPacketSize : 1500;
+    uint32_t Limit = Mtu - NET_IPV4_HEADER_SIZE - NET_UDP_HEADER_SIZE - TFTP_DATA_HEADER_SIZE;
+    return Limit < TFTP_MAX_BLOCK_SIZE ? Limit : TFTP_MAX_BLOCK_SIZE;
+}
+
+// Begin downloading FileName from Server (host order) into the transfer's
+// destination and send the request. Once this succeeds the session holds a
+// socket and a timer until TftpFinish.
+EFI_STATUS TftpStart(TFTP_SESSION *Session, NET_STACK *Stack, uint32_t Server, const char *FileName,
+                     TFTP_TRANSFER *Transfer) {
+    EFI_STATUS Status;
+    
+    if (Session == NULL || Stack == NULL || Stack->Snp == NULL || FileName == NULL || Transfer == NULL ||
+        Server == 0 || (Transfer->Buffer != NULL && Transfer->File != NULL)) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    MemSet(&Transfer->Size, 0, sizeof(*Transfer) - offsetof(TFTP_TRANSFER, Size));
+    Transfer->NegotiatedBlockSize = TFTP_DEFAULT_BLOCK_SIZE;
+    Transfer->NegotiatedWindowSize = 1;
+    
+    MemSet(Session, 0, sizeof(*Session));
+    Session->Stack = Stack;
+    Session->Transfer = Transfer;
+    Session->Server = Server;
+    Session->State = TftpRequested;
+    Session->TimeoutUs = Transfer->TimeoutUs != 0 ? Transfer->TimeoutUs : TFTP_TIMEOUT_US;
+    Session->Retries = Transfer->Retries != 0 ? Transfer->Retries : TFTP_RETRIES;
+    
+    uint32_t MaxBlock = MaxBlockSize(Stack);
+    Session->RequestedBlockSize = Transfer->BlockSize != 0 && Transfer->BlockSize < MaxBlock ? Transfer->BlockSize : MaxBlock;
+    if (Session->RequestedBlockSize < 8) {
+        Session->RequestedBlockSize = 8;
+    }
+    Session->RequestedWindowSize = Transfer->WindowSize != 0 ? Transfer->WindowSize : TFTP_DEFAULT_WINDOW_SIZE;
+    if (Session->RequestedWindowSize > TFTP_MAX_WINDOW_SIZE) {
+        Session->RequestedWindowSize = TFTP_MAX_WINDOW_SIZE;
+    }
+    
+    Status = BuildRequest(Session, FileName);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    Status = ST->BootServices->CreateEvent(EVT_TIMER, TPL_CALLBACK, NULL, NULL, &Session->Timer);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    Status = NetUdpOpen(Stack, &Session->Socket, 0, TftpReceive, Session);
+    if (EFI_ERROR(Status)) {
+        ST->BootServices->CloseEvent(Session->Timer);
+        return Status;
+    }
+    
+    Session->Start = ReadTimestamp();
+    Status = Retransmit(Session);
+    if (EFI_ERROR(Status)) {
+        Fail(Session, Status, 0, NULL);
+    }
+    return EFI_SUCCESS;
+}
+
+// Retransmit when the timer fired without progress; frames must have been
+// dispatched just before
+static void CheckTimeout(TFTP_SESSION *Session) {
+    if (Session->State == TftpDone || ST->BootServices->CheckEvent(Session->Timer) != EFI_SUCCESS) {
+        return;
+    }
+    
+    // Blocks still arriving mid-window are not a timeout
+    if (Session->Progressed) {
+        ArmTimer(Session);
+        return;
+    }
+    
+    Session->Transfer->Timeouts++;
+    if (++Session->Attempts > Session->Retries) {
+        Fail(Session, EFI_TIMEOUT, 0, NULL);
+        return;
+    }
+    
+    // A full transmit ring is retried on the next timeout
+    EFI_STATUS Status = Retransmit(Session);
+    if (EFI_ERROR(Status) && Status != EFI_NOT_READY) {
+        Fail(Session, Status, 0, NULL);
+    }
+}
+
+// Dispatch whatever the stack has received without waiting, then handle
+// the retransmission timer. EFI_NOT_READY while the download runs.
+EFI_STATUS TftpPoll(TFTP_SESSION *Session) {
+    if (Session == NULL || Session->Stack == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    if (Session->State != TftpDone) {
+        NetStackPoll(Session->Stack);
+        CheckTimeout(Session);
+    }
+    return Session->State == TftpDone ? Session->Status : EFI_NOT_READY;
+}
+
+// Stop a running download and tell the server
+void TftpCancel(TFTP_SESSION *Session) {
+    if (Session != NULL && Session->State != TftpDone) {
+        Fail(Session, EFI_ABORTED, TFTP_ERROR_UNDEFINED, "Cancelled");
+    }
+}
+
+// Release the session and return the outcome. A buffer allocated for the
+// download is freed again on failure.
+EFI_STATUS TftpFinish(TFTP_SESSION *Session) {
+    if (Session == NULL || Session->Transfer == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    TFTP_TRANSFER *Transfer = Session->Transfer;
+    EFI_STATUS Status = Session->State == TftpDone ? Session->Status : EFI_ABORTED;
+    
+    if (!EFI_ERROR(Status) && Transfer->TransferSize != 0 && Transfer->Size != Transfer->TransferSize) {
+        Status = EFI_PROTOCOL_ERROR;
+    }
+    Transfer->Ticks = ReadTimestamp() - Session->Start;
+    
+    ST->BootServices->SetTimer(Session->Timer, TimerCancel, 0);
+    ST->BootServices->CloseEvent(Session->Timer);
+    NetUdpClose(&Session->Socket);
+    if (Session->FileBuffer != NULL) {
+        FreePool(Session->FileBuffer);
+    }
+    if (EFI_ERROR(Status) && Transfer->Allocated) {
+        FreePool(Transfer->Buffer);
+        Transfer->Buffer = NULL;
+        Transfer->Capacity = 0;
+        Transfer->Allocated = false;
+    }
+    
+    Session->Transfer = NULL;
+    return Status;
+}
+
+// Download FileName from Server (host order) into the transfer's
+// destination. Blocks are copied from the receive pool directly to their
+// final place; a buffer allocated here is freed again on failure.
+EFI_STATUS TftpDownload(NET_STACK *Stack, uint32_t Server, const char *FileName, TFTP_TRANSFER *Transfer) {
+    TFTP_SESSION Session;
+    
+    EFI_STATUS Status = TftpStart(&Session, Stack, Server, FileName, Transfer);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    while (Session.State != TftpDone) {
+        Status = NetStackWait(Stack, Session.TimeoutUs / 4 + 1);
+        if (EFI_ERROR(Status) && Status != EFI_TIMEOUT && Status != EFI_NOT_READY) {
+            Fail(&Session, Status, 0, NULL);
+            break;
+        }
+        CheckTimeout(&Session);
+    }
+    
+    return TftpFinish(&Session);
+}
+
+static void PrintAscii(const char *Text) {
+    char16_t Chunk[33];
+    uint32_t Count = 0;
+    
+    while (*Text != 0) {
+        Chunk[Count++] = (char16_t)(uint8_t)*Text++;
+        if (Count == 32 || *Text == 0) {
+            Chunk[Count] = 0;
+            PRINT(Chunk);
+            Count = 0;
+        }
+    }
+}
+
+void TftpPrintStats(const TFTP_TRANSFER *Transfer) {
+    if (Transfer == NULL) {
+        return;
+    }
+    
+    PrintDec(Transfer->Size);
+    PRINT(u" bytes in ");
+    PrintDec(TimestampToMicroseconds(Transfer->Ticks) / 1000);
+    PRINT(u" ms, ");
+    PrintDec(BytesPerSecond(Transfer->Size, Transfer->Ticks) * 8 / 1000000);
+    PRINT(u" Mbit/s (blksize ");
+    PrintDec(Transfer->NegotiatedBlockSize);
+    PRINT(u", windowsize ");
+    PrintDec(Transfer->NegotiatedWindowSize);
+    PRINTL(u")");
+    
+    PRINT(u"Blocks ");
+    PrintDec(Transfer->Blocks);
+    PRINT(u", ACKs ");
+    PrintDec(Transfer->Acks);
+    PRINT(u", timeouts ");
+    PrintDec(Transfer->Timeouts);
+    PRINT(u", duplicates ");
+    PrintDec(Transfer->Duplicates);
+    PRINT(u", out of order ");
+    PrintDec(Transfer->OutOfOrder);
+    PRINT(u", foreign ");
+    PrintDec(Transfer->ForeignPackets);
+    PRINTL(u"");
+    
+    if (Transfer->ErrorMessage[0] != 0) {
+        PRINT(u"Server error ");
+        PrintDec(Transfer->ErrorCode);
+        PRINT(u": ");
+        PrintAscii(Transfer->ErrorMessage);
+        PRINTL(u"");
+    }
+}
+
+// Scripted server for TftpSelfTest. It answers the request with an OACK
+// reporting TransferSize as tsize, then sends Size bytes in 512-byte
+// blocks, one per ACK.
+typedef struct {
+    uint64_t TransferSize;
+    uint64_t Size;
+} TFTP_TEST_SERVER;
+
+static uint8_t TestByte(uint64_t Offset) {
+    return (uint8_t)(Offset * 7 + Offset / 251);
+}
+
+static void TestServerReceive(NET_UDP_SOCKET *Socket, const NET_UDP_DATAGRAM *Datagram, void *Context) {
+    TFTP_TEST_SERVER *Server = (TFTP_TEST_SERVER*)Context;
+    uint8_t Packet[TFTP_DATA_HEADER_SIZE + TFTP_DEFAULT_BLOCK_SIZE];
+    uint32_t Length = 2;
+    
+    if (Datagram->Length < 4) {
+        return;
+    }
+    
+    if (Read16(Datagram->Data) == TFTP_OPCODE_RRQ) {
+        Write16(Packet, TFTP_OPCODE_OACK);
+        AppendString(Packet, &Length, sizeof(Packet), "tsize");
+        AppendNumber(Packet, &Length, sizeof(Packet), Server->TransferSize);
+        NetUdpSendTo(Socket, Datagram->SrcAddress, Datagram->SrcPort, Packet, Length);
+        return;
+    }
+    
+    // After ACK n comes block n + 1, the last one being the first short one
+    uint32_t Block = Read16(Datagram->Data + 2) + 1u;
+    uint64_t Offset = (uint64_t)(Block - 1) * TFTP_DEFAULT_BLOCK_SIZE;
+    if (Read16(Datagram->Data) != TFTP_OPCODE_ACK || Offset > Server->Size) {
+        return;
+    }
+    
+    uint64_t Remaining = Server->Size - Offset;
+    uint32_t Payload = Remaining < TFTP_DEFAULT_BLOCK_SIZE ? (uint32_t)Remaining : TFTP_DEFAULT_BLOCK_SIZE;
+    Write16(Packet, TFTP_OPCODE_DATA);
+    Write16(Packet + 2, (uint16_t)Block);
+    for (uint32_t i = 0; i < Payload; i++) {
+        Packet[TFTP_DATA_HEADER_SIZE + i] = TestByte(Offset + i);
+    }
+    NetUdpSendTo(Socket, Datagram->SrcAddress, Datagram->SrcPort, Packet, TFTP_DATA_HEADER_SIZE + Payload);
+}
+
+static void TestPollPeer(void *Context) {
+    NetStackPoll((NET_STACK*)Context);
+}
+
+// Download into an allocated buffer from a server reporting an honest
+// tsize, one reporting none, and one reporting far less than it sends,
+// which must be refused rather than overrun the buffer sized from tsize
+EFI_STATUS TftpSelfTest(void) {
+    static const uint64_t TransferSizes[] = { TFTP_SELF_TEST_BYTES, 0, 1 };
+    static const EFI_STATUS Expected[] = { EFI_SUCCESS, EFI_SUCCESS, EFI_PROTOCOL_ERROR };
+    NET_LOOPBACK_PORT Ports[2];
+    NET_STACK Client, Server;
+    NET_UDP_SOCKET ServerSocket;
+    NET_IPV4_CONFIG Config;
+    TFTP_TEST_SERVER Script;
+    bool Passed = true;
+    
+    if (EFI_ERROR(NetLoopbackCreate(&Ports[0], 1)) || EFI_ERROR(NetLoopbackCreate(&Ports[1], 2))) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    NetLoopbackConnect(&Ports[0], &Ports[1]);
+    
+    MemSet(&Config, 0, sizeof(Config));
+    Config.SubnetMask = NET_IPV4(255, 255, 255, 0);
+    Config.Address = NET_IPV4(10, 0, 0, 1);
+    EFI_STATUS Status = NetStackCreate(&Client, &Ports[0].Snp, &Config);
+    Config.Address = NET_IPV4(10, 0, 0, 2);
+    if (!EFI_ERROR(Status)) {
+        Status = NetStackCreate(&Server, &Ports[1].Snp, &Config);
+        if (EFI_ERROR(Status)) {
+            NetStackDestroy(&Client);
+        }
+    }
+    if (EFI_ERROR(Status)) {
+        NetLoopbackDestroy(&Ports[0]);
+        NetLoopbackDestroy(&Ports[1]);
+        return Status;
+    }
+    
+    Client.Idle = TestPollPeer;
+    Client.IdleContext = &Server;
+    Server.Idle = TestPollPeer;
+    Server.IdleContext = &Client;
+    NetUdpOpen(&Server, &ServerSocket, TFTP_SERVER_PORT, TestServerReceive, &Script);
+    
+    for (uint32_t t = 0; t < sizeof(TransferSizes) / sizeof(TransferSizes[0]) && Passed; t++) {
+        TFTP_TRANSFER Transfer;
+        
+        Script.TransferSize = TransferSizes[t];
+        Script.Size = TFTP_SELF_TEST_BYTES;
+        MemSet(&Transfer, 0, sizeof(Transfer));
+        
+        Status = TftpDownload(&Client, Config.Address, "selftest", &Transfer);
+        Passed = Status == Expected[t];
+        if (Passed && !EFI_ERROR(Status)) {
+            Passed = Transfer.Size == Script.Size && Transfer.Capacity >= Transfer.Size;
+            for (uint64_t i = 0; i < Transfer.Size && Passed; i++) {
+                Passed = Transfer.Buffer[i] == TestByte(i);
+            }
+        }
+        
+        if (Transfer.Allocated) {
+            FreePool(Transfer.Buffer);
+        }
+    }
+    
+    NetUdpClose(&ServerSocket);
+    NetStackDestroy(&Client);
+    NetStackDestroy(&Server);
+    NetLoopbackDestroy(&Ports[0]);
+    NetLoopbackDestroy(&Ports[1]);
+    
+    if (!Passed) {
+        return EFI_DEVICE_ERROR;
+    }
+    
+    PRINTL(u"TFTP self-test: passed");
+    return EFI_SUCCESS;
+}
+
+// Configure the interface with DHCP and download FileName (or the lease's
+// boot file, or TFTP_BENCHMARK_FILE) from the lease's server with several
+// block and window sizes
+void TftpBenchmark(EFI_SIMPLE_NETWORK_PROTOCOL *Snp, const char *FileName) {
+    static const uint32_t BlockSizes[] = { TFTP_DEFAULT_BLOCK_SIZE, 0 };
+    static const uint32_t WindowSizes[] = { 1, 4, TFTP_DEFAULT_WINDOW_SIZE };
+    NET_STACK Stack;
+    
+    if (Snp == NULL || EFI_ERROR(NetStackCreate(&Stack, Snp, NULL))) {
+        PRINTL(u"TFTP benchmark: network not available");
+        return;
+    }
+    
+    EFI_STATUS Status = NetDhcpConfigure(&Stack, 0);
+    if (EFI_ERROR(Status) || Stack.Config.ServerAddress == 0) {
+        PRINTL(u"TFTP benchmark: no DHCP lease naming a server");
+        NetStackDestroy(&Stack);
+        return;
+    }
+    
+    if (FileName == NULL) {
+        FileName = Stack.Config.BootFile[0] != 0 ? Stack.Config.BootFile : TFTP_BENCHMARK_FILE;
+    }
+    
+    PRINT(u"TFTP ");
+    PrintIpv4Address(Stack.Config.ServerAddress);
+    PRINT(u":");
+    PrintAscii(FileName);
+    PRINTL(u"");
+    
+    for (uint32_t b = 0; b < sizeof(BlockSizes) / sizeof(BlockSizes[0]); b++) {
+        for (uint32_t w = 0; w < sizeof(WindowSizes) / sizeof(WindowSizes[0]); w++) {
+            TFTP_TRANSFER Transfer;
+            
+            MemSet(&Transfer, 0, sizeof(Transfer));
+            Transfer.BlockSize = BlockSizes[b];
+            Transfer.WindowSize = WindowSizes[w];
+            
+            Status = TftpDownload(&Stack, Stack.Config.ServerAddress, FileName, &Transfer);
+            if (EFI_ERROR(Status)) {
+                PRINT(u"Download failed: ");
+                PrintHex(Status);
+                PRINTL(u"");
+            }
+            TftpPrintStats(&Transfer);
+            
+            if (Transfer.Allocated) {
+                FreePool(Transfer.Buffer);
+            }
+        }
+    }
+    
+    NetStackDestroy(&Stack);
+}
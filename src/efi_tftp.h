@@ -0,0 +1,122 @@
+// efi_tftp.h
+#ifndef TINYUEFI_TFTP_H
+#define TINYUEFI_TFTP_H
+
+#include "uefi_types.h"
+#include "efi_file_protocol.h"
+#include "efi_net_ip.h"
+
+// Well-known server port
+#define TFTP_SERVER_PORT              69
+
+// Block sizes: without negotiation, and the largest RFC 2348 allows
+#define TFTP_DEFAULT_BLOCK_SIZE       512
+#define TFTP_MAX_BLOCK_SIZE           65464
+
+// Blocks per acknowledgment requested when the caller does not choose,
+// and the most this client accepts (RFC 7440)
+#define TFTP_DEFAULT_WINDOW_SIZE      16
+#define TFTP_MAX_WINDOW_SIZE          64
+
+// Retransmission timeout and how many timeouts in a row end the transfer
+#define TFTP_TIMEOUT_US               1000000
+#define TFTP_RETRIES                  5
+
+// File destinations are written in chunks of this size
+#define TFTP_FILE_BUFFER_SIZE         (256 * 1024)
+
+// Largest read request, file name and options included
+#define TFTP_REQUEST_SIZE             512
+
+// Initial buffer when neither a destination nor tsize is available
+#define TFTP_INITIAL_BUFFER_SIZE      (1024 * 1024)
+
+// Served over loopback ports by TftpSelfTest; several blocks with a short
+// last one
+#define TFTP_SELF_TEST_BYTES          (5 * TFTP_DEFAULT_BLOCK_SIZE + 300)
+
+// Downloaded by the benchmark when the lease names no boot file
+#define TFTP_BENCHMARK_FILE           "TinyUEFI.efi"
+
+// One download. Fill in the destination and options, pass it to
+// TftpDownload, then read the results.
+typedef struct {
+    // Destination: Buffer of Capacity bytes, or File, or neither to have a
+    // buffer allocated (sized from tsize when the server reports it)
+    uint8_t *Buffer;
+    uint64_t Capacity;
+    EFI_FILE_PROTOCOL *File;
+    
+    // Requested options (0 picks the default). BlockSize is capped to what
+    // fits the interface MTU.
+    uint32_t BlockSize;
+    uint32_t WindowSize;
+    uint64_t TimeoutUs;
+    uint32_t Retries;
+    
+    // Results
+    uint64_t Size;                // Bytes received
+    uint64_t TransferSize;        // tsize reported by the server (0 if none)
+    bool Allocated;               // Buffer came from TftpDownload; free with FreePool
+    uint32_t NegotiatedBlockSize;
+    uint32_t NegotiatedWindowSize;
+    uint64_t Blocks;
+    uint64_t Acks;
+    uint64_t Timeouts;
+    uint64_t Duplicates;          // Blocks received again after a lost ACK
+    uint64_t OutOfOrder;          // Blocks past a gap, discarded
+    uint64_t ForeignPackets;      // From a port other than the server's transfer ID
+    uint64_t Ticks;
+    uint16_t ErrorCode;           // From a server ERROR packet
+    char ErrorMessage[64];
+} TFTP_TRANSFER;
+
+typedef enum {
+    TftpRequested,
+    TftpTransferring,
+    TftpDone
+} TFTP_STATE;
+
+// State of a download in progress. Filled in by TftpStart; the socket
+// points back at it, so it must stay in place until TftpFinish.
+typedef struct {
+    NET_STACK *Stack;
+    NET_UDP_SOCKET Socket;
+    TFTP_TRANSFER *Transfer;
+    EFI_EVENT Timer;
+    uint32_t Server;
+    uint16_t ServerPort;          // Server's transfer ID, 0 until it replies
+    TFTP_STATE State;
+    EFI_STATUS Status;
+    uint32_t RequestedBlockSize;
+    uint32_t RequestedWindowSize;
+    uint64_t TimeoutUs;
+    uint32_t Retries;
+    uint64_t LastBlock;           // Blocks stored so far
+    uint32_t WindowReceived;      // Blocks since the last ACK
+    bool Progressed;              // A block arrived since the timer was armed
+    bool Reacked;                 // ACK resent since the last block arrived
+    uint32_t Attempts;            // Timeouts in a row
+    uint8_t *FileBuffer;
+    uint64_t FileUsed;
+    uint64_t Start;
+    uint8_t Request[TFTP_REQUEST_SIZE];
+    uint32_t RequestLength;
+} TFTP_SESSION;
+
+// Helper functions
+EFI_STATUS TftpDownload(NET_STACK *Stack, uint32_t Server, const char *FileName, TFTP_TRANSFER *Transfer);
+
+// Downloads that run side by side: poll each session until it stops
+// returning EFI_NOT_READY, then finish it
+EFI_STATUS TftpStart(TFTP_SESSION *Session, NET_STACK *Stack, uint32_t Server, const char *FileName,
+                     TFTP_TRANSFER *Transfer);
+EFI_STATUS TftpPoll(TFTP_SESSION *Session);
+void TftpCancel(TFTP_SESSION *Session);
+EFI_STATUS TftpFinish(TFTP_SESSION *Session);
+
+void TftpPrintStats(const TFTP_TRANSFER *Transfer);
+EFI_STATUS TftpSelfTest(void);
+void TftpBenchmark(EFI_SIMPLE_NETWORK_PROTOCOL *Snp, const char *FileName);
+
+#endif // TINYUEFI_TFTP_H
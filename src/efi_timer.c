@@ -0,0 +1,72 @@
+// efi_timer.c
+#include "efi_timer.h"
+#include "uefi_helpers.h"
+
+// Calibration interval for the timestamp counter
+#define TIMER_CALIBRATION_US          10000
+
+// Cached TSC frequency in Hz (0 until calibrated)
+static uint64_t TimestampFrequency = 0;
+
+// Read the CPU timestamp counter
+uint64_t ReadTimestamp(void) {
+    uint32_t Low, High;
+    
+    __asm__ volatile ("rdtsc" : "=a"(Low), "=d"(High));
+    return ((uint64_t)High << 32) | Low;
+}
+
+// Get the timestamp frequency, calibrating against Stall on first use
+uint64_t GetTimestampFrequency(void) {
+    if (TimestampFrequency != 0) {
+        return TimestampFrequency;
+    }
+    
+    EFI_STALL Stall = (EFI_STALL)ST->BootServices->Stall;
+    
+    uint64_t Start = ReadTimestamp();
+    Stall(TIMER_CALIBRATION_US);
+    uint64_t End = ReadTimestamp();
+    
+    TimestampFrequency = (End - Start) * (1000000 / TIMER_CALIBRATION_US);
+    if (TimestampFrequency == 0) {
+        TimestampFrequency = 1;
+    }
+    
+    return TimestampFrequency;
+}
+
+// Convert a timestamp delta to microseconds
+uint64_t TimestampToMicroseconds(uint64_t Ticks) {
+    return (uint64_t)(((unsigned __int128)Ticks * 1000000) / GetTimestampFrequency());
+}
+
+// Compute a transfer rate in bytes per second
+uint64_t BytesPerSecond(uint64_t Bytes, uint64_t Ticks) {
+    if (Ticks == 0) {
+        return 0;
+    }
+    
+    return (uint64_t)(((unsigned __int128)Bytes * GetTimestampFrequency()) / Ticks);
+}
+
+// Print a transfer rate as "N.NN MB/s" or "N.NN GB/s"
+void PrintThroughput(uint64_t Bytes, uint64_t Ticks) {
+    uint64_t Rate = BytesPerSecond(Bytes, Ticks);
+    uint64_t Unit = 1000000;
+    const char16_t *Suffix = u" MB/s";
+    
+    if (Rate >= 1000000000) {
+        Unit = 1000000000;
+        Suffix = u" GB/s";
+    }
+    
+    uint64_t Hundredths = (Rate * 100) / Unit;
+    PrintDec(Hundredths / 100);
+    PRINT(u".");
+    if (Hundredths % 100 < 10) {
+        PRINT(u"0");
+    }
+    PrintDec(Hundredths % 100);
+    PRINT(Suffix);
+}
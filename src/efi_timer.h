@@ -0,0 +1,14 @@
+// efi_timer.h
+#ifndef TINYUEFI_TIMER_H
+#define TINYUEFI_TIMER_H
+
+#include "uefi_types.h"
+
+// Helper functions
+uint64_t ReadTimestamp(void);
+uint64_t GetTimestampFrequency(void);
+uint64_t TimestampToMicroseconds(uint64_t Ticks);
+uint64_t BytesPerSecond(uint64_t Bytes, uint64_t Ticks);
+void PrintThroughput(uint64_t Bytes, uint64_t Ticks);
+
+#endif // TINYUEFI_TIMER_H
@@ -5,6 +5,8 @@
 #include "efi_network_protocol.h"
 #include "efi_gop_protocol.h"
 #include "efi_protocol_discovery.h"
+#include "efi_protocol_cache.h"
+#include "efi_handle_snapshot.h"
 
 // Example using file system protocol
 void FileSystemExample() {
@@ -230,6 +232,25 @@ void ProtocolDiscoveryExample() {
     if (Handles != NULL) {
         FreePool(Handles);
     }
+    
+    // The same question answered from a snapshot of the handle database,
+    // which further queries can use without calling the firmware
+    HANDLE_SNAPSHOT Snapshot;
+    MemSet(&Snapshot, 0, sizeof(Snapshot));
+    if (!EFI_ERROR(HandleSnapshotBuild(&Snapshot))) {
+        const EFI_HANDLE *SnapshotHandles;
+        uint32_t SnapshotCount = 0;
+        
+        HandleSnapshotPrintStats(&Snapshot);
+        HandleSnapshotHandlesWith(&Snapshot, &BlockIoProtocolGuid, &SnapshotHandles, &SnapshotCount);
+        PRINT(u"Snapshot: ");
+        PrintDec(SnapshotCount);
+        PRINTL(u" handles with Block I/O");
+    }
+    HandleSnapshotFree(&Snapshot);
+    
+    // The examples above looked up their protocols through the cache
+    ProtocolCachePrintStats();
 }
 
 // Main example function
@@ -264,5 +285,8 @@ EFI_STATUS efi_main(EFI_HANDLE image_handle, EFI_SYSTEM_TABLE *system_table) {
     CLEAR_SCREEN();
     PRINTL(u"Exiting TinyUEFI demo...");
     
+    // Notification events must not outlive the image
+    ProtocolCacheReset();
+    
     return EFI_SUCCESS;
 }
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include "efi_network_protocol.h"
 #include "efi_gop_protocol.h"
 #include "efi_protocol_discovery.h"
+#include "efi_protocol_cache.h"
 
 EFI_SYSTEM_TABLE *ST = NULL;
 
@@ -97,5 +98,8 @@ EFI_STATUS efi_main(EFI_HANDLE image_handle, EFI_SYSTEM_TABLE *system_table) {
     CLEAR_SCREEN();
     PRINTL(u"Exiting TinyUEFI application...");
     
+    // Notification events must not outlive the image
+    ProtocolCacheReset();
+    
     return EFI_SUCCESS;
 }
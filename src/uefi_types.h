@@ -166,12 +166,77 @@ typedef EFI_STATUS (*EFI_FREE_POOL)(
     void *Buffer
 );
 
+// Task priority levels
+typedef uint64_t EFI_TPL;
+
+#define TPL_APPLICATION                 4
+#define TPL_CALLBACK                    8
+#define TPL_NOTIFY                      16
+#define TPL_HIGH_LEVEL                  31
+
+// Event types
+#define EVT_TIMER                       0x80000000
+#define EVT_RUNTIME                     0x40000000
+#define EVT_NOTIFY_WAIT                 0x00000100
+#define EVT_NOTIFY_SIGNAL               0x00000200
+#define EVT_SIGNAL_EXIT_BOOT_SERVICES   0x00000201
+#define EVT_SIGNAL_VIRTUAL_ADDRESS_CHANGE 0x60000202
+
+// Timer types (SetTimer trigger times are in 100 ns units)
+typedef enum {
+    TimerCancel,
+    TimerPeriodic,
+    TimerRelative
+} EFI_TIMER_DELAY;
+
+// Event and timer function types
+typedef void (*EFI_EVENT_NOTIFY)(
+    EFI_EVENT Event,
+    void *Context
+);
+
+typedef EFI_STATUS (*EFI_CREATE_EVENT)(
+    uint32_t Type,
+    EFI_TPL NotifyTpl,
+    EFI_EVENT_NOTIFY NotifyFunction,
+    void *NotifyContext,
+    EFI_EVENT *Event
+);
+
+typedef EFI_STATUS (*EFI_SET_TIMER)(
+    EFI_EVENT Event,
+    EFI_TIMER_DELAY Type,
+    uint64_t TriggerTime
+);
+
 typedef EFI_STATUS (*EFI_WAIT_FOR_EVENT)(
     uint64_t NumberOfEvents,
     EFI_EVENT *Event,
     uint64_t *Index
 );
 
+typedef EFI_STATUS (*EFI_SIGNAL_EVENT)(
+    EFI_EVENT Event
+);
+
+typedef EFI_STATUS (*EFI_CLOSE_EVENT)(
+    EFI_EVENT Event
+);
+
+typedef EFI_STATUS (*EFI_CHECK_EVENT)(
+    EFI_EVENT Event
+);
+
+typedef EFI_STATUS (*EFI_STALL)(
+    uint64_t Microseconds
+);
+
+typedef EFI_STATUS (*EFI_CALCULATE_CRC32)(
+    void *Data,
+    uint64_t DataSize,
+    uint32_t *Crc32
+);
+
 // Protocol handler functions
 typedef EFI_STATUS (*EFI_LOCATE_PROTOCOL)(
     EFI_GUID *Protocol,
@@ -203,6 +268,47 @@ typedef EFI_STATUS (*EFI_CLOSE_PROTOCOL)(
     EFI_HANDLE ControllerHandle
 );
 
+typedef EFI_STATUS (*EFI_REGISTER_PROTOCOL_NOTIFY)(
+    EFI_GUID *Protocol,
+    EFI_EVENT Event,
+    void **Registration
+);
+
+// Interface types for InstallProtocolInterface
+typedef enum {
+    EFI_NATIVE_INTERFACE
+} EFI_INTERFACE_TYPE;
+
+typedef EFI_STATUS (*EFI_INSTALL_PROTOCOL_INTERFACE)(
+    EFI_HANDLE *Handle,
+    EFI_GUID *Protocol,
+    EFI_INTERFACE_TYPE InterfaceType,
+    void *Interface
+);
+
+typedef EFI_STATUS (*EFI_UNINSTALL_PROTOCOL_INTERFACE)(
+    EFI_HANDLE Handle,
+    EFI_GUID *Protocol,
+    void *Interface
+);
+
+// The firmware allocates Buffer; free it with FreePool
+typedef EFI_STATUS (*EFI_LOCATE_HANDLE_BUFFER)(
+    EFI_LOCATE_SEARCH_TYPE SearchType,
+    EFI_GUID *Protocol,
+    void *SearchKey,
+    uint64_t *NoHandles,
+    EFI_HANDLE **Buffer
+);
+
+// The firmware allocates the array of GUID pointers; free it with FreePool.
+// The GUIDs themselves belong to the protocol database.
+typedef EFI_STATUS (*EFI_PROTOCOLS_PER_HANDLE)(
+    EFI_HANDLE Handle,
+    EFI_GUID ***ProtocolBuffer,
+    uint64_t *ProtocolBufferCount
+);
+
 // Protocol open attributes
 #define EFI_OPEN_PROTOCOL_BY_HANDLE_PROTOCOL  0x00000001
 #define EFI_OPEN_PROTOCOL_GET_PROTOCOL        0x00000002
@@ -227,12 +333,12 @@ struct _EFI_BOOT_SERVICES {
     EFI_FREE_POOL FreePool;
     
     // Event & Timer Services
-    void *CreateEvent;
-    void *SetTimer;
+    EFI_CREATE_EVENT CreateEvent;
+    EFI_SET_TIMER SetTimer;
     EFI_WAIT_FOR_EVENT WaitForEvent;
-    void *SignalEvent;
-    void *CloseEvent;
-    void *CheckEvent;
+    EFI_SIGNAL_EVENT SignalEvent;
+    EFI_CLOSE_EVENT CloseEvent;
+    EFI_CHECK_EVENT CheckEvent;
     
     // Protocol Handler Services
     void *InstallProtocolInterface;
@@ -300,6 +406,11 @@ struct _EFI_BOOT_SERVICES {
 #define EFI_NOT_FOUND                   0x800000000000000E
 #define EFI_ACCESS_DENIED               0x800000000000000F
 #define EFI_TIMEOUT                     0x8000000000000010
+#define EFI_NO_MAPPING                  0x8000000000000011
+#define EFI_ALREADY_STARTED             0x8000000000000014
+#define EFI_ABORTED                     0x8000000000000015
+#define EFI_TFTP_ERROR                  0x8000000000000017
+#define EFI_PROTOCOL_ERROR              0x8000000000000018
 
 // Text Output defines
 #define EFI_BLACK                       0x00